@@ -0,0 +1,520 @@
+/*
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "HostBVH.h"
+
+#include <Morton.h>
+#include <sutil.h>
+#include <ThreadPool.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+#ifdef _MSC_VER
+#  include <intrin.h>
+#endif
+
+using namespace optix;
+
+
+namespace
+{
+
+// Elements per chunk of the parallel passes
+const size_t CHUNK_SIZE = 16384;
+
+
+inline int countLeadingZeros( uint64_t x )
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    return _BitScanReverse64( &index, x ) ? 63 - static_cast<int>( index ) : 64;
+#else
+    return x ? __builtin_clzll( x ) : 64;
+#endif
+}
+
+
+struct Slot
+{
+    Aabb     bounds;
+    uint32_t child;
+    uint32_t count;
+};
+
+inline Slot getSlot( const HostBVHNode& node, int side )
+{
+    Slot slot = { node.bounds[side], node.child[side], node.count[side] };
+    return slot;
+}
+
+inline void setSlot( HostBVHNode& node, int side, const Slot& slot )
+{
+    node.bounds[side] = slot.bounds;
+    node.child[side]  = slot.child;
+    node.count[side]  = slot.count;
+}
+
+inline Aabb merge( const Aabb& a, const Aabb& b )
+{
+    Aabb result = a;
+    result.include( b );
+    return result;
+}
+
+} // namespace
+
+
+HostBVH::HostBVH()
+    : m_visits_capacity( 0 ),
+      m_build_time( 0.0 ),
+      m_refit_time( 0.0 )
+{
+}
+
+
+void HostBVH::build( const Aabb* prim_bounds, size_t count, const HostBVHBuildOptions& options )
+{
+    const double start_time = sutil::currentTime();
+
+    m_nodes.clear();
+    m_parents.clear();
+    m_inner_nodes.clear();
+    m_prim_indices.clear();
+    m_bounds.invalidate();
+
+    if( count > 0 )
+    {
+        const unsigned int max_leaf_size = std::max( 1u, options.max_leaf_size );
+        computeMortonCodes( prim_bounds, count, options.morton_64 );
+        sortMortonCodes( options.morton_64 );
+        emitHierarchy( max_leaf_size );
+        computeNodeBounds( prim_bounds );
+
+        // Rotations only pay off once the bounds are known; children come
+        // before parents in post order so improvements propagate upwards
+        if( options.refine_passes > 0 && m_inner_nodes.size() > 1 )
+        {
+            std::vector<uint32_t> post_order;
+            post_order.reserve( m_inner_nodes.size() );
+            std::vector<uint32_t> stack( 1, 0u );
+            while( !stack.empty() )
+            {
+                const uint32_t node = stack.back();
+                stack.pop_back();
+                post_order.push_back( node );
+                for( int c = 0; c < 2; ++c )
+                {
+                    if( !( m_nodes[node].child[c] & HostBVHNode::LEAF ) )
+                        stack.push_back( m_nodes[node].child[c] );
+                }
+            }
+            std::reverse( post_order.begin(), post_order.end() );
+
+            for( unsigned int pass = 0; pass < options.refine_passes; ++pass )
+            {
+                for( size_t i = 0; i < post_order.size(); ++i )
+                    rotate( post_order[i] );
+            }
+        }
+    }
+
+    m_build_time = ( sutil::currentTime() - start_time ) * 1000.0;
+}
+
+
+void HostBVH::refit( const Aabb* prim_bounds, size_t count )
+{
+    if( count != m_prim_indices.size() )
+        throw std::runtime_error( "HostBVH: refit() with a different primitive count than the last build" );
+
+    const double start_time = sutil::currentTime();
+    if( count > 0 )
+        computeNodeBounds( prim_bounds );
+    m_refit_time = ( sutil::currentTime() - start_time ) * 1000.0;
+}
+
+
+void HostBVH::computeMortonCodes( const Aabb* prim_bounds, size_t count, bool morton_64 )
+{
+    sutil::ThreadPool& pool = sutil::defaultThreadPool();
+    const size_t num_chunks = ( count + CHUNK_SIZE - 1 ) / CHUNK_SIZE;
+
+    // Codes quantize centroids within the centroid bounds
+    std::vector<Aabb> chunk_bounds( num_chunks );
+    pool.parallelFor( 0, num_chunks, 1, [&]( size_t chunk_begin, size_t chunk_end )
+    {
+        for( size_t chunk = chunk_begin; chunk < chunk_end; ++chunk )
+        {
+            Aabb box;
+            const size_t end = std::min( count, ( chunk + 1 ) * CHUNK_SIZE );
+            for( size_t i = chunk * CHUNK_SIZE; i < end; ++i )
+                box.include( prim_bounds[i].center() );
+            chunk_bounds[chunk] = box;
+        }
+    } );
+
+    Aabb centroid_bounds;
+    for( size_t chunk = 0; chunk < num_chunks; ++chunk )
+        centroid_bounds.include( chunk_bounds[chunk] );
+
+    const float  grid  = morton_64 ? static_cast<float>( 1 << 21 ) : 1024.0f;
+    const float3 extent = centroid_bounds.extent();
+    const float3 scale = make_float3(
+        extent.x > 0.0f ? ( grid - 1.0f ) / extent.x : 0.0f,
+        extent.y > 0.0f ? ( grid - 1.0f ) / extent.y : 0.0f,
+        extent.z > 0.0f ? ( grid - 1.0f ) / extent.z : 0.0f );
+
+    m_codes.resize( count );
+    m_prim_indices.resize( count );
+    pool.parallelFor( 0, count, CHUNK_SIZE, [&]( size_t begin, size_t end )
+    {
+        for( size_t i = begin; i < end; ++i )
+        {
+            const float3 p = ( prim_bounds[i].center() - centroid_bounds.m_min ) * scale;
+            const uint32_t x = static_cast<uint32_t>( std::max( 0.0f, p.x ) );
+            const uint32_t y = static_cast<uint32_t>( std::max( 0.0f, p.y ) );
+            const uint32_t z = static_cast<uint32_t>( std::max( 0.0f, p.z ) );
+            m_codes[i] = morton_64 ? sutil::mortonCode63( x, y, z ) : sutil::mortonCode30( x, y, z );
+            m_prim_indices[i] = static_cast<uint32_t>( i );
+        }
+    } );
+}
+
+
+void HostBVH::sortMortonCodes( bool morton_64 )
+{
+    // LSD radix sort on 8 bit digits.  Every chunk histograms its digits,
+    // the histograms are scanned digit-major so each chunk gets its own
+    // stable output range, then the chunks scatter in parallel.
+    sutil::ThreadPool& pool = sutil::defaultThreadPool();
+    const size_t count      = m_codes.size();
+    const size_t num_chunks = ( count + CHUNK_SIZE - 1 ) / CHUNK_SIZE;
+    const int    num_passes = morton_64 ? 8 : 4;
+
+    m_codes_tmp.resize( count );
+    m_indices_tmp.resize( count );
+    std::vector<uint32_t> offsets( num_chunks * 256 );
+
+    for( int pass = 0; pass < num_passes; ++pass )
+    {
+        const int shift = pass * 8;
+
+        pool.parallelFor( 0, num_chunks, 1, [&]( size_t chunk_begin, size_t chunk_end )
+        {
+            for( size_t chunk = chunk_begin; chunk < chunk_end; ++chunk )
+            {
+                uint32_t* histogram = &offsets[chunk * 256];
+                std::fill( histogram, histogram + 256, 0u );
+                const size_t end = std::min( count, ( chunk + 1 ) * CHUNK_SIZE );
+                for( size_t i = chunk * CHUNK_SIZE; i < end; ++i )
+                    ++histogram[( m_codes[i] >> shift ) & 0xff];
+            }
+        } );
+
+        uint32_t sum = 0;
+        for( int digit = 0; digit < 256; ++digit )
+        {
+            for( size_t chunk = 0; chunk < num_chunks; ++chunk )
+            {
+                uint32_t& n = offsets[chunk * 256 + digit];
+                const uint32_t chunk_count = n;
+                n = sum;
+                sum += chunk_count;
+            }
+        }
+
+        pool.parallelFor( 0, num_chunks, 1, [&]( size_t chunk_begin, size_t chunk_end )
+        {
+            for( size_t chunk = chunk_begin; chunk < chunk_end; ++chunk )
+            {
+                uint32_t* next = &offsets[chunk * 256];
+                const size_t end = std::min( count, ( chunk + 1 ) * CHUNK_SIZE );
+                for( size_t i = chunk * CHUNK_SIZE; i < end; ++i )
+                {
+                    const uint32_t dst = next[( m_codes[i] >> shift ) & 0xff]++;
+                    m_codes_tmp[dst]   = m_codes[i];
+                    m_indices_tmp[dst] = m_prim_indices[i];
+                }
+            }
+        } );
+
+        m_codes.swap( m_codes_tmp );
+        m_prim_indices.swap( m_indices_tmp );
+    }
+}
+
+
+void HostBVH::emitHierarchy( unsigned int max_leaf_size )
+{
+    const size_t count = m_codes.size();
+
+    if( count <= max_leaf_size )
+    {
+        // Everything fits in one leaf; the second slot is an empty leaf
+        HostBVHNode root;
+        root.child[0] = HostBVHNode::LEAF;
+        root.count[0] = static_cast<uint32_t>( count );
+        root.child[1] = HostBVHNode::LEAF;
+        root.count[1] = 0;
+        m_nodes.assign( 1, root );
+        m_parents.assign( 1, 0u );
+        m_inner_nodes.assign( 1, 0u );
+        m_ranges.assign( 2, 0u );
+        m_ranges[1] = static_cast<uint32_t>( count - 1 );
+        return;
+    }
+
+    const int64_t n = static_cast<int64_t>( count );
+    const uint64_t* codes = &m_codes[0];
+
+    // Length of the common prefix of codes i and j, with the index as a
+    // tie-break for duplicate codes; -1 outside the array
+    auto delta = [codes, n]( int64_t i, int64_t j ) -> int
+    {
+        if( j < 0 || j >= n )
+            return -1;
+        const uint64_t x = codes[i] ^ codes[j];
+        if( x )
+            return countLeadingZeros( x );
+        return 64 + countLeadingZeros( static_cast<uint64_t>( i ^ j ) ) - 32;
+    };
+
+    m_nodes.resize( count - 1 );
+    m_parents.resize( count - 1 );
+    m_ranges.resize( 2 * ( count - 1 ) );
+    m_parents[0] = 0;
+
+    sutil::defaultThreadPool().parallelFor( 0, count - 1, CHUNK_SIZE, [&]( size_t begin, size_t end )
+    {
+        for( size_t node = begin; node < end; ++node )
+        {
+            const int64_t i = static_cast<int64_t>( node );
+
+            // Direction of the range and its other end
+            const int d = delta( i, i + 1 ) - delta( i, i - 1 ) > 0 ? 1 : -1;
+            const int delta_min = delta( i, i - d );
+            int64_t l_max = 2;
+            while( delta( i, i + l_max * d ) > delta_min )
+                l_max *= 2;
+            int64_t l = 0;
+            for( int64_t t = l_max / 2; t >= 1; t /= 2 )
+            {
+                if( delta( i, i + ( l + t ) * d ) > delta_min )
+                    l += t;
+            }
+            const int64_t j = i + l * d;
+
+            // Split position: highest differing bit within the range
+            const int delta_node = delta( i, j );
+            int64_t s = 0;
+            int64_t divisor = 2;
+            int64_t t;
+            do
+            {
+                t = ( l + divisor - 1 ) / divisor;
+                if( delta( i, i + ( s + t ) * d ) > delta_node )
+                    s += t;
+                divisor *= 2;
+            } while( t > 1 );
+            const int64_t gamma = i + s * d + std::min( d, 0 );
+
+            const uint32_t first = static_cast<uint32_t>( std::min( i, j ) );
+            const uint32_t last  = static_cast<uint32_t>( std::max( i, j ) );
+            m_ranges[2 * node]     = first;
+            m_ranges[2 * node + 1] = last;
+
+            HostBVHNode& bvh_node = m_nodes[node];
+            const uint32_t left_count  = static_cast<uint32_t>( gamma ) - first + 1;
+            const uint32_t right_count = last - static_cast<uint32_t>( gamma );
+            if( left_count <= max_leaf_size )
+            {
+                bvh_node.child[0] = HostBVHNode::LEAF | first;
+                bvh_node.count[0] = left_count;
+            }
+            else
+            {
+                bvh_node.child[0] = static_cast<uint32_t>( gamma );
+                bvh_node.count[0] = 0;
+                m_parents[gamma] = static_cast<uint32_t>( node );
+            }
+            if( right_count <= max_leaf_size )
+            {
+                bvh_node.child[1] = HostBVHNode::LEAF | static_cast<uint32_t>( gamma + 1 );
+                bvh_node.count[1] = right_count;
+            }
+            else
+            {
+                bvh_node.child[1] = static_cast<uint32_t>( gamma + 1 );
+                bvh_node.count[1] = 0;
+                m_parents[gamma + 1] = static_cast<uint32_t>( node );
+            }
+        }
+    } );
+
+    // Nodes inside collapsed leaves are never referenced
+    for( size_t node = 0; node < count - 1; ++node )
+    {
+        if( m_ranges[2 * node + 1] - m_ranges[2 * node] + 1 > max_leaf_size )
+            m_inner_nodes.push_back( static_cast<uint32_t>( node ) );
+    }
+}
+
+
+void HostBVH::computeNodeBounds( const Aabb* prim_bounds )
+{
+    const size_t num_nodes = m_nodes.size();
+    if( m_visits_capacity < num_nodes )
+    {
+        m_visits.reset( new std::atomic<uint32_t>[num_nodes] );
+        m_visits_capacity = num_nodes;
+    }
+    for( size_t i = 0; i < num_nodes; ++i )
+        m_visits[i].store( 0, std::memory_order_relaxed );
+
+    // Leaf bounds are computed where they are referenced.  The second child
+    // to finish completes a node and carries on to its parent, so every
+    // node's bounds are written exactly once and only after its children.
+    sutil::defaultThreadPool().parallelFor( 0, m_inner_nodes.size(), 1024, [&]( size_t begin, size_t end )
+    {
+        for( size_t k = begin; k < end; ++k )
+        {
+            uint32_t node = m_inner_nodes[k];
+            HostBVHNode& n = m_nodes[node];
+
+            uint32_t arrivals = 0;
+            for( int c = 0; c < 2; ++c )
+            {
+                if( !( n.child[c] & HostBVHNode::LEAF ) )
+                    continue;
+                Aabb box;
+                const uint32_t first = n.child[c] & ~HostBVHNode::LEAF;
+                for( uint32_t i = first; i < first + n.count[c]; ++i )
+                    box.include( prim_bounds[m_prim_indices[i]] );
+                n.bounds[c] = box;
+                ++arrivals;
+            }
+
+            if( arrivals == 0 || m_visits[node].fetch_add( arrivals ) + arrivals < 2 )
+                continue;
+
+            for( ;; )
+            {
+                const Aabb box = merge( m_nodes[node].bounds[0], m_nodes[node].bounds[1] );
+                if( node == 0 )
+                {
+                    m_bounds = box;
+                    break;
+                }
+                const uint32_t parent = m_parents[node];
+                HostBVHNode& p = m_nodes[parent];
+                p.bounds[p.child[0] == node ? 0 : 1] = box;
+                if( m_visits[parent].fetch_add( 1 ) + 1 < 2 )
+                    break;
+                node = parent;
+            }
+        }
+    } );
+}
+
+
+void HostBVH::rotate( uint32_t node )
+{
+    // For a child R = (C0, C1) of N = (R, S), swapping S with C0 or C1 keeps
+    // N's bounds but can shrink R's.  Take the best such swap, if any.
+    HostBVHNode& n = m_nodes[node];
+
+    float best_gain  = 0.0f;
+    int   best_side  = -1;
+    int   best_grand = -1;
+    for( int side = 0; side < 2; ++side )
+    {
+        if( n.child[side] & HostBVHNode::LEAF )
+            continue;
+        const HostBVHNode& r = m_nodes[n.child[side]];
+        const float area = n.bounds[side].area();
+        for( int k = 0; k < 2; ++k )
+        {
+            const float gain = area - merge( n.bounds[1 - side], r.bounds[1 - k] ).area();
+            if( gain > best_gain * 1.0001f + 1e-12f )
+            {
+                best_gain  = gain;
+                best_side  = side;
+                best_grand = k;
+            }
+        }
+    }
+
+    if( best_side < 0 )
+        return;
+
+    const uint32_t r_index = n.child[best_side];
+    HostBVHNode& r = m_nodes[r_index];
+    const Slot sibling = getSlot( n, 1 - best_side );
+    const Slot grand   = getSlot( r, best_grand );
+
+    setSlot( n, 1 - best_side, grand );
+    setSlot( r, best_grand, sibling );
+    n.bounds[best_side] = merge( r.bounds[0], r.bounds[1] );
+
+    if( !( grand.child & HostBVHNode::LEAF ) )
+        m_parents[grand.child] = node;
+    if( !( sibling.child & HostBVHNode::LEAF ) )
+        m_parents[sibling.child] = r_index;
+}
+
+
+size_t HostBVH::memoryBytes() const
+{
+    return m_nodes.capacity() * sizeof( HostBVHNode )
+         + ( m_parents.capacity() + m_inner_nodes.capacity() + m_prim_indices.capacity() +
+             m_indices_tmp.capacity() + m_ranges.capacity() ) * sizeof( uint32_t )
+         + ( m_codes.capacity() + m_codes_tmp.capacity() ) * sizeof( uint64_t )
+         + m_visits_capacity * sizeof( std::atomic<uint32_t> );
+}
+
+
+float HostBVH::sahCost() const
+{
+    if( m_nodes.empty() )
+        return 0.0f;
+
+    const float root_area = std::max( m_bounds.area(), 1e-20f );
+    double cost = 0.0;
+    for( size_t k = 0; k < m_inner_nodes.size(); ++k )
+    {
+        const HostBVHNode& n = m_nodes[m_inner_nodes[k]];
+        cost += merge( n.bounds[0], n.bounds[1] ).area();
+        for( int c = 0; c < 2; ++c )
+        {
+            if( ( n.child[c] & HostBVHNode::LEAF ) && n.count[c] )
+                cost += static_cast<double>( n.count[c] ) * n.bounds[c].area();
+        }
+    }
+    return static_cast<float>( cost / root_area );
+}
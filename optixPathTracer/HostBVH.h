@@ -0,0 +1,383 @@
+/*
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <optixu/optixu_aabb_namespace.h>
+#include <optixu/optixu_math_namespace.h>
+
+#include <atomic>
+#include <cfloat>
+#include <cmath>
+
+#if defined( __SSE__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 1 )
+#  include <xmmintrin.h>
+#  define HOST_BVH_USE_SSE
+#endif
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+
+//------------------------------------------------------------------------------
+//
+// Binary BVH over primitive bounding boxes for tracing on the host.
+//
+// Built as a linear BVH: primitives are sorted by the Morton code of their
+// centroid with a parallel radix sort and the hierarchy is emitted from the
+// sorted codes, every node independently (Karras 2012).  All passes run on
+// sutil::defaultThreadPool() and are linear in the primitive count, so the
+// build is cheap enough to redo every frame for animated geometry.  Subtrees
+// with at most max_leaf_size primitives become leaves.  An optional serial
+// pass of local tree rotations recovers part of the SAH quality a sweep
+// builder would have.
+//
+// Each node stores the bounds of both children so a traversal step tests two
+// boxes with one node fetch.
+//
+// For primitives that move without changing count, refit() keeps the
+// topology and only recomputes the bounds, bottom-up and in parallel.  The
+// tree degrades as primitives drift away from the neighbours they were
+// sorted with; callers compare sahCost() against its value after the build
+// to decide when a rebuild is due.
+//
+// traversePacket() walks HOST_PACKET_SIZE any-hit rays together, testing each
+// node's boxes against all of them at once.  For coherent rays, eg shadow
+// rays from neighbouring pixels to one light stratum, every node fetch is
+// shared by the whole packet.
+//
+//------------------------------------------------------------------------------
+
+struct HostBVHBuildOptions
+{
+    HostBVHBuildOptions()
+        : morton_64( false ), max_leaf_size( 4 ), refine_passes( 0 ) {}
+
+    bool         morton_64;       // 63 bit codes (21 per axis) instead of 30
+    unsigned int max_leaf_size;
+    unsigned int refine_passes;   // Rotation sweeps after the build, 0 = off
+};
+
+
+static const unsigned int HOST_PACKET_SIZE = 4;
+
+// Rays in SoA layout for packet traversal.  Lanes are selected by a bit mask.
+struct HostRayPacket
+{
+    float ox[HOST_PACKET_SIZE], oy[HOST_PACKET_SIZE], oz[HOST_PACKET_SIZE];
+    float dx[HOST_PACKET_SIZE], dy[HOST_PACKET_SIZE], dz[HOST_PACKET_SIZE];
+    float tmin[HOST_PACKET_SIZE], tmax[HOST_PACKET_SIZE];
+};
+
+
+struct HostBVHNode
+{
+    static const uint32_t LEAF = 0x80000000u;
+
+    optix::Aabb  bounds[2];
+    uint32_t     child[2];        // Node index, or LEAF | first sorted primitive
+    uint32_t     count[2];        // Primitives in a leaf child, 0 for nodes
+};
+
+
+class HostBVH
+{
+public:
+    HostBVH();
+
+    void build( const optix::Aabb* prim_bounds, size_t count, const HostBVHBuildOptions& options = HostBVHBuildOptions() );
+
+    // Update the bounds for the same primitives at new positions.  count must
+    // match the last build.
+    void refit( const optix::Aabb* prim_bounds, size_t count );
+
+    // Walk the hierarchy with a ray.  test( prim, tmax ) is called for every
+    // primitive in a leaf the ray enters; it returns true if the primitive is
+    // hit before tmax and then shortens tmax to the hit distance.  With
+    // any_hit the walk stops at the first hit.  Returns whether anything was
+    // hit.
+    template<typename PrimitiveTest>
+    bool traverse( const optix::float3& origin, const optix::float3& dir, float tmin, float& tmax,
+                   PrimitiveTest& test, bool any_hit ) const;
+
+    // Any hit walk for the active lanes of a packet.  test( prim, lanes )
+    // tests a leaf primitive for the given lanes and returns the mask of
+    // those that hit it; they leave active.  Stops when no lane is left.
+    template<typename PacketTest>
+    void traversePacket( const HostRayPacket& packet, unsigned int& active, PacketTest& test ) const;
+
+    // Surface area heuristic cost of the hierarchy, relative units
+    float sahCost() const;
+
+    bool                                empty()          const { return m_prim_indices.empty(); }
+    size_t                              primCount()      const { return m_prim_indices.size(); }
+    const optix::Aabb&                  bounds()         const { return m_bounds; }
+    const std::vector<HostBVHNode>&     nodes()          const { return m_nodes; }
+    const std::vector<uint32_t>&        primIndices()    const { return m_prim_indices; }
+
+    // Bytes held by the hierarchy and the build scratch kept with it
+    size_t memoryBytes() const;
+
+    // Wall clock time of the last build and refit, in milliseconds
+    double lastBuildTime() const { return m_build_time; }
+    double lastRefitTime() const { return m_refit_time; }
+
+private:
+    friend class HostBVHCache;
+
+    void computeMortonCodes( const optix::Aabb* prim_bounds, size_t count, bool morton_64 );
+    void sortMortonCodes( bool morton_64 );
+    void emitHierarchy( unsigned int max_leaf_size );
+    void computeNodeBounds( const optix::Aabb* prim_bounds );
+    void rotate( uint32_t node );
+
+    std::vector<HostBVHNode>  m_nodes;          // Root is node 0
+    std::vector<uint32_t>     m_parents;        // Per node, root's is itself
+    std::vector<uint32_t>     m_inner_nodes;    // Nodes that are part of the tree
+    std::vector<uint32_t>     m_prim_indices;   // Sorted position -> primitive
+    optix::Aabb               m_bounds;
+
+    // Build scratch, kept to avoid reallocating for per frame rebuilds
+    std::vector<uint64_t>     m_codes;
+    std::vector<uint64_t>     m_codes_tmp;
+    std::vector<uint32_t>     m_indices_tmp;
+    std::vector<uint32_t>     m_ranges;         // first, last per node
+    std::unique_ptr< std::atomic<uint32_t>[] > m_visits;
+    size_t                    m_visits_capacity;
+
+    double                    m_build_time;
+    double                    m_refit_time;
+};
+
+
+//------------------------------------------------------------------------------
+//
+// Implementation
+//
+//------------------------------------------------------------------------------
+
+namespace host_bvh_detail
+{
+
+// Exit distances are widened by 1 + 2 * gamma(3) (PBRT's bound on the rounding
+// of the slab subtraction and product), so that rounding never culls a box
+// around a primitive whose own test would report a hit.
+const float BOX_EXIT_SCALE = 1.0f + 2.0f * ( 3.0f * 0.5f * FLT_EPSILON ) / ( 1.0f - 3.0f * 0.5f * FLT_EPSILON );
+
+inline bool intersectBox( const optix::Aabb& box, const optix::float3& origin, const optix::float3& inv_dir,
+                          float tmin, float tmax, float& t_enter )
+{
+    const float tx0 = ( box.m_min.x - origin.x ) * inv_dir.x;
+    const float tx1 = ( box.m_max.x - origin.x ) * inv_dir.x;
+    const float ty0 = ( box.m_min.y - origin.y ) * inv_dir.y;
+    const float ty1 = ( box.m_max.y - origin.y ) * inv_dir.y;
+    const float tz0 = ( box.m_min.z - origin.z ) * inv_dir.z;
+    const float tz1 = ( box.m_max.z - origin.z ) * inv_dir.z;
+
+    const float t0 = optix::fmaxf( optix::fmaxf( optix::fminf( tx0, tx1 ), optix::fminf( ty0, ty1 ) ),
+                                   optix::fmaxf( optix::fminf( tz0, tz1 ), tmin ) );
+    const float t1 = optix::fminf( optix::fminf( optix::fmaxf( tx0, tx1 ), optix::fmaxf( ty0, ty1 ) ),
+                                   optix::fminf( optix::fmaxf( tz0, tz1 ), tmax ) ) * BOX_EXIT_SCALE;
+    t_enter = t0;
+    return t0 <= t1;
+}
+
+
+// Large finite reciprocals keep 0 * inf NaNs out of the slab test
+inline float safeInverse( float d )
+{
+    return 1.0f / ( fabsf( d ) > 1e-20f ? d : ( d < 0.0f ? -1e-20f : 1e-20f ) );
+}
+
+
+// Lanes of the packet whose [tmin, tmax] overlaps the box, among active ones
+inline unsigned int intersectBoxPacket( const optix::Aabb& box, const HostRayPacket& packet, const float* inv_x,
+                                        const float* inv_y, const float* inv_z, unsigned int active )
+{
+#ifdef HOST_BVH_USE_SSE
+    const __m128 ix = _mm_loadu_ps( inv_x );
+    const __m128 iy = _mm_loadu_ps( inv_y );
+    const __m128 iz = _mm_loadu_ps( inv_z );
+    const __m128 ox = _mm_loadu_ps( packet.ox );
+    const __m128 oy = _mm_loadu_ps( packet.oy );
+    const __m128 oz = _mm_loadu_ps( packet.oz );
+    const __m128 tx0 = _mm_mul_ps( _mm_sub_ps( _mm_set1_ps( box.m_min.x ), ox ), ix );
+    const __m128 tx1 = _mm_mul_ps( _mm_sub_ps( _mm_set1_ps( box.m_max.x ), ox ), ix );
+    const __m128 ty0 = _mm_mul_ps( _mm_sub_ps( _mm_set1_ps( box.m_min.y ), oy ), iy );
+    const __m128 ty1 = _mm_mul_ps( _mm_sub_ps( _mm_set1_ps( box.m_max.y ), oy ), iy );
+    const __m128 tz0 = _mm_mul_ps( _mm_sub_ps( _mm_set1_ps( box.m_min.z ), oz ), iz );
+    const __m128 tz1 = _mm_mul_ps( _mm_sub_ps( _mm_set1_ps( box.m_max.z ), oz ), iz );
+    const __m128 t0 = _mm_max_ps( _mm_max_ps( _mm_min_ps( tx0, tx1 ), _mm_min_ps( ty0, ty1 ) ),
+                                  _mm_max_ps( _mm_min_ps( tz0, tz1 ), _mm_loadu_ps( packet.tmin ) ) );
+    const __m128 t1 = _mm_min_ps( _mm_min_ps( _mm_max_ps( tx0, tx1 ), _mm_max_ps( ty0, ty1 ) ),
+                                  _mm_min_ps( _mm_max_ps( tz0, tz1 ), _mm_loadu_ps( packet.tmax ) ) );
+    const __m128 t1_scaled = _mm_mul_ps( t1, _mm_set1_ps( BOX_EXIT_SCALE ) );
+    return static_cast<unsigned int>( _mm_movemask_ps( _mm_cmple_ps( t0, t1_scaled ) ) ) & active;
+#else
+    unsigned int mask = 0;
+    for( unsigned int lane = 0; lane < HOST_PACKET_SIZE; ++lane )
+    {
+        if( !( active & ( 1u << lane ) ) )
+            continue;
+        float t_enter;
+        if( intersectBox( box, optix::make_float3( packet.ox[lane], packet.oy[lane], packet.oz[lane] ),
+                          optix::make_float3( inv_x[lane], inv_y[lane], inv_z[lane] ),
+                          packet.tmin[lane], packet.tmax[lane], t_enter ) )
+            mask |= 1u << lane;
+    }
+    return mask;
+#endif
+}
+
+} // namespace host_bvh_detail
+
+
+template<typename PrimitiveTest>
+bool HostBVH::traverse( const optix::float3& origin, const optix::float3& dir, float tmin, float& tmax,
+                        PrimitiveTest& test, bool any_hit ) const
+{
+    if( m_nodes.empty() )
+        return false;
+
+    const optix::float3 inv_dir = optix::make_float3( host_bvh_detail::safeInverse( dir.x ),
+                                                      host_bvh_detail::safeInverse( dir.y ),
+                                                      host_bvh_detail::safeInverse( dir.z ) );
+
+    // LBVH depth is bounded by the code length plus the index tie-break bits
+    uint32_t stack[256];
+    int      stack_size = 0;
+    uint32_t node = 0;
+    bool     hit = false;
+
+    for( ;; )
+    {
+        const HostBVHNode& n = m_nodes[node];
+
+        float t_enter[2];
+        bool  enter[2];
+        for( int c = 0; c < 2; ++c )
+        {
+            enter[c] = host_bvh_detail::intersectBox( n.bounds[c], origin, inv_dir, tmin, tmax, t_enter[c] );
+            if( enter[c] && ( n.child[c] & HostBVHNode::LEAF ) )
+            {
+                // Leaf children are handled right away
+                enter[c] = false;
+                const uint32_t first = n.child[c] & ~HostBVHNode::LEAF;
+                for( uint32_t i = first; i < first + n.count[c]; ++i )
+                {
+                    if( test( m_prim_indices[i], tmax ) )
+                    {
+                        hit = true;
+                        if( any_hit )
+                            return true;
+                    }
+                }
+            }
+        }
+
+        if( enter[0] && enter[1] )
+        {
+            // Visit the nearer child first
+            const int near_child = t_enter[0] <= t_enter[1] ? 0 : 1;
+            stack[stack_size++] = n.child[1 - near_child];
+            node = n.child[near_child];
+        }
+        else if( enter[0] || enter[1] )
+        {
+            node = n.child[enter[0] ? 0 : 1];
+        }
+        else
+        {
+            // Entries pushed before tmax shrank may no longer be worth a
+            // visit, the box test above rejects them cheaply
+            if( stack_size == 0 )
+                return hit;
+            node = stack[--stack_size];
+        }
+    }
+}
+
+
+template<typename PacketTest>
+void HostBVH::traversePacket( const HostRayPacket& packet, unsigned int& active, PacketTest& test ) const
+{
+    if( m_nodes.empty() || !active )
+        return;
+
+    float inv_x[HOST_PACKET_SIZE], inv_y[HOST_PACKET_SIZE], inv_z[HOST_PACKET_SIZE];
+    for( unsigned int lane = 0; lane < HOST_PACKET_SIZE; ++lane )
+    {
+        inv_x[lane] = host_bvh_detail::safeInverse( packet.dx[lane] );
+        inv_y[lane] = host_bvh_detail::safeInverse( packet.dy[lane] );
+        inv_z[lane] = host_bvh_detail::safeInverse( packet.dz[lane] );
+    }
+
+    uint32_t stack[256];
+    int      stack_size = 0;
+    uint32_t node = 0;
+
+    for( ;; )
+    {
+        const HostBVHNode& n = m_nodes[node];
+
+        unsigned int enter[2];
+        for( int c = 0; c < 2; ++c )
+        {
+            enter[c] = host_bvh_detail::intersectBoxPacket( n.bounds[c], packet, inv_x, inv_y, inv_z, active );
+            if( enter[c] && ( n.child[c] & HostBVHNode::LEAF ) )
+            {
+                const uint32_t first = n.child[c] & ~HostBVHNode::LEAF;
+                for( uint32_t i = first; i < first + n.count[c]; ++i )
+                {
+                    active &= ~test( m_prim_indices[i], enter[c] & active );
+                    if( !active )
+                        return;
+                }
+                enter[c] = 0;
+            }
+        }
+
+        // Any hit rays need no near to far order; lanes that left since a
+        // push are masked out when the entry is popped
+        if( enter[0] && enter[1] )
+        {
+            stack[stack_size++] = n.child[1];
+            node = n.child[0];
+        }
+        else if( enter[0] || enter[1] )
+        {
+            node = n.child[enter[0] ? 0 : 1];
+        }
+        else
+        {
+            if( stack_size == 0 )
+                return;
+            node = stack[--stack_size];
+        }
+    }
+}
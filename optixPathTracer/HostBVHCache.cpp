@@ -0,0 +1,480 @@
+/*
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "HostBVHCache.h"
+
+#include <sutil.h>
+
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+#if defined(_WIN32)
+#    ifndef WIN32_LEAN_AND_MEAN
+#        define WIN32_LEAN_AND_MEAN 1
+#    endif
+#    include <windows.h>
+#else
+#    include <fcntl.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <unistd.h>
+#endif
+
+using namespace optix;
+
+
+namespace
+{
+
+const char     CACHE_MAGIC[8] = { 'H', 'O', 'S', 'T', 'B', 'V', 'H', 'C' };
+const uint32_t CACHE_VERSION  = 1;      // Bump with any change to the builders or the layout
+
+enum CacheKind
+{
+    CACHE_FULL = 0,
+    CACHE_COMPRESSED
+};
+
+// Followed by the nodes and, for CACHE_FULL, the parents and inner nodes,
+// then the primitive indices.  Every array starts 4 byte aligned.
+struct CacheHeader
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t kind;
+    uint64_t key;
+    uint64_t num_nodes;
+    uint64_t num_inner_nodes;
+    uint64_t num_prims;
+    float    bounds[6];
+    float    eps[3];
+    uint32_t pad;
+};
+
+
+//
+// Read only view of a whole file
+//
+
+class MappedFile
+{
+public:
+    // Null if the file cannot be opened or is empty
+    static std::shared_ptr<MappedFile> open( const std::string& path );
+    ~MappedFile();
+
+    const char* data() const { return m_data; }
+    size_t      size() const { return m_size; }
+
+private:
+    MappedFile() : m_data( 0 ), m_size( 0 ) {}
+
+    const char* m_data;
+    size_t      m_size;
+};
+
+
+std::shared_ptr<MappedFile> MappedFile::open( const std::string& path )
+{
+    std::shared_ptr<MappedFile> file( new MappedFile );
+#if defined(_WIN32)
+    HANDLE handle = CreateFileA( path.c_str(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING,
+                                 FILE_ATTRIBUTE_NORMAL, 0 );
+    if( handle == INVALID_HANDLE_VALUE )
+        return std::shared_ptr<MappedFile>();
+
+    LARGE_INTEGER size;
+    HANDLE mapping = 0;
+    if( GetFileSizeEx( handle, &size ) && size.QuadPart > 0 )
+        mapping = CreateFileMappingA( handle, 0, PAGE_READONLY, 0, 0, 0 );
+    CloseHandle( handle );
+    if( !mapping )
+        return std::shared_ptr<MappedFile>();
+
+    // The view keeps the file open
+    const void* view = MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+    CloseHandle( mapping );
+    if( !view )
+        return std::shared_ptr<MappedFile>();
+    file->m_data = static_cast<const char*>( view );
+    file->m_size = static_cast<size_t>( size.QuadPart );
+#else
+    const int fd = ::open( path.c_str(), O_RDONLY );
+    if( fd < 0 )
+        return std::shared_ptr<MappedFile>();
+
+    struct stat info;
+    void* view = MAP_FAILED;
+    if( fstat( fd, &info ) == 0 && info.st_size > 0 )
+        view = mmap( 0, static_cast<size_t>( info.st_size ), PROT_READ, MAP_PRIVATE, fd, 0 );
+    close( fd );
+    if( view == MAP_FAILED )
+        return std::shared_ptr<MappedFile>();
+    file->m_data = static_cast<const char*>( view );
+    file->m_size = static_cast<size_t>( info.st_size );
+#endif
+    return file;
+}
+
+
+MappedFile::~MappedFile()
+{
+    if( !m_data )
+        return;
+#if defined(_WIN32)
+    UnmapViewOfFile( m_data );
+#else
+    munmap( const_cast<char*>( m_data ), m_size );
+#endif
+}
+
+
+// Header of a mapped file if it is of the given kind and key, holds count
+// primitives and is exactly as long as its header says
+const CacheHeader* checkHeader( const MappedFile& file, uint64_t key, CacheKind kind, size_t count,
+                                size_t node_size )
+{
+    if( file.size() < sizeof( CacheHeader ) )
+        return 0;
+    const CacheHeader* header = reinterpret_cast<const CacheHeader*>( file.data() );
+    if( memcmp( header->magic, CACHE_MAGIC, sizeof( CACHE_MAGIC ) ) != 0 ||
+        header->version != CACHE_VERSION || header->kind != static_cast<uint32_t>( kind ) ||
+        header->key != key || header->num_prims != count || header->num_nodes == 0 )
+        return 0;
+
+    // Sizes are checked one by one so a garbled count cannot overflow the sum
+    const uint64_t limit = file.size();
+    if( header->num_nodes > limit / node_size || header->num_inner_nodes > limit / 4 || header->num_prims > limit / 4 )
+        return 0;
+    const uint64_t expected = sizeof( CacheHeader ) + header->num_nodes * node_size +
+                              ( ( kind == CACHE_FULL ? header->num_nodes : 0 ) + header->num_inner_nodes +
+                                header->num_prims ) * sizeof( uint32_t );
+    return expected == limit ? header : 0;
+}
+
+
+// A permutation of [0, count) has no index past it
+bool checkPrimIndices( const uint32_t* prims, size_t count )
+{
+    for( size_t i = 0; i < count; ++i )
+        if( prims[i] >= count )
+            return false;
+    return true;
+}
+
+
+// Walks the hierarchy from the root.  Each inner node has to be reached
+// once only, and no deeper than the 256 entry stacks of the traversals
+// hold, so a corrupt file can neither make a walk loop nor overrun a stack.
+// Child indices are not ordered: LBVH nodes can point at lower indices.
+// reached gets a flag per node.
+template<typename Node>
+bool checkTree( const Node* nodes, size_t num_nodes, uint32_t leaf_flag, std::vector<char>& reached )
+{
+    const uint32_t max_depth = 256;
+    reached.assign( num_nodes, 0 );
+    reached[0] = 1;
+    std::vector< std::pair<uint32_t, uint32_t> > stack( 1, std::make_pair( 0u, 1u ) );   // Node, depth
+    while( !stack.empty() )
+    {
+        const uint32_t node  = stack.back().first;
+        const uint32_t depth = stack.back().second;
+        stack.pop_back();
+        for( int c = 0; c < 2; ++c )
+        {
+            const uint32_t child = nodes[node].child[c];
+            if( child & leaf_flag )
+                continue;
+            if( child >= num_nodes || reached[child] || depth >= max_depth )
+                return false;
+            reached[child] = 1;
+            stack.push_back( std::make_pair( child, depth + 1 ) );
+        }
+    }
+    return true;
+}
+
+
+void fillHeader( CacheHeader& header, uint64_t key, CacheKind kind, const Aabb& bounds )
+{
+    memset( &header, 0, sizeof( header ) );
+    memcpy( header.magic, CACHE_MAGIC, sizeof( CACHE_MAGIC ) );
+    header.version   = CACHE_VERSION;
+    header.kind      = kind;
+    header.key       = key;
+    header.bounds[0] = bounds.m_min.x;
+    header.bounds[1] = bounds.m_min.y;
+    header.bounds[2] = bounds.m_min.z;
+    header.bounds[3] = bounds.m_max.x;
+    header.bounds[4] = bounds.m_max.y;
+    header.bounds[5] = bounds.m_max.z;
+}
+
+
+Aabb headerBounds( const CacheHeader& header )
+{
+    return Aabb( make_float3( header.bounds[0], header.bounds[1], header.bounds[2] ),
+                 make_float3( header.bounds[3], header.bounds[4], header.bounds[5] ) );
+}
+
+
+// Write the arrays after header, atomically for concurrent readers
+void writeCacheFile( const std::string& path, const CacheHeader& header,
+                     const void* const* arrays, const size_t* sizes, int num_arrays )
+{
+    std::vector<const void*> chunks( 1, &header );
+    std::vector<size_t>      chunk_sizes( 1, sizeof( header ) );
+    chunks.insert( chunks.end(), arrays, arrays + num_arrays );
+    chunk_sizes.insert( chunk_sizes.end(), sizes, sizes + num_arrays );
+    sutil::writeFileAtomic( path, chunks.data(), chunk_sizes.data(), chunks.size() );
+}
+
+
+inline uint64_t mix( uint64_t h, uint64_t word )
+{
+    h ^= word * 0x9e3779b97f4a7c15ull;
+    h  = ( h << 31 ) | ( h >> 33 );
+    return h * 0xff51afd7ed558ccdull;
+}
+
+} // namespace
+
+
+//------------------------------------------------------------------------------
+//
+// HostBVHCache
+//
+//------------------------------------------------------------------------------
+
+HostBVHCache::HostBVHCache()
+    : m_hits( 0 ),
+      m_misses( 0 ),
+      m_time( 0.0 )
+{
+}
+
+
+uint64_t HostBVHCache::key( const Aabb* prim_bounds, size_t count, const HostBVHBuildOptions& options, bool compressed )
+{
+    uint64_t h = 0xcbf29ce484222325ull;
+    h = mix( h, CACHE_VERSION );
+    h = mix( h, compressed ? 1 : 0 );
+    h = mix( h, options.morton_64 ? 1 : 0 );
+    h = mix( h, options.max_leaf_size );
+    h = mix( h, options.refine_passes );
+    h = mix( h, count );
+
+    // Bit patterns, so -0 and 0 differ, which at worst costs a rebuild
+    const uint32_t* words = reinterpret_cast<const uint32_t*>( prim_bounds );
+    const size_t num_words = count * sizeof( Aabb ) / sizeof( uint32_t );
+    for( size_t i = 0; i + 1 < num_words; i += 2 )
+        h = mix( h, static_cast<uint64_t>( words[i] ) | static_cast<uint64_t>( words[i + 1] ) << 32 );
+    if( num_words & 1 )
+        h = mix( h, words[num_words - 1] );
+
+    // Final avalanche, as in MurmurHash3
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+
+std::string HostBVHCache::path( uint64_t key, bool compressed ) const
+{
+    std::ostringstream path;
+    path << m_directory << "/" << std::hex << std::setw( 16 ) << std::setfill( '0' ) << key
+         << ( compressed ? ".hcbvh" : ".hbvh" );
+    return path.str();
+}
+
+
+bool HostBVHCache::load( uint64_t key, size_t count, HostBVH& bvh )
+{
+    if( !enabled() )
+        return false;
+    const double start_time = sutil::currentTime();
+
+    std::shared_ptr<MappedFile> file = MappedFile::open( path( key, false ) );
+    const CacheHeader* header = file ? checkHeader( *file, key, CACHE_FULL, count, sizeof( HostBVHNode ) ) : 0;
+    bool valid = header != 0;
+    if( valid )
+    {
+        const size_t num_nodes = static_cast<size_t>( header->num_nodes );
+        const size_t num_inner = static_cast<size_t>( header->num_inner_nodes );
+        const HostBVHNode* nodes   = reinterpret_cast<const HostBVHNode*>( header + 1 );
+        const uint32_t*    parents = reinterpret_cast<const uint32_t*>( nodes + num_nodes );
+        const uint32_t*    inner   = parents + num_nodes;
+        const uint32_t*    prims   = inner + num_inner;
+
+        // Refits start from the inner node list and climb the parents, so
+        // the list has to hold exactly the nodes of the tree, each linked
+        // back to its parent.  Nodes inside collapsed leaves are left over
+        // from the build and never read.
+        std::vector<char> reached;
+        valid = checkPrimIndices( prims, count ) &&
+                checkTree( nodes, num_nodes, HostBVHNode::LEAF, reached );
+        size_t num_reached = 0;
+        for( size_t i = 0; valid && i < num_nodes; ++i )
+        {
+            if( !reached[i] )
+                continue;
+            ++num_reached;
+            for( int c = 0; c < 2; ++c )
+            {
+                const uint32_t child = nodes[i].child[c];
+                if( child & HostBVHNode::LEAF )
+                    valid = valid && ( child & ~HostBVHNode::LEAF ) + uint64_t( nodes[i].count[c] ) <= count;
+                else
+                    valid = valid && parents[child] == i;
+            }
+        }
+        valid = valid && num_inner == num_reached;
+        for( size_t i = 0; valid && i < num_inner; ++i )
+        {
+            // Each listed once; the flag is cleared as it is seen
+            valid = inner[i] < num_nodes && reached[inner[i]];
+            if( valid )
+                reached[inner[i]] = 0;
+        }
+
+        if( valid )
+        {
+            bvh = HostBVH();
+            bvh.m_nodes.assign( nodes, nodes + num_nodes );
+            bvh.m_parents.assign( parents, parents + num_nodes );
+            bvh.m_inner_nodes.assign( inner, inner + num_inner );
+            bvh.m_prim_indices.assign( prims, prims + count );
+            bvh.m_bounds = headerBounds( *header );
+        }
+    }
+
+    valid ? ++m_hits : ++m_misses;
+    m_time += ( sutil::currentTime() - start_time ) * 1000.0;
+    return valid;
+}
+
+
+bool HostBVHCache::load( uint64_t key, size_t count, HostCompressedBVH& bvh )
+{
+    if( !enabled() )
+        return false;
+    const double start_time = sutil::currentTime();
+
+    std::shared_ptr<MappedFile> file = MappedFile::open( path( key, true ) );
+    const CacheHeader* header = file ? checkHeader( *file, key, CACHE_COMPRESSED, count, sizeof( HostCompressedNode ) ) : 0;
+    bool valid = header != 0 && header->num_inner_nodes == 0;
+    if( valid )
+    {
+        const size_t num_nodes = static_cast<size_t>( header->num_nodes );
+        const HostCompressedNode* nodes = reinterpret_cast<const HostCompressedNode*>( header + 1 );
+        const uint32_t*           prims = reinterpret_cast<const uint32_t*>( nodes + num_nodes );
+
+        // The traversal trusts the file as much as its own compress(), which
+        // writes children after their parent
+        std::vector<char> reached;
+        valid = checkPrimIndices( prims, count ) &&
+                checkTree( nodes, num_nodes, HostCompressedNode::LEAF, reached );
+        for( size_t i = 0; valid && i < num_nodes; ++i )
+        {
+            for( int c = 0; c < 2; ++c )
+            {
+                const uint32_t child = nodes[i].child[c];
+                if( child & HostCompressedNode::LEAF )
+                    valid = valid && ( child & HostCompressedNode::FIRST_MASK ) +
+                                     uint64_t( ( child & ~HostCompressedNode::LEAF ) >> HostCompressedNode::COUNT_SHIFT ) <= count;
+                else
+                    valid = valid && child > i && child < num_nodes;
+            }
+        }
+
+        if( valid )
+        {
+            bvh.clear();
+            bvh.m_bounds       = headerBounds( *header );
+            bvh.m_eps          = make_float3( header->eps[0], header->eps[1], header->eps[2] );
+            bvh.m_num_nodes    = num_nodes;
+            bvh.m_num_prims    = count;
+            bvh.m_mapped_nodes = nodes;
+            bvh.m_mapped_prims = prims;
+            bvh.m_mapping      = file;
+        }
+    }
+
+    valid ? ++m_hits : ++m_misses;
+    m_time += ( sutil::currentTime() - start_time ) * 1000.0;
+    return valid;
+}
+
+
+void HostBVHCache::store( uint64_t key, const HostBVH& bvh )
+{
+    if( !enabled() || bvh.m_nodes.empty() )
+        return;
+    const double start_time = sutil::currentTime();
+
+    CacheHeader header;
+    fillHeader( header, key, CACHE_FULL, bvh.m_bounds );
+    header.num_nodes       = bvh.m_nodes.size();
+    header.num_inner_nodes = bvh.m_inner_nodes.size();
+    header.num_prims       = bvh.m_prim_indices.size();
+
+    const void* arrays[] = { bvh.m_nodes.data(), bvh.m_parents.data(), bvh.m_inner_nodes.data(),
+                             bvh.m_prim_indices.data() };
+    const size_t sizes[] = { bvh.m_nodes.size() * sizeof( HostBVHNode ), bvh.m_parents.size() * sizeof( uint32_t ),
+                             bvh.m_inner_nodes.size() * sizeof( uint32_t ), bvh.m_prim_indices.size() * sizeof( uint32_t ) };
+    writeCacheFile( path( key, false ), header, arrays, sizes, 4 );
+    m_time += ( sutil::currentTime() - start_time ) * 1000.0;
+}
+
+
+void HostBVHCache::store( uint64_t key, const HostCompressedBVH& bvh )
+{
+    if( !enabled() || bvh.empty() )
+        return;
+    const double start_time = sutil::currentTime();
+
+    CacheHeader header;
+    fillHeader( header, key, CACHE_COMPRESSED, bvh.m_bounds );
+    header.num_nodes = bvh.m_num_nodes;
+    header.num_prims = bvh.m_num_prims;
+    header.eps[0]    = bvh.m_eps.x;
+    header.eps[1]    = bvh.m_eps.y;
+    header.eps[2]    = bvh.m_eps.z;
+
+    const void* arrays[] = { bvh.nodeData(), bvh.primData() };
+    const size_t sizes[] = { bvh.m_num_nodes * sizeof( HostCompressedNode ), bvh.m_num_prims * sizeof( uint32_t ) };
+    writeCacheFile( path( key, true ), header, arrays, sizes, 2 );
+    m_time += ( sutil::currentTime() - start_time ) * 1000.0;
+}
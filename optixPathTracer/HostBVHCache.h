@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#pragma once
+
+#include "HostBVH.h"
+#include "HostCompressedBVH.h"
+
+#include <optixu/optixu_aabb_namespace.h>
+
+#include <stdint.h>
+#include <string>
+
+
+//------------------------------------------------------------------------------
+//
+// Directory of built host hierarchies, so static geometry is not rebuilt on
+// every launch.  A hierarchy depends on nothing but the primitive bounds and
+// the build options, so those are what the key hashes; a file named after the
+// key holds a versioned header that repeats it, followed by the raw arrays.
+//
+// Files are memory mapped.  A HostCompressedBVH is used in place from the
+// mapping, a HostBVH copies its arrays out since refit() writes them.  Files
+// are written under a temporary name and renamed, and any file that does not
+// check out is treated as a miss and replaced.
+//
+//------------------------------------------------------------------------------
+
+class HostBVHCache
+{
+public:
+    HostBVHCache();
+
+    // Empty disables the cache.  The directory must exist.
+    void               setDirectory( const std::string& directory ) { m_directory = directory; }
+    const std::string& directory() const { return m_directory; }
+    bool               enabled()   const { return !m_directory.empty(); }
+
+    static uint64_t key( const optix::Aabb* prim_bounds, size_t count, const HostBVHBuildOptions& options,
+                         bool compressed );
+
+    // Load the hierarchy stored under key for count primitives, false if
+    // there is none
+    bool load( uint64_t key, size_t count, HostBVH& bvh );
+    bool load( uint64_t key, size_t count, HostCompressedBVH& bvh );
+
+    // Failures to write are ignored, the next run builds again
+    void store( uint64_t key, const HostBVH& bvh );
+    void store( uint64_t key, const HostCompressedBVH& bvh );
+
+    unsigned int numHits()   const { return m_hits; }
+    unsigned int numMisses() const { return m_misses; }
+
+    // Milliseconds spent loading and storing so far
+    double time() const { return m_time; }
+
+private:
+    std::string path( uint64_t key, bool compressed ) const;
+
+    std::string  m_directory;
+    unsigned int m_hits;
+    unsigned int m_misses;
+    double       m_time;
+};
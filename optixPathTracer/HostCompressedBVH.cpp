@@ -0,0 +1,191 @@
+/*
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "HostCompressedBVH.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+using namespace optix;
+
+
+namespace
+{
+
+// Outward rounded 8 bit bounds of box within frame, widened until the
+// decoded box, as the traversal computes it, contains box
+void quantizeChildBox( const Aabb& box, const Aabb& frame, const float3& eps, HostCompressedNode& node, int c )
+{
+    const float box_lo[3]   = { box.m_min.x, box.m_min.y, box.m_min.z };
+    const float box_hi[3]   = { box.m_max.x, box.m_max.y, box.m_max.z };
+    const float frame_lo[3] = { frame.m_min.x, frame.m_min.y, frame.m_min.z };
+    const float frame_hi[3] = { frame.m_max.x, frame.m_max.y, frame.m_max.z };
+    for( int k = 0; k < 3; ++k )
+    {
+        const float extent = frame_hi[k] - frame_lo[k];
+        const float lo = extent > 0.0f ? std::floor( ( box_lo[k] - frame_lo[k] ) / extent * 255.0f ) : 0.0f;
+        const float hi = extent > 0.0f ? std::ceil( ( box_hi[k] - frame_lo[k] ) / extent * 255.0f ) : 0.0f;
+        node.lo[c][k] = static_cast<uint8_t>( std::min( std::max( lo, 0.0f ), 255.0f ) );
+        node.hi[c][k] = static_cast<uint8_t>( std::min( std::max( hi, 0.0f ), 255.0f ) );
+    }
+
+    for( ;; )
+    {
+        Aabb boxes[2];
+        host_bvh_detail::decodeChildBoxes( node, frame, eps, boxes );
+        const Aabb& decoded = boxes[c];
+        const float dec_lo[3] = { decoded.m_min.x, decoded.m_min.y, decoded.m_min.z };
+        const float dec_hi[3] = { decoded.m_max.x, decoded.m_max.y, decoded.m_max.z };
+        bool changed = false;
+        for( int k = 0; k < 3; ++k )
+        {
+            if( dec_lo[k] > box_lo[k] && node.lo[c][k] > 0 )
+            {
+                --node.lo[c][k];
+                changed = true;
+            }
+            if( dec_hi[k] < box_hi[k] && node.hi[c][k] < 255 )
+            {
+                ++node.hi[c][k];
+                changed = true;
+            }
+        }
+        if( !changed )
+            return;
+    }
+}
+
+} // namespace
+
+
+HostCompressedBVH::HostCompressedBVH()
+    : m_eps( make_float3( 0.0f ) ),
+      m_num_nodes( 0 ),
+      m_num_prims( 0 ),
+      m_mapped_nodes( 0 ),
+      m_mapped_prims( 0 )
+{
+}
+
+
+void HostCompressedBVH::compress( const HostBVH& bvh )
+{
+    clear();
+    if( bvh.nodes().empty() )
+        return;
+
+    const std::vector<HostBVHNode>& nodes = bvh.nodes();
+    m_prim_indices = bvh.primIndices();
+    m_bounds       = bvh.bounds();
+
+    // A few ulps of the largest coordinate, which no decode rounds by more
+    const float3 magnitude = make_float3( optix::fmaxf( fabsf( m_bounds.m_min.x ), fabsf( m_bounds.m_max.x ) ),
+                                          optix::fmaxf( fabsf( m_bounds.m_min.y ), fabsf( m_bounds.m_max.y ) ),
+                                          optix::fmaxf( fabsf( m_bounds.m_min.z ), fabsf( m_bounds.m_max.z ) ) );
+    m_eps = magnitude * 9.5367431640625e-7f;    // 2^-20
+
+    if( m_prim_indices.size() > HostCompressedNode::FIRST_MASK + 1u )
+        throw std::runtime_error( "HostCompressedBVH: too many primitives" );
+
+    // Children are placed next to each other as their parent is written, so
+    // the layout is depth first over sibling pairs
+    struct Item
+    {
+        uint32_t source;
+        uint32_t target;
+        Aabb     frame;
+    };
+    std::vector<Item> stack;
+    stack.push_back( Item() );
+    stack.back().source = 0;
+    stack.back().target = 0;
+    stack.back().frame  = m_bounds;
+    m_nodes.reserve( nodes.size() );
+    m_nodes.resize( 1 );
+
+    while( !stack.empty() )
+    {
+        const Item item = stack.back();
+        stack.pop_back();
+        const HostBVHNode& source = nodes[item.source];
+
+        HostCompressedNode node = HostCompressedNode();
+        for( int c = 0; c < 2; ++c )
+        {
+            if( source.child[c] & HostBVHNode::LEAF )
+            {
+                // Empty leaves keep the zero box, they have nothing to test
+                if( source.count[c] > HostCompressedNode::MAX_COUNT )
+                    throw std::runtime_error( "HostCompressedBVH: leaf too large" );
+                if( source.count[c] )
+                    quantizeChildBox( source.bounds[c], item.frame, m_eps, node, c );
+                node.child[c] = HostCompressedNode::LEAF | source.count[c] << HostCompressedNode::COUNT_SHIFT |
+                                ( source.child[c] & ~HostBVHNode::LEAF );
+                continue;
+            }
+
+            quantizeChildBox( source.bounds[c], item.frame, m_eps, node, c );
+            node.child[c] = static_cast<uint32_t>( m_nodes.size() );
+            m_nodes.push_back( HostCompressedNode() );
+
+            Aabb boxes[2];
+            host_bvh_detail::decodeChildBoxes( node, item.frame, m_eps, boxes );
+            Item child;
+            child.source = source.child[c];
+            child.target = node.child[c];
+            child.frame  = boxes[c];
+            stack.push_back( child );
+        }
+        m_nodes[item.target] = node;
+    }
+    m_nodes.shrink_to_fit();
+    m_num_nodes = m_nodes.size();
+    m_num_prims = m_prim_indices.size();
+}
+
+
+void HostCompressedBVH::clear()
+{
+    m_nodes.clear();
+    m_prim_indices.clear();
+    m_bounds.invalidate();
+    m_num_nodes    = 0;
+    m_num_prims    = 0;
+    m_mapped_nodes = 0;
+    m_mapped_prims = 0;
+    m_mapping.reset();
+}
+
+
+size_t HostCompressedBVH::memoryBytes() const
+{
+    if( m_mapping )
+        return m_num_nodes * sizeof( HostCompressedNode ) + m_num_prims * sizeof( uint32_t );
+    return m_nodes.capacity() * sizeof( HostCompressedNode ) + m_prim_indices.capacity() * sizeof( uint32_t );
+}
@@ -0,0 +1,294 @@
+/*
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#pragma once
+
+#include "HostBVH.h"
+
+#include <optixu/optixu_aabb_namespace.h>
+#include <optixu/optixu_math_namespace.h>
+
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+
+//------------------------------------------------------------------------------
+//
+// Read only, compressed copy of a HostBVH for objects that are traced but not
+// refitted.  A node stores its two child boxes as 8 bit offsets in 1/255ths
+// of its own box, which the traversal decodes from the box of the parent, so
+// only the root bounds are kept at full precision.  Leaf children pack the
+// leaf flag, primitive count and first sorted primitive into one word.  A
+// node takes 20 bytes instead of 64.
+//
+// Quantization rounds outwards and decoded boxes are enlarged by a few ulps
+// of their coordinates, so a decoded box always contains the exact one and
+// no ray misses a primitive it would hit in the full precision hierarchy.
+//
+// A hierarchy loaded by HostBVHCache is used in place from the mapped file.
+//
+//------------------------------------------------------------------------------
+
+struct HostCompressedNode
+{
+    static const uint32_t LEAF        = 0x80000000u;
+    static const uint32_t COUNT_SHIFT = 27;            // Leaf: LEAF | count << 27 | first
+    static const uint32_t MAX_COUNT   = 15;
+    static const uint32_t FIRST_MASK  = ( 1u << COUNT_SHIFT ) - 1;
+
+    uint8_t   lo[2][3];       // Child, axis
+    uint8_t   hi[2][3];
+    uint32_t  child[2];       // Node index, or a packed leaf
+};
+
+
+class HostCompressedBVH
+{
+public:
+    HostCompressedBVH();
+
+    // Compress a built hierarchy.  Leaves may hold up to MAX_COUNT
+    // primitives and there may be up to FIRST_MASK + 1 of them.
+    void compress( const HostBVH& bvh );
+
+    void clear();
+
+    // Same contracts as HostBVH::traverse() and HostBVH::traversePacket()
+    template<typename PrimitiveTest>
+    bool traverse( const optix::float3& origin, const optix::float3& dir, float tmin, float& tmax,
+                   PrimitiveTest& test, bool any_hit ) const;
+
+    template<typename PacketTest>
+    void traversePacket( const HostRayPacket& packet, unsigned int& active, PacketTest& test ) const;
+
+    bool               empty()       const { return m_num_nodes == 0; }
+    size_t             primCount()   const { return m_num_prims; }
+    const optix::Aabb& bounds()      const { return m_bounds; }
+
+    // Bytes held by nodes and primitive indices, mapped ones included
+    size_t memoryBytes() const;
+
+private:
+    friend class HostBVHCache;
+
+    const HostCompressedNode* nodeData() const { return m_mapped_nodes ? m_mapped_nodes : m_nodes.data(); }
+    const uint32_t*           primData() const { return m_mapped_prims ? m_mapped_prims : m_prim_indices.data(); }
+
+    std::vector<HostCompressedNode> m_nodes;          // Depth first, root is node 0
+    std::vector<uint32_t>           m_prim_indices;
+    optix::Aabb                     m_bounds;
+    optix::float3                   m_eps;            // Decode enlargement
+    size_t                          m_num_nodes;
+    size_t                          m_num_prims;
+
+    // Used instead of the vectors when set, kept alive by m_mapping
+    const HostCompressedNode*       m_mapped_nodes;
+    const uint32_t*                 m_mapped_prims;
+    std::shared_ptr<const void>     m_mapping;
+};
+
+
+//------------------------------------------------------------------------------
+//
+// Implementation
+//
+//------------------------------------------------------------------------------
+
+namespace host_bvh_detail
+{
+
+// Child boxes of a node whose own box is frame, as the traversal sees them.
+// eps covers the rounding of the decode at the scale of the root bounds.
+inline void decodeChildBoxes( const HostCompressedNode& node, const optix::Aabb& frame, const optix::float3& eps,
+                              optix::Aabb boxes[2] )
+{
+    const optix::float3 scale = ( frame.m_max - frame.m_min ) * ( 1.0f / 255.0f );
+    const optix::float3 lo    = frame.m_min - eps;
+    const optix::float3 hi    = frame.m_min + eps;
+    for( int c = 0; c < 2; ++c )
+    {
+        boxes[c].m_min = lo + optix::make_float3( node.lo[c][0], node.lo[c][1], node.lo[c][2] ) * scale;
+        boxes[c].m_max = hi + optix::make_float3( node.hi[c][0], node.hi[c][1], node.hi[c][2] ) * scale;
+    }
+}
+
+} // namespace host_bvh_detail
+
+
+template<typename PrimitiveTest>
+bool HostCompressedBVH::traverse( const optix::float3& origin, const optix::float3& dir, float tmin, float& tmax,
+                                  PrimitiveTest& test, bool any_hit ) const
+{
+    if( empty() )
+        return false;
+
+    const HostCompressedNode* nodes = nodeData();
+    const uint32_t*           prims = primData();
+
+    const optix::float3 inv_dir = optix::make_float3( host_bvh_detail::safeInverse( dir.x ),
+                                                      host_bvh_detail::safeInverse( dir.y ),
+                                                      host_bvh_detail::safeInverse( dir.z ) );
+
+    // Entries carry the decoded box of the node, the frame of its children
+    uint32_t    stack[256];
+    optix::Aabb stack_frames[256];
+    int         stack_size = 0;
+    uint32_t    node = 0;
+    optix::Aabb frame = m_bounds;
+    bool        hit = false;
+
+    for( ;; )
+    {
+        const HostCompressedNode& n = nodes[node];
+
+        optix::Aabb boxes[2];
+        host_bvh_detail::decodeChildBoxes( n, frame, m_eps, boxes );
+
+        float t_enter[2];
+        bool  enter[2];
+        for( int c = 0; c < 2; ++c )
+        {
+            enter[c] = host_bvh_detail::intersectBox( boxes[c], origin, inv_dir, tmin, tmax, t_enter[c] );
+            if( enter[c] && ( n.child[c] & HostCompressedNode::LEAF ) )
+            {
+                enter[c] = false;
+                const uint32_t first = n.child[c] & HostCompressedNode::FIRST_MASK;
+                const uint32_t count = ( n.child[c] & ~HostCompressedNode::LEAF ) >> HostCompressedNode::COUNT_SHIFT;
+                for( uint32_t i = first; i < first + count; ++i )
+                {
+                    if( test( prims[i], tmax ) )
+                    {
+                        hit = true;
+                        if( any_hit )
+                            return true;
+                    }
+                }
+            }
+        }
+
+        if( enter[0] && enter[1] )
+        {
+            const int near_child = t_enter[0] <= t_enter[1] ? 0 : 1;
+            stack[stack_size]        = n.child[1 - near_child];
+            stack_frames[stack_size] = boxes[1 - near_child];
+            ++stack_size;
+            node  = n.child[near_child];
+            frame = boxes[near_child];
+        }
+        else if( enter[0] || enter[1] )
+        {
+            const int c = enter[0] ? 0 : 1;
+            node  = n.child[c];
+            frame = boxes[c];
+        }
+        else
+        {
+            if( stack_size == 0 )
+                return hit;
+            --stack_size;
+            node  = stack[stack_size];
+            frame = stack_frames[stack_size];
+        }
+    }
+}
+
+
+template<typename PacketTest>
+void HostCompressedBVH::traversePacket( const HostRayPacket& packet, unsigned int& active, PacketTest& test ) const
+{
+    if( empty() || !active )
+        return;
+
+    const HostCompressedNode* nodes = nodeData();
+    const uint32_t*           prims = primData();
+
+    float inv_x[HOST_PACKET_SIZE], inv_y[HOST_PACKET_SIZE], inv_z[HOST_PACKET_SIZE];
+    for( unsigned int lane = 0; lane < HOST_PACKET_SIZE; ++lane )
+    {
+        inv_x[lane] = host_bvh_detail::safeInverse( packet.dx[lane] );
+        inv_y[lane] = host_bvh_detail::safeInverse( packet.dy[lane] );
+        inv_z[lane] = host_bvh_detail::safeInverse( packet.dz[lane] );
+    }
+
+    uint32_t    stack[256];
+    optix::Aabb stack_frames[256];
+    int         stack_size = 0;
+    uint32_t    node = 0;
+    optix::Aabb frame = m_bounds;
+
+    for( ;; )
+    {
+        const HostCompressedNode& n = nodes[node];
+
+        optix::Aabb boxes[2];
+        host_bvh_detail::decodeChildBoxes( n, frame, m_eps, boxes );
+
+        unsigned int enter[2];
+        for( int c = 0; c < 2; ++c )
+        {
+            enter[c] = host_bvh_detail::intersectBoxPacket( boxes[c], packet, inv_x, inv_y, inv_z, active );
+            if( enter[c] && ( n.child[c] & HostCompressedNode::LEAF ) )
+            {
+                const uint32_t first = n.child[c] & HostCompressedNode::FIRST_MASK;
+                const uint32_t count = ( n.child[c] & ~HostCompressedNode::LEAF ) >> HostCompressedNode::COUNT_SHIFT;
+                for( uint32_t i = first; i < first + count; ++i )
+                {
+                    active &= ~test( prims[i], enter[c] & active );
+                    if( !active )
+                        return;
+                }
+                enter[c] = 0;
+            }
+        }
+
+        if( enter[0] && enter[1] )
+        {
+            stack[stack_size]        = n.child[1];
+            stack_frames[stack_size] = boxes[1];
+            ++stack_size;
+            node  = n.child[0];
+            frame = boxes[0];
+        }
+        else if( enter[0] || enter[1] )
+        {
+            const int c = enter[0] ? 0 : 1;
+            node  = n.child[c];
+            frame = boxes[c];
+        }
+        else
+        {
+            if( stack_size == 0 )
+                return;
+            --stack_size;
+            node  = stack[stack_size];
+            frame = stack_frames[stack_size];
+        }
+    }
+}
@@ -0,0 +1,515 @@
+/*
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "HostRasterizer.h"
+
+#include <sutil.h>
+#include <ThreadPool.h>
+
+#include <algorithm>
+#include <cmath>
+
+#if defined( __SSE__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 1 )
+#  include <xmmintrin.h>
+#  define HOST_RASTERIZER_USE_SSE
+#endif
+
+using namespace optix;
+
+
+namespace
+{
+
+const uint32_t NO_PRIMITIVE = 0xFFFFFFFFu;
+
+// Near plane, in units of the distance to the image plane
+const float NEAR_DEPTH = 1e-3f;
+
+
+// Camera space is ( u, v, w ) with the image plane at w = 1 and the screen
+// at u, v in [-1, 1]
+struct CameraFrame
+{
+    float3 eye;
+    float3 U, V, W;
+    float3 u_axis, v_axis, w_axis;   // U / |U|^2 etc, to project onto
+    float  half_width;
+    float  half_height;
+
+    float3 toCamera( const float3& p ) const
+    {
+        const float3 d = p - eye;
+        return make_float3( dot( d, u_axis ), dot( d, v_axis ), dot( d, w_axis ) );
+    }
+
+    float2 toScreen( const float3& c ) const
+    {
+        return make_float2( ( c.x / c.z + 1.0f ) * half_width, ( c.y / c.z + 1.0f ) * half_height );
+    }
+};
+
+
+class PrimitiveSetup
+{
+public:
+    PrimitiveSetup( const CameraFrame& camera, int width, int height, std::vector<HostRasterizer::Primitive>& out )
+        : m_camera( camera ), m_width( width ), m_height( height ), m_out( out ) {}
+
+    void triangle( const float3& p0, const float3& p1, const float3& p2, uint32_t object_id )
+    {
+        const float3 c[3] = { m_camera.toCamera( p0 ), m_camera.toCamera( p1 ), m_camera.toCamera( p2 ) };
+        const float3 normal = normalize( cross( p1 - p0, p2 - p0 ) );
+        if( c[0].z >= NEAR_DEPTH && c[1].z >= NEAR_DEPTH && c[2].z >= NEAR_DEPTH )
+        {
+            emitTriangle( c[0], c[1], c[2], normal, object_id );
+            return;
+        }
+
+        // Clip to the near plane, leaves at most a quad
+        float3 clipped[4];
+        int count = 0;
+        for( int i = 0; i < 3; ++i )
+        {
+            const float3& a = c[i];
+            const float3& b = c[( i + 1 ) % 3];
+            const bool a_in = a.z >= NEAR_DEPTH;
+            const bool b_in = b.z >= NEAR_DEPTH;
+            if( a_in )
+                clipped[count++] = a;
+            if( a_in != b_in )
+                clipped[count++] = a + ( b - a ) * ( ( NEAR_DEPTH - a.z ) / ( b.z - a.z ) );
+        }
+        for( int i = 1; i + 1 < count; ++i )
+            emitTriangle( clipped[0], clipped[i], clipped[i + 1], normal, object_id );
+    }
+
+    void sphere( const float3& center, float radius, uint32_t object_id )
+    {
+        HostRasterizer::Primitive prim;
+        prim.center_radius = make_float4( center, radius );
+        prim.object_id = object_id;
+
+        // Screen bounds of the bounding box corners, the whole screen if the
+        // box reaches past the near plane
+        float2 lo = make_float2( 1e30f, 1e30f ), hi = make_float2( -1e30f, -1e30f );
+        bool clipped = false;
+        for( int corner = 0; corner < 8 && !clipped; ++corner )
+        {
+            const float3 c = m_camera.toCamera( center + make_float3( corner & 1 ? radius : -radius,
+                                                                      corner & 2 ? radius : -radius,
+                                                                      corner & 4 ? radius : -radius ) );
+            if( c.z < NEAR_DEPTH )
+            {
+                clipped = true;
+                break;
+            }
+            const float2 s = m_camera.toScreen( c );
+            lo = make_float2( std::min( lo.x, s.x ), std::min( lo.y, s.y ) );
+            hi = make_float2( std::max( hi.x, s.x ), std::max( hi.y, s.y ) );
+        }
+        if( clipped )
+        {
+            if( m_camera.toCamera( center ).z + radius / length( m_camera.W ) < NEAR_DEPTH )
+                return;     // Entirely behind the camera
+            lo = make_float2( 0.0f, 0.0f );
+            hi = make_float2( float( m_width ), float( m_height ) );
+        }
+        if( !setBounds( lo, hi, prim ) )
+            return;
+        m_out.push_back( prim );
+    }
+
+private:
+    bool setBounds( const float2& lo, const float2& hi, HostRasterizer::Primitive& prim ) const
+    {
+        // Pixels whose center x + 0.5 lies within [lo, hi]
+        prim.x0 = std::max( 0, int( ceilf( lo.x - 0.5f ) ) );
+        prim.y0 = std::max( 0, int( ceilf( lo.y - 0.5f ) ) );
+        prim.x1 = std::min( m_width - 1, int( floorf( hi.x - 0.5f ) ) );
+        prim.y1 = std::min( m_height - 1, int( floorf( hi.y - 0.5f ) ) );
+        return prim.x0 <= prim.x1 && prim.y0 <= prim.y1;
+    }
+
+    void emitTriangle( const float3& c0, const float3& c1, const float3& c2, const float3& normal, uint32_t object_id )
+    {
+        float2 s[3] = { m_camera.toScreen( c0 ), m_camera.toScreen( c1 ), m_camera.toScreen( c2 ) };
+        float  z[3] = { 1.0f / c0.z, 1.0f / c1.z, 1.0f / c2.z };
+
+        float area = ( s[1].x - s[0].x ) * ( s[2].y - s[0].y ) - ( s[1].y - s[0].y ) * ( s[2].x - s[0].x );
+        if( !( fabsf( area ) > 1e-12f ) )
+            return;         // Edge on, or NaN from a degenerate vertex
+        if( area < 0.0f )
+        {
+            // Counter clockwise so the inside is positive for every edge
+            std::swap( s[1], s[2] );
+            std::swap( z[1], z[2] );
+            area = -area;
+        }
+
+        HostRasterizer::Primitive prim;
+        for( int i = 0; i < 3; ++i )
+        {
+            const float2& a = s[i];
+            const float2& b = s[( i + 1 ) % 3];
+            prim.edge_a[i] = a.y - b.y;
+            prim.edge_b[i] = b.x - a.x;
+            prim.edge_c[i] = ( b.y - a.y ) * a.x - ( b.x - a.x ) * a.y;
+        }
+
+        // Vertex i is opposite edge i + 1, inverse depth is affine on screen
+        const float inv_area = 1.0f / area;
+        prim.depth_a = ( prim.edge_a[1] * z[0] + prim.edge_a[2] * z[1] + prim.edge_a[0] * z[2] ) * inv_area;
+        prim.depth_b = ( prim.edge_b[1] * z[0] + prim.edge_b[2] * z[1] + prim.edge_b[0] * z[2] ) * inv_area;
+        prim.depth_c = ( prim.edge_c[1] * z[0] + prim.edge_c[2] * z[1] + prim.edge_c[0] * z[2] ) * inv_area;
+        prim.center_radius = make_float4( 0.0f );
+        prim.normal = normal;
+        prim.object_id = object_id;
+
+        const float2 lo = make_float2( std::min( s[0].x, std::min( s[1].x, s[2].x ) ),
+                                       std::min( s[0].y, std::min( s[1].y, s[2].y ) ) );
+        const float2 hi = make_float2( std::max( s[0].x, std::max( s[1].x, s[2].x ) ),
+                                       std::max( s[0].y, std::max( s[1].y, s[2].y ) ) );
+        if( setBounds( lo, hi, prim ) )
+            m_out.push_back( prim );
+    }
+
+    const CameraFrame& m_camera;
+    const int          m_width;
+    const int          m_height;
+    std::vector<HostRasterizer::Primitive>& m_out;
+};
+
+
+void setupPrimitive( const HostObject& object, size_t prim, PrimitiveSetup& setup )
+{
+    if( object.type == HOST_OBJECT_TRIANGLES )
+    {
+        const int3& tri = object.triangles[prim];
+        setup.triangle( transformPoint( object, object.vertices[tri.x] ),
+                        transformPoint( object, object.vertices[tri.y] ),
+                        transformPoint( object, object.vertices[tri.z] ), object.object_id );
+    }
+    else if( object.type == HOST_OBJECT_QUADS )
+    {
+        for( int lane = 0; lane < QUAD_BLOCK_SIZE; ++lane )
+        {
+            float3 anchor, v1, v2;
+            if( !getQuadBlockLane( object.quad_blocks[prim], lane, anchor, v1, v2 ) )
+                continue;
+            const float3 p00 = transformPoint( object, anchor );
+            const float3 p10 = transformPoint( object, anchor + v1 );
+            const float3 p01 = transformPoint( object, anchor + v2 );
+            const float3 p11 = p10 + p01 - p00;
+            const size_t slot = prim * QUAD_BLOCK_SIZE + lane;
+            const uint32_t id = object.quad_ids.empty() ? object.object_id : object.quad_ids[slot];
+            setup.triangle( p00, p10, p11, id );
+            setup.triangle( p00, p11, p01, id );
+        }
+    }
+    else
+    {
+        const float4& s = object.spheres[prim];
+        float radius = s.w;
+        if( object.has_transform )
+        {
+            // Largest axis scale, exact for the usual rigid and uniform cases
+            const float* m = object.transform.getData();
+            const float sx = sqrtf( m[0] * m[0] + m[4] * m[4] + m[8] * m[8] );
+            const float sy = sqrtf( m[1] * m[1] + m[5] * m[5] + m[9] * m[9] );
+            const float sz = sqrtf( m[2] * m[2] + m[6] * m[6] + m[10] * m[10] );
+            radius *= std::max( sx, std::max( sy, sz ) );
+        }
+        setup.sphere( transformPoint( object, make_float3( s.x, s.y, s.z ) ), radius, object.object_id );
+    }
+}
+
+
+// Nearest hit in front of the near plane of the ray eye + t * dir, t in
+// units of dir
+inline bool intersectSphere( const float4& sphere, const float3& eye, const float3& dir, float& t )
+{
+    const float3 oc = eye - make_float3( sphere.x, sphere.y, sphere.z );
+    const float  a  = dot( dir, dir );
+    const float  b  = dot( oc, dir );
+    const float  c  = dot( oc, oc ) - sphere.w * sphere.w;
+    const float  disc = b * b - a * c;
+    if( disc < 0.0f )
+        return false;
+    const float root = sqrtf( disc );
+    t = ( -b - root ) / a;
+    if( t < NEAR_DEPTH )
+        t = ( -b + root ) / a;
+    return t >= NEAR_DEPTH;
+}
+
+
+void rasterizeTriangle( const HostRasterizer::Primitive& prim, int x0, int y0, int x1, int y1,
+                        int width, uint32_t prim_id, float* depth, uint32_t* prim_ids )
+{
+#ifdef HOST_RASTERIZER_USE_SSE
+    const __m128 lane_offsets = _mm_set_ps( 3.5f, 2.5f, 1.5f, 0.5f );
+    const __m128 ea0 = _mm_set1_ps( prim.edge_a[0] ), eb0 = _mm_set1_ps( prim.edge_b[0] ), ec0 = _mm_set1_ps( prim.edge_c[0] );
+    const __m128 ea1 = _mm_set1_ps( prim.edge_a[1] ), eb1 = _mm_set1_ps( prim.edge_b[1] ), ec1 = _mm_set1_ps( prim.edge_c[1] );
+    const __m128 ea2 = _mm_set1_ps( prim.edge_a[2] ), eb2 = _mm_set1_ps( prim.edge_b[2] ), ec2 = _mm_set1_ps( prim.edge_c[2] );
+    const __m128 da  = _mm_set1_ps( prim.depth_a ),   db  = _mm_set1_ps( prim.depth_b ),   dc  = _mm_set1_ps( prim.depth_c );
+    const __m128 zero = _mm_setzero_ps();
+
+    for( int y = y0; y <= y1; ++y )
+    {
+        const __m128 py = _mm_set1_ps( y + 0.5f );
+        const __m128 row0 = _mm_add_ps( _mm_mul_ps( eb0, py ), ec0 );
+        const __m128 row1 = _mm_add_ps( _mm_mul_ps( eb1, py ), ec1 );
+        const __m128 row2 = _mm_add_ps( _mm_mul_ps( eb2, py ), ec2 );
+        const __m128 rowz = _mm_add_ps( _mm_mul_ps( db, py ), dc );
+        float*    depth_row = depth + size_t( y ) * width;
+        uint32_t* id_row    = prim_ids + size_t( y ) * width;
+
+        for( int x = x0; x <= x1; x += 4 )
+        {
+            const __m128 px = _mm_add_ps( _mm_set1_ps( float( x ) ), lane_offsets );
+            const __m128 e0 = _mm_add_ps( _mm_mul_ps( ea0, px ), row0 );
+            const __m128 e1 = _mm_add_ps( _mm_mul_ps( ea1, px ), row1 );
+            const __m128 e2 = _mm_add_ps( _mm_mul_ps( ea2, px ), row2 );
+            const __m128 inside = _mm_and_ps( _mm_cmpge_ps( e0, zero ),
+                                  _mm_and_ps( _mm_cmpge_ps( e1, zero ), _mm_cmpge_ps( e2, zero ) ) );
+            int mask = _mm_movemask_ps( inside );
+            if( !mask )
+                continue;
+
+            // Nearer is a larger inverse depth
+            float z[4];
+            _mm_storeu_ps( z, _mm_add_ps( _mm_mul_ps( da, px ), rowz ) );
+            const int lanes = std::min( 4, x1 - x + 1 );
+            for( int lane = 0; lane < lanes; ++lane )
+            {
+                if( ( mask >> lane & 1 ) && z[lane] > depth_row[x + lane] )
+                {
+                    depth_row[x + lane] = z[lane];
+                    id_row[x + lane]    = prim_id;
+                }
+            }
+        }
+    }
+#else
+    for( int y = y0; y <= y1; ++y )
+    {
+        const float py = y + 0.5f;
+        for( int x = x0; x <= x1; ++x )
+        {
+            const float px = x + 0.5f;
+            if( prim.edge_a[0] * px + prim.edge_b[0] * py + prim.edge_c[0] < 0.0f ||
+                prim.edge_a[1] * px + prim.edge_b[1] * py + prim.edge_c[1] < 0.0f ||
+                prim.edge_a[2] * px + prim.edge_b[2] * py + prim.edge_c[2] < 0.0f )
+                continue;
+            const float z = prim.depth_a * px + prim.depth_b * py + prim.depth_c;
+            const size_t index = size_t( y ) * width + x;
+            if( z > depth[index] )
+            {
+                depth[index]    = z;
+                prim_ids[index] = prim_id;
+            }
+        }
+    }
+#endif
+}
+
+
+void rasterizeSphere( const HostRasterizer::Primitive& prim, const CameraFrame& camera, int x0, int y0, int x1, int y1,
+                      int width, int height, uint32_t prim_id, float* depth, uint32_t* prim_ids )
+{
+    for( int y = y0; y <= y1; ++y )
+    {
+        const float ndc_y = ( y + 0.5f ) / height * 2.0f - 1.0f;
+        for( int x = x0; x <= x1; ++x )
+        {
+            const float ndc_x = ( x + 0.5f ) / width * 2.0f - 1.0f;
+            const float3 dir = ndc_x * camera.U + ndc_y * camera.V + camera.W;
+            float t;
+            if( !intersectSphere( prim.center_radius, camera.eye, dir, t ) )
+                continue;
+            // t is the camera depth since dir has unit w
+            const float z = 1.0f / t;
+            const size_t index = size_t( y ) * width + x;
+            if( z > depth[index] )
+            {
+                depth[index]    = z;
+                prim_ids[index] = prim_id;
+            }
+        }
+    }
+}
+
+} // namespace
+
+
+HostRasterizer::HostRasterizer()
+    : m_tile_size( 64 ),
+      m_time( 0.0 )
+{
+}
+
+
+void HostRasterizer::render( const HostScene& scene,
+                             const float3& eye, const float3& U, const float3& V, const float3& W,
+                             unsigned int width, unsigned int height,
+                             float3* hits, float3* normals, float3* ffnormals, float* object_ids )
+{
+    const double start_time = sutil::currentTime();
+    sutil::ThreadPool& pool = sutil::defaultThreadPool();
+
+    CameraFrame camera;
+    camera.eye = eye;
+    camera.U = U;
+    camera.V = V;
+    camera.W = W;
+    camera.u_axis = U / dot( U, U );
+    camera.v_axis = V / dot( V, V );
+    camera.w_axis = W / dot( W, W );
+    camera.half_width  = 0.5f * width;
+    camera.half_height = 0.5f * height;
+
+    // Setup, every chunk takes its share of every object's primitives
+    const size_t num_chunks = std::max( 1u, pool.numThreads() );
+    m_chunk_prims.resize( num_chunks );
+    pool.parallelFor( 0, num_chunks, 1,
+        [&]( size_t chunk_begin, size_t chunk_end )
+        {
+            for( size_t chunk = chunk_begin; chunk < chunk_end; ++chunk )
+            {
+                m_chunk_prims[chunk].clear();
+                PrimitiveSetup setup( camera, int( width ), int( height ), m_chunk_prims[chunk] );
+                forEachPrimitiveShare( scene, chunk, num_chunks, [&]( const HostObject& object, size_t prim )
+                {
+                    setupPrimitive( object, prim, setup );
+                } );
+            }
+        } );
+    m_prims.clear();
+    for( size_t chunk = 0; chunk < num_chunks; ++chunk )
+        m_prims.insert( m_prims.end(), m_chunk_prims[chunk].begin(), m_chunk_prims[chunk].end() );
+
+    // Bin, one task per band of tile rows so every bin has a single writer
+    const unsigned int tile_size = m_tile_size;
+    const unsigned int tiles_x = ( width + tile_size - 1 ) / tile_size;
+    const unsigned int tiles_y = ( height + tile_size - 1 ) / tile_size;
+    m_bins.resize( size_t( tiles_x ) * tiles_y );
+    pool.parallelFor( 0, tiles_y, 1,
+        [&]( size_t row_begin, size_t row_end )
+        {
+            for( size_t row = row_begin; row < row_end; ++row )
+            {
+                for( unsigned int tx = 0; tx < tiles_x; ++tx )
+                    m_bins[row * tiles_x + tx].clear();
+                const int y0 = int( row * tile_size );
+                const int y1 = y0 + int( tile_size ) - 1;
+                for( size_t i = 0; i < m_prims.size(); ++i )
+                {
+                    const Primitive& prim = m_prims[i];
+                    if( prim.y1 < y0 || prim.y0 > y1 )
+                        continue;
+                    for( int tx = prim.x0 / int( tile_size ); tx <= prim.x1 / int( tile_size ); ++tx )
+                        m_bins[row * tiles_x + tx].push_back( static_cast<uint32_t>( i ) );
+                }
+            }
+        } );
+
+    // Rasterize tiles in parallel, each owns its pixels
+    const size_t num_pixels = size_t( width ) * height;
+    m_depth.resize( num_pixels );
+    m_prim_ids.resize( num_pixels );
+    pool.parallelFor( 0, m_bins.size(), 1,
+        [&]( size_t tile_begin, size_t tile_end )
+        {
+            for( size_t tile = tile_begin; tile < tile_end; ++tile )
+            {
+                const int tx0 = int( tile % tiles_x ) * int( tile_size );
+                const int ty0 = int( tile / tiles_x ) * int( tile_size );
+                const int tx1 = std::min( tx0 + int( tile_size ), int( width ) ) - 1;
+                const int ty1 = std::min( ty0 + int( tile_size ), int( height ) ) - 1;
+                for( int y = ty0; y <= ty1; ++y )
+                {
+                    std::fill( m_depth.begin() + size_t( y ) * width + tx0, m_depth.begin() + size_t( y ) * width + tx1 + 1, 0.0f );
+                    std::fill( m_prim_ids.begin() + size_t( y ) * width + tx0, m_prim_ids.begin() + size_t( y ) * width + tx1 + 1, NO_PRIMITIVE );
+                }
+
+                const std::vector<uint32_t>& bin = m_bins[tile];
+                for( size_t i = 0; i < bin.size(); ++i )
+                {
+                    const Primitive& prim = m_prims[bin[i]];
+                    const int x0 = std::max( prim.x0, tx0 ), x1 = std::min( prim.x1, tx1 );
+                    const int y0 = std::max( prim.y0, ty0 ), y1 = std::min( prim.y1, ty1 );
+                    if( prim.center_radius.w > 0.0f )
+                        rasterizeSphere( prim, camera, x0, y0, x1, y1, int( width ), int( height ), bin[i],
+                                         &m_depth[0], &m_prim_ids[0] );
+                    else
+                        rasterizeTriangle( prim, x0, y0, x1, y1, int( width ), bin[i], &m_depth[0], &m_prim_ids[0] );
+                }
+            }
+        } );
+
+    // Resolve the G-buffer from the winning primitives
+    pool.parallelFor( 0, height, 16,
+        [&]( size_t row_begin, size_t row_end )
+        {
+            for( size_t y = row_begin; y < row_end; ++y )
+            {
+                const float ndc_y = ( y + 0.5f ) / height * 2.0f - 1.0f;
+                for( size_t x = 0; x < width; ++x )
+                {
+                    const size_t index = y * width + x;
+                    const uint32_t id = m_prim_ids[index];
+                    if( id == NO_PRIMITIVE )
+                    {
+                        hits[index] = normals[index] = make_float3( 0.0f );
+                        if( ffnormals )
+                            ffnormals[index] = make_float3( 0.0f );
+                        if( object_ids )
+                            object_ids[index] = 0.0f;
+                        continue;
+                    }
+
+                    const Primitive& prim = m_prims[id];
+                    const float ndc_x = ( x + 0.5f ) / width * 2.0f - 1.0f;
+                    const float3 dir = ndc_x * U + ndc_y * V + W;
+                    const float3 hit = eye + dir * ( 1.0f / m_depth[index] );
+                    const float3 normal = prim.center_radius.w > 0.0f
+                        ? normalize( hit - make_float3( prim.center_radius.x, prim.center_radius.y, prim.center_radius.z ) )
+                        : prim.normal;
+                    hits[index] = hit;
+                    normals[index] = normal;
+                    if( ffnormals )
+                        ffnormals[index] = dot( normal, dir ) > 0.0f ? -normal : normal;
+                    if( object_ids )
+                        object_ids[index] = float( prim.object_id );
+                }
+            }
+        } );
+
+    m_time = ( sutil::currentTime() - start_time ) * 1000.0;
+}
@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#pragma once
+
+#include "HostScene.h"
+
+#include <optixu/optixu_math_namespace.h>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+
+//------------------------------------------------------------------------------
+//
+// Rasterizes the primary visibility of a HostScene into the G-buffer channels
+// the first pass writes: hit position, geometric and face forward normal and
+// object ID per pixel, for the pinhole camera of pathtrace_camera (eye and
+// U / V / W, one sample at each pixel center).
+//
+// Primitives are set up in parallel chunks: triangles and quads are clipped
+// to the near plane and projected, with edge functions and an inverse depth
+// plane in screen space; spheres are bounded on screen and intersected
+// exactly per pixel.  Each chunk bins its primitives into screen tiles, then
+// tiles are rasterized in parallel into a depth and primitive buffer, four
+// pixels at a time with SSE where available.  A final pass reconstructs the
+// G-buffer from the winning primitive of every pixel.
+//
+// The scene is only read: objects, transforms and primitives as added, no
+// commit() needed.
+//
+//------------------------------------------------------------------------------
+
+class HostRasterizer
+{
+public:
+    HostRasterizer();
+
+    void setTileSize( unsigned int tile_size ) { m_tile_size = tile_size ? tile_size : 1u; }
+
+    // Pixels without a hit get zero normals and object ID 0.  ffnormals and
+    // object_ids may be null.
+    void render( const HostScene& scene,
+                 const optix::float3& eye, const optix::float3& U, const optix::float3& V, const optix::float3& W,
+                 unsigned int width, unsigned int height,
+                 optix::float3* hits, optix::float3* normals, optix::float3* ffnormals, float* object_ids );
+
+    // Stats of the last render
+    double lastTime()           const { return m_time; }          // Milliseconds
+    size_t lastPrimitiveCount() const { return m_prims.size(); }  // After clipping and culling
+
+    struct Primitive
+    {
+        // Triangles: edge functions a * x + b * y + c >= 0 inside and inverse
+        // depth plane, in pixels.  Spheres only use center_radius.
+        float          edge_a[3];
+        float          edge_b[3];
+        float          edge_c[3];
+        float          depth_a, depth_b, depth_c;
+        optix::float4  center_radius;     // w > 0 for spheres
+        optix::float3  normal;            // Triangles, world space
+        uint32_t       object_id;
+        int            x0, y0, x1, y1;     // Pixel bounds, inclusive
+    };
+
+private:
+    unsigned int                          m_tile_size;
+    std::vector<Primitive>                m_prims;
+    std::vector< std::vector<Primitive> > m_chunk_prims;
+    std::vector<float>                    m_depth;      // Inverse depth per pixel, 0 is empty
+    std::vector<uint32_t>                 m_prim_ids;
+    std::vector< std::vector<uint32_t> >  m_bins;       // Per tile
+    double                                m_time;
+};
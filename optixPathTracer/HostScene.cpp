@@ -0,0 +1,943 @@
+/*
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "HostScene.h"
+
+#include <sutil.h>
+#include <ThreadPool.h>
+
+#include <chrono>
+#include <stdexcept>
+
+#if defined( __SSE__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 1 )
+#  include <xmmintrin.h>
+#  define HOST_SCENE_USE_SSE
+#endif
+
+using namespace optix;
+
+
+//------------------------------------------------------------------------------
+//
+// Primitive intersection
+//
+//------------------------------------------------------------------------------
+
+namespace
+{
+
+// Same test as parallelogram.cu, on the four quads of a block at once.  Lanes
+// with a zero normal get a NaN distance and drop out.
+inline bool intersectQuadBlock( const QuadBlock& block, const float3& origin, const float3& dir,
+                                float tmin, float& tmax, unsigned int& hit_lane )
+{
+#ifdef HOST_SCENE_USE_SSE
+    const __m128 nx = _mm_loadu_ps( block.nx );
+    const __m128 ny = _mm_loadu_ps( block.ny );
+    const __m128 nz = _mm_loadu_ps( block.nz );
+    const __m128 ox = _mm_set1_ps( origin.x );
+    const __m128 oy = _mm_set1_ps( origin.y );
+    const __m128 oz = _mm_set1_ps( origin.z );
+    const __m128 dx = _mm_set1_ps( dir.x );
+    const __m128 dy = _mm_set1_ps( dir.y );
+    const __m128 dz = _mm_set1_ps( dir.z );
+
+    const __m128 dt = _mm_add_ps( _mm_add_ps( _mm_mul_ps( nx, dx ), _mm_mul_ps( ny, dy ) ), _mm_mul_ps( nz, dz ) );
+    const __m128 no = _mm_add_ps( _mm_add_ps( _mm_mul_ps( nx, ox ), _mm_mul_ps( ny, oy ) ), _mm_mul_ps( nz, oz ) );
+    const __m128 t  = _mm_div_ps( _mm_sub_ps( _mm_loadu_ps( block.d ), no ), dt );
+    __m128 mask = _mm_and_ps( _mm_cmpge_ps( t, _mm_set1_ps( tmin ) ), _mm_cmplt_ps( t, _mm_set1_ps( tmax ) ) );
+    if( !_mm_movemask_ps( mask ) )
+        return false;
+
+    const __m128 px = _mm_sub_ps( _mm_add_ps( ox, _mm_mul_ps( dx, t ) ), _mm_loadu_ps( block.ax ) );
+    const __m128 py = _mm_sub_ps( _mm_add_ps( oy, _mm_mul_ps( dy, t ) ), _mm_loadu_ps( block.ay ) );
+    const __m128 pz = _mm_sub_ps( _mm_add_ps( oz, _mm_mul_ps( dz, t ) ), _mm_loadu_ps( block.az ) );
+    const __m128 a1 = _mm_add_ps( _mm_add_ps( _mm_mul_ps( _mm_loadu_ps( block.v1x ), px ),
+                                              _mm_mul_ps( _mm_loadu_ps( block.v1y ), py ) ),
+                                  _mm_mul_ps( _mm_loadu_ps( block.v1z ), pz ) );
+    const __m128 a2 = _mm_add_ps( _mm_add_ps( _mm_mul_ps( _mm_loadu_ps( block.v2x ), px ),
+                                              _mm_mul_ps( _mm_loadu_ps( block.v2y ), py ) ),
+                                  _mm_mul_ps( _mm_loadu_ps( block.v2z ), pz ) );
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one  = _mm_set1_ps( 1.0f );
+    mask = _mm_and_ps( mask, _mm_and_ps( _mm_cmpge_ps( a1, zero ), _mm_cmple_ps( a1, one ) ) );
+    mask = _mm_and_ps( mask, _mm_and_ps( _mm_cmpge_ps( a2, zero ), _mm_cmple_ps( a2, one ) ) );
+    int bits = _mm_movemask_ps( mask );
+    if( !bits )
+        return false;
+
+    float ts[QUAD_BLOCK_SIZE];
+    _mm_storeu_ps( ts, t );
+    for( unsigned int lane = 0; bits; ++lane, bits >>= 1 )
+    {
+        if( ( bits & 1 ) && ts[lane] < tmax )
+        {
+            tmax     = ts[lane];
+            hit_lane = lane;
+        }
+    }
+    return true;
+#else
+    bool hit = false;
+    for( unsigned int lane = 0; lane < QUAD_BLOCK_SIZE; ++lane )
+    {
+        const float3 n  = make_float3( block.nx[lane], block.ny[lane], block.nz[lane] );
+        const float  t  = ( block.d[lane] - dot( n, origin ) ) / dot( dir, n );
+        if( !( t >= tmin && t < tmax ) )
+            continue;
+
+        const float3 vi = origin + dir * t - make_float3( block.ax[lane], block.ay[lane], block.az[lane] );
+        const float  a1 = dot( make_float3( block.v1x[lane], block.v1y[lane], block.v1z[lane] ), vi );
+        const float  a2 = dot( make_float3( block.v2x[lane], block.v2y[lane], block.v2z[lane] ), vi );
+        if( a1 >= 0.0f && a1 <= 1.0f && a2 >= 0.0f && a2 <= 1.0f )
+        {
+            tmax     = t;
+            hit_lane = lane;
+            hit      = true;
+        }
+    }
+    return hit;
+#endif
+}
+
+
+inline bool intersectSphere( const float4& sphere, const float3& origin, const float3& dir, float tmin, float& tmax )
+{
+    const float3 O = origin - make_float3( sphere );
+    const float  a = dot( dir, dir );
+    const float  b = dot( O, dir );
+    const float  c = dot( O, O ) - sphere.w * sphere.w;
+    const float  disc = b * b - a * c;
+    if( disc < 0.0f )
+        return false;
+
+    const float sdisc = sqrtf( disc );
+    float t = ( -b - sdisc ) / a;
+    if( t < tmin )
+        t = ( -b + sdisc ) / a;
+    if( t < tmin || t >= tmax )
+        return false;
+    tmax = t;
+    return true;
+}
+
+
+// Primitive test for one object, as HostBVH::traverse expects
+struct ObjectTest
+{
+    ObjectTest( const HostObject& object, const float3& origin, const float3& dir, float tmin, bool any_hit )
+        : object( object ), origin( origin ), dir( dir ), tmin( tmin ), any_hit( any_hit ), primitive( 0 )
+    {
+        if( object.type == HOST_OBJECT_TRIANGLES )
+            watertight = makeWatertightRay( origin, dir );
+    }
+
+    bool operator()( uint32_t prim, float& tmax )
+    {
+        bool hit;
+        switch( object.type )
+        {
+            case HOST_OBJECT_TRIANGLES:
+            {
+                if( object.triangle_blocks.empty() )
+                {
+                    // Compressed objects keep no blocks
+                    const int3& tri = object.triangles[prim];
+                    hit = intersectTriangle( object.vertices[tri.x], object.vertices[tri.y], object.vertices[tri.z],
+                                             watertight, tmin, tmax );
+                    break;
+                }
+                unsigned int lane = 0;
+                hit = intersectTriangleBlock( object.triangle_blocks[prim], watertight, tmin, tmax, lane, any_hit );
+                if( hit )
+                    primitive = prim * TRIANGLE_BLOCK_SIZE + lane;
+                return hit;
+            }
+            case HOST_OBJECT_QUADS:
+            {
+                unsigned int lane = 0;
+                hit = intersectQuadBlock( object.quad_blocks[prim], origin, dir, tmin, tmax, lane );
+                if( hit )
+                    primitive = prim * QUAD_BLOCK_SIZE + lane;
+                return hit;
+            }
+            default:
+                hit = intersectSphere( object.spheres[prim], origin, dir, tmin, tmax );
+                break;
+        }
+        if( hit )
+            primitive = prim;
+        return hit;
+    }
+
+    const HostObject& object;
+    const float3      origin;
+    const float3      dir;
+    const float       tmin;
+    const bool        any_hit;
+    WatertightRay     watertight;
+    uint32_t          primitive;        // Block slot for triangle blocks and quads
+};
+
+
+// The hierarchy of an object, in whichever form it is kept
+template<typename PrimitiveTest>
+inline bool traverseObject( const HostObject& object, const float3& origin, const float3& dir, float tmin,
+                            float& tmax, PrimitiveTest& test, bool any_hit )
+{
+    if( !object.compressed_bvh.empty() )
+        return object.compressed_bvh.traverse( origin, dir, tmin, tmax, test, any_hit );
+    return object.bvh.traverse( origin, dir, tmin, tmax, test, any_hit );
+}
+
+template<typename PacketTest>
+inline void traverseObjectPacket( const HostObject& object, const HostRayPacket& packet, unsigned int& active,
+                                  PacketTest& test )
+{
+    if( !object.compressed_bvh.empty() )
+        object.compressed_bvh.traversePacket( packet, active, test );
+    else
+        object.bvh.traversePacket( packet, active, test );
+}
+
+inline const Aabb& objectHierarchyBounds( const HostObject& object )
+{
+    return object.compressed_bvh.empty() ? object.bvh.bounds() : object.compressed_bvh.bounds();
+}
+
+
+// Top level test, descends into the object hierarchies, or those of their
+// shadow proxies with use_proxies
+struct SceneTest
+{
+    SceneTest( const std::vector<HostObject>& objects, const float3& origin, const float3& dir, float tmin, bool any_hit,
+               bool use_proxies = false )
+        : objects( objects ), origin( origin ), dir( dir ), tmin( tmin ), any_hit( any_hit ),
+          use_proxies( use_proxies ), object( 0 ), primitive( 0 ) {}
+
+    bool operator()( uint32_t index, float& tmax )
+    {
+        const HostObject& placed = objects[index];
+        const HostObject& target = use_proxies && placed.shadow_proxy ? *placed.shadow_proxy : placed;
+        float3 ray_origin = origin;
+        float3 ray_dir    = dir;
+        if( placed.has_transform )
+        {
+            // Distances along an affinely transformed ray are unchanged
+            ray_origin = make_float3( placed.inverse_transform * make_float4( origin, 1.0f ) );
+            ray_dir    = make_float3( placed.inverse_transform * make_float4( dir, 0.0f ) );
+        }
+
+        ObjectTest test( target, ray_origin, ray_dir, tmin, any_hit );
+        if( !traverseObject( target, ray_origin, ray_dir, tmin, tmax, test, any_hit ) )
+            return false;
+        object    = index;
+        primitive = test.primitive;
+        return true;
+    }
+
+    const std::vector<HostObject>& objects;
+    const float3      origin;
+    const float3      dir;
+    const float       tmin;
+    const bool        any_hit;
+    const bool        use_proxies;
+    uint32_t          object;
+    uint32_t          primitive;
+};
+
+// SceneTest over the caster top level, whose primitives index m_caster_handles
+struct CasterTest
+{
+    CasterTest( SceneTest& test, const std::vector<uint32_t>& handles ) : test( test ), handles( handles ) {}
+
+    bool operator()( uint32_t index, float& tmax ) { return test( handles[index], tmax ); }
+
+    SceneTest&                   test;
+    const std::vector<uint32_t>& handles;
+};
+
+
+//
+// Packet versions of the tests above, for HostBVH::traversePacket()
+//
+
+struct PacketObjectTest
+{
+    PacketObjectTest( const HostObject& object, const HostRayPacket& packet, unsigned int lanes )
+        : object( object ), packet( packet )
+    {
+        if( object.type != HOST_OBJECT_TRIANGLES )
+            return;
+        for( unsigned int lane = 0; lane < HOST_PACKET_SIZE; ++lane )
+            if( lanes & ( 1u << lane ) )
+                watertight[lane] = makeWatertightRay( make_float3( packet.ox[lane], packet.oy[lane], packet.oz[lane] ),
+                                                      make_float3( packet.dx[lane], packet.dy[lane], packet.dz[lane] ) );
+    }
+
+    unsigned int operator()( uint32_t prim, unsigned int lanes )
+    {
+        // Triangle and quad blocks are already SIMD across their primitives,
+        // spheres are rare
+        unsigned int hits = 0;
+        for( unsigned int lane = 0; lane < HOST_PACKET_SIZE; ++lane )
+        {
+            if( !( lanes & ( 1u << lane ) ) )
+                continue;
+            const float3 origin = make_float3( packet.ox[lane], packet.oy[lane], packet.oz[lane] );
+            const float3 dir    = make_float3( packet.dx[lane], packet.dy[lane], packet.dz[lane] );
+            float        tmax   = packet.tmax[lane];
+            unsigned int block_lane = 0;
+            bool hit;
+            if( object.type == HOST_OBJECT_TRIANGLES && object.triangle_blocks.empty() )
+            {
+                const int3& tri = object.triangles[prim];
+                hit = intersectTriangle( object.vertices[tri.x], object.vertices[tri.y], object.vertices[tri.z],
+                                         watertight[lane], packet.tmin[lane], tmax );
+            }
+            else if( object.type == HOST_OBJECT_TRIANGLES )
+                hit = intersectTriangleBlock( object.triangle_blocks[prim], watertight[lane], packet.tmin[lane], tmax,
+                                              block_lane, true );
+            else if( object.type == HOST_OBJECT_QUADS )
+                hit = intersectQuadBlock( object.quad_blocks[prim], origin, dir, packet.tmin[lane], tmax, block_lane );
+            else
+                hit = intersectSphere( object.spheres[prim], origin, dir, packet.tmin[lane], tmax );
+            if( hit )
+                hits |= 1u << lane;
+        }
+        return hits;
+    }
+
+    const HostObject&    object;
+    const HostRayPacket& packet;
+    WatertightRay        watertight[HOST_PACKET_SIZE];
+};
+
+
+struct PacketSceneTest
+{
+    PacketSceneTest( const std::vector<HostObject>& objects, const HostRayPacket& packet, bool use_proxies )
+        : objects( objects ), packet( packet ), use_proxies( use_proxies ) {}
+
+    unsigned int operator()( uint32_t index, unsigned int lanes )
+    {
+        const HostObject& placed = objects[index];
+        const HostObject& target = use_proxies && placed.shadow_proxy ? *placed.shadow_proxy : placed;
+        const HostRayPacket* rays = &packet;
+        HostRayPacket local;
+        if( placed.has_transform )
+        {
+            local = packet;
+            for( unsigned int lane = 0; lane < HOST_PACKET_SIZE; ++lane )
+            {
+                if( !( lanes & ( 1u << lane ) ) )
+                    continue;
+                const float4 o = placed.inverse_transform * make_float4( packet.ox[lane], packet.oy[lane], packet.oz[lane], 1.0f );
+                const float4 d = placed.inverse_transform * make_float4( packet.dx[lane], packet.dy[lane], packet.dz[lane], 0.0f );
+                local.ox[lane] = o.x; local.oy[lane] = o.y; local.oz[lane] = o.z;
+                local.dx[lane] = d.x; local.dy[lane] = d.y; local.dz[lane] = d.z;
+            }
+            rays = &local;
+        }
+
+        unsigned int remaining = lanes;
+        PacketObjectTest test( target, *rays, lanes );
+        traverseObjectPacket( target, *rays, remaining, test );
+        return lanes & ~remaining;
+    }
+
+    const std::vector<HostObject>& objects;
+    const HostRayPacket&           packet;
+    const bool                     use_proxies;
+};
+
+
+struct PacketCasterTest
+{
+    PacketCasterTest( PacketSceneTest& test, const std::vector<uint32_t>& handles ) : test( test ), handles( handles ) {}
+
+    unsigned int operator()( uint32_t index, unsigned int lanes ) { return test( handles[index], lanes ); }
+
+    PacketSceneTest&             test;
+    const std::vector<uint32_t>& handles;
+};
+
+
+// Hierarchies of fewer primitives build about as fast as their file opens
+const size_t CACHE_MIN_PRIMS = 256;
+
+// SAH cost ratio to the last build past which refitted objects rebuild
+const float REBUILD_THRESHOLD = 1.5f;
+
+} // namespace
+
+
+//------------------------------------------------------------------------------
+//
+// HostScene
+//
+//------------------------------------------------------------------------------
+
+HostScene::HostScene()
+    : m_top_dirty( true ),
+      m_commit_time( 0.0 ),
+      m_background_rebuilds( 0 )
+{
+}
+
+
+unsigned int HostScene::addTriangles( unsigned int object_id, const float* positions, int num_vertices,
+                                      const int32_t* indices, int num_triangles )
+{
+    HostObject object;
+    object.type      = HOST_OBJECT_TRIANGLES;
+    object.object_id = object_id;
+    object.vertices.resize( num_vertices );
+    for( int i = 0; i < num_vertices; ++i )
+        object.vertices[i] = make_float3( positions[3 * i], positions[3 * i + 1], positions[3 * i + 2] );
+    object.triangles.resize( num_triangles );
+    for( int i = 0; i < num_triangles; ++i )
+        object.triangles[i] = make_int3( indices[3 * i], indices[3 * i + 1], indices[3 * i + 2] );
+
+    m_objects.push_back( std::move( object ) );
+    m_top_dirty = true;
+    return static_cast<unsigned int>( m_objects.size() - 1 );
+}
+
+
+unsigned int HostScene::addQuad( unsigned int object_id, const float3& anchor, const float3& v1, const float3& v2 )
+{
+    HostObject object;
+    object.type      = HOST_OBJECT_QUADS;
+    object.object_id = object_id;
+    object.quad_blocks.resize( 1 );
+    for( unsigned int lane = 1; lane < QUAD_BLOCK_SIZE; ++lane )
+        clearQuadBlockLane( object.quad_blocks[0], lane );
+    setQuadBlockLane( object.quad_blocks[0], 0, anchor, v1, v2 );
+
+    m_objects.push_back( std::move( object ) );
+    m_top_dirty = true;
+    return static_cast<unsigned int>( m_objects.size() - 1 );
+}
+
+
+unsigned int HostScene::addQuadBlocks( const QuadBlock* blocks, size_t num_blocks, const unsigned int* slot_object_ids )
+{
+    HostObject object;
+    object.type = HOST_OBJECT_QUADS;
+    object.quad_blocks.assign( blocks, blocks + num_blocks );
+    object.quad_ids.assign( slot_object_ids, slot_object_ids + num_blocks * QUAD_BLOCK_SIZE );
+
+    m_objects.push_back( std::move( object ) );
+    m_top_dirty = true;
+    return static_cast<unsigned int>( m_objects.size() - 1 );
+}
+
+
+unsigned int HostScene::addSpheres( unsigned int object_id, const float4* spheres, size_t count )
+{
+    HostObject object;
+    object.type      = HOST_OBJECT_SPHERES;
+    object.object_id = object_id;
+    object.spheres.assign( spheres, spheres + count );
+
+    m_objects.push_back( std::move( object ) );
+    m_top_dirty = true;
+    return static_cast<unsigned int>( m_objects.size() - 1 );
+}
+
+
+void HostScene::setSpheres( unsigned int handle, const float4* spheres, size_t count )
+{
+    HostObject& object = m_objects[handle];
+    if( object.type != HOST_OBJECT_SPHERES )
+        throw std::runtime_error( "HostScene: setSpheres() on an object without spheres" );
+    object.spheres.assign( spheres, spheres + count );
+    object.dirty = true;
+    m_top_dirty  = true;
+}
+
+
+void HostScene::setShadowProxy( unsigned int handle, const float* positions, int num_vertices,
+                                const int32_t* indices, int num_triangles )
+{
+    HostObject& object = m_objects[handle];
+    if( object.type != HOST_OBJECT_TRIANGLES )
+        throw std::runtime_error( "HostScene: setShadowProxy() on an object without triangles" );
+
+    std::unique_ptr<HostObject> proxy( new HostObject );
+    proxy->type      = HOST_OBJECT_TRIANGLES;
+    proxy->object_id = object.object_id;
+    proxy->vertices.resize( num_vertices );
+    for( int i = 0; i < num_vertices; ++i )
+        proxy->vertices[i] = make_float3( positions[3 * i], positions[3 * i + 1], positions[3 * i + 2] );
+    proxy->triangles.resize( num_triangles );
+    for( int i = 0; i < num_triangles; ++i )
+        proxy->triangles[i] = make_int3( indices[3 * i], indices[3 * i + 1], indices[3 * i + 2] );
+    if( object.update_mode == HOST_UPDATE_COMPRESSED )
+        proxy->update_mode = HOST_UPDATE_COMPRESSED;
+
+    object.shadow_proxy = std::move( proxy );
+    m_top_dirty = true;
+}
+
+
+void HostScene::setUpdateMode( unsigned int handle, HostUpdateMode mode )
+{
+    // Switching to or from compressed changes what is stored, not just how
+    // it is updated
+    HostObject& object = m_objects[handle];
+    const bool rebuild = ( mode == HOST_UPDATE_COMPRESSED ) != ( object.update_mode == HOST_UPDATE_COMPRESSED );
+    object.update_mode = mode;
+    if( object.shadow_proxy )
+        object.shadow_proxy->update_mode = mode == HOST_UPDATE_COMPRESSED ? HOST_UPDATE_COMPRESSED : HOST_UPDATE_REBUILD;
+    if( rebuild )
+    {
+        object.dirty = true;
+        if( object.shadow_proxy )
+            object.shadow_proxy->dirty = true;
+        m_top_dirty = true;
+    }
+}
+
+
+void HostScene::setTransform( unsigned int handle, const Matrix4x4& transform )
+{
+    HostObject& object = m_objects[handle];
+    object.transform         = transform;
+    object.inverse_transform = transform.inverse();
+    object.has_transform     = true;
+    m_top_dirty = true;
+}
+
+
+void HostScene::setCastsShadow( unsigned int handle, bool casts_shadow )
+{
+    m_objects[handle].casts_shadow = casts_shadow;
+    m_top_dirty = true;
+}
+
+
+void HostScene::removeObject( unsigned int handle )
+{
+    HostObject& object = m_objects[handle];
+    object.vertices.clear();
+    object.triangles.clear();
+    object.triangle_blocks.clear();
+    object.block_triangles.clear();
+    object.compressed_bvh.clear();
+    object.quad_blocks.clear();
+    object.quad_ids.clear();
+    object.spheres.clear();
+    object.shadow_proxy.reset();
+    object.rebuild = std::future< std::shared_ptr<HostBVH> >();
+    object.dirty = true;
+    m_top_dirty  = true;
+}
+
+
+void HostScene::removeQuad( unsigned int handle, unsigned int slot )
+{
+    HostObject& object = m_objects[handle];
+    if( object.type != HOST_OBJECT_QUADS )
+        throw std::runtime_error( "HostScene: removeQuad() on an object without quads" );
+    clearQuadBlockLane( object.quad_blocks[slot / QUAD_BLOCK_SIZE], slot % QUAD_BLOCK_SIZE );
+    object.dirty = true;
+    m_top_dirty  = true;
+}
+
+
+void HostScene::computePrimBounds( HostObject& object )
+{
+    std::vector<Aabb>& bounds = object.prim_bounds;
+    switch( object.type )
+    {
+        case HOST_OBJECT_TRIANGLES:
+            if( object.update_mode == HOST_UPDATE_COMPRESSED )
+            {
+                std::vector<TriangleBlock>().swap( object.triangle_blocks );
+                std::vector<uint32_t>().swap( object.block_triangles );
+                bounds.resize( object.triangles.size() );
+                for( size_t i = 0; i < object.triangles.size(); ++i )
+                {
+                    const int3& tri = object.triangles[i];
+                    bounds[i] = Aabb( object.vertices[tri.x], object.vertices[tri.x] );
+                    bounds[i].include( object.vertices[tri.y] );
+                    bounds[i].include( object.vertices[tri.z] );
+                }
+                break;
+            }
+
+            // The lane order is fixed on the first build, so refits keep the block count
+            if( object.block_triangles.empty() )
+                orderTriangleBlocks( object.vertices, object.triangles, object.block_triangles );
+            gatherTriangleBlocks( object.vertices, object.triangles, object.block_triangles, object.triangle_blocks );
+            bounds.resize( object.triangle_blocks.size() );
+            for( size_t i = 0; i < object.triangle_blocks.size(); ++i )
+                bounds[i] = triangleBlockBounds( object.triangle_blocks[i] );
+            break;
+        case HOST_OBJECT_QUADS:
+            bounds.resize( object.quad_blocks.size() );
+            for( size_t i = 0; i < object.quad_blocks.size(); ++i )
+                bounds[i] = quadBlockBounds( object.quad_blocks[i] );
+            break;
+        default:
+            bounds.resize( object.spheres.size() );
+            for( size_t i = 0; i < object.spheres.size(); ++i )
+            {
+                const float3 center = make_float3( object.spheres[i] );
+                bounds[i] = Aabb( center - object.spheres[i].w, center + object.spheres[i].w );
+            }
+            break;
+    }
+}
+
+
+bool HostScene::swapRebuilt( HostObject& object )
+{
+    if( !object.rebuild.valid() ||
+        object.rebuild.wait_for( std::chrono::seconds( 0 ) ) != std::future_status::ready )
+        return false;
+
+    std::shared_ptr<HostBVH> rebuilt = object.rebuild.get();
+    const std::vector<Aabb>& bounds = object.prim_bounds;
+    if( rebuilt->primCount() != bounds.size() )
+        return false;
+
+    object.bvh = std::move( *rebuilt );
+    object.bvh.refit( bounds.empty() ? 0 : &bounds[0], bounds.size() );
+    object.build_sah = object.sah = object.bvh.sahCost();
+    ++m_background_rebuilds;
+    return true;
+}
+
+
+void HostScene::updateObject( HostObject& object )
+{
+    const std::vector<Aabb>& bounds = object.prim_bounds;
+    const Aabb* bounds_data = bounds.empty() ? 0 : &bounds[0];
+    object.dirty = false;
+
+    // Objects that change after their first build would only fill the
+    // cache with hierarchies that are never loaded again
+    const bool cached = m_cache.enabled() && bounds.size() >= CACHE_MIN_PRIMS
+                     && object.bvh.empty() && object.compressed_bvh.empty();
+
+    if( object.update_mode == HOST_UPDATE_COMPRESSED )
+    {
+        // Only the compressed copy is kept, the bounds are recomputed on
+        // the next change anyway
+        object.rebuild = std::future< std::shared_ptr<HostBVH> >();
+        const uint64_t key = cached ? HostBVHCache::key( bounds_data, bounds.size(), m_build_options, true ) : 0;
+        if( !cached || !m_cache.load( key, bounds.size(), object.compressed_bvh ) )
+        {
+            object.bvh.build( bounds_data, bounds.size(), m_build_options );
+            object.compressed_bvh.compress( object.bvh );
+            object.bvh = HostBVH();
+            if( cached )
+                m_cache.store( key, object.compressed_bvh );
+        }
+        std::vector<Aabb>().swap( object.prim_bounds );
+        return;
+    }
+    object.compressed_bvh.clear();
+
+    // A triangle block already holds a leaf's worth of triangles
+    HostBVHBuildOptions options = m_build_options;
+    if( object.type == HOST_OBJECT_TRIANGLES )
+        options.max_leaf_size = 1;
+
+    const bool refit = object.update_mode == HOST_UPDATE_REFIT
+                    && !object.bvh.empty() && object.bvh.primCount() == bounds.size();
+    if( !refit )
+    {
+        // A build in flight was started for different primitives
+        object.rebuild = std::future< std::shared_ptr<HostBVH> >();
+        const uint64_t key = cached ? HostBVHCache::key( bounds_data, bounds.size(), options, false ) : 0;
+        if( !cached || !m_cache.load( key, bounds.size(), object.bvh ) )
+        {
+            object.bvh.build( bounds_data, bounds.size(), options );
+            if( cached )
+                m_cache.store( key, object.bvh );
+        }
+        if( object.update_mode == HOST_UPDATE_REFIT )
+            object.build_sah = object.sah = object.bvh.sahCost();
+        return;
+    }
+
+    if( swapRebuilt( object ) )
+        return;
+
+    object.bvh.refit( bounds_data, bounds.size() );
+    object.sah = object.bvh.sahCost();
+
+    if( !object.rebuild.valid() && object.sah > object.build_sah * REBUILD_THRESHOLD )
+    {
+        // The build runs on a snapshot, the refit after the swap catches up
+        // with whatever moved in between
+        std::shared_ptr< std::vector<Aabb> > snapshot( new std::vector<Aabb>( bounds ) );
+        object.rebuild = sutil::defaultThreadPool().enqueue( [snapshot, options]()
+        {
+            std::shared_ptr<HostBVH> rebuilt( new HostBVH );
+            rebuilt->build( &( *snapshot )[0], snapshot->size(), options );
+            return rebuilt;
+        } );
+    }
+}
+
+
+void HostScene::commit()
+{
+    const double start_time = sutil::currentTime();
+
+    for( size_t i = 0; i < m_objects.size(); ++i )
+    {
+        HostObject& object = m_objects[i];
+        if( object.dirty )
+        {
+            computePrimBounds( object );
+            updateObject( object );
+        }
+        else
+        {
+            // Objects that stopped moving still pick up their rebuild
+            swapRebuilt( object );
+        }
+
+        HostObject* proxy = object.shadow_proxy.get();
+        if( proxy && proxy->dirty )
+        {
+            computePrimBounds( *proxy );
+            updateObject( *proxy );
+        }
+    }
+
+    if( m_top_dirty )
+    {
+        m_object_bounds.resize( m_objects.size() );
+        for( size_t i = 0; i < m_objects.size(); ++i )
+        {
+            const HostObject& object = m_objects[i];
+
+            // Simplification moves vertices, the proxy can stick out a little
+            Aabb box = objectHierarchyBounds( object );
+            if( object.shadow_proxy && objectHierarchyBounds( *object.shadow_proxy ).valid() )
+                box.include( objectHierarchyBounds( *object.shadow_proxy ) );
+            if( !object.has_transform || !box.valid() )
+            {
+                m_object_bounds[i] = box;
+                continue;
+            }
+
+            Aabb world;
+            for( int corner = 0; corner < 8; ++corner )
+            {
+                const float4 p = make_float4( corner & 1 ? box.m_max.x : box.m_min.x,
+                                              corner & 2 ? box.m_max.y : box.m_min.y,
+                                              corner & 4 ? box.m_max.z : box.m_min.z, 1.0f );
+                world.include( make_float3( object.transform * p ) );
+            }
+            m_object_bounds[i] = world;
+        }
+
+        m_caster_handles.clear();
+        m_caster_bounds.clear();
+        for( size_t i = 0; i < m_objects.size(); ++i )
+        {
+            if( m_objects[i].casts_shadow )
+            {
+                m_caster_handles.push_back( static_cast<uint32_t>( i ) );
+                m_caster_bounds.push_back( m_object_bounds[i] );
+            }
+        }
+
+        // The top level is tiny, a plain build is always cheap enough
+        HostBVHBuildOptions top_options;
+        top_options.max_leaf_size = 1;
+        m_caster_top.build( m_caster_bounds.empty() ? 0 : &m_caster_bounds[0], m_caster_bounds.size(), top_options );
+        m_top_dirty = false;
+    }
+
+    m_commit_time = ( sutil::currentTime() - start_time ) * 1000.0;
+}
+
+
+namespace
+{
+
+void storeOccluder( const std::vector<HostObject>& objects, const SceneTest& test, HostOccluder* occluder )
+{
+    if( !occluder )
+        return;
+    const HostObject& placed = objects[test.object];
+    occluder->object    = test.object;
+    occluder->proxy     = test.use_proxies && placed.shadow_proxy;
+    const HostObject& target = occluder->proxy ? *placed.shadow_proxy : placed;
+    occluder->primitive = !target.triangle_blocks.empty()  ? test.primitive / TRIANGLE_BLOCK_SIZE
+                        : target.type == HOST_OBJECT_QUADS ? test.primitive / QUAD_BLOCK_SIZE
+                        :                                    test.primitive;
+}
+
+} // namespace
+
+
+bool HostScene::occluded( const float3& origin, const float3& dir, float tmin, float tmax, bool use_proxies,
+                          HostOccluder* occluder ) const
+{
+    SceneTest test( m_objects, origin, dir, tmin, true, use_proxies );
+    CasterTest caster_test( test, m_caster_handles );
+    if( !m_caster_top.traverse( origin, dir, tmin, tmax, caster_test, true ) )
+        return false;
+    storeOccluder( m_objects, test, occluder );
+    return true;
+}
+
+
+bool HostScene::occluded( const float3& origin, const float3& dir, float tmin, float tmax,
+                          const uint32_t* handles, size_t count, bool use_proxies, HostOccluder* occluder ) const
+{
+    // Candidate lists are short, a box test per object replaces the top level
+    const float3 inv_dir = make_float3( host_bvh_detail::safeInverse( dir.x ), host_bvh_detail::safeInverse( dir.y ),
+                                        host_bvh_detail::safeInverse( dir.z ) );
+
+    SceneTest test( m_objects, origin, dir, tmin, true, use_proxies );
+    for( size_t i = 0; i < count; ++i )
+    {
+        float t_enter;
+        if( host_bvh_detail::intersectBox( m_object_bounds[handles[i]], origin, inv_dir, tmin, tmax, t_enter ) &&
+            test( handles[i], tmax ) )
+        {
+            storeOccluder( m_objects, test, occluder );
+            return true;
+        }
+    }
+    return false;
+}
+
+
+unsigned int HostScene::occludedPacket( const HostRayPacket& packet, unsigned int active, bool use_proxies ) const
+{
+    PacketSceneTest test( m_objects, packet, use_proxies );
+    PacketCasterTest caster_test( test, m_caster_handles );
+    unsigned int remaining = active;
+    m_caster_top.traversePacket( packet, remaining, caster_test );
+    return active & ~remaining;
+}
+
+
+unsigned int HostScene::occludedPacket( const HostRayPacket& packet, unsigned int active,
+                                        const uint32_t* handles, size_t count, bool use_proxies ) const
+{
+    float inv_x[HOST_PACKET_SIZE], inv_y[HOST_PACKET_SIZE], inv_z[HOST_PACKET_SIZE];
+    for( unsigned int lane = 0; lane < HOST_PACKET_SIZE; ++lane )
+    {
+        inv_x[lane] = host_bvh_detail::safeInverse( packet.dx[lane] );
+        inv_y[lane] = host_bvh_detail::safeInverse( packet.dy[lane] );
+        inv_z[lane] = host_bvh_detail::safeInverse( packet.dz[lane] );
+    }
+
+    PacketSceneTest test( m_objects, packet, use_proxies );
+    unsigned int remaining = active;
+    for( size_t i = 0; i < count && remaining; ++i )
+    {
+        const unsigned int lanes = host_bvh_detail::intersectBoxPacket( m_object_bounds[handles[i]], packet,
+                                                                        inv_x, inv_y, inv_z, remaining );
+        if( lanes )
+            remaining &= ~test( handles[i], lanes );
+    }
+    return active & ~remaining;
+}
+
+
+bool HostScene::occludedBy( const HostOccluder& occluder, const float3& origin, const float3& dir,
+                            float tmin, float tmax ) const
+{
+    // The occluder may have been recorded before the scene changed
+    if( occluder.object >= m_objects.size() )
+        return false;
+    const HostObject& placed = m_objects[occluder.object];
+    if( !placed.casts_shadow || ( occluder.proxy && !placed.shadow_proxy ) )
+        return false;
+
+    const HostObject& target = occluder.proxy ? *placed.shadow_proxy : placed;
+    const size_t count = !target.triangle_blocks.empty()      ? target.triangle_blocks.size()
+                       : target.type == HOST_OBJECT_TRIANGLES ? target.triangles.size()
+                       : target.type == HOST_OBJECT_QUADS     ? target.quad_blocks.size()
+                       :                                        target.spheres.size();
+    if( occluder.primitive >= count )
+        return false;
+
+    float3 ray_origin = origin;
+    float3 ray_dir    = dir;
+    if( placed.has_transform )
+    {
+        ray_origin = make_float3( placed.inverse_transform * make_float4( origin, 1.0f ) );
+        ray_dir    = make_float3( placed.inverse_transform * make_float4( dir, 0.0f ) );
+    }
+    ObjectTest test( target, ray_origin, ray_dir, tmin, true );
+    return test( occluder.primitive, tmax );
+}
+
+
+unsigned int HostScene::numShadowProxies() const
+{
+    unsigned int count = 0;
+    for( size_t i = 0; i < m_objects.size(); ++i )
+        if( m_objects[i].shadow_proxy )
+            ++count;
+    return count;
+}
+
+
+namespace
+{
+
+size_t objectMemoryBytes( const HostObject& object )
+{
+    size_t bytes = object.bvh.memoryBytes() + object.compressed_bvh.memoryBytes()
+                 + object.prim_bounds.capacity() * sizeof( Aabb )
+                 + object.vertices.capacity() * sizeof( float3 ) + object.triangles.capacity() * sizeof( int3 )
+                 + object.triangle_blocks.capacity() * sizeof( TriangleBlock )
+                 + object.block_triangles.capacity() * sizeof( uint32_t )
+                 + object.quad_blocks.capacity() * sizeof( QuadBlock ) + object.quad_ids.capacity() * sizeof( unsigned int )
+                 + object.spheres.capacity() * sizeof( float4 );
+    if( object.shadow_proxy )
+        bytes += objectMemoryBytes( *object.shadow_proxy );
+    return bytes;
+}
+
+} // namespace
+
+
+size_t HostScene::memoryBytes() const
+{
+    size_t bytes = 0;
+    for( size_t i = 0; i < m_objects.size(); ++i )
+        bytes += objectMemoryBytes( m_objects[i] );
+    return bytes;
+}
@@ -0,0 +1,291 @@
+/*
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "HostBVH.h"
+#include "HostBVHCache.h"
+#include "HostCompressedBVH.h"
+#include "QuadSoup.h"
+#include "TriangleBlocks.h"
+
+#include <optixu/optixu_math_namespace.h>
+#include <optixu/optixu_matrix_namespace.h>
+
+#include <future>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+
+//------------------------------------------------------------------------------
+//
+// Copy of the scene geometry for tracing shadow rays on the host.  Every
+// object has its own BVH over world space primitives and a top level BVH is
+// built over the bounds of the shadow casters, so an animated object only
+// rebuilds its own hierarchy.
+// Objects are marked dirty when their primitives change and commit() rebuilds
+// what is needed.
+//
+// An object transform is applied to the ray on the way into the object's
+// hierarchy, so moving an object only rebuilds the top level.
+//
+// Objects that do not cast shadows are left out of the top level that
+// occluded() walks, so shadow queries never visit them while consumers of
+// the geometry like HostRasterizer still see everything.
+// Triangle objects can carry a simplified shadow proxy in their own object
+// space, which occluded() tests instead when asked to.
+//
+// The hierarchy of a triangle object is built over TriangleBlocks of
+// Morton ordered triangles, gathered again from the vertices on each change.
+//
+// Objects in HOST_UPDATE_COMPRESSED mode keep only a HostCompressedBVH after
+// each build, and triangle objects test their indexed triangles directly
+// instead of holding blocks, which takes several times less memory for
+// static geometry at some cost per ray.
+//
+// With a cache directory set, the first build of every object large enough
+// to be worth it is looked up in a HostBVHCache first and stored there when
+// missing, so static geometry loads its hierarchy on the next launch.
+//
+// Objects in HOST_UPDATE_REFIT mode, like spheres replaced every frame by
+// setSpheres(), refit their hierarchy instead while the primitive count
+// stays the same.  Once the SAH cost has grown past a threshold relative to
+// the last build, a full build is started on the thread pool from a snapshot
+// of the bounds and swapped in, refitted to the then current positions, by
+// the first commit() after it finished.
+//
+//------------------------------------------------------------------------------
+
+enum HostObjectType
+{
+    HOST_OBJECT_TRIANGLES = 0,
+    HOST_OBJECT_QUADS,
+    HOST_OBJECT_SPHERES
+};
+
+
+enum HostUpdateMode
+{
+    HOST_UPDATE_REBUILD = 0,        // Full build on every change
+    HOST_UPDATE_REFIT,              // Refit, rebuild in the background when degraded
+    HOST_UPDATE_COMPRESSED          // Full build on every change, kept compressed
+};
+
+
+struct HostObject
+{
+    HostObject()
+        : type( HOST_OBJECT_TRIANGLES ), object_id( 0 ), update_mode( HOST_UPDATE_REBUILD ),
+          has_transform( false ), casts_shadow( true ), dirty( true ), build_sah( 0.0f ), sah( 0.0f ) {}
+
+    HostObjectType              type;
+    unsigned int                object_id;  // Matches the GPU object_id
+
+    std::vector<optix::float3>  vertices;   // HOST_OBJECT_TRIANGLES
+    std::vector<optix::int3>    triangles;
+    std::vector<TriangleBlock>  triangle_blocks; // Primitives of the hierarchy, if any
+    std::vector<uint32_t>       block_triangles; // Triangle per block slot
+    std::vector<QuadBlock>      quad_blocks; // HOST_OBJECT_QUADS, primitives are blocks
+    std::vector<unsigned int>   quad_ids;   // Object ID per quad slot, empty if all share object_id
+    std::vector<optix::float4>  spheres;    // HOST_OBJECT_SPHERES, xyz center w radius
+
+    HostBVH                     bvh;
+    HostCompressedBVH           compressed_bvh; // Replaces bvh when not empty
+    std::vector<optix::Aabb>    prim_bounds;
+    HostUpdateMode              update_mode;
+
+    // Stand in for shadow rays, HOST_OBJECT_TRIANGLES without a transform
+    std::unique_ptr<HostObject> shadow_proxy;
+
+    // Object to world, applied on top of the primitive positions
+    optix::Matrix4x4            transform;
+    optix::Matrix4x4            inverse_transform;
+    bool                        has_transform;
+    bool                        casts_shadow;
+    bool                        dirty;
+
+    // Refit state: SAH cost right after the last build and now, and the
+    // background build in flight, if any
+    float                       build_sah;
+    float                       sah;
+    std::future< std::shared_ptr<HostBVH> > rebuild;
+};
+
+
+// World space position of a point given in the object's space
+inline optix::float3 transformPoint( const HostObject& object, const optix::float3& p )
+{
+    return object.has_transform ? optix::make_float3( object.transform * optix::make_float4( p, 1.0f ) ) : p;
+}
+
+
+// Triangles, quad blocks or spheres of the object
+inline size_t numPrimitives( const HostObject& object )
+{
+    return object.type == HOST_OBJECT_TRIANGLES ? object.triangles.size()
+         : object.type == HOST_OBJECT_QUADS     ? object.quad_blocks.size()
+         :                                        object.spheres.size();
+}
+
+
+// A primitive that blocked a shadow ray, worth testing first for the next
+// ray that starts nearby
+struct HostOccluder
+{
+    HostOccluder() : object( ~0u ), primitive( 0 ), proxy( false ) {}
+
+    unsigned int object;            // Handle, ~0u for none
+    unsigned int primitive;         // Triangle (block), quad block or sphere
+    bool         proxy;             // Primitive of the object's shadow proxy
+};
+
+
+class HostScene
+{
+public:
+    HostScene();
+
+    // Each add returns a handle for later updates.  Data is copied.
+    unsigned int addTriangles( unsigned int object_id, const float* positions, int num_vertices,
+                               const int32_t* indices, int num_triangles );
+    unsigned int addQuad( unsigned int object_id, const optix::float3& anchor,
+                          const optix::float3& v1, const optix::float3& v2 );
+    unsigned int addQuadBlocks( const QuadBlock* blocks, size_t num_blocks, const unsigned int* slot_object_ids );
+    unsigned int addSpheres( unsigned int object_id, const optix::float4* spheres, size_t count );
+
+    // Replace the spheres of a sphere object
+    void setSpheres( unsigned int handle, const optix::float4* spheres, size_t count );
+
+    // Simplified geometry occluded() can test instead of the object's own,
+    // in the same object space
+    void setShadowProxy( unsigned int handle, const float* positions, int num_vertices,
+                         const int32_t* indices, int num_triangles );
+
+    // Also applies to the object's shadow proxy
+    void setUpdateMode( unsigned int handle, HostUpdateMode mode );
+
+    // Place an object with a transform, only the top level is rebuilt
+    void setTransform( unsigned int handle, const optix::Matrix4x4& transform );
+
+    // Objects cast shadows unless set otherwise
+    void setCastsShadow( unsigned int handle, bool casts_shadow );
+
+    // Drop an object's primitives.  The handle stays valid, and reserved.
+    void removeObject( unsigned int handle );
+
+    // Clear one quad slot of a quad object
+    void removeQuad( unsigned int handle, unsigned int slot );
+
+    // Rebuild the hierarchies of changed objects and the top level
+    void commit();
+
+    // Any hit on a shadow caster in [tmin, tmax] along origin + t * dir.
+    // With use_proxies, casters with a shadow proxy are tested through it.
+    // The primitive hit is stored in occluder, if given.
+    bool occluded( const optix::float3& origin, const optix::float3& dir, float tmin, float tmax,
+                   bool use_proxies = false, HostOccluder* occluder = 0 ) const;
+
+    // Any hit among the given objects only, eg the candidates of a
+    // HostTileCuller tile
+    bool occluded( const optix::float3& origin, const optix::float3& dir, float tmin, float tmax,
+                   const uint32_t* handles, size_t count, bool use_proxies = false,
+                   HostOccluder* occluder = 0 ) const;
+
+    // occluded() for the active lanes of a packet, returns the mask of those
+    // that hit a caster
+    unsigned int occludedPacket( const HostRayPacket& packet, unsigned int active, bool use_proxies = false ) const;
+    unsigned int occludedPacket( const HostRayPacket& packet, unsigned int active,
+                                 const uint32_t* handles, size_t count, bool use_proxies = false ) const;
+
+    // Hit on just the occluder's primitive, false for a stale occluder
+    bool occludedBy( const HostOccluder& occluder, const optix::float3& origin, const optix::float3& dir,
+                     float tmin, float tmax ) const;
+
+    size_t             numObjects() const                 { return m_objects.size(); }
+    const HostObject&  object( unsigned int handle ) const { return m_objects[handle]; }
+
+    // World bounds of an object and its shadow proxy as of the last
+    // commit(), invalid if empty
+    const optix::Aabb& objectBounds( unsigned int handle ) const { return m_object_bounds[handle]; }
+
+    // Options for the object hierarchies, the top level always takes defaults
+    void setBuildOptions( const HostBVHBuildOptions& options ) { m_build_options = options; }
+
+    // Directory for cached hierarchies, empty for none
+    void                setCacheDirectory( const std::string& directory ) { m_cache.setDirectory( directory ); }
+    const HostBVHCache& cache() const { return m_cache; }
+
+    // Milliseconds spent in the last commit()
+    double lastCommitTime() const { return m_commit_time; }
+
+    // Background builds swapped in so far
+    unsigned int numBackgroundRebuilds() const { return m_background_rebuilds; }
+
+    // Objects with a shadow proxy
+    unsigned int numShadowProxies() const;
+
+    // Bytes held by the object hierarchies and primitives, shadow proxies
+    // included, as of the last commit()
+    size_t memoryBytes() const;
+
+private:
+    void computePrimBounds( HostObject& object );
+    void updateObject( HostObject& object );
+    bool swapRebuilt( HostObject& object );
+
+    std::vector<HostObject>   m_objects;
+    std::vector<optix::Aabb>  m_object_bounds;
+    HostBVH                   m_caster_top;     // Over m_caster_handles
+    std::vector<uint32_t>     m_caster_handles;
+    std::vector<optix::Aabb>  m_caster_bounds;
+    bool                      m_top_dirty;
+    HostBVHBuildOptions       m_build_options;
+    HostBVHCache              m_cache;
+    double                    m_commit_time;
+    unsigned int              m_background_rebuilds;
+};
+
+
+// Calls body( object, primitive ) for every primitive in the given share
+// of num_shares, each share holding an even part of every object.  Passes
+// over all of the geometry, like rasterizers, run one share per worker so a
+// single large object still spreads over all of them.
+template <typename F>
+void forEachPrimitiveShare( const HostScene& scene, size_t share, size_t num_shares, F body )
+{
+    for( unsigned int handle = 0; handle < scene.numObjects(); ++handle )
+    {
+        const HostObject& object = scene.object( handle );
+        const size_t count = numPrimitives( object );
+        const size_t end   = count * ( share + 1 ) / num_shares;
+        for( size_t prim = count * share / num_shares; prim < end; ++prim )
+            body( object, prim );
+    }
+}
@@ -0,0 +1,445 @@
+/*
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "HostShadowPass.h"
+
+#include <sutil.h>
+#include <ThreadPool.h>
+
+#include <algorithm>
+#include <atomic>
+
+using namespace optix;
+
+
+namespace
+{
+
+// Cheap per pixel hash for the sample jitter
+inline unsigned int hashPixel( unsigned int x, unsigned int y )
+{
+    unsigned int h = x * 0x8da6b343u ^ y * 0xd8163841u;
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    h *= 0x846ca68bu;
+    h ^= h >> 16;
+    return h;
+}
+
+
+inline float nextFloat( unsigned int& state )
+{
+    state = state * 1664525u + 1013904223u;
+    return ( state >> 8 ) * ( 1.0f / 16777216.0f );
+}
+
+
+// Inverse of interleaving the bits of x and y
+inline void decodeMorton( unsigned int code, unsigned int& x, unsigned int& y )
+{
+    x = y = 0;
+    for( unsigned int bit = 0; bit < 16; ++bit )
+    {
+        x |= ( ( code >> ( 2 * bit ) ) & 1u ) << bit;
+        y |= ( ( code >> ( 2 * bit + 1 ) ) & 1u ) << bit;
+    }
+}
+
+
+// Shadow rays of a tile in SoA layout, with a sort key each
+struct RayStream
+{
+    void clear()
+    {
+        ox.clear(); oy.clear(); oz.clear();
+        dx.clear(); dy.clear(); dz.clear();
+        tmin.clear(); pixel.clear(); key.clear();
+    }
+
+    void push( const float3& origin, const float3& dir, float ray_tmin, unsigned int ray_pixel, unsigned int ray_key )
+    {
+        ox.push_back( origin.x ); oy.push_back( origin.y ); oz.push_back( origin.z );
+        dx.push_back( dir.x );    dy.push_back( dir.y );    dz.push_back( dir.z );
+        tmin.push_back( ray_tmin );
+        pixel.push_back( ray_pixel );
+        key.push_back( ray_key );
+    }
+
+    void load( unsigned int ray, HostRayPacket& packet, unsigned int lane, unsigned int& ray_pixel ) const
+    {
+        packet.ox[lane] = ox[ray]; packet.oy[lane] = oy[ray]; packet.oz[lane] = oz[ray];
+        packet.dx[lane] = dx[ray]; packet.dy[lane] = dy[ray]; packet.dz[lane] = dz[ray];
+        packet.tmin[lane] = tmin[ray];
+        packet.tmax[lane] = 1.0f;
+        ray_pixel = pixel[ray];
+    }
+
+    std::vector<float>        ox, oy, oz;
+    std::vector<float>        dx, dy, dz;
+    std::vector<float>        tmin;
+    std::vector<unsigned int> pixel;            // Within the tile
+    std::vector<unsigned int> key;              // Bin
+};
+
+} // namespace
+
+
+HostShadowPass::HostShadowPass()
+    : m_sqrt_samples( 2 ),
+      m_epsilon( 0.1f ),
+      m_time( 0.0 ),
+      m_ray_count( 0 ),
+      m_proxy_ray_count( 0 ),
+      m_cache_hit_count( 0 ),
+      m_occluder_cache( true ),
+      m_verify_occluder_cache( false ),
+      m_cache_mismatch_count( 0 ),
+      m_packet_count( 0 ),
+      m_ray_streams( false ),
+      m_proxy_distance_ratio( 1.2f ),
+      m_tile_culling( true )
+{
+}
+
+
+void HostShadowPass::setCullTileSize( unsigned int tile_size )
+{
+    m_tile_culling = tile_size != 0;
+    if( m_tile_culling )
+        m_culler.setTileSize( tile_size );
+}
+
+
+void HostShadowPass::setReceivesShadow( unsigned int object_id, bool receives )
+{
+    if( object_id >= m_non_receivers.size() )
+    {
+        if( receives )
+            return;
+        m_non_receivers.resize( object_id + 1, 0 );
+    }
+    m_non_receivers[object_id] = receives ? 0 : 1;
+}
+
+
+void HostShadowPass::run( const HostScene& scene, const ParallelogramLight& light,
+                          const float3* hits, const float3* normals, const float* object_ids,
+                          unsigned int width, unsigned int height, float* visibility,
+                          const float* d1, const float* d2_max )
+{
+    const double start_time = sutil::currentTime();
+
+    const bool tile_culling = m_tile_culling;
+    if( tile_culling )
+        m_culler.build( scene, light, hits, normals, width, height );
+
+    const unsigned int sqrt_samples = m_sqrt_samples;
+    const unsigned int num_samples = sqrt_samples * sqrt_samples;
+    const float        inv_sqrt_samples = 1.0f / sqrt_samples;
+    const float        epsilon = m_epsilon;
+    const std::vector<unsigned char>& non_receivers = m_non_receivers;
+    const bool         check_receivers = object_ids && !non_receivers.empty();
+    const float        proxy_ratio = m_proxy_distance_ratio;
+    const bool         check_proxies = d1 && d2_max && proxy_ratio > 0.0f && scene.numShadowProxies() > 0;
+    const bool         occluder_cache = m_occluder_cache;
+    const bool         verify_cache = m_verify_occluder_cache;
+    const unsigned int tile_size = tile_culling ? m_culler.tileSize() : 16u;
+    const size_t       tile_columns = ( width + tile_size - 1 ) / tile_size;
+    std::atomic<size_t> ray_count( 0 );
+    std::atomic<size_t> proxy_ray_count( 0 );
+    std::atomic<size_t> cache_hit_count( 0 );
+    std::atomic<size_t> cache_mismatch_count( 0 );
+    std::atomic<size_t> packet_count( 0 );
+
+    // Per pixel setup shared by both modes.  Returns false for pixels without
+    // a hit.
+    auto setupPixel = [&]( size_t x, size_t y, bool& receives, const std::vector<uint32_t>*& candidates, bool& use_proxies )
+    {
+        const size_t index = y * width + x;
+        const float3 normal = normals[index];
+        if( normal.x == 0.0f && normal.y == 0.0f && normal.z == 0.0f )
+            return false;
+
+        receives = true;
+        if( check_receivers )
+        {
+            const unsigned int id = static_cast<unsigned int>( object_ids[index] );
+            receives = id >= non_receivers.size() || !non_receivers[id];
+        }
+
+        candidates = 0;
+        if( tile_culling )
+        {
+            candidates = &m_culler.candidates( static_cast<unsigned int>( x ), static_cast<unsigned int>( y ) );
+            if( candidates->empty() )
+                receives = false;   // Nothing to trace against
+        }
+
+        // A zero d2_max means no caster was found above the pixel
+        use_proxies = check_proxies && d1[index] > proxy_ratio * d2_max[index];
+        return true;
+    };
+
+    const size_t tile_rows = ( height + tile_size - 1 ) / tile_size;
+    if( !m_ray_streams )
+    {
+        sutil::defaultThreadPool().parallelFor( 0, tile_rows, 1,
+            [&]( size_t tile_row_begin, size_t tile_row_end )
+            {
+                size_t rays = 0;
+                size_t proxy_rays = 0;
+                size_t cache_hits = 0;
+                size_t cache_mismatches = 0;
+
+                // One entry per tile across the row, proxy use and light
+                // stratum: rays to the same stratum from nearby pixels are the
+                // most alike, and only an occluder found by the same traversal
+                // (same candidates, same proxy use) can stand in for it.
+                std::vector<HostOccluder> cache( occluder_cache ? tile_columns * 2 * num_samples : 0 );
+                for( size_t tile_row = tile_row_begin; tile_row < tile_row_end; ++tile_row )
+                {
+                    // Entries carry over between the rows of a tile, never into the next tile
+                    std::fill( cache.begin(), cache.end(), HostOccluder() );
+
+                    const size_t y_end = std::min<size_t>( ( tile_row + 1 ) * tile_size, height );
+                    for( size_t y = tile_row * tile_size; y < y_end; ++y )
+                    {
+                        for( size_t x = 0; x < width; ++x )
+                        {
+                            const size_t index = y * width + x;
+                            bool receives, use_proxies;
+                            const std::vector<uint32_t>* candidates;
+                            if( !setupPixel( x, y, receives, candidates, use_proxies ) )
+                            {
+                                visibility[index] = 0.0f;
+                                continue;
+                            }
+
+                            const float3 hit    = hits[index];
+                            const float3 normal = normals[index];
+                            unsigned int seed = hashPixel( static_cast<unsigned int>( x ), static_cast<unsigned int>( y ) );
+                            unsigned int unoccluded = 0;
+                            unsigned int valid = 0;
+                            for( unsigned int j = 0; j < sqrt_samples; ++j )
+                            {
+                                for( unsigned int i = 0; i < sqrt_samples; ++i )
+                                {
+                                    const float u = ( i + nextFloat( seed ) ) * inv_sqrt_samples;
+                                    const float v = ( j + nextFloat( seed ) ) * inv_sqrt_samples;
+                                    const float3 to_light = light.corner + light.v1 * u + light.v2 * v - hit;
+                                    if( dot( to_light, normal ) <= 0.0f )
+                                        continue;
+
+                                    ++valid;
+                                    if( !receives )
+                                    {
+                                        ++unoccluded;
+                                        continue;
+                                    }
+
+                                    // Unnormalized direction, so the light sits at t = 1
+                                    const float dist = length( to_light );
+                                    const float eps  = epsilon / dist;
+                                    ++rays;
+                                    if( use_proxies )
+                                        ++proxy_rays;
+
+                                    HostOccluder* last = occluder_cache
+                                        ? &cache[( ( x / tile_size * 2 + ( use_proxies ? 1 : 0 ) ) * sqrt_samples + j ) * sqrt_samples + i]
+                                        : 0;
+                                    if( last && last->object != ~0u && scene.occludedBy( *last, hit, to_light, eps, 1.0f ) )
+                                    {
+                                        ++cache_hits;
+                                        if( verify_cache )
+                                        {
+                                            const bool occluded = candidates
+                                                ? scene.occluded( hit, to_light, eps, 1.0f, candidates->data(), candidates->size(), use_proxies, 0 )
+                                                : scene.occluded( hit, to_light, eps, 1.0f, use_proxies, 0 );
+                                            if( !occluded )
+                                                ++cache_mismatches;
+                                        }
+                                        continue;
+                                    }
+
+                                    const bool occluded = candidates
+                                        ? scene.occluded( hit, to_light, eps, 1.0f, candidates->data(), candidates->size(), use_proxies, last )
+                                        : scene.occluded( hit, to_light, eps, 1.0f, use_proxies, last );
+                                    if( !occluded )
+                                        ++unoccluded;
+                                }
+                            }
+                            visibility[index] = valid ? float( unoccluded ) / num_samples : 0.0f;
+                        }
+                    }
+                }
+                ray_count += rays;
+                proxy_ray_count += proxy_rays;
+                cache_hit_count += cache_hits;
+                cache_mismatch_count += cache_mismatches;
+            } );
+    }
+    else
+    {
+        sutil::defaultThreadPool().parallelFor( 0, tile_columns * tile_rows, 1,
+            [&]( size_t tile_begin, size_t tile_end )
+            {
+                size_t rays = 0;
+                size_t proxy_rays = 0;
+                size_t packets = 0;
+
+                // Reused by all tiles of the chunk
+                RayStream stream;
+                std::vector<unsigned int> order;
+                std::vector<unsigned int> bin_offsets( 2 * num_samples + 1 );
+                std::vector<unsigned int> valid( tile_size * tile_size );
+                std::vector<unsigned int> unoccluded( tile_size * tile_size );
+
+                for( size_t tile = tile_begin; tile < tile_end; ++tile )
+                {
+                    const size_t x0 = ( tile % tile_columns ) * tile_size;
+                    const size_t y0 = ( tile / tile_columns ) * tile_size;
+                    const size_t x1 = std::min<size_t>( x0 + tile_size, width );
+                    const size_t y1 = std::min<size_t>( y0 + tile_size, height );
+                    const std::vector<uint32_t>* tile_candidates = 0;
+
+                    // Gather the tile's rays breadth first, visiting the pixels
+                    // along a Z curve so rays from nearby origins stay close
+                    stream.clear();
+                    unsigned int span = 1;
+                    while( span < tile_size )
+                        span *= 2;
+                    for( unsigned int code = 0; code < span * span; ++code )
+                    {
+                        unsigned int tx, ty;
+                        decodeMorton( code, tx, ty );
+                        const size_t x = x0 + tx;
+                        const size_t y = y0 + ty;
+                        if( x >= x1 || y >= y1 )
+                            continue;
+
+                        const size_t       index = y * width + x;
+                        const unsigned int local = static_cast<unsigned int>( ( y - y0 ) * tile_size + ( x - x0 ) );
+                        valid[local] = unoccluded[local] = 0;
+
+                        bool receives, use_proxies;
+                        const std::vector<uint32_t>* candidates;
+                        if( !setupPixel( x, y, receives, candidates, use_proxies ) )
+                            continue;
+                        tile_candidates = candidates;
+
+                        const float3 hit    = hits[index];
+                        const float3 normal = normals[index];
+                        unsigned int seed = hashPixel( static_cast<unsigned int>( x ), static_cast<unsigned int>( y ) );
+                        for( unsigned int j = 0; j < sqrt_samples; ++j )
+                        {
+                            for( unsigned int i = 0; i < sqrt_samples; ++i )
+                            {
+                                const float u = ( i + nextFloat( seed ) ) * inv_sqrt_samples;
+                                const float v = ( j + nextFloat( seed ) ) * inv_sqrt_samples;
+                                const float3 to_light = light.corner + light.v1 * u + light.v2 * v - hit;
+                                if( dot( to_light, normal ) <= 0.0f )
+                                    continue;
+
+                                ++valid[local];
+                                if( !receives )
+                                {
+                                    ++unoccluded[local];
+                                    continue;
+                                }
+
+                                // Binned by proxy use, then light stratum
+                                const unsigned int stratum = j * sqrt_samples + i;
+                                stream.push( hit, to_light, epsilon / length( to_light ), local,
+                                             ( use_proxies ? num_samples : 0u ) + stratum );
+                            }
+                        }
+                    }
+
+                    // Counting sort by bin, stable so each bin stays in Z order
+                    const unsigned int count = static_cast<unsigned int>( stream.key.size() );
+                    std::fill( bin_offsets.begin(), bin_offsets.end(), 0u );
+                    for( unsigned int k = 0; k < count; ++k )
+                        ++bin_offsets[stream.key[k] + 1];
+                    for( size_t bin = 1; bin < bin_offsets.size(); ++bin )
+                        bin_offsets[bin] += bin_offsets[bin - 1];
+                    order.resize( count );
+                    for( unsigned int k = 0; k < count; ++k )
+                        order[bin_offsets[stream.key[k]]++] = k;
+
+                    // Trace in packets of consecutive rays that agree on proxy use
+                    for( unsigned int k = 0; k < count; )
+                    {
+                        const bool use_proxies = stream.key[order[k]] >= num_samples;
+                        HostRayPacket packet;
+                        unsigned int  pixels[HOST_PACKET_SIZE];
+                        unsigned int  lanes = 0;
+                        for( ; lanes < HOST_PACKET_SIZE && k < count &&
+                               ( stream.key[order[k]] >= num_samples ) == use_proxies; ++lanes, ++k )
+                            stream.load( order[k], packet, lanes, pixels[lanes] );
+                        const unsigned int active = ( 1u << lanes ) - 1u;
+
+                        // Idle lanes repeat the first ray so they hold valid numbers
+                        for( unsigned int lane = lanes; lane < HOST_PACKET_SIZE; ++lane )
+                            stream.load( order[k - lanes], packet, lane, pixels[lane] );
+
+                        const unsigned int occluded = tile_candidates
+                            ? scene.occludedPacket( packet, active, tile_candidates->data(), tile_candidates->size(), use_proxies )
+                            : scene.occludedPacket( packet, active, use_proxies );
+                        for( unsigned int lane = 0; lane < lanes; ++lane )
+                            if( !( occluded & ( 1u << lane ) ) )
+                                ++unoccluded[pixels[lane]];
+
+                        ++packets;
+                        rays += lanes;
+                        if( use_proxies )
+                            proxy_rays += lanes;
+                    }
+
+                    for( size_t y = y0; y < y1; ++y )
+                    {
+                        for( size_t x = x0; x < x1; ++x )
+                        {
+                            const unsigned int local = static_cast<unsigned int>( ( y - y0 ) * tile_size + ( x - x0 ) );
+                            visibility[y * width + x] = valid[local] ? float( unoccluded[local] ) / num_samples : 0.0f;
+                        }
+                    }
+                }
+                ray_count += rays;
+                proxy_ray_count += proxy_rays;
+                packet_count += packets;
+            } );
+    }
+
+    m_ray_count = ray_count;
+    m_proxy_ray_count = proxy_ray_count;
+    m_cache_hit_count = cache_hit_count;
+    m_cache_mismatch_count = cache_mismatch_count;
+    m_packet_count = packet_count;
+    m_time = ( sutil::currentTime() - start_time ) * 1000.0;
+}
@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "HostScene.h"
+#include "HostTileCuller.h"
+#include "optixPathTracer.h"
+
+#include <optixu/optixu_math_namespace.h>
+
+#include <stddef.h>
+#include <vector>
+
+
+//------------------------------------------------------------------------------
+//
+// Traces the light visibility of every pixel on the host.  Takes the first
+// hit positions and normals written by the primary ray pass and shoots a
+// stratified set of shadow rays per pixel towards a parallelogram light
+// against a HostScene.  Rows are distributed over sutil::defaultThreadPool().
+//
+// With tile culling on, a HostTileCuller pass first finds the objects that
+// can shadow each screen tile and rays only test those.  Tiles without
+// candidates are lit wherever they face the light, without tracing.
+//
+// Given predicted d1 / d2_max distances per pixel, eg from a
+// LightDepthPyramid, pixels where even the caster nearest to the receiver is
+// far up towards the light get a penumbra wide enough for the filter to blur
+// away occluder detail.  Those pixels test the casters' shadow proxies.
+//
+// Neighbouring rays towards the same light mostly hit the same primitive, so
+// the last occluder per screen tile, light stratum and proxy use is tested
+// before walking the hierarchy.  Workers take whole rows of tiles, and an
+// entry lives exactly as long as its tile, so a cached occluder is always one
+// that the tile's own traversal could have found.  Shadow rays are any hit,
+// which makes a cache hit give the same answer as the full traversal;
+// setVerifyOccluderCache() checks that.
+//
+// In ray stream mode the pass runs breadth first over screen tiles instead:
+// all shadow rays of a tile are gathered into SoA streams, sorted by proxy
+// use, light stratum and origin cell, and traced in packets of
+// HOST_PACKET_SIZE that share every node visit.  The occluder cache is not
+// used in this mode.
+//
+//------------------------------------------------------------------------------
+
+class HostShadowPass
+{
+public:
+    HostShadowPass();
+
+    // sqrt_samples^2 shadow rays per pixel
+    void setSamples( unsigned int sqrt_samples ) { m_sqrt_samples = sqrt_samples ? sqrt_samples : 1u; }
+
+    // Offset along the ray to skip the surface the ray starts on
+    void setEpsilon( float epsilon )              { m_epsilon = epsilon; }
+
+    // Screen tile size for occluder culling, 0 traces against the whole scene
+    void setCullTileSize( unsigned int tile_size );
+
+    // Test the last occluder of the tile first, on by default
+    void setOccluderCache( bool enable )          { m_occluder_cache = enable; }
+
+    // Also run the full traversal for every cache hit and count the rays it
+    // finds unoccluded, off by default.  For testing, it costs the speedup.
+    void setVerifyOccluderCache( bool enable )    { m_verify_occluder_cache = enable; }
+
+    // Trace tiles breadth first in packets, off by default
+    void setRayStreams( bool enable )             { m_ray_streams = enable; }
+
+    // Objects that do not receive shadows see every light sample they face
+    void setReceivesShadow( unsigned int object_id, bool receives );
+
+    // d1 / d2_max above which a pixel's rays use shadow proxies, 0 never
+    // does.  Defaults to 1.2, a penumbra of a fifth of the light's size.
+    void setProxyDistanceRatio( float ratio )     { m_proxy_distance_ratio = ratio; }
+
+    // Writes the unoccluded fraction of light samples to visibility, 0 for
+    // pixels without a hit (zero normal) or facing away from the light.
+    // object_ids holds the object hit per pixel, it is only read when some
+    // object does not receive shadows.  Only casters are tested against.
+    // Shadow proxies are only used with d1 and d2_max given.
+    void run( const HostScene& scene, const ParallelogramLight& light,
+              const optix::float3* hits, const optix::float3* normals, const float* object_ids,
+              unsigned int width, unsigned int height, float* visibility,
+              const float* d1 = 0, const float* d2_max = 0 );
+
+    // Stats of the last run
+    double lastTime()     const { return m_time; }       // Milliseconds
+    size_t lastRayCount() const { return m_ray_count; }
+    size_t lastProxyRayCount() const { return m_proxy_ray_count; }
+    size_t lastCacheHitCount() const { return m_cache_hit_count; }   // Rays stopped by the cached occluder
+    size_t lastCacheMismatchCount() const { return m_cache_mismatch_count; }   // Verification only, should be 0
+    size_t lastPacketCount()   const { return m_packet_count; }      // Ray stream mode only
+    const HostTileCuller& culler() const { return m_culler; }
+
+private:
+    unsigned int m_sqrt_samples;
+    float        m_epsilon;
+    double       m_time;
+    size_t       m_ray_count;
+    size_t       m_proxy_ray_count;
+    size_t       m_cache_hit_count;
+    bool         m_occluder_cache;
+    bool         m_verify_occluder_cache;
+    size_t       m_cache_mismatch_count;
+    size_t       m_packet_count;
+    bool         m_ray_streams;
+    float        m_proxy_distance_ratio;
+
+    std::vector<unsigned char> m_non_receivers;   // By object ID
+
+    bool           m_tile_culling;
+    HostTileCuller m_culler;
+};
@@ -0,0 +1,157 @@
+/*
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "HostTileCuller.h"
+
+#include <sutil.h>
+#include <ThreadPool.h>
+
+#include <algorithm>
+#include <atomic>
+
+using namespace optix;
+
+
+namespace
+{
+
+// Narrow [s0, s1] to where p + s * q <= 0
+inline bool clipInterval( float p, float q, float& s0, float& s1 )
+{
+    if( q == 0.0f )
+        return p <= 0.0f;
+    const float s = -p / q;
+    if( q > 0.0f )
+        s1 = optix::fminf( s1, s );
+    else
+        s0 = optix::fmaxf( s0, s );
+    return s0 <= s1;
+}
+
+} // namespace
+
+
+bool overlapsSweptBox( const Aabb& box, const Aabb& a, const Aabb& b )
+{
+    if( !box.valid() )
+        return false;
+
+    float s0 = 0.0f;
+    float s1 = 1.0f;
+    for( int k = 0; k < 3; ++k )
+    {
+        // lerp( a.min, b.min, s ) <= box.max and lerp( a.max, b.max, s ) >= box.min
+        const float a_min = ( &a.m_min.x )[k], a_max = ( &a.m_max.x )[k];
+        const float b_min = ( &b.m_min.x )[k], b_max = ( &b.m_max.x )[k];
+        if( !clipInterval( a_min - ( &box.m_max.x )[k], b_min - a_min, s0, s1 ) ||
+            !clipInterval( ( &box.m_min.x )[k] - a_max, a_max - b_max, s0, s1 ) )
+            return false;
+    }
+    return true;
+}
+
+
+HostTileCuller::HostTileCuller()
+    : m_tile_size( 16 ),
+      m_tiles_x( 0 ),
+      m_empty_tiles( 0 ),
+      m_average_candidates( 0.0 ),
+      m_time( 0.0 )
+{
+}
+
+
+void HostTileCuller::build( const HostScene& scene, const ParallelogramLight& light,
+                            const float3* hits, const float3* normals,
+                            unsigned int width, unsigned int height )
+{
+    const double start_time = sutil::currentTime();
+
+    const unsigned int tile_size = m_tile_size;
+    const unsigned int tiles_y   = ( height + tile_size - 1 ) / tile_size;
+    m_tiles_x = ( width + tile_size - 1 ) / tile_size;
+    m_tiles.resize( size_t( m_tiles_x ) * tiles_y );
+
+    Aabb light_bounds( light.corner, light.corner + light.v1 );
+    light_bounds.include( light.corner + light.v2 );
+    light_bounds.include( light.corner + light.v1 + light.v2 );
+
+    const unsigned int num_objects = static_cast<unsigned int>( scene.numObjects() );
+    std::atomic<size_t> empty_tiles( 0 );
+    std::atomic<size_t> total_candidates( 0 );
+    std::atomic<size_t> hit_tiles( 0 );
+
+    sutil::defaultThreadPool().parallelFor( 0, m_tiles.size(), 8,
+        [&]( size_t tile_begin, size_t tile_end )
+        {
+            size_t empty = 0, candidates = 0, with_hits = 0;
+            for( size_t tile = tile_begin; tile < tile_end; ++tile )
+            {
+                std::vector<uint32_t>& list = m_tiles[tile];
+                list.clear();
+
+                const unsigned int x0 = static_cast<unsigned int>( tile % m_tiles_x ) * tile_size;
+                const unsigned int y0 = static_cast<unsigned int>( tile / m_tiles_x ) * tile_size;
+                const unsigned int x1 = std::min( x0 + tile_size, width );
+                const unsigned int y1 = std::min( y0 + tile_size, height );
+
+                Aabb tile_bounds;
+                for( unsigned int y = y0; y < y1; ++y )
+                {
+                    for( unsigned int x = x0; x < x1; ++x )
+                    {
+                        const size_t index  = size_t( y ) * width + x;
+                        const float3 normal = normals[index];
+                        if( normal.x != 0.0f || normal.y != 0.0f || normal.z != 0.0f )
+                            tile_bounds.include( hits[index] );
+                    }
+                }
+                if( !tile_bounds.valid() )
+                    continue;
+
+                for( unsigned int object = 0; object < num_objects; ++object )
+                {
+                    if( scene.object( object ).casts_shadow &&
+                        overlapsSweptBox( scene.objectBounds( object ), tile_bounds, light_bounds ) )
+                        list.push_back( object );
+                }
+                ++with_hits;
+                candidates += list.size();
+                if( list.empty() )
+                    ++empty;
+            }
+            empty_tiles += empty;
+            total_candidates += candidates;
+            hit_tiles += with_hits;
+        } );
+
+    m_empty_tiles = empty_tiles;
+    m_average_candidates = hit_tiles ? double( total_candidates ) / hit_tiles : 0.0;
+    m_time = ( sutil::currentTime() - start_time ) * 1000.0;
+}
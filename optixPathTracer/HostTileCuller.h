@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "HostScene.h"
+#include "optixPathTracer.h"
+
+#include <optixu/optixu_aabb_namespace.h>
+#include <optixu/optixu_math_namespace.h>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+
+//------------------------------------------------------------------------------
+//
+// Per tile occluder culling toward a parallelogram light.  A shadow ray from
+// a pixel of a tile stays inside the convex hull of the tile's hit points and
+// the light, so only objects overlapping that hull can shadow the tile.
+//
+// The hull is bounded by the boxes interpolated between the tile's hit
+// bounds and the light bounds; an object is kept when its world bounds
+// overlap one of them.  Each axis limits the interpolation parameter to an
+// interval, so the test is exact for that set of boxes and costs a handful of
+// divisions per object.  Tiles without candidates need no shadow rays at all.
+//
+// Culling is per HostScene object.  Tiles are processed in parallel on
+// sutil::defaultThreadPool().
+//
+//------------------------------------------------------------------------------
+
+class HostTileCuller
+{
+public:
+    HostTileCuller();
+
+    void setTileSize( unsigned int tile_size ) { m_tile_size = tile_size ? tile_size : 1u; }
+    unsigned int tileSize() const              { return m_tile_size; }
+
+    // Build the candidate lists from the primary hits, pixels with a zero
+    // normal have no hit.  The scene must be committed.
+    void build( const HostScene& scene, const ParallelogramLight& light,
+                const optix::float3* hits, const optix::float3* normals,
+                unsigned int width, unsigned int height );
+
+    // Scene object handles that can shadow pixel (x, y)
+    const std::vector<uint32_t>& candidates( unsigned int x, unsigned int y ) const
+    {
+        return m_tiles[( y / m_tile_size ) * m_tiles_x + x / m_tile_size];
+    }
+
+    // Stats of the last build
+    size_t numTiles()          const { return m_tiles.size(); }
+    size_t numEmptyTiles()     const { return m_empty_tiles; }      // Tiles with hits but no candidates
+    double averageCandidates() const { return m_average_candidates; }
+    double lastTime()          const { return m_time; }             // Milliseconds
+
+private:
+    unsigned int                        m_tile_size;
+    unsigned int                        m_tiles_x;
+    std::vector< std::vector<uint32_t> > m_tiles;      // Capacity kept between builds
+
+    size_t                              m_empty_tiles;
+    double                              m_average_candidates;
+    double                              m_time;
+};
+
+
+// Whether box overlaps any of the boxes lerp( a, b, s ) for s in [0, 1]
+bool overlapsSweptBox( const optix::Aabb& box, const optix::Aabb& a, const optix::Aabb& b );
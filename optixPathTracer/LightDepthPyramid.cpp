@@ -0,0 +1,311 @@
+/*
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "LightDepthPyramid.h"
+
+#include <sutil.h>
+#include <ThreadPool.h>
+
+#include <algorithm>
+#include <cfloat>
+
+using namespace optix;
+
+
+namespace
+{
+
+inline float2 emptyTexel()
+{
+    return make_float2( FLT_MAX, -FLT_MAX );
+}
+
+
+inline void mergeTexel( float2& texel, const float2& other )
+{
+    texel.x = std::min( texel.x, other.x );
+    texel.y = std::max( texel.y, other.y );
+}
+
+
+} // namespace
+
+
+LightDepthPyramid::LightDepthPyramid()
+    : m_resolution( 256 ),
+      m_build_time( 0.0 ),
+      m_estimate_time( 0.0 )
+{
+}
+
+
+void LightDepthPyramid::setResolution( unsigned int resolution )
+{
+    m_resolution = 1;
+    while( m_resolution < resolution )
+        m_resolution *= 2;
+}
+
+
+float3 LightDepthPyramid::toLight( const float3& p ) const
+{
+    const float3 d = p - m_origin;
+    return make_float3( dot( d, m_u ), dot( d, m_v ), dot( d, m_n ) );
+}
+
+
+void LightDepthPyramid::build( const HostScene& scene, const ParallelogramLight& light )
+{
+    const double start_time = sutil::currentTime();
+
+    // Light frame, depth grows away from the emitting side
+    m_origin = light.corner;
+    m_n      = -normalize( cross( light.v1, light.v2 ) );
+    m_u      = normalize( light.v1 );
+    m_v      = cross( m_n, m_u );
+
+    const float3 light_corners[4] = { light.corner, light.corner + light.v1, light.corner + light.v2,
+                                      light.corner + light.v1 + light.v2 };
+    m_light_min = make_float2( FLT_MAX, FLT_MAX );
+    m_light_max = make_float2( -FLT_MAX, -FLT_MAX );
+    for( int i = 0; i < 4; ++i )
+    {
+        const float3 q = toLight( light_corners[i] );
+        m_light_min = make_float2( std::min( m_light_min.x, q.x ), std::min( m_light_min.y, q.y ) );
+        m_light_max = make_float2( std::max( m_light_max.x, q.x ), std::max( m_light_max.y, q.y ) );
+    }
+
+    // The grid spans the projected object bounds
+    float2 grid_min = make_float2( FLT_MAX, FLT_MAX );
+    float2 grid_max = make_float2( -FLT_MAX, -FLT_MAX );
+    for( unsigned int i = 0; i < scene.numObjects(); ++i )
+    {
+        const Aabb& box = scene.objectBounds( i );
+        if( !box.valid() || !scene.object( i ).casts_shadow )
+            continue;
+        for( int corner = 0; corner < 8; ++corner )
+        {
+            const float3 q = toLight( make_float3( corner & 1 ? box.m_max.x : box.m_min.x,
+                                                   corner & 2 ? box.m_max.y : box.m_min.y,
+                                                   corner & 4 ? box.m_max.z : box.m_min.z ) );
+            grid_min = make_float2( std::min( grid_min.x, q.x ), std::min( grid_min.y, q.y ) );
+            grid_max = make_float2( std::max( grid_max.x, q.x ), std::max( grid_max.y, q.y ) );
+        }
+    }
+
+    const unsigned int res = m_resolution;
+    if( grid_min.x > grid_max.x )
+    {
+        // No casters
+        grid_min = grid_max = make_float2( 0.0f, 0.0f );
+    }
+    m_grid_min  = grid_min;
+    m_inv_texel = make_float2( res / std::max( grid_max.x - grid_min.x, 1e-6f ),
+                               res / std::max( grid_max.y - grid_min.y, 1e-6f ) );
+
+    // Splat on a private grid per chunk, every chunk takes its share of
+    // every object's primitives
+    const size_t num_chunks = std::max( 1u, sutil::defaultThreadPool().numThreads() );
+    m_chunk_grids.resize( num_chunks );
+    sutil::defaultThreadPool().parallelFor( 0, num_chunks, 1,
+        [&]( size_t chunk_begin, size_t chunk_end )
+        {
+            for( size_t chunk = chunk_begin; chunk < chunk_end; ++chunk )
+            {
+                std::vector<float2>& grid = m_chunk_grids[chunk];
+                grid.assign( size_t( res ) * res, emptyTexel() );
+
+                float3 points[8];
+                auto splat = [&]( int count )
+                {
+                    float3 lo = make_float3( FLT_MAX ), hi = make_float3( -FLT_MAX );
+                    for( int i = 0; i < count; ++i )
+                    {
+                        const float3 q = toLight( points[i] );
+                        lo = make_float3( std::min( lo.x, q.x ), std::min( lo.y, q.y ), std::min( lo.z, q.z ) );
+                        hi = make_float3( std::max( hi.x, q.x ), std::max( hi.y, q.y ), std::max( hi.z, q.z ) );
+                    }
+                    if( hi.z <= 0.0f )
+                        return;         // Behind the light
+                    const int x0 = std::max( 0, int( floorf( ( lo.x - m_grid_min.x ) * m_inv_texel.x ) ) );
+                    const int y0 = std::max( 0, int( floorf( ( lo.y - m_grid_min.y ) * m_inv_texel.y ) ) );
+                    const int x1 = std::min( int( res ) - 1, int( floorf( ( hi.x - m_grid_min.x ) * m_inv_texel.x ) ) );
+                    const int y1 = std::min( int( res ) - 1, int( floorf( ( hi.y - m_grid_min.y ) * m_inv_texel.y ) ) );
+                    const float2 depth = make_float2( std::max( lo.z, 0.0f ), hi.z );
+                    for( int y = y0; y <= y1; ++y )
+                        for( int x = x0; x <= x1; ++x )
+                            mergeTexel( grid[size_t( y ) * res + x], depth );
+                };
+
+                forEachPrimitiveShare( scene, chunk, num_chunks, [&]( const HostObject& object, size_t prim )
+                {
+                    if( !object.casts_shadow )
+                        return;
+                    if( object.type == HOST_OBJECT_TRIANGLES )
+                    {
+                        const int3& tri = object.triangles[prim];
+                        points[0] = transformPoint( object, object.vertices[tri.x] );
+                        points[1] = transformPoint( object, object.vertices[tri.y] );
+                        points[2] = transformPoint( object, object.vertices[tri.z] );
+                        splat( 3 );
+                    }
+                    else if( object.type == HOST_OBJECT_QUADS )
+                    {
+                        for( int lane = 0; lane < QUAD_BLOCK_SIZE; ++lane )
+                        {
+                            float3 anchor, v1, v2;
+                            if( !getQuadBlockLane( object.quad_blocks[prim], lane, anchor, v1, v2 ) )
+                                continue;
+                            points[0] = transformPoint( object, anchor );
+                            points[1] = transformPoint( object, anchor + v1 );
+                            points[2] = transformPoint( object, anchor + v2 );
+                            points[3] = transformPoint( object, anchor + v1 + v2 );
+                            splat( 4 );
+                        }
+                    }
+                    else
+                    {
+                        const float4& sphere = object.spheres[prim];
+                        for( int corner = 0; corner < 8; ++corner )
+                            points[corner] = transformPoint( object, make_float3(
+                                sphere.x + ( corner & 1 ? sphere.w : -sphere.w ),
+                                sphere.y + ( corner & 2 ? sphere.w : -sphere.w ),
+                                sphere.z + ( corner & 4 ? sphere.w : -sphere.w ) ) );
+                        splat( 8 );
+                    }
+                } );
+            }
+        } );
+
+    // Merge the chunks into level 0, then reduce
+    unsigned int levels = 1;
+    for( unsigned int size = res; size > 1; size /= 2 )
+        ++levels;
+    m_levels.resize( levels );
+    m_levels[0].resize( size_t( res ) * res );
+    sutil::defaultThreadPool().parallelFor( 0, res, 16,
+        [&]( size_t row_begin, size_t row_end )
+        {
+            for( size_t i = row_begin * res; i < row_end * res; ++i )
+            {
+                float2 texel = m_chunk_grids[0][i];
+                for( size_t chunk = 1; chunk < num_chunks; ++chunk )
+                    mergeTexel( texel, m_chunk_grids[chunk][i] );
+                m_levels[0][i] = texel;
+            }
+        } );
+
+    for( unsigned int level = 1; level < levels; ++level )
+    {
+        const unsigned int size = res >> level;
+        const std::vector<float2>& fine = m_levels[level - 1];
+        std::vector<float2>& coarse = m_levels[level];
+        coarse.resize( size_t( size ) * size );
+        sutil::defaultThreadPool().parallelFor( 0, size, 16,
+            [&]( size_t row_begin, size_t row_end )
+            {
+                for( size_t y = row_begin; y < row_end; ++y )
+                {
+                    for( size_t x = 0; x < size; ++x )
+                    {
+                        const size_t f = 2 * y * ( 2 * size ) + 2 * x;
+                        float2 texel = fine[f];
+                        mergeTexel( texel, fine[f + 1] );
+                        mergeTexel( texel, fine[f + 2 * size] );
+                        mergeTexel( texel, fine[f + 2 * size + 1] );
+                        coarse[y * size + x] = texel;
+                    }
+                }
+            } );
+    }
+
+    m_build_time = ( sutil::currentTime() - start_time ) * 1000.0;
+}
+
+
+bool LightDepthPyramid::query( const float3& receiver, float epsilon, float& d1, float& d2_min, float& d2_max ) const
+{
+    const float3 q = toLight( receiver );
+    d1 = q.z;
+    d2_min = d2_max = 0.0f;
+    if( m_levels.empty() || q.z <= 0.0f )
+        return false;
+
+    // Footprint of everything between the receiver and the light
+    const float s0 = std::min( m_light_min.x, q.x ), s1 = std::max( m_light_max.x, q.x );
+    const float t0 = std::min( m_light_min.y, q.y ), t1 = std::max( m_light_max.y, q.y );
+    const int res = static_cast<int>( m_resolution );
+    const int x0 = std::max( 0, int( floorf( ( s0 - m_grid_min.x ) * m_inv_texel.x ) ) );
+    const int y0 = std::max( 0, int( floorf( ( t0 - m_grid_min.y ) * m_inv_texel.y ) ) );
+    const int x1 = std::min( res - 1, int( floorf( ( s1 - m_grid_min.x ) * m_inv_texel.x ) ) );
+    const int y1 = std::min( res - 1, int( floorf( ( t1 - m_grid_min.y ) * m_inv_texel.y ) ) );
+    if( x0 > x1 || y0 > y1 )
+        return false;
+
+    // Coarsest needed level has the footprint on at most 2x2 texels
+    unsigned int level = 0;
+    while( ( x1 >> level ) - ( x0 >> level ) > 1 || ( y1 >> level ) - ( y0 >> level ) > 1 )
+        ++level;
+    const int size = res >> level;
+    const std::vector<float2>& texels = m_levels[level];
+    float2 depth = emptyTexel();
+    for( int y = y0 >> level; y <= ( y1 >> level ); ++y )
+        for( int x = x0 >> level; x <= ( x1 >> level ); ++x )
+            mergeTexel( depth, texels[size_t( y ) * size + x] );
+
+    if( depth.x >= q.z - epsilon )
+        return false;
+    d2_min = depth.x;
+    d2_max = std::min( depth.y, q.z - epsilon );
+    return true;
+}
+
+
+void LightDepthPyramid::estimate( const float3* hits, const float3* normals, unsigned int width, unsigned int height,
+                                  float epsilon, float* d1, float* d2_min, float* d2_max )
+{
+    const double start_time = sutil::currentTime();
+
+    sutil::defaultThreadPool().parallelFor( 0, height, 8,
+        [&]( size_t row_begin, size_t row_end )
+        {
+            for( size_t i = row_begin * width; i < row_end * width; ++i )
+            {
+                const float3 normal = normals[i];
+                if( normal.x == 0.0f && normal.y == 0.0f && normal.z == 0.0f )
+                {
+                    d1[i] = d2_min[i] = d2_max[i] = 0.0f;
+                    continue;
+                }
+                query( hits[i], epsilon, d1[i], d2_min[i], d2_max[i] );
+            }
+        } );
+
+    m_estimate_time = ( sutil::currentTime() - start_time ) * 1000.0;
+}
@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#pragma once
+
+#include "HostScene.h"
+#include "optixPathTracer.h"
+
+#include <optixu/optixu_math_namespace.h>
+
+#include <stddef.h>
+#include <vector>
+
+
+//------------------------------------------------------------------------------
+//
+// Ray free estimate of the d1 / d2_min / d2_max distances of the first pass.
+//
+// The shadow casters of a HostScene are splatted into a light space grid:
+// the light plane is the image plane and depth is the distance below it.
+// Every primitive covers the texels of its projected bounding rectangle with
+// its depth range, so each texel holds conservative min/max caster depths.
+// Coarser levels are 2x2 reductions of the finer ones.
+//
+// Any caster that can shadow a receiver lies between it and the light, so its
+// projection falls into the rectangle around the light and the receiver's own
+// projection.  query() reads at most 2x2 texels on the level where that
+// rectangle is that small, which bounds the caster depths from the outside.
+// Distances are measured along the light normal, like the filter analysis.
+//
+//------------------------------------------------------------------------------
+
+class LightDepthPyramid
+{
+public:
+    LightDepthPyramid();
+
+    // Texels per side on the finest level, rounded up to a power of two
+    void setResolution( unsigned int resolution );
+
+    // Splat the casters of a committed scene and build the coarser levels
+    void build( const HostScene& scene, const ParallelogramLight& light );
+
+    // d1 is the receiver depth.  Returns false, and zero d2s, if no caster
+    // lies between the receiver and the light.  Casters within epsilon of
+    // the receiver are ignored.
+    bool query( const optix::float3& receiver, float epsilon, float& d1, float& d2_min, float& d2_max ) const;
+
+    // query() for every pixel with a hit (non zero normal), zeros elsewhere.
+    // Rows are distributed over sutil::defaultThreadPool().
+    void estimate( const optix::float3* hits, const optix::float3* normals, unsigned int width, unsigned int height,
+                   float epsilon, float* d1, float* d2_min, float* d2_max );
+
+    unsigned int numLevels() const { return static_cast<unsigned int>( m_levels.size() ); }
+
+    // Milliseconds spent in the last build and estimate
+    double lastBuildTime()    const { return m_build_time; }
+    double lastEstimateTime() const { return m_estimate_time; }
+
+private:
+    optix::float3 toLight( const optix::float3& p ) const;   // s, t, depth
+
+    unsigned int   m_resolution;
+
+    // Light frame
+    optix::float3  m_origin;
+    optix::float3  m_u;
+    optix::float3  m_v;
+    optix::float3  m_n;                 // Points away from the light
+    optix::float2  m_light_min;         // Light rectangle in s, t
+    optix::float2  m_light_max;
+
+    // Grid placement over the casters, level 0
+    optix::float2  m_grid_min;
+    optix::float2  m_inv_texel;
+
+    std::vector< std::vector<optix::float2> > m_levels;       // min, max depth per texel
+    std::vector< std::vector<optix::float2> > m_chunk_grids;  // Splat scratch per chunk
+
+    double         m_build_time;
+    double         m_estimate_time;
+};
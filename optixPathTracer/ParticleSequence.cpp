@@ -0,0 +1,473 @@
+/*
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ParticleSequence.h"
+
+#include <ThreadPool.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <stdexcept>
+
+#if defined( __SSE__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 1 )
+#  include <xmmintrin.h>
+#  define PARTICLE_USE_SSE
+#endif
+
+
+//------------------------------------------------------------------------------
+//
+// ParticleFrame
+//
+//------------------------------------------------------------------------------
+
+void ParticleFrame::resize( size_t n )
+{
+    if( n <= px.size() )
+        return;
+
+    // Leave headroom since sequences usually grow as particles are emitted
+    const size_t capacity = n + n / 4;
+    std::vector<float>* arrays[] = { &px, &py, &pz, &vx, &vy, &vz, &cr, &cg, &cb, &radius };
+    for( size_t i = 0; i < sizeof( arrays ) / sizeof( arrays[0] ); ++i )
+    {
+        arrays[i]->reserve( capacity );
+        arrays[i]->resize( n );
+    }
+}
+
+
+//------------------------------------------------------------------------------
+//
+// Parsing
+//
+//------------------------------------------------------------------------------
+
+namespace
+{
+
+const int FLOATS_PER_PARTICLE = 10;
+
+
+inline const char* skipBlanks( const char* p, const char* end )
+{
+    while( p < end && ( *p == ' ' || *p == '\t' || *p == '\r' ) )
+        ++p;
+    return p;
+}
+
+
+inline const char* skipLine( const char* p, const char* end )
+{
+    while( p < end && *p != '\n' )
+        ++p;
+    return p < end ? p + 1 : p;
+}
+
+
+// The frame number conversion of a file pattern: one %d or %i with an
+// optional '0' or '-' flag and width.  '%%' is a literal percent sign.
+struct FramePattern
+{
+    size_t begin;       // Of the conversion in the pattern
+    size_t end;
+    char   flag;        // '0', '-' or 0
+    int    width;
+};
+
+
+// Throws std::runtime_error unless the pattern has exactly one frame number
+// conversion and no other directives.  The pattern comes from the scene
+// file, so it is never handed to printf.
+FramePattern parseFramePattern( const std::string& pattern )
+{
+    FramePattern result = { std::string::npos, 0, 0, 0 };
+    for( size_t i = 0; i < pattern.size(); ++i )
+    {
+        if( pattern[i] != '%' )
+            continue;
+        if( i + 1 < pattern.size() && pattern[i + 1] == '%' )
+        {
+            ++i;
+            continue;
+        }
+
+        size_t j    = i + 1;
+        char   flag = 0;
+        if( j < pattern.size() && ( pattern[j] == '0' || pattern[j] == '-' ) )
+            flag = pattern[j++];
+        int width = 0;
+        while( j < pattern.size() && pattern[j] >= '0' && pattern[j] <= '9' && width < 100 )
+            width = width * 10 + ( pattern[j++] - '0' );
+
+        if( j == pattern.size() || ( pattern[j] != 'd' && pattern[j] != 'i' ) || width >= 100 )
+            throw std::runtime_error( "ParticleSequence: '" + pattern + "' has an unsupported % directive, "
+                                      "only one %d (eg %04d) for the frame number is allowed" );
+        if( result.begin != std::string::npos )
+            throw std::runtime_error( "ParticleSequence: '" + pattern + "' has more than one frame number" );
+
+        result.begin = i;
+        result.end   = j + 1;
+        result.flag  = flag;
+        result.width = width;
+        i = j;
+    }
+
+    if( result.begin == std::string::npos )
+        throw std::runtime_error( "ParticleSequence: '" + pattern + "' has no %d for the frame number" );
+    return result;
+}
+
+
+std::string formatFrameFilename( const std::string& pattern, const FramePattern& conversion, int frame )
+{
+    // Only a fixed format reaches snprintf
+    char number[128];
+    if( conversion.flag == '0' )
+        snprintf( number, sizeof( number ), "%0*d", conversion.width, frame );
+    else if( conversion.flag == '-' )
+        snprintf( number, sizeof( number ), "%-*d", conversion.width, frame );
+    else
+        snprintf( number, sizeof( number ), "%*d", conversion.width, frame );
+
+    std::string filename;
+    for( size_t i = 0; i < pattern.size(); ++i )
+    {
+        if( i == conversion.begin )
+        {
+            filename += number;
+            i = conversion.end - 1;
+        }
+        else
+        {
+            filename += pattern[i];
+            if( pattern[i] == '%' )
+                ++i;    // '%%'
+        }
+    }
+    return filename;
+}
+
+} // namespace
+
+
+void ParticleSequence::loadFrame( const std::string& filename, ParticleFrame& frame, std::vector<char>& scratch )
+{
+    // Read the whole file with one call; per-line stream extraction is what
+    // made the text format slow to load.
+    FILE* file = fopen( filename.c_str(), "rb" );
+    if( !file )
+        throw std::runtime_error( "ParticleSequence: unable to open '" + filename + "'" );
+
+    fseek( file, 0, SEEK_END );
+    const long size = ftell( file );
+    fseek( file, 0, SEEK_SET );
+    if( size < 0 )
+    {
+        fclose( file );
+        throw std::runtime_error( "ParticleSequence: unable to read '" + filename + "'" );
+    }
+
+    // strtof needs a terminator past the last number
+    scratch.resize( static_cast<size_t>( size ) + 1 );
+    const size_t read = fread( &scratch[0], 1, static_cast<size_t>( size ), file );
+    fclose( file );
+    scratch[read] = '\0';
+
+    const char* p   = &scratch[0];
+    const char* end = p + read;
+
+    // Rough upper bound on the particle count so the arrays grow at most once
+    size_t lines = 0;
+    for( const char* q = p; q < end; ++q )
+        lines += ( *q == '\n' );
+    frame.resize( lines + 1 );
+
+    float* arrays[FLOATS_PER_PARTICLE] =
+    {
+        &frame.px[0], &frame.py[0], &frame.pz[0],
+        &frame.vx[0], &frame.vy[0], &frame.vz[0],
+        &frame.cr[0], &frame.cg[0], &frame.cb[0],
+        &frame.radius[0]
+    };
+
+    size_t count = 0;
+    int line_number = 0;
+    while( p < end )
+    {
+        ++line_number;
+        p = skipBlanks( p, end );
+        if( p == end || *p == '\n' || *p == '#' )
+        {
+            p = skipLine( p, end );
+            continue;
+        }
+
+        for( int i = 0; i < FLOATS_PER_PARTICLE; ++i )
+        {
+            char* next;
+            arrays[i][count] = strtof( p, &next );
+            if( next == p )
+            {
+                std::ostringstream oss;
+                oss << "ParticleSequence: " << filename << "(" << line_number << "): expected "
+                    << FLOATS_PER_PARTICLE << " numbers";
+                throw std::runtime_error( oss.str() );
+            }
+            p = next;
+        }
+        ++count;
+        p = skipLine( p, end );
+    }
+
+    frame.count = count;
+}
+
+
+void ParticleSequence::loadAllFrames( const std::string& pattern, int first_frame, int last_frame, std::vector<ParticleFrame>& frames )
+{
+    if( last_frame < first_frame )
+        throw std::runtime_error( "ParticleSequence: empty frame range for '" + pattern + "'" );
+
+    const FramePattern conversion = parseFramePattern( pattern );
+    frames.assign( last_frame - first_frame + 1, ParticleFrame() );
+    sutil::defaultThreadPool().parallelFor( 0, frames.size(), 1,
+        [&]( size_t begin, size_t end )
+        {
+            std::vector<char> scratch;
+            for( size_t i = begin; i < end; ++i )
+            {
+                const int frame = first_frame + static_cast<int>( i );
+                loadFrame( formatFrameFilename( pattern, conversion, frame ), frames[i], scratch );
+                frames[i].frame = frame;
+            }
+        } );
+}
+
+
+//------------------------------------------------------------------------------
+//
+// Interpolation
+//
+//------------------------------------------------------------------------------
+
+void interpolateParticles( const ParticleFrame& a, const ParticleFrame& b, float t, float velocity_scale, ParticleFrame& out )
+{
+    out.resize( a.count );
+    out.count = a.count;
+    out.frame = a.frame;
+    if( a.count == 0 )
+        return;
+
+    // p = (1-t) * (p0 + v0*t0) + t * (p1 - v1*t1)
+    //   = (1-t)*p0 + t*p1 + (1-t)*t0*v0 - t*t1*v1
+    const float w0 = 1.0f - t;
+    const float w1 = t;
+    const float s0 = w0 * t * velocity_scale;
+    const float s1 = -w1 * ( 1.0f - t ) * velocity_scale;
+
+    const size_t blended = std::min( a.count, b.count );
+    const float* const pa[3] = { &a.px[0], &a.py[0], &a.pz[0] };
+    const float* const va[3] = { &a.vx[0], &a.vy[0], &a.vz[0] };
+    const float* const pb[3] = { b.count ? &b.px[0] : 0, b.count ? &b.py[0] : 0, b.count ? &b.pz[0] : 0 };
+    const float* const vb[3] = { b.count ? &b.vx[0] : 0, b.count ? &b.vy[0] : 0, b.count ? &b.vz[0] : 0 };
+    float* const       po[3] = { &out.px[0], &out.py[0], &out.pz[0] };
+
+    for( int axis = 0; axis < 3; ++axis )
+    {
+        size_t i = 0;
+#ifdef PARTICLE_USE_SSE
+        const __m128 w0_4 = _mm_set1_ps( w0 );
+        const __m128 w1_4 = _mm_set1_ps( w1 );
+        const __m128 s0_4 = _mm_set1_ps( s0 );
+        const __m128 s1_4 = _mm_set1_ps( s1 );
+        for( ; i + 4 <= blended; i += 4 )
+        {
+            __m128 p = _mm_mul_ps( w0_4, _mm_loadu_ps( pa[axis] + i ) );
+            p = _mm_add_ps( p, _mm_mul_ps( w1_4, _mm_loadu_ps( pb[axis] + i ) ) );
+            p = _mm_add_ps( p, _mm_mul_ps( s0_4, _mm_loadu_ps( va[axis] + i ) ) );
+            p = _mm_add_ps( p, _mm_mul_ps( s1_4, _mm_loadu_ps( vb[axis] + i ) ) );
+            _mm_storeu_ps( po[axis] + i, p );
+        }
+#endif
+        for( ; i < blended; ++i )
+            po[axis][i] = w0 * pa[axis][i] + w1 * pb[axis][i] + s0 * va[axis][i] + s1 * vb[axis][i];
+
+        // Particles that are gone by the next snapshot keep moving along v0
+        const float e = t * velocity_scale;
+        for( ; i < a.count; ++i )
+            po[axis][i] = pa[axis][i] + e * va[axis][i];
+    }
+
+    std::copy( a.radius.begin(), a.radius.begin() + a.count, out.radius.begin() );
+}
+
+
+//------------------------------------------------------------------------------
+//
+// ParticleSequence
+//
+//------------------------------------------------------------------------------
+
+ParticleSequence::ParticleSequence()
+    : m_first_frame( 0 ),
+      m_last_frame( -1 ),
+      m_current_slot( -1 ),
+      m_stop( false )
+{
+}
+
+
+ParticleSequence::~ParticleSequence()
+{
+    close();
+}
+
+
+std::string ParticleSequence::frameFilename( int frame ) const
+{
+    return formatFrameFilename( m_pattern, parseFramePattern( m_pattern ), frame );
+}
+
+
+void ParticleSequence::open( const std::string& pattern, int first_frame, int last_frame, unsigned int ring_size )
+{
+    close();
+
+    if( last_frame < first_frame )
+        throw std::runtime_error( "ParticleSequence: empty frame range for '" + pattern + "'" );
+
+    parseFramePattern( pattern );
+    m_pattern     = pattern;
+    m_first_frame = first_frame;
+    m_last_frame  = last_frame;
+
+    // Fail early on a bad pattern instead of from the loader thread
+    FILE* file = fopen( frameFilename( first_frame ).c_str(), "rb" );
+    if( !file )
+        throw std::runtime_error( "ParticleSequence: unable to open '" + frameFilename( first_frame ) + "'" );
+    fclose( file );
+
+    m_ring.assign( std::max( 2u, ring_size ), ParticleFrame() );
+    m_free_slots.clear();
+    m_ready_slots.clear();
+    for( size_t i = 0; i < m_ring.size(); ++i )
+        m_free_slots.push_back( static_cast<int>( i ) );
+    m_current_slot = -1;
+    m_stop = false;
+    m_error.clear();
+
+    m_loader = std::thread( &ParticleSequence::loaderLoop, this );
+}
+
+
+void ParticleSequence::close()
+{
+    if( !m_loader.joinable() )
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        m_stop = true;
+    }
+    m_slot_freed.notify_all();
+    m_loader.join();
+}
+
+
+const ParticleFrame& ParticleSequence::nextFrame()
+{
+    std::unique_lock<std::mutex> lock( m_mutex );
+
+    if( m_current_slot < 0 )
+    {
+        while( m_ready_slots.empty() && m_error.empty() )
+            m_frame_ready.wait( lock );
+    }
+
+    if( !m_error.empty() )
+        throw std::runtime_error( m_error );
+
+    if( !m_ready_slots.empty() )
+    {
+        if( m_current_slot >= 0 )
+            m_free_slots.push_back( m_current_slot );
+        m_current_slot = m_ready_slots.front();
+        m_ready_slots.pop_front();
+
+        lock.unlock();
+        m_slot_freed.notify_one();
+    }
+
+    return m_ring[m_current_slot];
+}
+
+
+void ParticleSequence::loaderLoop()
+{
+    std::vector<char> scratch;
+    int frame = m_first_frame;
+
+    for( ;; )
+    {
+        int slot;
+        {
+            std::unique_lock<std::mutex> lock( m_mutex );
+            while( !m_stop && m_free_slots.empty() )
+                m_slot_freed.wait( lock );
+            if( m_stop )
+                return;
+            slot = m_free_slots.front();
+            m_free_slots.pop_front();
+        }
+
+        // Slot is exclusively owned by this thread until it is queued as ready
+        try
+        {
+            loadFrame( frameFilename( frame ), m_ring[slot], scratch );
+            m_ring[slot].frame = frame;
+        }
+        catch( const std::exception& e )
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_error = e.what();
+            m_frame_ready.notify_all();
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_ready_slots.push_back( slot );
+        }
+        m_frame_ready.notify_one();
+
+        frame = frame < m_last_frame ? frame + 1 : m_first_frame;
+    }
+}
@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+//------------------------------------------------------------------------------
+//
+// One snapshot of a particle sequence, stored as structure of arrays.  Each
+// line of a particle file holds position, velocity, color and radius.
+//
+//------------------------------------------------------------------------------
+struct ParticleFrame
+{
+    ParticleFrame() : frame( -1 ), count( 0 ) {}
+
+    // Grows the arrays to at least n particles.  Never shrinks, so a frame
+    // slot that is reused for the whole sequence stops allocating once it has
+    // held the largest snapshot.
+    void resize( size_t n );
+
+    int                 frame;          // Frame number within the sequence
+    size_t              count;          // Number of valid particles
+
+    std::vector<float>  px, py, pz;     // Positions
+    std::vector<float>  vx, vy, vz;     // Velocities
+    std::vector<float>  cr, cg, cb;     // Colors
+    std::vector<float>  radius;
+};
+
+
+//------------------------------------------------------------------------------
+//
+// Streams particles.NNNN.txt style files from disk.  A background thread
+// parses frames into a fixed ring of ParticleFrame slots while the render
+// thread consumes them, so the render loop never waits on text parsing.  The
+// sequence loops back to the first frame after the last one.
+//
+//------------------------------------------------------------------------------
+class ParticleSequence
+{
+public:
+    ParticleSequence();
+    ~ParticleSequence();
+
+    // Start streaming.  pattern holds one %d for the frame number, with an
+    // optional '0' or '-' flag and width, eg "data/particles/particles.%04d.txt",
+    // and '%%' for a literal percent sign.  Any other % directive throws
+    // std::runtime_error.  ring_size is the number of frame slots, at least
+    // two: one being displayed, the rest in flight.
+    void open( const std::string& pattern, int first_frame, int last_frame, unsigned int ring_size = 3 );
+    void close();
+
+    // Advance to the next parsed frame if the loader has one ready and
+    // return it; otherwise keep returning the current frame.  Only waits for
+    // the very first frame after open().  The returned frame stays valid
+    // until the next call.
+    const ParticleFrame& nextFrame();
+
+    int firstFrame() const { return m_first_frame; }
+    int lastFrame()  const { return m_last_frame; }
+
+    // Parse a single particle file into frame, growing it as needed.
+    // Throws std::runtime_error if the file cannot be read or is malformed.
+    static void loadFrame( const std::string& filename, ParticleFrame& frame, std::vector<char>& scratch );
+
+    // Parse every frame of a sequence up front, in parallel on
+    // sutil::defaultThreadPool().  Used for interpolated playback, which
+    // needs random access to neighbouring snapshots.
+    static void loadAllFrames( const std::string& pattern, int first_frame, int last_frame, std::vector<ParticleFrame>& frames );
+
+private:
+    std::string frameFilename( int frame ) const;
+    void        loaderLoop();
+
+    std::string                 m_pattern;
+    int                         m_first_frame;
+    int                         m_last_frame;
+
+    std::vector<ParticleFrame>  m_ring;
+    std::deque<int>             m_free_slots;   // Slots the loader may fill
+    std::deque<int>             m_ready_slots;  // Parsed, in frame order
+    int                         m_current_slot; // Owned by the render thread
+
+    std::thread                 m_loader;
+    std::mutex                  m_mutex;
+    std::condition_variable     m_slot_freed;
+    std::condition_variable     m_frame_ready;
+    bool                        m_stop;
+    std::string                 m_error;        // Set if the loader failed
+
+    ParticleSequence( const ParticleSequence& );            // forbidden
+    ParticleSequence& operator=( const ParticleSequence& ); // forbidden
+};
+
+
+// Positions between snapshots a and b at t in [0,1].  Each particle moves
+// along its velocity from both ends, p0 + v0*t*velocity_scale and
+// p1 - v1*(1-t)*velocity_scale, blended by t so playback passes exactly
+// through the stored snapshots.  Particles missing from b are extrapolated
+// from a; particles new in b appear at the next snapshot.  Writes positions
+// and radii of a.count particles into out.
+void interpolateParticles( const ParticleFrame& a, const ParticleFrame& b, float t, float velocity_scale, ParticleFrame& out );
@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "QuadSoup.h"
+
+#include <Morton.h>
+
+#include <algorithm>
+#include <cstring>
+
+using namespace optix;
+
+
+const uint32_t QuadSoup::NO_QUAD;
+
+
+void setQuadBlockLane( QuadBlock& block, unsigned int lane,
+                       const float3& anchor, const float3& v1, const float3& v2 )
+{
+    const float3 n = normalize( cross( v1, v2 ) );
+    const float3 scaled_v1 = v1 / dot( v1, v1 );
+    const float3 scaled_v2 = v2 / dot( v2, v2 );
+
+    block.nx[lane]  = n.x;
+    block.ny[lane]  = n.y;
+    block.nz[lane]  = n.z;
+    block.d[lane]   = dot( n, anchor );
+    block.ax[lane]  = anchor.x;
+    block.ay[lane]  = anchor.y;
+    block.az[lane]  = anchor.z;
+    block.v1x[lane] = scaled_v1.x;
+    block.v1y[lane] = scaled_v1.y;
+    block.v1z[lane] = scaled_v1.z;
+    block.v2x[lane] = scaled_v2.x;
+    block.v2y[lane] = scaled_v2.y;
+    block.v2z[lane] = scaled_v2.z;
+}
+
+
+void clearQuadBlockLane( QuadBlock& block, unsigned int lane )
+{
+    // A zero normal makes the plane distance 0 / 0, which fails every
+    // comparison
+    block.nx[lane]  = block.ny[lane]  = block.nz[lane]  = block.d[lane] = 0.0f;
+    block.ax[lane]  = block.ay[lane]  = block.az[lane]  = 0.0f;
+    block.v1x[lane] = block.v1y[lane] = block.v1z[lane] = 0.0f;
+    block.v2x[lane] = block.v2y[lane] = block.v2z[lane] = 0.0f;
+}
+
+
+bool getQuadBlockLane( const QuadBlock& block, unsigned int lane, float3& anchor, float3& v1, float3& v2 )
+{
+    if( block.nx[lane] == 0.0f && block.ny[lane] == 0.0f && block.nz[lane] == 0.0f )
+        return false;
+
+    // Undo the 1 / length^2 scale
+    anchor = make_float3( block.ax[lane], block.ay[lane], block.az[lane] );
+    v1 = make_float3( block.v1x[lane], block.v1y[lane], block.v1z[lane] );
+    v2 = make_float3( block.v2x[lane], block.v2y[lane], block.v2z[lane] );
+    v1 /= dot( v1, v1 );
+    v2 /= dot( v2, v2 );
+    return true;
+}
+
+
+Aabb quadBlockBounds( const QuadBlock& block )
+{
+    Aabb box;
+    for( unsigned int lane = 0; lane < QUAD_BLOCK_SIZE; ++lane )
+    {
+        float3 anchor, v1, v2;
+        if( !getQuadBlockLane( block, lane, anchor, v1, v2 ) )
+            continue;
+        box.include( anchor );
+        box.include( anchor + v1 );
+        box.include( anchor + v2 );
+        box.include( anchor + v1 + v2 );
+    }
+    return box;
+}
+
+
+uint32_t QuadSoup::add( const float3& anchor, const float3& v1, const float3& v2 )
+{
+    m_anchors.push_back( anchor );
+    m_v1.push_back( v1 );
+    m_v2.push_back( v2 );
+    return static_cast<uint32_t>( m_anchors.size() - 1 );
+}
+
+
+void QuadSoup::build()
+{
+    const size_t count = m_anchors.size();
+
+    std::vector<float3> centers( count );
+    for( size_t i = 0; i < count; ++i )
+        centers[i] = m_anchors[i] + 0.5f * ( m_v1[i] + m_v2[i] );
+    std::vector<uint32_t> order;
+    sutil::mortonOrder( centers.data(), count, order );
+
+    const size_t num_blocks = ( count + QUAD_BLOCK_SIZE - 1 ) / QUAD_BLOCK_SIZE;
+    m_blocks.resize( num_blocks );
+    std::memset( m_blocks.data(), 0, num_blocks * sizeof( QuadBlock ) );
+    m_slot_quads.assign( num_blocks * QUAD_BLOCK_SIZE, NO_QUAD );
+    m_quad_slots.resize( count );
+    for( size_t slot = 0; slot < count; ++slot )
+    {
+        const uint32_t quad = order[slot];
+        setQuadBlockLane( m_blocks[slot / QUAD_BLOCK_SIZE], slot % QUAD_BLOCK_SIZE,
+                          m_anchors[quad], m_v1[quad], m_v2[quad] );
+        m_slot_quads[slot] = quad;
+        m_quad_slots[quad] = static_cast<uint32_t>( slot );
+    }
+}
+
+
+uint32_t QuadSoup::disable( uint32_t quad )
+{
+    const uint32_t slot = m_quad_slots[quad];
+    clearQuadBlockLane( m_blocks[slot / QUAD_BLOCK_SIZE], slot % QUAD_BLOCK_SIZE );
+    m_slot_quads[slot] = NO_QUAD;
+    return slot / QUAD_BLOCK_SIZE;
+}
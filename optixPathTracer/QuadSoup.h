@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "optixPathTracer.h"
+
+#include <optixu/optixu_aabb_namespace.h>
+#include <optixu/optixu_math_namespace.h>
+
+#include <stdint.h>
+#include <vector>
+
+
+//------------------------------------------------------------------------------
+//
+// Builds the QuadBlock layout for a set of parallelograms.  Quads are ordered
+// along a Morton curve of their centers before they are packed, so the four
+// quads of a block are close together and the block bounds stay tight.
+//
+// Quads keep the index add() returned; slots are block * QUAD_BLOCK_SIZE +
+// lane.
+//
+//------------------------------------------------------------------------------
+
+class QuadSoup
+{
+public:
+    static const uint32_t NO_QUAD = 0xFFFFFFFFu;
+
+    // Edge vectors are given at full length
+    uint32_t add( const optix::float3& anchor, const optix::float3& v1, const optix::float3& v2 );
+
+    // Sort and pack everything added so far
+    void build();
+
+    // Clear a quad's lane so it is never hit again.  Returns its block.
+    uint32_t disable( uint32_t quad );
+
+    size_t                         numQuads()  const { return m_anchors.size(); }
+    const std::vector<QuadBlock>&  blocks()    const { return m_blocks; }
+    const std::vector<uint32_t>&   slotQuads() const { return m_slot_quads; }  // NO_QUAD for padding
+    uint32_t                       slot( uint32_t quad ) const { return m_quad_slots[quad]; }
+
+    const optix::float3& anchor( uint32_t quad ) const { return m_anchors[quad]; }
+    const optix::float3& v1( uint32_t quad )     const { return m_v1[quad]; }
+    const optix::float3& v2( uint32_t quad )     const { return m_v2[quad]; }
+
+private:
+    std::vector<optix::float3>  m_anchors;
+    std::vector<optix::float3>  m_v1;
+    std::vector<optix::float3>  m_v2;
+
+    std::vector<QuadBlock>      m_blocks;
+    std::vector<uint32_t>       m_slot_quads;
+    std::vector<uint32_t>       m_quad_slots;
+};
+
+
+// Fill one lane of a block, or clear it
+void setQuadBlockLane( QuadBlock& block, unsigned int lane,
+                       const optix::float3& anchor, const optix::float3& v1, const optix::float3& v2 );
+void clearQuadBlockLane( QuadBlock& block, unsigned int lane );
+
+// Read a lane back with full length edges, false for a cleared lane
+bool getQuadBlockLane( const QuadBlock& block, unsigned int lane,
+                       optix::float3& anchor, optix::float3& v1, optix::float3& v2 );
+
+// Bounds of the used lanes
+optix::Aabb quadBlockBounds( const QuadBlock& block );
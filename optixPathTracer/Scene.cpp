@@ -0,0 +1,530 @@
+/*
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Scene.h"
+
+#include <ThreadPool.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+using namespace optix;
+
+
+//------------------------------------------------------------------------------
+//
+// Helpers
+//
+//------------------------------------------------------------------------------
+
+namespace
+{
+
+std::string directoryOf( const std::string& filename )
+{
+    const size_t pos = filename.find_last_of( "/\\" );
+    return pos == std::string::npos ? std::string() : filename.substr( 0, pos + 1 );
+}
+
+
+bool isAbsolutePath( const std::string& path )
+{
+    if( path.empty() )
+        return false;
+    if( path[0] == '/' || path[0] == '\\' )
+        return true;
+    return path.size() > 1 && path[1] == ':';  // Windows drive letter
+}
+
+
+class SceneParser
+{
+public:
+    SceneParser( const std::string& filename )
+        : m_filename( filename ), m_line_number( 0 )
+    {
+    }
+
+    SceneDescription parse();
+
+private:
+    void error( const std::string& message ) const
+    {
+        std::ostringstream oss;
+        oss << "Scene: " << m_filename << "(" << m_line_number << "): " << message;
+        throw std::runtime_error( oss.str() );
+    }
+
+    float readFloat( std::istringstream& iss )
+    {
+        float f;
+        if( !( iss >> f ) )
+            error( "expected a number" );
+        return f;
+    }
+
+    int readInt( std::istringstream& iss )
+    {
+        int i;
+        if( !( iss >> i ) )
+            error( "expected an integer" );
+        return i;
+    }
+
+    float3 readFloat3( std::istringstream& iss )
+    {
+        const float x = readFloat( iss );
+        const float y = readFloat( iss );
+        const float z = readFloat( iss );
+        return make_float3( x, y, z );
+    }
+
+    void expectEnd( std::istringstream& iss )
+    {
+        std::string extra;
+        if( iss >> extra )
+            error( "unexpected '" + extra + "'" );
+    }
+
+    SceneObject& currentObject( const std::string& keyword )
+    {
+        if( m_current == CURRENT_ADDED_OBJECT )
+            return m_scene.edits.back().object;
+        if( m_current != CURRENT_OBJECT )
+            error( "'" + keyword + "' must follow a mesh, quad or particles" );
+        return m_scene.objects.back();
+    }
+
+    unsigned int readObjectID( std::istringstream& iss )
+    {
+        const int id = readInt( iss );
+        if( id < 1 )
+            error( "object IDs start at 1" );
+        return static_cast<unsigned int>( id );
+    }
+
+    bool parseObject( const std::string& keyword, std::istringstream& iss, SceneObject& object );
+    void parseEdit( std::istringstream& iss );
+    void parseAttribute( const std::string& keyword, std::istringstream& iss );
+
+    enum Current
+    {
+        CURRENT_NONE = 0,
+        CURRENT_CAMERA,
+        CURRENT_LIGHT,
+        CURRENT_OBJECT,
+        CURRENT_ADDED_OBJECT,   // Object of an 'at' line
+        CURRENT_MOVE            // Transform of an 'at' move line
+    };
+
+    std::string      m_filename;
+    std::string      m_base_dir;
+    int              m_line_number;
+    Current          m_current;
+    SceneDescription m_scene;
+};
+
+
+SceneDescription SceneParser::parse()
+{
+    std::ifstream file( m_filename.c_str() );
+    if( !file )
+        throw std::runtime_error( "Scene: unable to open '" + m_filename + "'" );
+
+    m_scene = SceneDescription();
+    m_scene.filename = m_filename;
+    m_current = CURRENT_NONE;
+
+    m_base_dir = directoryOf( m_filename );
+
+    std::string line;
+    while( std::getline( file, line ) )
+    {
+        ++m_line_number;
+
+        const size_t comment = line.find( '#' );
+        if( comment != std::string::npos )
+            line.erase( comment );
+
+        std::istringstream iss( line );
+        std::string keyword;
+        if( !( iss >> keyword ) )
+            continue;
+
+        if( keyword == "camera" )
+        {
+            if( m_scene.has_camera )
+                error( "camera specified twice" );
+            m_scene.has_camera    = true;
+            m_scene.camera.eye    = readFloat3( iss );
+            m_scene.camera.lookat = readFloat3( iss );
+            m_scene.camera.up     = make_float3( 0.0f, 1.0f, 0.0f );
+            m_scene.camera.fov    = 35.0f;
+            m_current = CURRENT_CAMERA;
+        }
+        else if( keyword == "light" )
+        {
+            SceneLight light;
+            light.light.corner    = readFloat3( iss );
+            light.light.v1        = readFloat3( iss );
+            light.light.v2        = readFloat3( iss );
+            light.light.normal    = normalize( cross( light.light.v1, light.light.v2 ) );
+            light.light.emission  = make_float3( 25.0f );
+            light.emission_color  = make_float3( 15.0f, 15.0f, 5.0f );
+            m_scene.lights.push_back( light );
+            m_current = CURRENT_LIGHT;
+        }
+        else if( keyword == "at" )
+        {
+            parseEdit( iss );
+        }
+        else
+        {
+            SceneObject object;
+            if( parseObject( keyword, iss, object ) )
+            {
+                m_scene.objects.push_back( object );
+                m_current = CURRENT_OBJECT;
+            }
+            else
+            {
+                parseAttribute( keyword, iss );
+            }
+        }
+
+        expectEnd( iss );
+    }
+
+    if( m_scene.lights.empty() )
+        throw std::runtime_error( "Scene: " + m_filename + " does not define a light" );
+
+    // Applied in frame order, edits of the same frame in file order
+    std::stable_sort( m_scene.edits.begin(), m_scene.edits.end(),
+                      []( const SceneEdit& a, const SceneEdit& b ) { return a.frame < b.frame; } );
+
+    return m_scene;
+}
+
+
+bool SceneParser::parseObject( const std::string& keyword, std::istringstream& iss, SceneObject& object )
+{
+    if( keyword == "quad" )
+    {
+        object.type   = SCENE_OBJECT_QUAD;
+        object.anchor = readFloat3( iss );
+        object.v1     = readFloat3( iss );
+        object.v2     = readFloat3( iss );
+    }
+    else if( keyword == "mesh" )
+    {
+        std::string path;
+        if( !( iss >> path ) )
+            error( "mesh requires a file name" );
+
+        object.type     = SCENE_OBJECT_MESH;
+        object.filename = isAbsolutePath( path ) ? path : m_base_dir + path;
+    }
+    else if( keyword == "particles" )
+    {
+        std::string pattern;
+        if( !( iss >> pattern ) )
+            error( "particles requires a file pattern" );
+
+        object.type        = SCENE_OBJECT_PARTICLES;
+        object.filename    = isAbsolutePath( pattern ) ? pattern : m_base_dir + pattern;
+        object.first_frame = readInt( iss );
+        object.last_frame  = readInt( iss );
+        if( object.last_frame < object.first_frame )
+            error( "particles frame range is empty" );
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+
+void SceneParser::parseEdit( std::istringstream& iss )
+{
+    SceneEdit edit;
+    edit.frame = readInt( iss );
+    if( edit.frame < 1 )
+        error( "edit frames start at 1" );
+
+    std::string command;
+    if( !( iss >> command ) )
+        error( "'at' requires an edit" );
+
+    Current current = CURRENT_NONE;
+    if( command == "remove" )
+    {
+        edit.type      = SCENE_EDIT_REMOVE;
+        edit.object_id = readObjectID( iss );
+    }
+    else if( command == "color" )
+    {
+        edit.type      = SCENE_EDIT_COLOR;
+        edit.object_id = readObjectID( iss );
+        edit.color     = readFloat3( iss );
+    }
+    else if( command == "move" )
+    {
+        // The transform is composed from the attribute lines that follow
+        edit.type      = SCENE_EDIT_TRANSFORM;
+        edit.object_id = readObjectID( iss );
+        current        = CURRENT_MOVE;
+    }
+    else if( parseObject( command, iss, edit.object ) )
+    {
+        edit.type = SCENE_EDIT_ADD;
+        current   = CURRENT_ADDED_OBJECT;
+    }
+    else
+    {
+        error( "unknown edit '" + command + "'" );
+    }
+
+    m_scene.edits.push_back( edit );
+    m_current = current;
+}
+
+
+void SceneParser::parseAttribute( const std::string& keyword, std::istringstream& iss )
+{
+    if( keyword == "color" )
+    {
+        const float3 color = readFloat3( iss );
+        if( m_current == CURRENT_LIGHT )
+            m_scene.lights.back().emission_color = color;
+        else
+            currentObject( keyword ).color = color;
+    }
+    else if( keyword == "emission" )
+    {
+        if( m_current != CURRENT_LIGHT )
+            error( "'emission' must follow a light" );
+        m_scene.lights.back().light.emission = readFloat3( iss );
+    }
+    else if( keyword == "up" || keyword == "fov" )
+    {
+        if( m_current != CURRENT_CAMERA )
+            error( "'" + keyword + "' must follow the camera" );
+        if( keyword == "up" )
+            m_scene.camera.up = readFloat3( iss );
+        else
+            m_scene.camera.fov = readFloat( iss );
+    }
+    else if( keyword == "substeps" || keyword == "velocity_scale" || keyword == "accel" )
+    {
+        SceneObject& object = currentObject( keyword );
+        if( object.type != SCENE_OBJECT_PARTICLES )
+            error( "'" + keyword + "' only applies to particles" );
+        if( keyword == "substeps" )
+        {
+            object.substeps = readInt( iss );
+            if( object.substeps < 0 )
+                error( "substeps must not be negative" );
+        }
+        else if( keyword == "velocity_scale" )
+        {
+            object.velocity_scale = readFloat( iss );
+        }
+        else
+        {
+            std::string accel;
+            iss >> accel;
+            if( accel != "bvh" && accel != "grid" )
+                error( "accel must be 'bvh' or 'grid'" );
+            object.particle_grid = accel == "grid";
+        }
+    }
+    else if( keyword == "casts_shadow" || keyword == "receives_shadow" )
+    {
+        SceneObject& object = currentObject( keyword );
+        const int flag = readInt( iss );
+        if( flag != 0 && flag != 1 )
+            error( "'" + keyword + "' must be 0 or 1" );
+        if( keyword == "casts_shadow" )
+            object.casts_shadow = flag != 0;
+        else
+            object.receives_shadow = flag != 0;
+    }
+    else if( keyword == "translate" || keyword == "scale" || keyword == "rotate" )
+    {
+        Matrix4x4* transform = 0;
+        if( m_current == CURRENT_MOVE )
+        {
+            // Any object can be moved, quads included
+            transform = &m_scene.edits.back().transform;
+        }
+        else
+        {
+            SceneObject& object = currentObject( keyword );
+            if( object.type == SCENE_OBJECT_QUAD )
+                error( "'" + keyword + "' does not apply to quads" );
+            transform = &object.transform;
+        }
+
+        // Composed in file order, matching Matrix4x4 operator*=
+        if( keyword == "translate" )
+        {
+            *transform *= Matrix4x4::translate( readFloat3( iss ) );
+        }
+        else if( keyword == "scale" )
+        {
+            *transform *= Matrix4x4::scale( readFloat3( iss ) );
+        }
+        else
+        {
+            const float radians = readFloat( iss );
+            *transform *= Matrix4x4::rotate( radians, readFloat3( iss ) );
+        }
+    }
+    else
+    {
+        error( "unknown keyword '" + keyword + "'" );
+    }
+}
+
+} // namespace
+
+
+//------------------------------------------------------------------------------
+//
+// Scene API
+//
+//------------------------------------------------------------------------------
+
+SceneDescription parseSceneFile( const std::string& filename )
+{
+    SceneParser parser( filename );
+    return parser.parse();
+}
+
+
+//------------------------------------------------------------------------------
+//
+// SceneMeshLoader
+//
+//------------------------------------------------------------------------------
+
+SceneMeshLoader::~SceneMeshLoader()
+{
+    for( size_t i = 0; i < m_loads.size(); ++i )
+    {
+        m_loads[i]->done.wait();
+        freeMesh( m_loads[i]->mesh );
+        freeMesh( m_loads[i]->proxy );
+    }
+}
+
+
+void SceneMeshLoader::start( const SceneDescription& scene, bool reorder, float proxy_ratio )
+{
+    for( size_t i = 0; i < scene.objects.size(); ++i )
+    {
+        const SceneObject& object = scene.objects[i];
+        if( object.type != SCENE_OBJECT_MESH )
+            continue;
+
+        // The task owns what it loads until take(), and frees it on failure
+        std::shared_ptr<Load> load( new Load );
+        load->object = i;
+        const bool with_proxy = proxy_ratio > 0.0f && object.casts_shadow;
+        load->done = sutil::defaultThreadPool().enqueue( [load, object, reorder, with_proxy, proxy_ratio]()
+        {
+            try
+            {
+                loadMesh( object.filename, load->mesh, object.transform.getData(), reorder );
+                if( with_proxy )
+                    loadSimplifiedMesh( object.filename, proxy_ratio, load->proxy, object.transform.getData() );
+            }
+            catch( ... )
+            {
+                freeMesh( load->mesh );
+                freeMesh( load->proxy );
+                throw;
+            }
+        } );
+        m_loads.push_back( load );
+    }
+}
+
+
+void SceneMeshLoader::finish( size_t index, Mesh& mesh, Mesh& proxy )
+{
+    std::shared_ptr<Load> load = m_loads[index];
+    m_loads.erase( m_loads.begin() + index );
+    load->done.get();
+    mesh  = load->mesh;
+    proxy = load->proxy;
+}
+
+
+void SceneMeshLoader::take( size_t object, Mesh& mesh, Mesh& proxy )
+{
+    mesh  = Mesh();
+    proxy = Mesh();
+    for( size_t i = 0; i < m_loads.size(); ++i )
+    {
+        if( m_loads[i]->object == object )
+        {
+            finish( i, mesh, proxy );
+            return;
+        }
+    }
+}
+
+
+bool SceneMeshLoader::takeReady( size_t& object, Mesh& mesh, Mesh& proxy, std::string& error )
+{
+    for( size_t i = 0; i < m_loads.size(); ++i )
+    {
+        if( m_loads[i]->done.wait_for( std::chrono::seconds( 0 ) ) == std::future_status::ready )
+        {
+            object = m_loads[i]->object;
+            mesh   = Mesh();
+            proxy  = Mesh();
+            error.clear();
+            try
+            {
+                finish( i, mesh, proxy );
+            }
+            catch( const std::exception& e )
+            {
+                error = e.what();
+            }
+            return true;
+        }
+    }
+    return false;
+}
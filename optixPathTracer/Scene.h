@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "optixPathTracer.h"
+
+#include <optixu/optixu_math_namespace.h>
+#include <optixu/optixu_matrix_namespace.h>
+#include <Mesh.h>
+
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+//------------------------------------------------------------------------------
+//
+// Scene description loaded from a .scene text file (see data/grid.scene for
+// the syntax).  Parsing only reads the text file; the referenced meshes are
+// loaded separately by SceneMeshLoader.
+//
+//------------------------------------------------------------------------------
+
+enum SceneObjectType
+{
+    SCENE_OBJECT_MESH = 0,
+    SCENE_OBJECT_QUAD,
+    SCENE_OBJECT_PARTICLES
+};
+
+
+struct SceneObject
+{
+    // Defaults for every type, the parser fills in what the file specifies
+    SceneObject()
+        : type( SCENE_OBJECT_MESH ), color( optix::make_float3( 0.8f ) ),
+          transform( optix::Matrix4x4::identity() ), first_frame( 0 ), last_frame( 0 ), substeps( 0 ),
+          velocity_scale( 1.0f ), particle_grid( false ), casts_shadow( true ), receives_shadow( true ),
+          anchor( optix::make_float3( 0.0f ) ), v1( optix::make_float3( 0.0f ) ), v2( optix::make_float3( 0.0f ) ) {}
+
+    SceneObjectType   type;
+    optix::float3     color;
+
+    // SCENE_OBJECT_MESH and SCENE_OBJECT_PARTICLES
+    std::string       filename;     // Resolved against the scene file directory
+    optix::Matrix4x4  transform;    // Load transform
+
+    // SCENE_OBJECT_PARTICLES, filename is a pattern with a %d for the frame
+    int               first_frame;
+    int               last_frame;
+    int               substeps;       // Rendered frames per snapshot, 0 streams
+    float             velocity_scale; // Snapshot intervals per unit velocity
+    bool              particle_grid;  // Uniform grid instead of a BVH
+
+    // Shadow flags: casters are the only objects shadow rays are traced
+    // against, receivers the only objects that trace them
+    bool              casts_shadow;
+    bool              receives_shadow;
+
+    // SCENE_OBJECT_QUAD
+    optix::float3     anchor;
+    optix::float3     v1;
+    optix::float3     v2;
+};
+
+
+struct SceneLight
+{
+    ParallelogramLight light;           // Uploaded to the lights buffer
+    optix::float3      emission_color;  // Color of the emitter geometry
+};
+
+
+struct SceneCamera
+{
+    optix::float3      eye;
+    optix::float3      lookat;
+    optix::float3      up;
+    float              fov;             // Vertical, in degrees
+};
+
+
+enum SceneEditType
+{
+    SCENE_EDIT_ADD = 0,
+    SCENE_EDIT_REMOVE,
+    SCENE_EDIT_TRANSFORM,
+    SCENE_EDIT_COLOR
+};
+
+
+// Change to the scene after it is loaded, by object ID.  Scene files schedule
+// them with 'at' lines; the application queues its own the same way.
+struct SceneEdit
+{
+    SceneEdit()
+        : type( SCENE_EDIT_REMOVE ), frame( 0 ), object_id( 0 ),
+          transform( optix::Matrix4x4::identity() ), color( optix::make_float3( 0.8f ) ) {}
+
+    SceneEditType     type;
+    int               frame;        // Rendered frame the edit is applied before
+    unsigned int      object_id;    // Handed out when SCENE_EDIT_ADD is issued
+    SceneObject       object;       // SCENE_EDIT_ADD
+    optix::Matrix4x4  transform;    // SCENE_EDIT_TRANSFORM, relative to the loaded pose
+    optix::float3     color;        // SCENE_EDIT_COLOR
+};
+
+
+struct SceneDescription
+{
+    SceneDescription() : has_camera( false ) {}
+
+    std::string               filename;
+    std::vector<SceneObject>  objects;  // In object ID order
+    std::vector<SceneEdit>    edits;    // By frame, in file order within a frame
+    std::vector<SceneLight>   lights;
+    bool                      has_camera;
+    SceneCamera               camera;
+};
+
+
+// Parse a scene file.  Throws std::runtime_error naming the file and line on
+// malformed input.
+SceneDescription parseSceneFile( const std::string& filename );
+
+
+//------------------------------------------------------------------------------
+//
+// Background load of the meshes and shadow proxies of a scene, one task per
+// mesh object on sutil::defaultThreadPool().  Started before the OptiX
+// context is set up, so parsing overlaps with context creation and program
+// compiles.  The main thread then takes each mesh when it creates the
+// object, either waiting for it or, to populate the scene progressively,
+// taking whichever loads have finished.
+//
+//------------------------------------------------------------------------------
+
+class SceneMeshLoader
+{
+public:
+    SceneMeshLoader() {}
+
+    // Waits for loads in flight and frees the meshes not taken
+    ~SceneMeshLoader();
+
+    // With proxy_ratio > 0 the meshes of shadow casting objects also get
+    // proxies from loadSimplifiedMesh(), ratio being the fraction of
+    // triangles kept.  With reorder the meshes are put in spatial order by
+    // reorderMesh().
+    void start( const SceneDescription& scene, bool reorder, float proxy_ratio );
+
+    // Wait for the mesh and proxy of objects[object], zeroed if it has none.
+    // They pass to the caller, to release with freeMesh().  Rethrows the
+    // exception of a failed load.
+    void take( size_t object, Mesh& mesh, Mesh& proxy );
+
+    // take() for some object whose load has finished, false if none has.
+    // A failed load is taken too, with zeroed meshes and its exception's
+    // message in error, which is empty otherwise.
+    bool takeReady( size_t& object, Mesh& mesh, Mesh& proxy, std::string& error );
+
+    // Loads not taken yet
+    size_t numPending() const { return m_loads.size(); }
+
+private:
+    struct Load
+    {
+        Load() : object( 0 ), mesh( Mesh() ), proxy( Mesh() ) {}
+
+        size_t            object;
+        Mesh              mesh;
+        Mesh              proxy;
+        std::future<void> done;
+    };
+
+    void finish( size_t index, Mesh& mesh, Mesh& proxy );
+
+    std::vector< std::shared_ptr<Load> > m_loads;      // In object order
+
+    SceneMeshLoader( const SceneMeshLoader& );              // forbidden
+    SceneMeshLoader& operator=( const SceneMeshLoader& );   // forbidden
+};
@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "SphereGrid.h"
+
+#include <sutil.h>
+#include <ThreadPool.h>
+
+#include <algorithm>
+#include <cmath>
+
+using namespace optix;
+
+
+namespace
+{
+
+// Upper bound on cells per axis so a few huge spheres cannot blow up memory
+const int MAX_GRID_DIM = 256;
+
+// Spheres per bounds chunk, and the fewest spheres worth a histogram
+const size_t BUILD_CHUNK_SIZE = 4096;
+
+
+} // namespace
+
+
+SphereGrid::SphereGrid()
+    : m_min( make_float3( 0.0f ) ),
+      m_max( make_float3( 0.0f ) ),
+      m_cell_size( make_float3( 1.0f ) ),
+      m_inv_cell_size( make_float3( 1.0f ) ),
+      m_dims( make_int3( 0, 0, 0 ) ),
+      m_build_time( 0.0 )
+{
+}
+
+
+void SphereGrid::cellRange( const float4& sphere, int3& lo, int3& hi ) const
+{
+    const float3 center = make_float3( sphere );
+    const float3 a = ( center - sphere.w - m_min ) * m_inv_cell_size;
+    const float3 b = ( center + sphere.w - m_min ) * m_inv_cell_size;
+    lo = make_int3( std::max( 0, static_cast<int>( a.x ) ),
+                    std::max( 0, static_cast<int>( a.y ) ),
+                    std::max( 0, static_cast<int>( a.z ) ) );
+    hi = make_int3( std::min( m_dims.x - 1, static_cast<int>( b.x ) ),
+                    std::min( m_dims.y - 1, static_cast<int>( b.y ) ),
+                    std::min( m_dims.z - 1, static_cast<int>( b.z ) ) );
+}
+
+
+void SphereGrid::build( const float4* spheres, size_t count, float cells_per_sphere )
+{
+    const double start_time = sutil::currentTime();
+
+    m_spheres.assign( spheres, spheres + count );
+    if( count == 0 )
+    {
+        m_dims = make_int3( 0, 0, 0 );
+        m_cell_start.assign( 1, 0u );
+        m_items.clear();
+        m_build_time = ( sutil::currentTime() - start_time ) * 1000.0;
+        return;
+    }
+
+    sutil::ThreadPool& pool = sutil::defaultThreadPool();
+    const size_t num_chunks = ( count + BUILD_CHUNK_SIZE - 1 ) / BUILD_CHUNK_SIZE;
+
+    // Bounds, reduced per chunk
+    std::vector<float3> chunk_min( num_chunks ), chunk_max( num_chunks );
+    pool.parallelFor( 0, num_chunks, 1, [&]( size_t chunk_begin, size_t chunk_end )
+    {
+        for( size_t chunk = chunk_begin; chunk < chunk_end; ++chunk )
+        {
+            float3 lo = make_float3(  1e30f );
+            float3 hi = make_float3( -1e30f );
+            const size_t end = std::min( count, ( chunk + 1 ) * BUILD_CHUNK_SIZE );
+            for( size_t i = chunk * BUILD_CHUNK_SIZE; i < end; ++i )
+            {
+                const float3 center = make_float3( m_spheres[i] );
+                lo = fminf( lo, center - m_spheres[i].w );
+                hi = fmaxf( hi, center + m_spheres[i].w );
+            }
+            chunk_min[chunk] = lo;
+            chunk_max[chunk] = hi;
+        }
+    } );
+
+    m_min = chunk_min[0];
+    m_max = chunk_max[0];
+    for( size_t chunk = 1; chunk < num_chunks; ++chunk )
+    {
+        m_min = fminf( m_min, chunk_min[chunk] );
+        m_max = fmaxf( m_max, chunk_max[chunk] );
+    }
+
+    // Roughly cubic cells, about cells_per_sphere of them per sphere
+    const float3 extent = fmaxf( m_max - m_min, make_float3( 1e-6f ) );
+    const float  target_cells = std::max( 1.0f, cells_per_sphere * static_cast<float>( count ) );
+    const float  cell = cbrtf( extent.x * extent.y * extent.z / target_cells );
+    m_dims = make_int3(
+        std::min( MAX_GRID_DIM, std::max( 1, static_cast<int>( ceilf( extent.x / cell ) ) ) ),
+        std::min( MAX_GRID_DIM, std::max( 1, static_cast<int>( ceilf( extent.y / cell ) ) ) ),
+        std::min( MAX_GRID_DIM, std::max( 1, static_cast<int>( ceilf( extent.z / cell ) ) ) ) );
+    m_cell_size     = extent / make_float3( static_cast<float>( m_dims.x ), static_cast<float>( m_dims.y ), static_cast<float>( m_dims.z ) );
+    m_inv_cell_size = 1.0f / m_cell_size;
+
+    const size_t num_cells = static_cast<size_t>( m_dims.x ) * m_dims.y * m_dims.z;
+
+    // Counting sort.  The spheres are split into one contiguous range per
+    // worker, and each range counts its cell references into its own
+    // histogram, so no atomics are needed and the result is deterministic.
+    // The number of histograms is bounded by the thread count, not the sphere
+    // count, which keeps the build linear in spheres plus cells.
+    const size_t num_parts  = std::min<size_t>( pool.numThreads() + 1, num_chunks );
+    const size_t part_size  = ( count + num_parts - 1 ) / num_parts;
+    m_part_counts.assign( num_parts * num_cells, 0u );
+    pool.parallelFor( 0, num_parts, 1, [&]( size_t part_begin, size_t part_end )
+    {
+        for( size_t part = part_begin; part < part_end; ++part )
+        {
+            uint32_t* counts = &m_part_counts[part * num_cells];
+            const size_t end = std::min( count, ( part + 1 ) * part_size );
+            for( size_t i = part * part_size; i < end; ++i )
+            {
+                int3 lo, hi;
+                cellRange( m_spheres[i], lo, hi );
+                for( int z = lo.z; z <= hi.z; ++z )
+                    for( int y = lo.y; y <= hi.y; ++y )
+                        for( int x = lo.x; x <= hi.x; ++x )
+                            ++counts[( z * m_dims.y + y ) * m_dims.x + x];
+            }
+        }
+    } );
+
+    // Pass 2: per cell totals, then an exclusive scan over cells.  The
+    // histograms are turned into range offsets within each cell in place.
+    m_cell_start.resize( num_cells + 1 );
+    pool.parallelFor( 0, num_cells, 4096, [&]( size_t cell_begin, size_t cell_end )
+    {
+        for( size_t c = cell_begin; c < cell_end; ++c )
+        {
+            uint32_t total = 0;
+            for( size_t part = 0; part < num_parts; ++part )
+            {
+                uint32_t& n = m_part_counts[part * num_cells + c];
+                const uint32_t part_count = n;
+                n = total;
+                total += part_count;
+            }
+            m_cell_start[c] = total;
+        }
+    } );
+
+    uint32_t offset = 0;
+    for( size_t c = 0; c < num_cells; ++c )
+    {
+        const uint32_t n = m_cell_start[c];
+        m_cell_start[c] = offset;
+        offset += n;
+    }
+    m_cell_start[num_cells] = offset;
+
+    // Pass 3: scatter sphere indices, each range into its own slots
+    m_items.resize( offset );
+    pool.parallelFor( 0, num_parts, 1, [&]( size_t part_begin, size_t part_end )
+    {
+        for( size_t part = part_begin; part < part_end; ++part )
+        {
+            uint32_t* next = &m_part_counts[part * num_cells];
+            const size_t end = std::min( count, ( part + 1 ) * part_size );
+            for( size_t i = part * part_size; i < end; ++i )
+            {
+                int3 lo, hi;
+                cellRange( m_spheres[i], lo, hi );
+                for( int z = lo.z; z <= hi.z; ++z )
+                    for( int y = lo.y; y <= hi.y; ++y )
+                        for( int x = lo.x; x <= hi.x; ++x )
+                        {
+                            const size_t c = ( z * m_dims.y + y ) * m_dims.x + x;
+                            m_items[m_cell_start[c] + next[c]++] = static_cast<uint32_t>( i );
+                        }
+            }
+        }
+    } );
+
+    m_build_time = ( sutil::currentTime() - start_time ) * 1000.0;
+}
+
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <optixu/optixu_math_namespace.h>
+
+#include <stdint.h>
+#include <vector>
+
+
+//------------------------------------------------------------------------------
+//
+// Uniform grid over spheres, rebuilt from scratch every frame.  Each cell
+// lists the spheres overlapping it.  The cell lists are built with a parallel
+// counting sort with one histogram per worker thread, so the build is linear
+// in spheres plus cells and does not degrade as particles move,
+// which suits many similarly sized moving spheres better than a SAH BVH.
+//
+// The layout matches the buffers read by sphere_grid.cu: cell c holds
+// items[cell_start[c] .. cell_start[c+1]), cells are x-major.
+//
+//------------------------------------------------------------------------------
+class SphereGrid
+{
+public:
+    SphereGrid();
+
+    // Build over count spheres, xyz center and w radius.  The spheres are
+    // copied.  cells_per_sphere sets the grid resolution relative to the
+    // sphere count.
+    void build( const optix::float4* spheres, size_t count, float cells_per_sphere = 1.0f );
+
+    const std::vector<optix::float4>& spheres()   const { return m_spheres; }
+    const std::vector<uint32_t>&      cellStart() const { return m_cell_start; }
+    const std::vector<uint32_t>&      items()     const { return m_items; }
+
+    const optix::float3&  boundsMin() const { return m_min; }
+    const optix::float3&  boundsMax() const { return m_max; }
+    const optix::float3&  cellSize()  const { return m_cell_size; }
+    const optix::int3&    dims()      const { return m_dims; }
+
+    // Wall clock time of the last build, in milliseconds
+    double lastBuildTime() const { return m_build_time; }
+
+private:
+    void cellRange( const optix::float4& sphere, optix::int3& lo, optix::int3& hi ) const;
+
+    std::vector<optix::float4>  m_spheres;
+    std::vector<uint32_t>       m_cell_start;   // num_cells + 1 entries
+    std::vector<uint32_t>       m_items;        // Sphere indices per cell
+    std::vector<uint32_t>       m_part_counts;  // Per worker range histograms
+
+    optix::float3               m_min;
+    optix::float3               m_max;
+    optix::float3               m_cell_size;
+    optix::float3               m_inv_cell_size;
+    optix::int3                 m_dims;
+    double                      m_build_time;
+};
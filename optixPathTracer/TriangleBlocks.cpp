@@ -0,0 +1,303 @@
+/*
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "TriangleBlocks.h"
+
+#include <Morton.h>
+
+#include <algorithm>
+
+#if defined( __AVX__ )
+#  include <immintrin.h>
+#  define TRIANGLE_BLOCKS_USE_AVX
+#elif defined( __SSE__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 1 )
+#  include <xmmintrin.h>
+#  define TRIANGLE_BLOCKS_USE_SSE
+#endif
+
+using namespace optix;
+
+
+namespace
+{
+
+// The watertight test for one triangle, also the reference for the SIMD
+// paths.  t is the hit distance times det, which is made positive.
+inline bool intersectWatertight( const float3& p0, const float3& p1, const float3& p2, const WatertightRay& ray,
+                                 float tmin, float tmax, float& t, float& det )
+{
+    const float a[3] = { p0.x - ray.origin[0], p0.y - ray.origin[1], p0.z - ray.origin[2] };
+    const float b[3] = { p1.x - ray.origin[0], p1.y - ray.origin[1], p1.z - ray.origin[2] };
+    const float c[3] = { p2.x - ray.origin[0], p2.y - ray.origin[1], p2.z - ray.origin[2] };
+    const float az = a[ray.kz], bz = b[ray.kz], cz = c[ray.kz];
+
+    const float sax = a[ray.kx] - ray.sx * az, say = a[ray.ky] - ray.sy * az;
+    const float sbx = b[ray.kx] - ray.sx * bz, sby = b[ray.ky] - ray.sy * bz;
+    const float scx = c[ray.kx] - ray.sx * cz, scy = c[ray.ky] - ray.sy * cz;
+
+    const float u = scx * sby - scy * sbx;
+    const float v = sax * scy - say * scx;
+    const float w = sbx * say - sby * sax;
+    if( ( u < 0.0f || v < 0.0f || w < 0.0f ) && ( u > 0.0f || v > 0.0f || w > 0.0f ) )
+        return false;
+
+    det = u + v + w;
+    if( det == 0.0f )
+        return false;
+
+    t = ray.sz * ( u * az + v * bz + w * cz );
+    if( det < 0.0f )
+    {
+        t   = -t;
+        det = -det;
+    }
+    return t >= tmin * det && t < tmax * det;
+}
+
+
+#ifdef TRIANGLE_BLOCKS_USE_SSE
+// Lanes [offset, offset + 4), the scaled distances and determinants of the
+// hits go to dist and det
+inline int intersectLanes4( const TriangleBlock& block, unsigned int offset, const WatertightRay& ray,
+                            float tmin, float tmax, float* dist, float* det )
+{
+    const __m128 ox = _mm_set1_ps( ray.origin[ray.kx] );
+    const __m128 oy = _mm_set1_ps( ray.origin[ray.ky] );
+    const __m128 oz = _mm_set1_ps( ray.origin[ray.kz] );
+    const __m128 sx = _mm_set1_ps( ray.sx );
+    const __m128 sy = _mm_set1_ps( ray.sy );
+
+    const __m128 az = _mm_sub_ps( _mm_loadu_ps( block.p[0][ray.kz] + offset ), oz );
+    const __m128 bz = _mm_sub_ps( _mm_loadu_ps( block.p[1][ray.kz] + offset ), oz );
+    const __m128 cz = _mm_sub_ps( _mm_loadu_ps( block.p[2][ray.kz] + offset ), oz );
+    const __m128 sax = _mm_sub_ps( _mm_sub_ps( _mm_loadu_ps( block.p[0][ray.kx] + offset ), ox ), _mm_mul_ps( sx, az ) );
+    const __m128 say = _mm_sub_ps( _mm_sub_ps( _mm_loadu_ps( block.p[0][ray.ky] + offset ), oy ), _mm_mul_ps( sy, az ) );
+    const __m128 sbx = _mm_sub_ps( _mm_sub_ps( _mm_loadu_ps( block.p[1][ray.kx] + offset ), ox ), _mm_mul_ps( sx, bz ) );
+    const __m128 sby = _mm_sub_ps( _mm_sub_ps( _mm_loadu_ps( block.p[1][ray.ky] + offset ), oy ), _mm_mul_ps( sy, bz ) );
+    const __m128 scx = _mm_sub_ps( _mm_sub_ps( _mm_loadu_ps( block.p[2][ray.kx] + offset ), ox ), _mm_mul_ps( sx, cz ) );
+    const __m128 scy = _mm_sub_ps( _mm_sub_ps( _mm_loadu_ps( block.p[2][ray.ky] + offset ), oy ), _mm_mul_ps( sy, cz ) );
+
+    const __m128 u = _mm_sub_ps( _mm_mul_ps( scx, sby ), _mm_mul_ps( scy, sbx ) );
+    const __m128 v = _mm_sub_ps( _mm_mul_ps( sax, scy ), _mm_mul_ps( say, scx ) );
+    const __m128 w = _mm_sub_ps( _mm_mul_ps( sbx, say ), _mm_mul_ps( sby, sax ) );
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 any_negative = _mm_or_ps( _mm_or_ps( _mm_cmplt_ps( u, zero ), _mm_cmplt_ps( v, zero ) ), _mm_cmplt_ps( w, zero ) );
+    const __m128 any_positive = _mm_or_ps( _mm_or_ps( _mm_cmpgt_ps( u, zero ), _mm_cmpgt_ps( v, zero ) ), _mm_cmpgt_ps( w, zero ) );
+    const __m128 d = _mm_add_ps( _mm_add_ps( u, v ), w );
+    __m128 mask = _mm_andnot_ps( _mm_and_ps( any_negative, any_positive ), _mm_cmpneq_ps( d, zero ) );
+    if( !_mm_movemask_ps( mask ) )
+        return 0;
+
+    // Range test on t * |det|, the division is left for the lanes that hit
+    const __m128 sign = _mm_and_ps( d, _mm_set1_ps( -0.0f ) );
+    const __m128 abs_d = _mm_xor_ps( d, sign );
+    const __m128 s = _mm_xor_ps( _mm_mul_ps( _mm_set1_ps( ray.sz ),
+        _mm_add_ps( _mm_add_ps( _mm_mul_ps( u, az ), _mm_mul_ps( v, bz ) ), _mm_mul_ps( w, cz ) ) ), sign );
+    mask = _mm_and_ps( mask, _mm_and_ps( _mm_cmpge_ps( s, _mm_mul_ps( _mm_set1_ps( tmin ), abs_d ) ),
+                                         _mm_cmplt_ps( s, _mm_mul_ps( _mm_set1_ps( tmax ), abs_d ) ) ) );
+    _mm_storeu_ps( dist, s );
+    _mm_storeu_ps( det, abs_d );
+    return _mm_movemask_ps( mask );
+}
+#endif
+
+} // namespace
+
+
+WatertightRay makeWatertightRay( const float3& origin, const float3& dir )
+{
+    WatertightRay ray;
+    const float adx = fabsf( dir.x ), ady = fabsf( dir.y ), adz = fabsf( dir.z );
+    ray.kz = adx > ady ? ( adx > adz ? 0 : 2 ) : ( ady > adz ? 1 : 2 );
+    ray.kx = ray.kz == 2 ? 0 : ray.kz + 1;
+    ray.ky = ray.kx == 2 ? 0 : ray.kx + 1;
+
+    // Keep the winding the same for either sign of the dominant component
+    const float d[3] = { dir.x, dir.y, dir.z };
+    if( d[ray.kz] < 0.0f )
+        std::swap( ray.kx, ray.ky );
+
+    ray.sx = d[ray.kx] / d[ray.kz];
+    ray.sy = d[ray.ky] / d[ray.kz];
+    ray.sz = 1.0f / d[ray.kz];
+    ray.origin[0] = origin.x;
+    ray.origin[1] = origin.y;
+    ray.origin[2] = origin.z;
+    return ray;
+}
+
+
+void orderTriangleBlocks( const std::vector<float3>& vertices, const std::vector<int3>& triangles,
+                          std::vector<uint32_t>& block_triangles )
+{
+    const size_t count = triangles.size();
+
+    std::vector<float3> centroids( count );
+    for( size_t i = 0; i < count; ++i )
+    {
+        const int3& tri = triangles[i];
+        centroids[i] = ( vertices[tri.x] + vertices[tri.y] + vertices[tri.z] ) * ( 1.0f / 3.0f );
+    }
+    std::vector<uint32_t> order;
+    sutil::mortonOrder( centroids.data(), count, order );
+
+    const size_t num_blocks = ( count + TRIANGLE_BLOCK_SIZE - 1 ) / TRIANGLE_BLOCK_SIZE;
+    block_triangles.resize( num_blocks * TRIANGLE_BLOCK_SIZE );
+    for( size_t slot = 0; slot < block_triangles.size(); ++slot )
+    {
+        const size_t source = slot < count ? slot : slot - slot % TRIANGLE_BLOCK_SIZE;
+        block_triangles[slot] = order[source];
+    }
+}
+
+
+void gatherTriangleBlocks( const std::vector<float3>& vertices, const std::vector<int3>& triangles,
+                           const std::vector<uint32_t>& block_triangles, std::vector<TriangleBlock>& blocks )
+{
+    blocks.resize( block_triangles.size() / TRIANGLE_BLOCK_SIZE );
+    for( size_t slot = 0; slot < block_triangles.size(); ++slot )
+    {
+        TriangleBlock& block = blocks[slot / TRIANGLE_BLOCK_SIZE];
+        const unsigned int lane = slot % TRIANGLE_BLOCK_SIZE;
+        const int3& tri = triangles[block_triangles[slot]];
+        const float3 p[3] = { vertices[tri.x], vertices[tri.y], vertices[tri.z] };
+        for( int v = 0; v < 3; ++v )
+        {
+            block.p[v][0][lane] = p[v].x;
+            block.p[v][1][lane] = p[v].y;
+            block.p[v][2][lane] = p[v].z;
+        }
+    }
+}
+
+
+Aabb triangleBlockBounds( const TriangleBlock& block )
+{
+    Aabb box;
+    for( int v = 0; v < 3; ++v )
+        for( unsigned int lane = 0; lane < TRIANGLE_BLOCK_SIZE; ++lane )
+            box.include( make_float3( block.p[v][0][lane], block.p[v][1][lane], block.p[v][2][lane] ) );
+    return box;
+}
+
+
+bool intersectTriangleBlock( const TriangleBlock& block, const WatertightRay& ray, float tmin, float& tmax,
+                             unsigned int& hit_lane, bool any_hit )
+{
+    float dist[TRIANGLE_BLOCK_SIZE];
+    float det[TRIANGLE_BLOCK_SIZE];
+    int   bits = 0;
+
+#if defined( TRIANGLE_BLOCKS_USE_AVX )
+    const __m256 ox = _mm256_set1_ps( ray.origin[ray.kx] );
+    const __m256 oy = _mm256_set1_ps( ray.origin[ray.ky] );
+    const __m256 oz = _mm256_set1_ps( ray.origin[ray.kz] );
+    const __m256 sx = _mm256_set1_ps( ray.sx );
+    const __m256 sy = _mm256_set1_ps( ray.sy );
+
+    const __m256 az = _mm256_sub_ps( _mm256_loadu_ps( block.p[0][ray.kz] ), oz );
+    const __m256 bz = _mm256_sub_ps( _mm256_loadu_ps( block.p[1][ray.kz] ), oz );
+    const __m256 cz = _mm256_sub_ps( _mm256_loadu_ps( block.p[2][ray.kz] ), oz );
+    const __m256 sax = _mm256_sub_ps( _mm256_sub_ps( _mm256_loadu_ps( block.p[0][ray.kx] ), ox ), _mm256_mul_ps( sx, az ) );
+    const __m256 say = _mm256_sub_ps( _mm256_sub_ps( _mm256_loadu_ps( block.p[0][ray.ky] ), oy ), _mm256_mul_ps( sy, az ) );
+    const __m256 sbx = _mm256_sub_ps( _mm256_sub_ps( _mm256_loadu_ps( block.p[1][ray.kx] ), ox ), _mm256_mul_ps( sx, bz ) );
+    const __m256 sby = _mm256_sub_ps( _mm256_sub_ps( _mm256_loadu_ps( block.p[1][ray.ky] ), oy ), _mm256_mul_ps( sy, bz ) );
+    const __m256 scx = _mm256_sub_ps( _mm256_sub_ps( _mm256_loadu_ps( block.p[2][ray.kx] ), ox ), _mm256_mul_ps( sx, cz ) );
+    const __m256 scy = _mm256_sub_ps( _mm256_sub_ps( _mm256_loadu_ps( block.p[2][ray.ky] ), oy ), _mm256_mul_ps( sy, cz ) );
+
+    const __m256 u = _mm256_sub_ps( _mm256_mul_ps( scx, sby ), _mm256_mul_ps( scy, sbx ) );
+    const __m256 v = _mm256_sub_ps( _mm256_mul_ps( sax, scy ), _mm256_mul_ps( say, scx ) );
+    const __m256 w = _mm256_sub_ps( _mm256_mul_ps( sbx, say ), _mm256_mul_ps( sby, sax ) );
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 any_negative = _mm256_or_ps( _mm256_or_ps( _mm256_cmp_ps( u, zero, _CMP_LT_OQ ), _mm256_cmp_ps( v, zero, _CMP_LT_OQ ) ),
+                                              _mm256_cmp_ps( w, zero, _CMP_LT_OQ ) );
+    const __m256 any_positive = _mm256_or_ps( _mm256_or_ps( _mm256_cmp_ps( u, zero, _CMP_GT_OQ ), _mm256_cmp_ps( v, zero, _CMP_GT_OQ ) ),
+                                              _mm256_cmp_ps( w, zero, _CMP_GT_OQ ) );
+    const __m256 d = _mm256_add_ps( _mm256_add_ps( u, v ), w );
+    __m256 mask = _mm256_andnot_ps( _mm256_and_ps( any_negative, any_positive ), _mm256_cmp_ps( d, zero, _CMP_NEQ_UQ ) );
+    if( !_mm256_movemask_ps( mask ) )
+        return false;
+
+    // Range test on t * |det|, the division is left for the lanes that hit
+    const __m256 sign = _mm256_and_ps( d, _mm256_set1_ps( -0.0f ) );
+    const __m256 abs_d = _mm256_xor_ps( d, sign );
+    const __m256 s = _mm256_xor_ps( _mm256_mul_ps( _mm256_set1_ps( ray.sz ),
+        _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( u, az ), _mm256_mul_ps( v, bz ) ), _mm256_mul_ps( w, cz ) ) ), sign );
+    mask = _mm256_and_ps( mask, _mm256_and_ps( _mm256_cmp_ps( s, _mm256_mul_ps( _mm256_set1_ps( tmin ), abs_d ), _CMP_GE_OQ ),
+                                               _mm256_cmp_ps( s, _mm256_mul_ps( _mm256_set1_ps( tmax ), abs_d ), _CMP_LT_OQ ) ) );
+    _mm256_storeu_ps( dist, s );
+    _mm256_storeu_ps( det, abs_d );
+    bits = _mm256_movemask_ps( mask );
+#elif defined( TRIANGLE_BLOCKS_USE_SSE )
+    bits = intersectLanes4( block, 0, ray, tmin, tmax, dist, det );
+    if( !( any_hit && bits ) )
+        bits |= intersectLanes4( block, 4, ray, tmin, tmax, dist + 4, det + 4 ) << 4;
+#else
+    for( unsigned int lane = 0; lane < TRIANGLE_BLOCK_SIZE; ++lane )
+    {
+        const float3 p0 = make_float3( block.p[0][0][lane], block.p[0][1][lane], block.p[0][2][lane] );
+        const float3 p1 = make_float3( block.p[1][0][lane], block.p[1][1][lane], block.p[1][2][lane] );
+        const float3 p2 = make_float3( block.p[2][0][lane], block.p[2][1][lane], block.p[2][2][lane] );
+        if( intersectWatertight( p0, p1, p2, ray, tmin, tmax, dist[lane], det[lane] ) )
+            bits |= 1 << lane;
+    }
+#endif
+
+    // Rounding of the division can put t a hair outside the range tested
+    bool hit = false;
+    for( unsigned int lane = 0; bits; ++lane, bits >>= 1 )
+    {
+        if( !( bits & 1 ) )
+            continue;
+        const float t = dist[lane] / det[lane];
+        if( t >= tmin && t < tmax )
+        {
+            tmax     = t;
+            hit_lane = lane;
+            hit      = true;
+            if( any_hit )
+                break;
+        }
+    }
+    return hit;
+}
+
+
+bool intersectTriangle( const float3& p0, const float3& p1, const float3& p2, const WatertightRay& ray,
+                        float tmin, float& tmax )
+{
+    float dist, det;
+    if( !intersectWatertight( p0, p1, p2, ray, tmin, tmax, dist, det ) )
+        return false;
+    const float t = dist / det;
+    if( !( t >= tmin && t < tmax ) )
+        return false;
+    tmax = t;
+    return true;
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#pragma once
+
+#include <optixu/optixu_aabb_namespace.h>
+#include <optixu/optixu_math_namespace.h>
+
+#include <stdint.h>
+#include <vector>
+
+
+//------------------------------------------------------------------------------
+//
+// Triangle storage for host tracing: triangles are ordered along a Morton
+// curve of their centroids and their vertices gathered into SoA blocks of
+// TRIANGLE_BLOCK_SIZE, so a leaf test loads whole lanes without going
+// through the index buffer.  Padding lanes repeat the block's first triangle,
+// which keeps them out of the bounds and never changes a result.
+//
+// The intersector is watertight (Woop, Benthin and Wald 2013): vertices are
+// translated to the ray origin and sheared so the ray runs along +z, and the
+// 2D edge functions are evaluated in a way that is consistent for the two
+// triangles sharing an edge.  Rays through shared edges or vertices cannot
+// slip between triangles.  Built with AVX (the USE_AVX CMake option) all
+// lanes of a block are tested at once, otherwise with SSE in two halves.
+//
+//------------------------------------------------------------------------------
+
+static const unsigned int TRIANGLE_BLOCK_SIZE = 8;
+
+
+struct TriangleBlock
+{
+    float p[3][3][TRIANGLE_BLOCK_SIZE];     // Vertex, axis, lane
+};
+
+
+// Per ray setup of the watertight test
+struct WatertightRay
+{
+    int   kx, ky, kz;                       // kz is the dominant axis of the direction
+    float sx, sy, sz;                       // Shear
+    float origin[3];
+};
+
+WatertightRay makeWatertightRay( const optix::float3& origin, const optix::float3& dir );
+
+
+// Lane order of the blocks for a triangle mesh: triangle per lane, padded to
+// a whole number of blocks
+void orderTriangleBlocks( const std::vector<optix::float3>& vertices, const std::vector<optix::int3>& triangles,
+                          std::vector<uint32_t>& block_triangles );
+
+// (Re)gather vertex positions into blocks in the given lane order
+void gatherTriangleBlocks( const std::vector<optix::float3>& vertices, const std::vector<optix::int3>& triangles,
+                           const std::vector<uint32_t>& block_triangles, std::vector<TriangleBlock>& blocks );
+
+optix::Aabb triangleBlockBounds( const TriangleBlock& block );
+
+// Hit in [tmin, tmax) on any lane of the block.  Shortens tmax to the
+// closest hit, or with any_hit to some hit, and returns its lane.
+bool intersectTriangleBlock( const TriangleBlock& block, const WatertightRay& ray, float tmin, float& tmax,
+                             unsigned int& hit_lane, bool any_hit );
+
+// The same test for a single triangle, eg one read through an index buffer
+bool intersectTriangle( const optix::float3& p0, const optix::float3& p1, const optix::float3& p2,
+                        const WatertightRay& ray, float tmin, float& tmax );
@@ -48,16 +48,31 @@
 #include <optixu/optixu_math_stream_namespace.h>
 
 #include "optixPathTracer.h"
+#include "HostRasterizer.h"
+#include "HostScene.h"
+#include "HostShadowPass.h"
+#include "LightDepthPyramid.h"
+#include "ParticleSequence.h"
+#include "QuadSoup.h"
+#include "Scene.h"
+#include "SphereGrid.h"
 #include <sutil.h>
 #include <Arcball.h>
+#include <ImageWriter.h>
 #include <OptiXMesh.h>
+#include <TextureCache.h>
 
 #include <algorithm>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <iostream>
 #include <stdint.h>
 #include <list>
+#include <map>
+#include <memory>
 #include <numeric>
+#include <stdexcept>
 #include <vector>
 
 using namespace optix;
@@ -81,7 +96,148 @@ int            rr_begin_depth = 1;
 Program        pgram_intersection = 0;
 Program        pgram_bounding_box = 0;
 
-uint           objectID = 0;
+uint           objectID = 0;         // Last object ID handed out
+
+// Non-emitting quads of the scene, packed into one geometry (quad_soup.cu).
+// Each quad reports its own material, which carries its color and object ID.
+QuadSoup       quad_soup;
+Geometry       quad_soup_geometry = 0;
+Buffer         quad_soup_blocks = 0;
+Program        quad_soup_intersection = 0;
+Program        quad_soup_bounding_box = 0;
+unsigned int   quad_soup_host_handle = ~0u;
+
+// Scene state.  With reorder_meshes, mesh triangles and vertices are sorted
+// spatially on load, for the locality of BVH builds and host traversal.
+std::string      scene_file;
+SceneDescription scene;
+bool             reorder_meshes = false;
+
+// Scene meshes load on the thread pool from before the context is created.
+// With progressive_load the first frames render without the meshes still
+// loading, which updateScene() adds to the static groups as they finish,
+// under the object IDs loadGeometry() reserved for them.
+SceneMeshLoader  mesh_loader;
+bool             progressive_load = false;
+std::map<size_t, unsigned int> pending_mesh_ids;   // Object index -> ID
+
+// Particle sequences, rendered as spheres in their own acceleration structure
+// that is rebuilt whenever a new frame is swapped in.  Sequences either stream
+// snapshots from disk or, with substeps > 0, keep all snapshots resident and
+// interpolate a new set of positions every rendered frame.
+struct ParticleObject
+{
+    std::shared_ptr<ParticleSequence> sequence;     // Streaming playback
+    std::vector<ParticleFrame> frames;              // Interpolated playback
+    ParticleFrame    interpolated;
+    int              substeps;
+    float            velocity_scale;
+    unsigned int     step;
+    Matrix4x4        transform;
+    float            radius_scale;
+    std::vector<float4> world;      // Transformed spheres of the current frame
+    Geometry         geometry;
+    Buffer           spheres;       // float4 center and radius
+    int              frame;         // Sequence frame currently in spheres
+
+    // Uniform grid acceleration, rebuilt per frame instead of the BVH
+    std::shared_ptr<SphereGrid> grid;
+    Buffer           grid_cell_start;
+    Buffer           grid_items;
+
+    unsigned int     object_id;
+    unsigned int     host_handle;   // Object in host_scene when host tracing
+};
+std::vector<ParticleObject> particle_objects;
+Program          sphere_intersection = 0;
+Program          sphere_bounding_box = 0;
+Program          sphere_grid_intersection = 0;
+Program          sphere_grid_bounding_box = 0;
+GeometryGroup    dynamic_group = 0;
+Group            top_group = 0;
+
+// Host tracing path: a copy of the scene geometry in HostBVHs, rebuilt per
+// frame for animated objects, used to trace shadow rays on the CPU from the
+// primary hits of the GPU pass.  With host_raster the primary hits are
+// rasterized on the CPU as well.  With shadow_proxy_ratio set, shadow
+// casting meshes get simplified proxies keeping that fraction of their
+// triangles, which pixels with a wide predicted penumbra trace against.
+// With host_compact, meshes keep compressed hierarchies.  With
+// verify_occluder_cache, rays answered by the shadow pass's occluder cache
+// are traced again and disagreements shown.
+bool             host_trace = false;
+bool             host_raster = false;
+bool             host_compact = false;
+bool             verify_occluder_cache = false;
+float            shadow_proxy_ratio = 0.0f;
+HostScene        host_scene;
+HostShadowPass   host_shadow_pass;
+HostRasterizer   host_rasterizer;
+Buffer           host_visibility_buffer = 0;
+std::vector<float3> host_hits;
+std::vector<float3> host_normals;
+std::vector<float3> host_ffnormals;
+std::vector<float>  host_object_ids;
+std::vector<float>  host_d1;
+std::vector<float>  host_d2_min;
+std::vector<float>  host_d2_max;
+
+// Ray free d1 / d2 estimate from a light space depth pyramid of the host
+// casters, shown in the distance heatmaps instead of the first pass ones
+// when LIGHT_PYRAMID is on
+LightDepthPyramid light_depth_pyramid;
+Buffer           light_d1_buffer = 0;
+Buffer           light_d2_min_buffer = 0;
+Buffer           light_d2_max_buffer = 0;
+
+// Incremental scene edits by object ID, queued by the edit functions and
+// applied by updateScene() before the next launch.  The edits the scene file
+// schedules are issued through the same functions as their frame comes up.
+// Objects loaded with the scene share static_group (or dynamic_group for
+// particles); the first move takes an object out into its own GeometryGroup
+// under a Transform in top_group, so later moves only rebuild the top level.
+// Added objects start out that way.  Recoloring only sets a variable.  Edits
+// of meshes progressive_load has not added yet stay queued until they are.
+struct SceneEntry
+{
+    SceneObjectType  type;
+    GeometryInstance instance;
+    GeometryGroup    group;         // Group holding instance
+    Transform        transform;     // Set once the object has its own group
+    unsigned int     host_handle;
+
+    // Casters are also in the shadow hierarchy: the instance in a shared
+    // caster group, or the Transform in shadower_group once isolated
+    bool             casts_shadow;
+    GeometryGroup    caster_group;
+
+    // Quads still in the quad soup share its instance and have a material
+    // of their own instead
+    int              quad;          // Index in quad_soup, -1 otherwise
+    Material         material;
+
+    // Textures the entry's mesh materials hold in the texture cache, given
+    // back when the entry is removed
+    std::vector<TextureSampler> textures;
+};
+std::map<unsigned int, SceneEntry> scene_entries;
+std::vector<SceneEdit> scene_edits;
+size_t           next_scene_edit = 0;   // First of scene.edits not issued
+int              scene_frame = 0;       // Frames updateScene() has prepared
+GeometryGroup    static_group = 0;
+Material         diffuse_material = 0;
+bool             host_scene_dirty = false;
+
+// top_shadower is a second hierarchy over only the objects flagged to cast
+// shadows, without the lights, set up for the shadow rays of the AA.cu
+// programs.  AA.cu is not in this tree, so only the host shadow pass, through
+// host_scene and host_shadow_pass, is known to honor the flags.  It shares
+// GeometryInstances and Transforms with top_object but has acceleration
+// structures of its own, and is caster_group until the scene needs a top
+// level.
+GeometryGroup    caster_group = 0;
+GeometryGroup    dynamic_caster_group = 0;
+Group            shadower_group = 0;
 
 // Camera state
 float3         camera_up;
@@ -91,6 +247,7 @@ Matrix4x4      camera_rotate;
 float          camera_pitch;
 float          camera_yaw;
 float3         camera_pos;
+float          camera_fov = 35.0f;
 bool           camera_changed = true;
 sutil::Arcball arcball;
 
@@ -116,9 +273,18 @@ bool           SPP = false;
 bool           BETA = false;
 bool           OBJID = false;
 bool           GROUND = false;
+bool           HOST_VISIBILITY = false;
+bool           LIGHT_PYRAMID = false;
 
 float          non_adaptive_spp = 500;
 
+// Saved images are written by image_writer on its own thread.  With
+// save_frames_file set, the result of every frame is queued as
+// <name>_<frame>.<ext> and dropped if the writer falls behind.
+std::unique_ptr<sutil::ImageWriter> image_writer;
+std::string    save_frames_file;
+unsigned int   saved_frame_count = 0;
+
 //------------------------------------------------------------------------------
 //
 // Forward decls 
@@ -126,6 +292,8 @@ float          non_adaptive_spp = 500;
 //------------------------------------------------------------------------------
 
 Buffer getOutputBuffer();
+sutil::ImageWriter& imageWriter();
+void saveFrame();
 void destroyContext();
 void registerExitHandler();
 void createContext();
@@ -133,6 +301,15 @@ void loadGeometry();
 void setupCamera();
 void updateCamera();
 void updateScene();
+unsigned int addSceneObject(const SceneObject& object);
+void removeSceneObject(unsigned int object_id);
+void transformSceneObject(unsigned int object_id, const Matrix4x4& transform);
+void recolorSceneObject(unsigned int object_id, const float3& color);
+void issueSceneEdits(int frame);
+void applySceneEdits();
+void traceHostVisibility();
+void estimateLightDepth();
+void estimateHostPenumbra(const float3* hits, const float3* normals, unsigned int buffer_width, unsigned int buffer_height);
 void glutInitialize( int* argc, char** argv );
 void glutRun();
 
@@ -156,10 +333,64 @@ Buffer getOutputBuffer()
 }
 
 
+sutil::ImageWriter& imageWriter()
+{
+    if( !image_writer )
+        image_writer.reset( new sutil::ImageWriter );
+    return *image_writer;
+}
+
+
+void saveFrame()
+{
+    // Number the frame before the extension, if the file name has one
+    const size_t slash = save_frames_file.find_last_of( "/\\" );
+    size_t       dot   = save_frames_file.find_last_of( '.' );
+    if( dot == std::string::npos || ( slash != std::string::npos && dot < slash ) )
+        dot = save_frames_file.size();
+
+    char number[32];
+    sprintf( number, "_%05u", saved_frame_count++ );
+    std::string filename = save_frames_file;
+    filename.insert( dot, number );
+
+    // The denoised result the default view shows
+    imageWriter().write( filename, context[ "denoised_result_buffer" ]->getBuffer(), true );
+}
+
+
+void releaseTextures( SceneEntry& entry )
+{
+    // Kept by the cache until purged, in case the scene brings them back
+    for( size_t i = 0; i < entry.textures.size(); ++i )
+        sutil::defaultTextureCache().release( entry.textures[i] );
+    entry.textures.clear();
+}
+
+
 void destroyContext()
 {
+    // Write the images still queued
+    if( image_writer )
+    {
+        if( image_writer->numDropped() )
+            std::cerr << image_writer->numDropped() << " frames dropped while the image writer was busy\n";
+        image_writer.reset();
+    }
+
+    for( std::map<unsigned int, SceneEntry>::iterator it = scene_entries.begin(); it != scene_entries.end(); ++it )
+        releaseTextures( it->second );
+    particle_objects.clear();
+    scene_entries.clear();
+    scene_edits.clear();
+    host_visibility_buffer = 0;
+
     if( context )
     {
+        // Destroy what nothing holds any more, and forget what still is,
+        // eg by meshes the scene does not know about
+        sutil::defaultTextureCache().purge();
+        sutil::defaultTextureCache().releaseContext( context );
         context->destroy();
         context = 0;
     }
@@ -189,12 +420,11 @@ void setMaterial(
 
 
 GeometryInstance createParallelogram(
+        unsigned int object_id,
         const float3& anchor,
         const float3& offset1,
         const float3& offset2)
 {
-    objectID++;
-
     Geometry parallelogram = context->createGeometry();
     parallelogram->setPrimitiveCount( 1u );
     parallelogram->setIntersectionProgram( pgram_intersection );
@@ -214,7 +444,7 @@ GeometryInstance createParallelogram(
 
     GeometryInstance gi = context->createGeometryInstance();
     gi->setGeometry(parallelogram);
-    gi["object_id"]->setUint(objectID);
+    gi["object_id"]->setUint(object_id);
     return gi;
 }
 
@@ -229,6 +459,7 @@ void createContext()
 
     context[ "scene_epsilon"                  ]->setFloat( 0.1f );
     context[ "rr_begin_depth"                 ]->setUint( rr_begin_depth );
+    context[ "receives_shadow"                ]->setInt( 1 );       // Overridden per object
 
     Buffer buffer = sutil::createOutputBuffer( context, RT_FORMAT_FLOAT4, width, height, use_pbo );
     context["output_buffer"]->set( buffer );
@@ -319,56 +550,265 @@ void createContext()
     context["non_adaptive_spp"]->setFloat(non_adaptive_spp);
 }
 
-GeometryInstance loadMesh(const std::string& filename, Material material, const float3 color, const Matrix4x4& mat)
+GeometryInstance createMesh(unsigned int object_id, const Mesh& host_mesh, Material material,
+    const float3 color, std::vector<TextureSampler>& textures)
 {
     OptiXMesh mesh;
     mesh.context = context;
     mesh.use_tri_api = false;
     mesh.ignore_mats = false;
     mesh.material = material;
-    loadMesh(filename, mesh, mat);
+    uploadMesh(host_mesh, mesh);
+    textures.insert(textures.end(), mesh.textures.begin(), mesh.textures.end());
 
     GeometryInstance gi = mesh.geom_instance;
-    gi["object_id"]->setUint(++objectID);
-    //gi->addMaterial(material);
+    gi["object_id"]->setUint(object_id);
     gi["diffuse_color"]->setFloat(color);
     return gi;
 }
 
+GeometryInstance createSceneMesh(unsigned int object_id, const SceneObject& object, Mesh& mesh, Mesh& proxy,
+    SceneEntry& entry)
+{
+    // Device and host copies of a loaded mesh and its proxy, which are freed
+    GeometryInstance gi = createMesh(object_id, mesh, diffuse_material, object.color, entry.textures);
+    unsigned int& host_handle = entry.host_handle;
+    host_handle = ~0u;
+    if (host_trace)
+    {
+        host_handle = host_scene.addTriangles(object_id, mesh.positions, mesh.num_vertices,
+            mesh.tri_indices, mesh.num_triangles);
+        if (host_compact)
+            host_scene.setUpdateMode(host_handle, HOST_UPDATE_COMPRESSED);
+        if (proxy.num_triangles)
+            host_scene.setShadowProxy(host_handle, proxy.positions, proxy.num_vertices,
+                proxy.tri_indices, proxy.num_triangles);
+    }
+    freeMesh(mesh);
+    freeMesh(proxy);
+    return gi;
+}
+
+template<typename T>
+void uploadToBuffer(Buffer buffer, const T* data, size_t count)
+{
+    // Buffers only grow; geometry reads at most the primitive count or the
+    // ranges stored alongside
+    RTsize size;
+    buffer->getSize(size);
+    if (size < count)
+        buffer->setSize(count);
+    if (count)
+    {
+        memcpy(buffer->map(), data, count * sizeof(T));
+        buffer->unmap();
+    }
+}
+
+void uploadParticles(ParticleObject& particles, const ParticleFrame& frame)
+{
+    const float* m = particles.transform.getData();
+    particles.world.resize(frame.count);
+    for (size_t i = 0; i < frame.count; ++i)
+    {
+        const float x = frame.px[i], y = frame.py[i], z = frame.pz[i];
+        particles.world[i] = make_float4(
+            m[0] * x + m[1] * y + m[2]  * z + m[3],
+            m[4] * x + m[5] * y + m[6]  * z + m[7],
+            m[8] * x + m[9] * y + m[10] * z + m[11],
+            frame.radius[i] * particles.radius_scale);
+    }
+    uploadToBuffer(particles.spheres, particles.world.data(), particles.world.size());
+    if (particles.host_handle != ~0u)
+        host_scene.setSpheres(particles.host_handle, particles.world.data(), particles.world.size());
+
+    if (particles.grid)
+    {
+        SphereGrid& grid = *particles.grid;
+        grid.build(particles.world.data(), particles.world.size());
+        uploadToBuffer(particles.grid_cell_start, grid.cellStart().data(), grid.cellStart().size());
+        uploadToBuffer(particles.grid_items, grid.items().data(), grid.items().size());
+        particles.geometry["grid_min"]->setFloat(grid.boundsMin());
+        particles.geometry["grid_max"]->setFloat(grid.boundsMax());
+        particles.geometry["grid_cell_size"]->setFloat(grid.cellSize());
+        particles.geometry["grid_dims"]->setInt(grid.dims());
+        particles.geometry->setPrimitiveCount(1u);
+    }
+    else
+    {
+        particles.geometry->setPrimitiveCount(static_cast<unsigned int>(frame.count));
+    }
+    particles.frame = frame.frame;
+}
+
+GeometryInstance createParticles(unsigned int object_id, const SceneObject& object, Material material)
+{
+    ParticleObject particles;
+    particles.substeps = object.substeps;
+    particles.velocity_scale = object.velocity_scale;
+    particles.step = 0;
+    particles.object_id = 0;
+    particles.host_handle = ~0u;
+    particles.transform = object.transform;
+    if (particles.substeps > 0)
+    {
+        ParticleSequence::loadAllFrames(object.filename, object.first_frame, object.last_frame, particles.frames);
+    }
+    else
+    {
+        particles.sequence.reset(new ParticleSequence);
+        particles.sequence->open(object.filename, object.first_frame, object.last_frame);
+    }
+
+    // Radii scale with the cube root of the volume change
+    const float* m = object.transform.getData();
+    const float det = m[0] * (m[5] * m[10] - m[6] * m[9])
+                    - m[1] * (m[4] * m[10] - m[6] * m[8])
+                    + m[2] * (m[4] * m[9]  - m[5] * m[8]);
+    particles.radius_scale = cbrtf(fabsf(det));
+
+    particles.spheres = context->createBuffer(RT_BUFFER_INPUT, RT_FORMAT_FLOAT4, 0);
+    particles.geometry = context->createGeometry();
+    particles.geometry["sphere_buffer"]->setBuffer(particles.spheres);
+    if (object.particle_grid)
+    {
+        particles.grid.reset(new SphereGrid);
+        particles.grid_cell_start = context->createBuffer(RT_BUFFER_INPUT, RT_FORMAT_UNSIGNED_INT, 0);
+        particles.grid_items = context->createBuffer(RT_BUFFER_INPUT, RT_FORMAT_UNSIGNED_INT, 0);
+        particles.geometry->setIntersectionProgram(sphere_grid_intersection);
+        particles.geometry->setBoundingBoxProgram(sphere_grid_bounding_box);
+        particles.geometry["grid_cell_start"]->setBuffer(particles.grid_cell_start);
+        particles.geometry["grid_items"]->setBuffer(particles.grid_items);
+    }
+    else
+    {
+        particles.geometry->setIntersectionProgram(sphere_intersection);
+        particles.geometry->setBoundingBoxProgram(sphere_bounding_box);
+    }
+
+    GeometryInstance gi = context->createGeometryInstance();
+    gi->setGeometry(particles.geometry);
+    gi["object_id"]->setUint(object_id);
+    particles.object_id = object_id;
+    if (host_trace)
+    {
+        // Particles move coherently between frames, refitting is cheaper
+        // than rebuilding until the hierarchy has degraded
+        particles.host_handle = host_scene.addSpheres(object_id, 0, 0);
+        host_scene.setUpdateMode(particles.host_handle, HOST_UPDATE_REFIT);
+    }
+
+    // Waits for the first frame only, later frames are picked up by updateScene()
+    uploadParticles(particles, particles.sequence ? particles.sequence->nextFrame() : particles.frames[0]);
+    particle_objects.push_back(particles);
+
+    setMaterial(gi, material, "diffuse_color", object.color);
+    return gi;
+}
+
+Material createQuadMaterial(unsigned int object_id, const float3& color)
+{
+    // Same programs as the shared diffuse material.  The soup instance does
+    // not set diffuse_color or object_id, so these are found here.
+    Material material = context->createMaterial();
+    material->setClosestHitProgram(0, diffuse_material->getClosestHitProgram(0));
+    material->setAnyHitProgram(1, diffuse_material->getAnyHitProgram(1));
+    material["diffuse_color"]->setFloat(color);
+    material["object_id"]->setUint(object_id);
+    return material;
+}
+
+void setShadowFlags(SceneEntry& entry, unsigned int object_id, const SceneObject& object)
+{
+    // receives_shadow is set up for the AA.cu programs, like top_shadower.
+    // It defaults to 1 on the context; soup quads set it on their material
+    // since they share an instance
+    entry.casts_shadow = object.casts_shadow;
+    entry.caster_group = 0;
+    if (!object.casts_shadow && entry.host_handle != ~0u)
+        host_scene.setCastsShadow(entry.host_handle, false);
+    if (!object.receives_shadow)
+    {
+        if (entry.material)
+            entry.material["receives_shadow"]->setInt(0);
+        else
+            entry.instance["receives_shadow"]->setInt(0);
+    }
+    host_shadow_pass.setReceivesShadow(object_id, object.receives_shadow);
+}
+
+GeometryInstance createQuadSoup()
+{
+    quad_soup.build();
+    const std::vector<QuadBlock>& blocks = quad_soup.blocks();
+    const std::vector<uint32_t>& slot_quads = quad_soup.slotQuads();
+
+    quad_soup_blocks = context->createBuffer(RT_BUFFER_INPUT);
+    quad_soup_blocks->setFormat(RT_FORMAT_USER);
+    quad_soup_blocks->setElementSize(sizeof(QuadBlock));
+    quad_soup_blocks->setSize(blocks.size());
+    memcpy(quad_soup_blocks->map(), blocks.data(), blocks.size() * sizeof(QuadBlock));
+    quad_soup_blocks->unmap();
+
+    // Materials are in quad order; padding slots can never be hit
+    std::vector<unsigned int> slot_materials(slot_quads.size());
+    for (size_t slot = 0; slot < slot_quads.size(); ++slot)
+        slot_materials[slot] = slot_quads[slot] == QuadSoup::NO_QUAD ? 0u : slot_quads[slot];
+    Buffer materials = context->createBuffer(RT_BUFFER_INPUT, RT_FORMAT_UNSIGNED_INT, slot_materials.size());
+    memcpy(materials->map(), slot_materials.data(), slot_materials.size() * sizeof(unsigned int));
+    materials->unmap();
+
+    quad_soup_geometry = context->createGeometry();
+    quad_soup_geometry->setPrimitiveCount(static_cast<unsigned int>(blocks.size()));
+    quad_soup_geometry->setIntersectionProgram(quad_soup_intersection);
+    quad_soup_geometry->setBoundingBoxProgram(quad_soup_bounding_box);
+    quad_soup_geometry["quad_blocks"]->setBuffer(quad_soup_blocks);
+    quad_soup_geometry["quad_materials"]->setBuffer(materials);
+
+    GeometryInstance gi = context->createGeometryInstance();
+    gi->setGeometry(quad_soup_geometry);
+    gi->setMaterialCount(static_cast<unsigned int>(quad_soup.numQuads()));
+    std::vector<unsigned int> slot_ids(slot_quads.size(), 0u);
+    for (std::map<unsigned int, SceneEntry>::iterator it = scene_entries.begin(); it != scene_entries.end(); ++it)
+    {
+        const SceneEntry& entry = it->second;
+        if (entry.quad < 0)
+            continue;
+        gi->setMaterial(entry.quad, entry.material);
+        slot_ids[quad_soup.slot(entry.quad)] = it->first;
+    }
+
+    if (host_trace)
+        quad_soup_host_handle = host_scene.addQuadBlocks(blocks.data(), blocks.size(), slot_ids.data());
+    return gi;
+}
+
 void loadGeometry()
 {
-    // Light buffer
-    ParallelogramLight light;
-    light.corner   = make_float3( 343.0f, 548.6f, 227.0f);
-    light.v1       = make_float3( -130.0f, 0.0f, 0.0f);
-    light.v2       = make_float3( 0.0f, 0.0f, 105.0f);
-    light.normal   = normalize( cross(light.v1, light.v2) );
-    light.emission = make_float3( 25.0f, 25.0f, 25.0f );
+    // Light buffer, the first light drives the filter parameters
+    const ParallelogramLight& light = scene.lights[0].light;
 
     float3 norm = cross(light.v1, light.v2);
     float sigma = sqrt(length(norm) / 4.0f);
     context["light_sigma"]->setFloat(sigma);
     context["light_norm"]->setFloat(normalize(norm));
 
+    std::vector<ParallelogramLight> lights;
+    for (size_t i = 0; i < scene.lights.size(); ++i)
+        lights.push_back(scene.lights[i].light);
+
     Buffer light_buffer = context->createBuffer( RT_BUFFER_INPUT );
     light_buffer->setFormat( RT_FORMAT_USER );
     light_buffer->setElementSize( sizeof( ParallelogramLight ) );
-    light_buffer->setSize( 1u );
-    memcpy( light_buffer->map(), &light, sizeof( light ) );
+    light_buffer->setSize( lights.size() );
+    memcpy( light_buffer->map(), &lights[0], sizeof( ParallelogramLight ) * lights.size() );
     light_buffer->unmap();
     context["lights"]->setBuffer( light_buffer );
 
 
     // Set up material
     Material diffuse = context->createMaterial();
-    /*
-    const char *ptx = sutil::getPtxString( SAMPLE_NAME, "optixPathTracer.cu" );
-    Program diffuse_ch = context->createProgramFromPTXString( ptx, "diffuse" );
-    Program diffuse_ah = context->createProgramFromPTXString( ptx, "shadow" );
-    diffuse->setClosestHitProgram( 0, diffuse_ch );
-    diffuse->setAnyHitProgram( 1, diffuse_ah );
-    */
-    //const char* ptx = sutil::getPtxString(SAMPLE_NAME, "optixPathTracer.cu");
+    diffuse_material = diffuse;
     const char* ptx_aa = sutil::getPtxString(SAMPLE_NAME, "AA.cu");
 
     Program diffuse_ch = context->createProgramFromPTXString(ptx_aa, "geometry_hit");
@@ -385,178 +825,695 @@ void loadGeometry()
     pgram_bounding_box = context->createProgramFromPTXString(ptx_aa, "bounds" );
     pgram_intersection = context->createProgramFromPTXString(ptx_aa, "intersect" );
 
+    ptx_aa = sutil::getPtxString( SAMPLE_NAME, "quad_soup.cu" );
+    quad_soup_bounding_box = context->createProgramFromPTXString(ptx_aa, "bounds" );
+    quad_soup_intersection = context->createProgramFromPTXString(ptx_aa, "intersect" );
+
+    // Set up sphere programs for particles
+    ptx_aa = sutil::getPtxString( SAMPLE_NAME, "sphere.cu" );
+    sphere_bounding_box = context->createProgramFromPTXString(ptx_aa, "bounds" );
+    sphere_intersection = context->createProgramFromPTXString(ptx_aa, "intersect" );
+    ptx_aa = sutil::getPtxString( SAMPLE_NAME, "sphere_grid.cu" );
+    sphere_grid_bounding_box = context->createProgramFromPTXString(ptx_aa, "bounds" );
+    sphere_grid_intersection = context->createProgramFromPTXString(ptx_aa, "intersect" );
+
+    std::vector<GeometryInstance> gis;
+    std::vector<GeometryInstance> caster_gis;
+    std::vector<GeometryInstance> dynamic_gis;
+    std::vector<GeometryInstance> dynamic_caster_gis;
+    std::vector<unsigned int> dynamic_ids;
+    for (size_t i = 0; i < scene.objects.size(); ++i)
+    {
+        const SceneObject& object = scene.objects[i];
+        const unsigned int object_id = ++objectID;
+        SceneEntry entry;
+        entry.type = object.type;
+        entry.host_handle = ~0u;
+        entry.quad = -1;
+        if (object.type == SCENE_OBJECT_QUAD && object.casts_shadow)
+        {
+            // Instance and host copy are set up with the whole soup below.
+            // The soup only holds casters so it can be shared with caster_group.
+            entry.quad = static_cast<int>(quad_soup.add(object.anchor, object.v1, object.v2));
+            entry.material = createQuadMaterial(object_id, object.color);
+        }
+        else if (object.type == SCENE_OBJECT_QUAD)
+        {
+            gis.push_back(createParallelogram(object_id, object.anchor, object.v1, object.v2));
+            setMaterial(gis.back(), diffuse, "diffuse_color", object.color);
+            if (host_trace)
+                entry.host_handle = host_scene.addQuad(object_id, object.anchor, object.v1, object.v2);
+            entry.instance = gis.back();
+        }
+        else if (object.type == SCENE_OBJECT_PARTICLES)
+        {
+            dynamic_gis.push_back(createParticles(object_id, object, diffuse));
+            dynamic_ids.push_back(object_id);
+            entry.host_handle = particle_objects.back().host_handle;
+            entry.instance = dynamic_gis.back();
+            if (object.casts_shadow)
+                dynamic_caster_gis.push_back(entry.instance);
+        }
+        else if (progressive_load)
+        {
+            // Added by addLoadedMeshes() once loaded
+            pending_mesh_ids[i] = object_id;
+            continue;
+        }
+        else
+        {
+            // Meshes were loading since main() started
+            Mesh mesh, proxy;
+            mesh_loader.take(i, mesh, proxy);
+            gis.push_back(createSceneMesh(object_id, object, mesh, proxy, entry));
+            entry.instance = gis.back();
+            if (object.casts_shadow)
+                caster_gis.push_back(entry.instance);
+        }
+        setShadowFlags(entry, object_id, object);
+        scene_entries[object_id] = entry;
+    }
+
+    if (quad_soup.numQuads())
+    {
+        gis.push_back(createQuadSoup());
+        caster_gis.push_back(gis.back());
+        for (std::map<unsigned int, SceneEntry>::iterator it = scene_entries.begin(); it != scene_entries.end(); ++it)
+        {
+            if (it->second.quad >= 0)
+            {
+                it->second.instance = gis.back();
+                it->second.host_handle = quad_soup_host_handle;
+            }
+        }
+    }
+
+    // Lights
+    for (size_t i = 0; i < scene.lights.size(); ++i)
+    {
+        const SceneLight& scene_light = scene.lights[i];
+        const unsigned int light_id = ++objectID;
+        gis.push_back(createParallelogram(light_id, scene_light.light.corner,
+            scene_light.light.v1,
+            scene_light.light.v2));
+        setMaterial(gis.back(), diffuse_light, "emission_color", scene_light.emission_color);
+        if (host_trace)
+        {
+            // Seen by the host rasterizer, never by shadow rays
+            const unsigned int handle = host_scene.addQuad(light_id, scene_light.light.corner,
+                scene_light.light.v1, scene_light.light.v2);
+            host_scene.setCastsShadow(handle, false);
+        }
+    }
+
+    // Create geometry group
+    GeometryGroup geometry_group = context->createGeometryGroup(gis.begin(), gis.end());
+    geometry_group->setAcceleration(context->createAcceleration("Trbvh"));
+    static_group = geometry_group;
+    for (std::map<unsigned int, SceneEntry>::iterator it = scene_entries.begin(); it != scene_entries.end(); ++it)
+        it->second.group = geometry_group;
+
+    // Create shadow caster group (no lights)
+    caster_group = context->createGeometryGroup(caster_gis.begin(), caster_gis.end());
+    caster_group->setAcceleration(context->createAcceleration("Trbvh"));
+    for (std::map<unsigned int, SceneEntry>::iterator it = scene_entries.begin(); it != scene_entries.end(); ++it)
+    {
+        if (it->second.casts_shadow)
+            it->second.caster_group = caster_group;
+    }
 
-    // cornell box
-    /*
+    if (host_trace)
     {
+        host_scene.commit();
+        std::cerr << "Host scene: " << host_scene.numObjects() << " objects built in "
+                  << host_scene.lastCommitTime() << " ms, "
+                  << host_scene.memoryBytes() / ( 1024.0 * 1024.0 ) << " MB\n";
+        if (host_scene.cache().enabled())
+            std::cerr << "Host BVH cache: " << host_scene.cache().numHits() << " loaded, "
+                      << host_scene.cache().numMisses() << " built, "
+                      << host_scene.cache().time() << " ms in cache files\n";
+    }
 
-        // create geometry instances
-        std::vector<GeometryInstance> gis;
-
-        const float3 white = make_float3(0.8f, 0.8f, 0.8f);
-        const float3 green = make_float3(0.05f, 0.8f, 0.05f);
-        const float3 red = make_float3(0.8f, 0.05f, 0.05f);
-        const float3 light_em = make_float3(15.0f, 15.0f, 5.0f);
-
-        // Floor
-        gis.push_back(createParallelogram(make_float3(0.0f, 0.0f, 0.0f),
-            make_float3(0.0f, 0.0f, 559.2f),
-            make_float3(556.0f, 0.0f, 0.0f)));
-        setMaterial(gis.back(), diffuse, "diffuse_color", white);
-
-        // Ceiling
-        gis.push_back(createParallelogram(make_float3(0.0f, 548.8f, 0.0f),
-            make_float3(556.0f, 0.0f, 0.0f),
-            make_float3(0.0f, 0.0f, 559.2f)));
-        setMaterial(gis.back(), diffuse, "diffuse_color", white);
-
-        // Back wall
-        gis.push_back(createParallelogram(make_float3(0.0f, 0.0f, 559.2f),
-            make_float3(0.0f, 548.8f, 0.0f),
-            make_float3(556.0f, 0.0f, 0.0f)));
-        setMaterial(gis.back(), diffuse, "diffuse_color", white);
-
-        // Right wall
-
-        gis.push_back(createParallelogram(make_float3(0.0f, 0.0f, 0.0f),
-            make_float3(0.0f, 548.8f, 0.0f),
-            make_float3(0.0f, 0.0f, 559.2f)));
-        setMaterial(gis.back(), diffuse, "diffuse_color", green);
-
-        // Left wall
-        gis.push_back(createParallelogram(make_float3(556.0f, 0.0f, 0.0f),
-            make_float3(0.0f, 0.0f, 559.2f),
-            make_float3(0.0f, 548.8f, 0.0f)));
-        setMaterial(gis.back(), diffuse, "diffuse_color", red);
-
-        // Short block
-        gis.push_back(createParallelogram(make_float3(130.0f, 165.0f, 65.0f),
-            make_float3(-48.0f, 0.0f, 160.0f),
-            make_float3(160.0f, 0.0f, 49.0f)));
-        setMaterial(gis.back(), diffuse, "diffuse_color", white);
-        gis.push_back(createParallelogram(make_float3(290.0f, 0.0f, 114.0f),
-            make_float3(0.0f, 165.0f, 0.0f),
-            make_float3(-50.0f, 0.0f, 158.0f)));
-        setMaterial(gis.back(), diffuse, "diffuse_color", white);
-        gis.push_back(createParallelogram(make_float3(130.0f, 0.0f, 65.0f),
-            make_float3(0.0f, 165.0f, 0.0f),
-            make_float3(160.0f, 0.0f, 49.0f)));
-        setMaterial(gis.back(), diffuse, "diffuse_color", white);
-        gis.push_back(createParallelogram(make_float3(82.0f, 0.0f, 225.0f),
-            make_float3(0.0f, 165.0f, 0.0f),
-            make_float3(48.0f, 0.0f, -160.0f)));
-        setMaterial(gis.back(), diffuse, "diffuse_color", white);
-        gis.push_back(createParallelogram(make_float3(240.0f, 0.0f, 272.0f),
-            make_float3(0.0f, 165.0f, 0.0f),
-            make_float3(-158.0f, 0.0f, -47.0f)));
-        setMaterial(gis.back(), diffuse, "diffuse_color", white);
-
-        // Tall block
-        gis.push_back(createParallelogram(make_float3(423.0f, 330.0f, 247.0f),
-            make_float3(-158.0f, 0.0f, 49.0f),
-            make_float3(49.0f, 0.0f, 159.0f)));
-        setMaterial(gis.back(), diffuse, "diffuse_color", white);
-        gis.push_back(createParallelogram(make_float3(423.0f, 0.0f, 247.0f),
-            make_float3(0.0f, 330.0f, 0.0f),
-            make_float3(49.0f, 0.0f, 159.0f)));
-        setMaterial(gis.back(), diffuse, "diffuse_color", white);
-        gis.push_back(createParallelogram(make_float3(472.0f, 0.0f, 406.0f),
-            make_float3(0.0f, 330.0f, 0.0f),
-            make_float3(-158.0f, 0.0f, 50.0f)));
-        setMaterial(gis.back(), diffuse, "diffuse_color", white);
-        gis.push_back(createParallelogram(make_float3(314.0f, 0.0f, 456.0f),
-            make_float3(0.0f, 330.0f, 0.0f),
-            make_float3(-49.0f, 0.0f, -160.0f)));
-        setMaterial(gis.back(), diffuse, "diffuse_color", white);
-        gis.push_back(createParallelogram(make_float3(265.0f, 0.0f, 296.0f),
-            make_float3(0.0f, 330.0f, 0.0f),
-            make_float3(158.0f, 0.0f, -49.0f)));
-        setMaterial(gis.back(), diffuse, "diffuse_color", white);
-
-        // Create shadow group (no light)
-        GeometryGroup shadow_group = context->createGeometryGroup(gis.begin(), gis.end());
-        shadow_group->setAcceleration(context->createAcceleration("Trbvh"));
-        context["top_shadower"]->set(shadow_group);
-
-        // Light
-        gis.push_back(createParallelogram(make_float3(343.0f, 548.6f, 227.0f),
-            make_float3(-130.0f, 0.0f, 0.0f),
-            make_float3(0.0f, 0.0f, 105.0f)));
-        setMaterial(gis.back(), diffuse_light, "emission_color", light_em);
-
-        // Create geometry group
-        GeometryGroup geometry_group = context->createGeometryGroup(gis.begin(), gis.end());
-        geometry_group->setAcceleration(context->createAcceleration("Trbvh"));
+    if (dynamic_gis.empty())
+    {
         context["top_object"]->set(geometry_group);
+        context["top_shadower"]->set(caster_group);
+        return;
+    }
 
+    // Animated objects get their own acceleration structure so swapping in a
+    // new frame does not rebuild the static scene
+    dynamic_group = context->createGeometryGroup(dynamic_gis.begin(), dynamic_gis.end());
+    dynamic_group->setAcceleration(context->createAcceleration("Trbvh"));
+    dynamic_caster_group = context->createGeometryGroup(dynamic_caster_gis.begin(), dynamic_caster_gis.end());
+    dynamic_caster_group->setAcceleration(context->createAcceleration("Trbvh"));
+    for (size_t i = 0; i < dynamic_ids.size(); ++i)
+    {
+        SceneEntry& entry = scene_entries[dynamic_ids[i]];
+        entry.group = dynamic_group;
+        entry.caster_group = entry.casts_shadow ? dynamic_caster_group : GeometryGroup();
     }
-    */
 
+    top_group = context->createGroup();
+    top_group->setAcceleration(context->createAcceleration("Trbvh"));
+    top_group->addChild(geometry_group);
+    top_group->addChild(dynamic_group);
+    context["top_object"]->set(top_group);
+
+    shadower_group = context->createGroup();
+    shadower_group->setAcceleration(context->createAcceleration("Trbvh"));
+    shadower_group->addChild(caster_group);
+    shadower_group->addChild(dynamic_caster_group);
+    context["top_shadower"]->set(shadower_group);
+}
 
-/**/
+void dropSceneEdits(unsigned int object_id)
+{
+    // Edits deferred behind a mesh that never arrives
+    for (size_t i = 0; i < scene_edits.size(); )
+    {
+        if (scene_edits[i].object_id == object_id)
+            scene_edits.erase(scene_edits.begin() + i);
+        else
+            ++i;
+    }
+}
 
-    // grid
+void addLoadedMeshes()
+{
+    // Meshes join the static groups like those loaded up front, so the scene
+    // ends up the same as without progressive_load
+    bool added = false;
+    size_t i;
+    Mesh mesh, proxy;
+    std::string error;
+    while (mesh_loader.takeReady(i, mesh, proxy, error))
+    {
+        const SceneObject& object = scene.objects[i];
+        const unsigned int object_id = pending_mesh_ids[i];
+        pending_mesh_ids.erase(i);
+        if (!error.empty())
+        {
+            // The rest of the scene goes on without the object
+            sutil::reportErrorMessage(error.c_str());
+            dropSceneEdits(object_id);
+            continue;
+        }
 
-        // create geometry instances
-        std::vector<GeometryInstance> gis;
+        SceneEntry entry;
+        entry.type = object.type;
+        entry.quad = -1;
+        entry.instance = createSceneMesh(object_id, object, mesh, proxy, entry);
 
-        const float3 white = make_float3(0.8f, 0.8f, 0.8f);
-        const float3 green = make_float3(0.05f, 0.8f, 0.05f);
-        const float3 red = make_float3(0.8f, 0.05f, 0.05f);
-        const float3 light_em = make_float3(15.0f, 15.0f, 5.0f);
+        setShadowFlags(entry, object_id, object);
+        static_group->addChild(entry.instance);
+        entry.group = static_group;
+        if (entry.casts_shadow)
+        {
+            caster_group->addChild(entry.instance);
+            entry.caster_group = caster_group;
+        }
+        scene_entries[object_id] = entry;
+        added = true;
+    }
 
-        // Floor
-        gis.push_back(createParallelogram(make_float3(-2000.0f, 0.0f, -2000.0f),
-            make_float3(0.0f, 0.0f, 4000.0f),
-            make_float3(4000.0f, 0.0f, 0.0f)));
-        setMaterial(gis.back(), diffuse, "diffuse_color", white);
+    if (added)
+    {
+        static_group->getAcceleration()->markDirty();
+        caster_group->getAcceleration()->markDirty();
+        if (top_group)
+        {
+            top_group->getAcceleration()->markDirty();
+            shadower_group->getAcceleration()->markDirty();
+        }
+        host_scene_dirty = true;
+        if (pending_mesh_ids.empty())
+            std::cerr << "Scene meshes loaded\n";
+    }
+}
 
-        Matrix4x4 transform;
-        transform = Matrix4x4::translate(make_float3(500, 90, 500));
-        transform *= Matrix4x4::scale(make_float3(60, 60, 60));
-        transform *= Matrix4x4::rotate(40, make_float3(1.0f, 0.0f, 0.0f));
-        transform *= Matrix4x4::rotate(40, make_float3(0.0f, 1.0f, 0.0f));
+void updateScene() {
+    if (!pending_mesh_ids.empty())
+        addLoadedMeshes();
+    issueSceneEdits(++scene_frame);
+    applySceneEdits();
+
+    // Swap in whatever the particle loaders have finished parsing since the
+    // last frame, without waiting for the next one
+    bool changed = false;
+    for (size_t i = 0; i < particle_objects.size(); ++i)
+    {
+        ParticleObject& particles = particle_objects[i];
+        bool uploaded = false;
+        if (!particles.sequence)
+        {
+            // Step through the snapshots at a fixed number of rendered frames
+            // each, holding the last snapshot before looping
+            const size_t snapshots = particles.frames.size();
+            particles.step = (particles.step + 1) % (snapshots * particles.substeps);
+            const size_t k = particles.step / particles.substeps;
+            const float  t = k + 1 < snapshots ? (particles.step % particles.substeps) / float(particles.substeps) : 0.0f;
+            interpolateParticles(particles.frames[k], particles.frames[std::min(k + 1, snapshots - 1)],
+                t, particles.velocity_scale, particles.interpolated);
+            uploadParticles(particles, particles.interpolated);
+            uploaded = true;
+        }
+        else
+        {
+            const ParticleFrame& frame = particles.sequence->nextFrame();
+            if (frame.frame != particles.frame)
+            {
+                uploadParticles(particles, frame);
+                uploaded = true;
+            }
+        }
 
-        // Grid
-        gis.push_back(loadMesh("I:/Axis-Aligned-Soft-Shadow/data/grid3.obj", diffuse, green, transform));
+        // Particles that were moved or added live in their own group
+        if (uploaded)
+        {
+            const SceneEntry& entry = scene_entries[particles.object_id];
+            entry.group->getAcceleration()->markDirty();
+            if (entry.caster_group)
+                entry.caster_group->getAcceleration()->markDirty();
+            changed = true;
+        }
+    }
 
-        Matrix4x4 transformcow;
-        transformcow = Matrix4x4::translate(make_float3(300, 50, 0));
-        transformcow *= Matrix4x4::scale(make_float3(2000, 2000, 2000));
-        transformcow *= Matrix4x4::rotate(0, make_float3(0.0f, 0.0f, 1.0f));
+    if (changed)
+    {
+        top_group->getAcceleration()->markDirty();
+        shadower_group->getAcceleration()->markDirty();
+        host_scene_dirty = true;
+    }
 
-        gis.push_back(loadMesh("I:/Axis-Aligned-Soft-Shadow/data/cow.obj", diffuse, white, transformcow));
+    if (host_trace && host_scene_dirty)
+    {
+        host_scene.commit();
+        host_scene_dirty = false;
+    }
+}
 
-        transform = Matrix4x4::translate(make_float3(100, 90, 500));
-        transform *= Matrix4x4::scale(make_float3(60, 60, 60));
-        transform *= Matrix4x4::rotate(50, make_float3(0.0f, 1.0f, 0.0f));
-        transform *= Matrix4x4::rotate(40, make_float3(1.0f, 0.0f, 0.0f));
+//------------------------------------------------------------------------------
+//
+//  Incremental scene edits
+//
+//------------------------------------------------------------------------------
 
-        // Grid
-        gis.push_back(loadMesh("I:/Axis-Aligned-Soft-Shadow/data/grid2.obj", diffuse, red, transform));
+unsigned int addSceneObject(const SceneObject& object)
+{
+    if (object.type == SCENE_OBJECT_PARTICLES && !dynamic_group)
+        throw std::runtime_error("addSceneObject: particles can only be added to scenes that load particles");
+
+    SceneEdit edit;
+    edit.type = SCENE_EDIT_ADD;
+    edit.object_id = ++objectID;
+    edit.object = object;
+    scene_edits.push_back(edit);
+    return edit.object_id;
+}
 
-        // Create shadow group (no light)
-        //GeometryGroup shadow_group = context->createGeometryGroup(gis.begin(), gis.end());
-        //shadow_group->setAcceleration(context->createAcceleration("Trbvh"));
-        //context["top_shadower"]->set(shadow_group);
+void removeSceneObject(unsigned int object_id)
+{
+    SceneEdit edit;
+    edit.type = SCENE_EDIT_REMOVE;
+    edit.object_id = object_id;
+    scene_edits.push_back(edit);
+}
 
-        //// Light
-        gis.push_back(createParallelogram(make_float3(343.0f, 548.6f, 227.0f),
-            make_float3(-130.0f, 0.0f, 0.0f),
-            make_float3(0.0f, 0.0f, 105.0f)));
-        setMaterial(gis.back(), diffuse_light, "emission_color", light_em);
+void transformSceneObject(unsigned int object_id, const Matrix4x4& transform)
+{
+    SceneEdit edit;
+    edit.type = SCENE_EDIT_TRANSFORM;
+    edit.object_id = object_id;
+    edit.transform = transform;
+    scene_edits.push_back(edit);
+}
 
-        // Create geometry group
-        GeometryGroup geometry_group = context->createGeometryGroup(gis.begin(), gis.end());
-        geometry_group->setAcceleration(context->createAcceleration("Trbvh"));
-        context["top_object"]->set(geometry_group);
-        
+void recolorSceneObject(unsigned int object_id, const float3& color)
+{
+    SceneEdit edit;
+    edit.type = SCENE_EDIT_COLOR;
+    edit.object_id = object_id;
+    edit.color = color;
+    scene_edits.push_back(edit);
+}
 
+void issueSceneEdits(int frame)
+{
+    // The scene file's edits for frames up to frame, queued like any other
+    for (; next_scene_edit < scene.edits.size() && scene.edits[next_scene_edit].frame <= frame; ++next_scene_edit)
+    {
+        const SceneEdit& edit = scene.edits[next_scene_edit];
+        if (edit.type == SCENE_EDIT_ADD)
+        {
+            try
+            {
+                const unsigned int object_id = addSceneObject(edit.object);
+                std::cerr << "Frame " << frame << ": added object " << object_id << "\n";
+            }
+            catch (const std::exception& e)
+            {
+                std::cerr << "Frame " << frame << ": " << e.what() << "\n";
+            }
+        }
+        else if (edit.type == SCENE_EDIT_REMOVE)
+            removeSceneObject(edit.object_id);
+        else if (edit.type == SCENE_EDIT_TRANSFORM)
+            transformSceneObject(edit.object_id, edit.transform);
+        else
+            recolorSceneObject(edit.object_id, edit.color);
+    }
+}
 
+bool isPendingMesh(unsigned int object_id)
+{
+    for (std::map<size_t, unsigned int>::const_iterator it = pending_mesh_ids.begin(); it != pending_mesh_ids.end(); ++it)
+    {
+        if (it->second == object_id)
+            return true;
+    }
+    return false;
 }
 
-void updateScene() {
+Group ensureTopGroup()
+{
+    if (!top_group)
+    {
+        top_group = context->createGroup();
+        top_group->setAcceleration(context->createAcceleration("Trbvh"));
+        top_group->addChild(static_group);
+        context["top_object"]->set(top_group);
+
+        shadower_group = context->createGroup();
+        shadower_group->setAcceleration(context->createAcceleration("Trbvh"));
+        shadower_group->addChild(caster_group);
+        context["top_shadower"]->set(shadower_group);
+    }
+    return top_group;
+}
+
+void isolateSceneEntry(SceneEntry& entry)
+{
+    // Own group under a Transform, so moves leave the shared groups alone
+    GeometryGroup group = context->createGeometryGroup();
+    group->setAcceleration(context->createAcceleration("Trbvh"));
+    group->addChild(entry.instance);
+
+    if (entry.group)
+    {
+        entry.group->removeChild(entry.instance);
+        entry.group->getAcceleration()->markDirty();
+    }
+    if (entry.caster_group)
+    {
+        entry.caster_group->removeChild(entry.instance);
+        entry.caster_group->getAcceleration()->markDirty();
+        entry.caster_group = 0;
+    }
+
+    entry.transform = context->createTransform();
+    const Matrix4x4 identity = Matrix4x4::identity();
+    entry.transform->setMatrix(false, identity.getData(), 0);
+    entry.transform->setChild(group);
+    ensureTopGroup()->addChild(entry.transform);
+    if (entry.casts_shadow)
+        shadower_group->addChild(entry.transform);
+    entry.group = group;
+}
+
+void removeFromQuadSoup(SceneEntry& entry)
+{
+    // Clear the quad's lane, the rest of the soup stays as it is
+    const uint32_t slot = quad_soup.slot(entry.quad);
+    const uint32_t block = quad_soup.disable(entry.quad);
+    QuadBlock* blocks = static_cast<QuadBlock*>(quad_soup_blocks->map());
+    blocks[block] = quad_soup.blocks()[block];
+    quad_soup_blocks->unmap();
+    static_group->getAcceleration()->markDirty();
+    caster_group->getAcceleration()->markDirty();
+
+    if (entry.host_handle != ~0u)
+        host_scene.removeQuad(entry.host_handle, slot);
+    entry.host_handle = ~0u;
+    entry.quad = -1;
+    entry.instance = 0;
+    entry.group = 0;
+    entry.caster_group = 0;
+}
+
+void detachFromQuadSoup(unsigned int object_id, SceneEntry& entry)
+{
+    // Quads that move become plain parallelograms with their own material
+    const uint32_t quad = static_cast<uint32_t>(entry.quad);
+    removeFromQuadSoup(entry);
+
+    entry.instance = createParallelogram(object_id, quad_soup.anchor(quad), quad_soup.v1(quad), quad_soup.v2(quad));
+    entry.instance->addMaterial(entry.material);
+    if (host_trace)
+        entry.host_handle = host_scene.addQuad(object_id, quad_soup.anchor(quad), quad_soup.v1(quad), quad_soup.v2(quad));
+}
+
+GeometryInstance createSceneObject(unsigned int object_id, const SceneObject& object, SceneEntry& entry)
+{
+    GeometryInstance gi;
+    unsigned int& host_handle = entry.host_handle;
+    host_handle = ~0u;
+    if (object.type == SCENE_OBJECT_QUAD)
+    {
+        gi = createParallelogram(object_id, object.anchor, object.v1, object.v2);
+        setMaterial(gi, diffuse_material, "diffuse_color", object.color);
+        if (host_trace)
+            host_handle = host_scene.addQuad(object_id, object.anchor, object.v1, object.v2);
+    }
+    else if (object.type == SCENE_OBJECT_PARTICLES)
+    {
+        gi = createParticles(object_id, object, diffuse_material);
+        host_handle = particle_objects.back().host_handle;
+    }
+    else
+    {
+        Mesh mesh = Mesh();
+        Mesh proxy = Mesh();
+        loadMesh(object.filename, mesh, object.transform.getData(), reorder_meshes);
+        if (host_trace && shadow_proxy_ratio > 0.0f && object.casts_shadow)
+            loadSimplifiedMesh(object.filename, shadow_proxy_ratio, proxy, object.transform.getData());
+        gi = createSceneMesh(object_id, object, mesh, proxy, entry);
+    }
+
+    return gi;
+}
 
+void applySceneEdits()
+{
+    // Edits only flag what they touch: shared groups they leave, their own
+    // group when added, the top level when placed, the host scene when any
+    // geometry changed
+    bool top_changed = false;
+    std::vector<SceneEdit> deferred;
+    for (size_t i = 0; i < scene_edits.size(); ++i)
+    {
+        const SceneEdit& edit = scene_edits[i];
+        if (edit.type == SCENE_EDIT_ADD)
+        {
+            SceneEntry entry;
+            entry.type = edit.object.type;
+            entry.quad = -1;
+            entry.instance = createSceneObject(edit.object_id, edit.object, entry);
+            setShadowFlags(entry, edit.object_id, edit.object);
+            isolateSceneEntry(entry);
+            scene_entries[edit.object_id] = entry;
+            top_changed = true;
+            host_scene_dirty = true;
+            continue;
+        }
+
+        std::map<unsigned int, SceneEntry>::iterator it = scene_entries.find(edit.object_id);
+        if (it == scene_entries.end())
+        {
+            // Edits of a mesh still loading keep their order behind it
+            if (isPendingMesh(edit.object_id))
+                deferred.push_back(edit);
+            else
+                std::cerr << "Scene edit for unknown object " << edit.object_id << " ignored\n";
+            continue;
+        }
+        SceneEntry& entry = it->second;
+
+        if (edit.type == SCENE_EDIT_COLOR)
+        {
+            if (entry.material)
+                entry.material["diffuse_color"]->setFloat(edit.color);
+            else
+                entry.instance["diffuse_color"]->setFloat(edit.color);
+        }
+        else if (edit.type == SCENE_EDIT_TRANSFORM)
+        {
+            if (entry.quad >= 0)
+                detachFromQuadSoup(edit.object_id, entry);
+            if (!entry.transform)
+                isolateSceneEntry(entry);
+            entry.transform->setMatrix(false, edit.transform.getData(), 0);
+            if (entry.host_handle != ~0u)
+                host_scene.setTransform(entry.host_handle, edit.transform);
+            top_changed = true;
+            host_scene_dirty = true;
+        }
+        else
+        {
+            if (entry.quad >= 0)
+            {
+                removeFromQuadSoup(entry);
+                if (top_group)
+                    top_changed = true;
+            }
+            else if (entry.transform)
+            {
+                top_group->removeChild(entry.transform);
+                if (entry.casts_shadow)
+                    shadower_group->removeChild(entry.transform);
+                top_changed = true;
+            }
+            else
+            {
+                entry.group->removeChild(entry.instance);
+                entry.group->getAcceleration()->markDirty();
+                if (entry.caster_group)
+                {
+                    entry.caster_group->removeChild(entry.instance);
+                    entry.caster_group->getAcceleration()->markDirty();
+                }
+                if (top_group)
+                    top_changed = true;
+            }
+            if (entry.host_handle != ~0u)
+                host_scene.removeObject(entry.host_handle);
+            if (entry.type == SCENE_OBJECT_PARTICLES)
+            {
+                for (size_t k = 0; k < particle_objects.size(); ++k)
+                {
+                    if (particle_objects[k].object_id == edit.object_id)
+                    {
+                        particle_objects.erase(particle_objects.begin() + k);
+                        break;
+                    }
+                }
+            }
+            releaseTextures(entry);
+            scene_entries.erase(it);
+            host_scene_dirty = true;
+        }
+    }
+    scene_edits.swap(deferred);
+
+    if (top_changed)
+    {
+        top_group->getAcceleration()->markDirty();
+        shadower_group->getAcceleration()->markDirty();
+    }
+}
+
+void estimateHostPenumbra(const float3* hits, const float3* normals, unsigned int buffer_width, unsigned int buffer_height)
+{
+    // d1 / d2 per pixel for the shadow proxy policy, from the same depth
+    // pyramid as the light pyramid heatmaps
+    const size_t num_pixels = static_cast<size_t>(buffer_width) * buffer_height;
+    host_d1.resize(num_pixels);
+    host_d2_min.resize(num_pixels);
+    host_d2_max.resize(num_pixels);
+    light_depth_pyramid.build(host_scene, scene.lights[0].light);
+    light_depth_pyramid.estimate(hits, normals, buffer_width, buffer_height, context["scene_epsilon"]->getFloat(),
+        host_d1.data(), host_d2_min.data(), host_d2_max.data());
+}
+
+void traceHostVisibility()
+{
+    // Shadow rays from the primary hits of the last launch, against the host
+    // copy of the scene
+    Buffer hits = context["hit_buffer"]->getBuffer();
+    Buffer normals = context["ffnormal_buffer"]->getBuffer();
+    Buffer object_id_buffer = context["object_id_buffer"]->getBuffer();
+    RTsize buffer_width, buffer_height;
+    hits->getSize(buffer_width, buffer_height);
+
+    if (!host_visibility_buffer)
+        host_visibility_buffer = context->createBuffer(RT_BUFFER_INPUT, RT_FORMAT_FLOAT, buffer_width, buffer_height);
+    else
+        host_visibility_buffer->setSize(buffer_width, buffer_height);
+
+    if (host_raster)
+    {
+        // Primary hits from the host rasterizer instead, with the GPU camera
+        const size_t num_pixels = buffer_width * buffer_height;
+        host_hits.resize(num_pixels);
+        host_normals.resize(num_pixels);
+        host_ffnormals.resize(num_pixels);
+        host_object_ids.resize(num_pixels);
+        host_rasterizer.render(host_scene, context["eye"]->getFloat3(), context["U"]->getFloat3(),
+            context["V"]->getFloat3(), context["W"]->getFloat3(),
+            static_cast<unsigned int>(buffer_width), static_cast<unsigned int>(buffer_height),
+            host_hits.data(), host_normals.data(), host_ffnormals.data(), host_object_ids.data());
+
+        const bool use_proxies = host_scene.numShadowProxies() > 0;
+        if (use_proxies)
+            estimateHostPenumbra(host_hits.data(), host_ffnormals.data(), static_cast<unsigned int>(buffer_width),
+                static_cast<unsigned int>(buffer_height));
+
+        float* visibility = static_cast<float*>(host_visibility_buffer->map(0, RT_BUFFER_MAP_WRITE_DISCARD));
+        host_shadow_pass.run(host_scene, scene.lights[0].light, host_hits.data(), host_ffnormals.data(),
+            host_object_ids.data(), static_cast<unsigned int>(buffer_width), static_cast<unsigned int>(buffer_height),
+            visibility, use_proxies ? host_d1.data() : 0, use_proxies ? host_d2_max.data() : 0);
+        host_visibility_buffer->unmap();
+        return;
+    }
+
+    const float3* hit_data = static_cast<const float3*>(hits->map(0, RT_BUFFER_MAP_READ));
+    const float3* normal_data = static_cast<const float3*>(normals->map(0, RT_BUFFER_MAP_READ));
+    float* visibility = static_cast<float*>(host_visibility_buffer->map(0, RT_BUFFER_MAP_WRITE_DISCARD));
+    const float* object_ids = static_cast<const float*>(object_id_buffer->map(0, RT_BUFFER_MAP_READ));
+    const bool use_proxies = host_scene.numShadowProxies() > 0;
+    if (use_proxies)
+        estimateHostPenumbra(hit_data, normal_data, static_cast<unsigned int>(buffer_width),
+            static_cast<unsigned int>(buffer_height));
+    host_shadow_pass.run(host_scene, scene.lights[0].light, hit_data, normal_data, object_ids,
+        static_cast<unsigned int>(buffer_width), static_cast<unsigned int>(buffer_height), visibility,
+        use_proxies ? host_d1.data() : 0, use_proxies ? host_d2_max.data() : 0);
+    host_visibility_buffer->unmap();
+    object_id_buffer->unmap();
+    normals->unmap();
+    hits->unmap();
+}
+
+void estimateLightDepth()
+{
+    // Same inputs as the first pass distance estimate, no rays
+    Buffer hits = context["hit_buffer"]->getBuffer();
+    Buffer normals = context["ffnormal_buffer"]->getBuffer();
+    RTsize buffer_width, buffer_height;
+    hits->getSize(buffer_width, buffer_height);
+
+    Buffer* outputs[3] = { &light_d1_buffer, &light_d2_min_buffer, &light_d2_max_buffer };
+    for (int i = 0; i < 3; ++i)
+    {
+        if (!*outputs[i])
+            *outputs[i] = context->createBuffer(RT_BUFFER_INPUT, RT_FORMAT_FLOAT, buffer_width, buffer_height);
+        else
+            (*outputs[i])->setSize(buffer_width, buffer_height);
+    }
+
+    light_depth_pyramid.build(host_scene, scene.lights[0].light);
+
+    const float3* hit_data = static_cast<const float3*>(hits->map(0, RT_BUFFER_MAP_READ));
+    const float3* normal_data = static_cast<const float3*>(normals->map(0, RT_BUFFER_MAP_READ));
+    float* d1 = static_cast<float*>(light_d1_buffer->map(0, RT_BUFFER_MAP_WRITE_DISCARD));
+    float* d2_min = static_cast<float*>(light_d2_min_buffer->map(0, RT_BUFFER_MAP_WRITE_DISCARD));
+    float* d2_max = static_cast<float*>(light_d2_max_buffer->map(0, RT_BUFFER_MAP_WRITE_DISCARD));
+    light_depth_pyramid.estimate(hit_data, normal_data, static_cast<unsigned int>(buffer_width),
+        static_cast<unsigned int>(buffer_height), context["scene_epsilon"]->getFloat(), d1, d2_min, d2_max);
+    light_d2_max_buffer->unmap();
+    light_d2_min_buffer->unmap();
+    light_d1_buffer->unmap();
+    normals->unmap();
+    hits->unmap();
 }
 
   
@@ -568,6 +1525,20 @@ void setupCamera()
     camera_pos    = make_float3(278.0f, 273.0f, -900.0f);
     camera_pitch  = 0.0f;
     camera_yaw    = 1.55f;
+    camera_fov    = 35.0f;
+
+    if( scene.has_camera )
+    {
+        camera_eye    = scene.camera.eye;
+        camera_lookat = scene.camera.lookat;
+        camera_up     = scene.camera.up;
+        camera_pos    = scene.camera.eye;
+        camera_fov    = scene.camera.fov;
+
+        const float3 front = normalize( camera_lookat - camera_eye );
+        camera_pitch  = asinf( front.y );
+        camera_yaw    = atan2f( front.z, front.x );
+    }
 
     camera_rotate  = Matrix4x4::identity();
 }
@@ -575,7 +1546,7 @@ void setupCamera()
 
 void updateCamera()
 {
-    const float fov  = 35.0f;
+    const float fov  = camera_fov;
     const float aspect_ratio = static_cast<float>(width) / static_cast<float>(height);
 
     float3 front = make_float3(cos(camera_pitch) * cos(camera_yaw), sin(camera_pitch), cos(camera_pitch) * sin(camera_yaw));
@@ -707,6 +1678,9 @@ void glutDisplay()
 
     // blur y
     context->launch(6, width, height);
+
+    if (!save_frames_file.empty())
+        saveFrame();
     
     //sutil::displayBufferGL( getOutputBuffer() );
     //diaplayHeatmap(context["d1_buffer"]->getBuffer(), 675.0f);
@@ -717,7 +1691,21 @@ void glutDisplay()
     //diaplayHeatmap(context["beta_buffer"]->getBuffer(), 10.0f);
     // sutil::displayText(strings[i].c_str(), width - 150, 55);
     
-    if (D1) {
+    if ((D1 || D2MIN || D2MAX) && LIGHT_PYRAMID && host_trace) {
+        // Same scales as the first pass views below, for comparison
+        estimateLightDepth();
+        if (D1)
+            diaplayHeatmap(light_d1_buffer, 800.0f);
+        else if (D2MIN)
+            diaplayHeatmap(light_d2_min_buffer, 700.0f);
+        else
+            diaplayHeatmap(light_d2_max_buffer, 640.0f);
+        char text[128];
+        sprintf(text, "%s light pyramid, build %.1f ms, query %.1f ms", D1 ? "d1" : D2MIN ? "d2_min" : "d2_max",
+            light_depth_pyramid.lastBuildTime(), light_depth_pyramid.lastEstimateTime());
+        sutil::displayText(text, width - 350, height - 50);
+    }
+    else if (D1) {
         diaplayHeatmap(context["d1_buffer"]->getBuffer(), 800.0f);
         sutil::displayText("d1_buffer", width - 150, height - 50);
     }
@@ -749,6 +1737,43 @@ void glutDisplay()
         sutil::displayBufferGL(context["result_buffer"]->getBuffer());
         sutil::displayText("GroundTruth spp500", width - 150, height - 50);
     }
+    else if (HOST_VISIBILITY && host_trace) {
+        traceHostVisibility();
+        diaplayHeatmap(host_visibility_buffer, 1.0f);
+        char text[256];
+        const HostTileCuller& culler = host_shadow_pass.culler();
+        sprintf(text, "host shadows %.1f ms (cull %.1f ms, %.1f objects/tile, %u unshadowed tiles), update %.1f ms, %u rebuilds",
+            host_shadow_pass.lastTime(), culler.lastTime(), culler.averageCandidates(),
+            static_cast<unsigned int>(culler.numEmptyTiles()), host_scene.lastCommitTime(), host_scene.numBackgroundRebuilds());
+        sutil::displayText(text, width - 600, height - 50);
+        const size_t rays = host_shadow_pass.lastRayCount();
+        const size_t packets = host_shadow_pass.lastPacketCount();
+        if (packets)
+            sprintf(text, "%u rays in %u packets of %.1f", static_cast<unsigned int>(rays),
+                static_cast<unsigned int>(packets), double(rays) / packets);
+        else if (verify_occluder_cache)
+            sprintf(text, "%u rays, %.0f%% stopped by the last occluder of their tile, %u disagree with a full trace",
+                static_cast<unsigned int>(rays), rays ? 100.0 * host_shadow_pass.lastCacheHitCount() / rays : 0.0,
+                static_cast<unsigned int>(host_shadow_pass.lastCacheMismatchCount()));
+        else
+            sprintf(text, "%u rays, %.0f%% stopped by the last occluder of their tile", static_cast<unsigned int>(rays),
+                rays ? 100.0 * host_shadow_pass.lastCacheHitCount() / rays : 0.0);
+        sutil::displayText(text, width - 600, height - 70);
+        int line = 90;
+        if (host_raster)
+        {
+            sprintf(text, "host raster %.1f ms, %u primitives", host_rasterizer.lastTime(),
+                static_cast<unsigned int>(host_rasterizer.lastPrimitiveCount()));
+            sutil::displayText(text, width - 600, height - line);
+            line += 20;
+        }
+        if (host_scene.numShadowProxies())
+        {
+            sprintf(text, "shadow proxies on %u objects, %.0f%% of rays", host_scene.numShadowProxies(),
+                rays ? 100.0 * host_shadow_pass.lastProxyRayCount() / rays : 0.0);
+            sutil::displayText(text, width - 600, height - line);
+        }
+    }
     else {
         sutil::displayBufferGL(context["denoised_result_buffer"]->getBuffer());
         sutil::displayText("Denoised result", width - 150, height - 50);
@@ -771,6 +1796,7 @@ void resetChoice()
     BETA = false;
     OBJID = false;
     GROUND = false;
+    HOST_VISIBILITY = false;
 }
 
 
@@ -787,7 +1813,8 @@ void glutKeyboardPress( unsigned char k, int x, int y )
         {
             const std::string outputImage = std::string(SAMPLE_NAME) + ".ppm";
             std::cerr << "Saving current frame to '" << outputImage << "'\n";
-            sutil::displayBufferPPM( outputImage.c_str(), getOutputBuffer(), false );
+            if( !imageWriter().write( outputImage, getOutputBuffer(), true ) )
+                std::cerr << "Image writer busy, frame not saved\n";
             break;
         }
         case('r'):
@@ -874,6 +1901,18 @@ void glutKeyboardPress( unsigned char k, int x, int y )
             OBJID = true;
             break;
         }
+        case('h'):
+        {
+            resetChoice();
+            HOST_VISIBILITY = true;
+            break;
+        }
+        case('l'):
+        {
+            // Switches the source of the distance views, keeps the view
+            LIGHT_PYRAMID = !LIGHT_PYRAMID;
+            break;
+        }
     }
 }
 
@@ -988,12 +2027,35 @@ void printUsageAndExit( const std::string& argv0 )
     std::cerr <<
         "App Options:\n"
         "  -h | --help               Print this usage message and exit.\n"
-        "  -f | --file               Save single frame to file and exit.\n"
+        "  -f | --file               Save single frame to file and exit.  .pfm and .raw files get float data.\n"
         "  -n | --nopbo              Disable GL interop for display buffer.\n"
         "  -d | --dim=<width>x<height> Set image dimensions. Defaults to 512x512\n"
+        "       --scene <file>       Scene description to load. Defaults to data/grid.scene\n"
+        "       --reorder-meshes     Sort mesh triangles and vertices along a space filling curve on load.\n"
+        "       --progressive        Start rendering before all meshes are loaded and add them as they finish.\n"
+        "       --save-frames <file> Save the result of every frame, numbered before the extension of file, in the\n"
+        "                            background.  Frames are dropped while the writer is behind.\n"
+        "       --host-trace         Keep a host copy of the scene and trace shadow rays on the CPU.\n"
+        "       --host-raster        Rasterize the primary hits for the host shadow pass on the CPU too (implies --host-trace).\n"
+        "       --cull-tile <n>      Screen tile size for host shadow occluder culling, 0 disables. Defaults to 16\n"
+        "       --ray-streams        Trace host shadow rays breadth first per tile, in packets (implies --host-trace).\n"
+        "       --verify-occluder-cache Trace every host shadow ray the occluder cache answered again through the whole\n"
+        "                            hierarchy and show how many disagree, for testing (implies --host-trace).\n"
+        "       --host-compact       Keep compressed host hierarchies for meshes, for large scenes (implies --host-trace).\n"
+        "       --bvh-morton64       Build host hierarchies from 63 bit instead of 30 bit Morton codes, for scenes\n"
+        "                            with much finer detail than their extent (implies --host-trace).\n"
+        "       --bvh-refine <n>     Refine host hierarchies with n tree rotation sweeps after each build, 0 disables.\n"
+        "                            Defaults to 0 (implies --host-trace).\n"
+        "       --bvh-cache <dir>    Load host hierarchies of unchanged geometry from, and store new ones in, an existing\n"
+        "                            directory (implies --host-trace).\n"
+        "       --shadow-proxy <f>   Give shadow casting meshes simplified proxies keeping fraction f of their triangles,\n"
+        "                            used by host shadow rays in wide penumbrae (implies --host-trace).\n"
+        "                            Proxies are cached in the user cache directory.\n"
         "App Keystrokes:\n"
         "  q  Quit\n" 
-        "  s  Save image to '" << SAMPLE_NAME << ".ppm'\n"
+        "  p  Save image to '" << SAMPLE_NAME << ".ppm'\n"
+        "  h  Show host traced light visibility (with --host-trace)\n"
+        "  l  Toggle the d1/d2 views (1-3) between the first pass and a light space depth pyramid (with --host-trace)\n"
         << std::endl;
 
     exit(1);
@@ -1003,6 +2065,8 @@ void printUsageAndExit( const std::string& argv0 )
 int main( int argc, char** argv )
  {
     std::string out_file;
+    HostBVHBuildOptions bvh_options;
+    scene_file = std::string( sutil::samplesDir() ) + "/data/grid.scene";
     for( int i=1; i<argc; ++i )
     {
         const std::string arg( argv[i] );
@@ -1020,6 +2084,98 @@ int main( int argc, char** argv )
             }
             out_file = argv[++i];
         }
+        else if( arg == "--scene" )
+        {
+            if( i == argc-1 )
+            {
+                std::cerr << "Option '" << arg << "' requires additional argument.\n";
+                printUsageAndExit( argv[0] );
+            }
+            scene_file = argv[++i];
+        }
+        else if( arg == "--reorder-meshes" )
+        {
+            reorder_meshes = true;
+        }
+        else if( arg == "--progressive" )
+        {
+            progressive_load = true;
+        }
+        else if( arg == "--host-trace" )
+        {
+            host_trace = true;
+        }
+        else if( arg == "--host-raster" )
+        {
+            host_trace = host_raster = true;
+        }
+        else if( arg == "--cull-tile" )
+        {
+            if( i == argc-1 )
+            {
+                std::cerr << "Option '" << arg << "' requires additional argument.\n";
+                printUsageAndExit( argv[0] );
+            }
+            host_shadow_pass.setCullTileSize( atoi( argv[++i] ) );
+        }
+        else if( arg == "--host-compact" )
+        {
+            host_trace = host_compact = true;
+        }
+        else if( arg == "--save-frames" )
+        {
+            if( i == argc-1 )
+            {
+                std::cerr << "Option '" << arg << "' requires additional argument.\n";
+                printUsageAndExit( argv[0] );
+            }
+            save_frames_file = argv[++i];
+        }
+        else if( arg == "--bvh-morton64" )
+        {
+            bvh_options.morton_64 = true;
+            host_trace = true;
+        }
+        else if( arg == "--bvh-refine" )
+        {
+            if( i == argc-1 )
+            {
+                std::cerr << "Option '" << arg << "' requires additional argument.\n";
+                printUsageAndExit( argv[0] );
+            }
+            bvh_options.refine_passes = static_cast<unsigned int>( atoi( argv[++i] ) );
+            host_trace = true;
+        }
+        else if( arg == "--bvh-cache" )
+        {
+            if( i == argc-1 )
+            {
+                std::cerr << "Option '" << arg << "' requires additional argument.\n";
+                printUsageAndExit( argv[0] );
+            }
+            host_scene.setCacheDirectory( argv[++i] );
+            host_trace = true;
+        }
+        else if( arg == "--ray-streams" )
+        {
+            host_shadow_pass.setRayStreams( true );
+            host_trace = true;
+        }
+        else if( arg == "--verify-occluder-cache" )
+        {
+            host_shadow_pass.setVerifyOccluderCache( true );
+            host_trace = verify_occluder_cache = true;
+        }
+        else if( arg == "--shadow-proxy" )
+        {
+            if( i == argc-1 )
+            {
+                std::cerr << "Option '" << arg << "' requires additional argument.\n";
+                printUsageAndExit( argv[0] );
+            }
+            shadow_proxy_ratio = static_cast<float>( atof( argv[++i] ) );
+            host_trace = true;
+        }
         else if( arg == "-n" || arg == "--nopbo"  )
         {
             use_pbo = false;
@@ -1049,9 +2205,25 @@ int main( int argc, char** argv )
             printUsageAndExit( argv[0] );
         }
     }
+    host_scene.setBuildOptions( bvh_options );
 
     try
     {
+        // Every program createContext() and loadGeometry() use, compiled on
+        // the thread pool while the window and scene are set up
+        const char* const sample_sources[] = { "optixPathTracer.cu", "AA.cu", "heatmap.cu", "parallelogram.cu",
+                                               "quad_soup.cu", "sphere.cu", "sphere_grid.cu" };
+        const char* const common_sources[] = { "phong.cu", "triangle_mesh.cu" };
+        sutil::compilePtxStringsAsync( SAMPLE_NAME, sample_sources, sizeof( sample_sources ) / sizeof( sample_sources[0] ) );
+        sutil::compilePtxStringsAsync( NULL, common_sources, sizeof( common_sources ) / sizeof( common_sources[0] ) );
+
+        scene = parseSceneFile( scene_file );
+        mesh_loader.start( scene, reorder_meshes, host_trace ? shadow_proxy_ratio : 0.0f );
+
+        // An image written to a file needs the whole scene
+        if( !out_file.empty() )
+            progressive_load = false;
+
         glutInitialize( &argc, argv );
 
 #ifndef __APPLE__
@@ -1071,8 +2243,12 @@ int main( int argc, char** argv )
         else
         {
             updateCamera();
+            issueSceneEdits( ++scene_frame );
+            applySceneEdits();
             context->launch( 0, width, height );
-            sutil::displayBufferPPM( out_file.c_str(), getOutputBuffer(), false );
+            sutil::ImageFrame frame;
+            sutil::snapshotBuffer( getOutputBuffer()->get(), frame );
+            sutil::writeImage( out_file, frame, sutil::imageFileFormat( out_file ), true );
             destroyContext();
         }
 
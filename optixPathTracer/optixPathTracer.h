@@ -38,3 +38,18 @@ struct ParallelogramLight
     optix::float3 emission;                                                        
 };                                                                               
 
+
+
+// Parallelograms in blocks of four, stored component-wise so the four are
+// intersected together (see quad_soup.cu).  Per lane: the plane normal and
+// distance, the anchor, and the edge vectors scaled by 1 / length^2 as in
+// parallelogram.cu.  Unused lanes are all zero and can never be hit.
+#define QUAD_BLOCK_SIZE 4
+
+struct QuadBlock
+{
+    float nx[QUAD_BLOCK_SIZE], ny[QUAD_BLOCK_SIZE], nz[QUAD_BLOCK_SIZE], d[QUAD_BLOCK_SIZE];
+    float ax[QUAD_BLOCK_SIZE], ay[QUAD_BLOCK_SIZE], az[QUAD_BLOCK_SIZE];
+    float v1x[QUAD_BLOCK_SIZE], v1y[QUAD_BLOCK_SIZE], v1z[QUAD_BLOCK_SIZE];
+    float v2x[QUAD_BLOCK_SIZE], v2y[QUAD_BLOCK_SIZE], v2z[QUAD_BLOCK_SIZE];
+};
@@ -0,0 +1,97 @@
+/* 
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <optix_world.h>
+#include "optixPathTracer.h"
+
+using namespace optix;
+
+// All non-emitting parallelograms of the scene as one geometry.  Every
+// primitive is a block of four quads (see QuadBlock) tested together, and
+// every quad reports its own material, which carries its color and object
+// ID.
+rtBuffer<QuadBlock> quad_blocks;
+rtBuffer<unsigned int> quad_materials;     // Per slot, block * 4 + lane
+
+rtDeclareVariable(float3, texcoord, attribute texcoord, ); 
+rtDeclareVariable(float3, geometric_normal, attribute geometric_normal, ); 
+rtDeclareVariable(float3, shading_normal, attribute shading_normal, ); 
+rtDeclareVariable(int, lgt_idx, attribute lgt_idx, ); 
+rtDeclareVariable(optix::Ray, ray, rtCurrentRay, );
+
+RT_PROGRAM void intersect(int primIdx)
+{
+    const QuadBlock& block = quad_blocks[primIdx];
+
+    // The lanes are independent, so the loads and plane tests of all four
+    // overlap once the loop is unrolled
+#pragma unroll
+    for( int lane = 0; lane < QUAD_BLOCK_SIZE; ++lane ) {
+        const float3 n = make_float3( block.nx[lane], block.ny[lane], block.nz[lane] );
+        const float dt = dot( ray.direction, n );
+        const float t = ( block.d[lane] - dot( n, ray.origin ) ) / dt;
+        if( t > ray.tmin && t < ray.tmax ) {
+            const float3 vi = ray.origin + ray.direction * t
+                            - make_float3( block.ax[lane], block.ay[lane], block.az[lane] );
+            const float a1 = dot( make_float3( block.v1x[lane], block.v1y[lane], block.v1z[lane] ), vi );
+            const float a2 = dot( make_float3( block.v2x[lane], block.v2y[lane], block.v2z[lane] ), vi );
+            if( a1 >= 0 && a1 <= 1 && a2 >= 0 && a2 <= 1 ) {
+                if( rtPotentialIntersection( t ) ) {
+                    shading_normal = geometric_normal = n;
+                    texcoord = make_float3( a1, a2, 0 );
+                    lgt_idx = 0;
+                    rtReportIntersection( quad_materials[primIdx * QUAD_BLOCK_SIZE + lane] );
+                }
+            }
+        }
+    }
+}
+
+RT_PROGRAM void bounds (int primIdx, float result[6])
+{
+    const QuadBlock& block = quad_blocks[primIdx];
+    optix::Aabb* aabb = (optix::Aabb*)result;
+    aabb->invalidate();
+
+    for( int lane = 0; lane < QUAD_BLOCK_SIZE; ++lane ) {
+        const float3 n = make_float3( block.nx[lane], block.ny[lane], block.nz[lane] );
+        if( n.x == 0.0f && n.y == 0.0f && n.z == 0.0f )
+            continue;
+
+        // v1 and v2 are scaled by 1./length^2.  Rescale back to normal for the bounds computation.
+        float3 v1 = make_float3( block.v1x[lane], block.v1y[lane], block.v1z[lane] );
+        float3 v2 = make_float3( block.v2x[lane], block.v2y[lane], block.v2z[lane] );
+        v1 = v1 / dot( v1, v1 );
+        v2 = v2 / dot( v2, v2 );
+        const float3 p00 = make_float3( block.ax[lane], block.ay[lane], block.az[lane] );
+        aabb->include( p00 );
+        aabb->include( p00 + v1 );
+        aabb->include( p00 + v2 );
+        aabb->include( p00 + v1 + v2 );
+    }
+}
@@ -0,0 +1,87 @@
+/* 
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <optix_world.h>
+
+using namespace optix;
+
+// Particle spheres, xyz is the center and w the radius
+rtBuffer<float4> sphere_buffer;
+
+rtDeclareVariable(float3, texcoord, attribute texcoord, ); 
+rtDeclareVariable(float3, geometric_normal, attribute geometric_normal, ); 
+rtDeclareVariable(float3, shading_normal, attribute shading_normal, ); 
+rtDeclareVariable(optix::Ray, ray, rtCurrentRay, );
+
+RT_PROGRAM void intersect(int primIdx)
+{
+    const float4 sphere = sphere_buffer[primIdx];
+    const float3 center = make_float3( sphere );
+    const float  radius = sphere.w;
+
+    const float3 O = ray.origin - center;
+    const float  b = dot( O, ray.direction );
+    const float  c = dot( O, O ) - radius * radius;
+    const float  disc = b * b - c;
+    if( disc > 0.0f ) {
+        const float sdisc = sqrtf( disc );
+        bool check_second = true;
+
+        float t = -b - sdisc;
+        if( rtPotentialIntersection( t ) ) {
+            shading_normal = geometric_normal = ( O + t * ray.direction ) / radius;
+            texcoord = make_float3( 0.0f );
+            if( rtReportIntersection( 0 ) )
+                check_second = false;
+        }
+        if( check_second ) {
+            t = -b + sdisc;
+            if( rtPotentialIntersection( t ) ) {
+                shading_normal = geometric_normal = ( O + t * ray.direction ) / radius;
+                texcoord = make_float3( 0.0f );
+                rtReportIntersection( 0 );
+            }
+        }
+    }
+}
+
+RT_PROGRAM void bounds (int primIdx, float result[6])
+{
+    const float4 sphere = sphere_buffer[primIdx];
+    const float3 center = make_float3( sphere );
+    const float  radius = sphere.w;
+
+    optix::Aabb* aabb = (optix::Aabb*)result;
+
+    if( radius > 0.0f && !isinf( radius ) ) {
+        aabb->m_min = center - radius;
+        aabb->m_max = center + radius;
+    } else {
+        aabb->invalidate();
+    }
+}
@@ -0,0 +1,159 @@
+/* 
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <optix_world.h>
+
+using namespace optix;
+
+// Uniform grid over particle spheres built on the host by SphereGrid.  The
+// whole grid is a single primitive; the intersection program walks it with a
+// 3D-DDA and stops at the first cell that holds a hit.
+rtBuffer<float4>       sphere_buffer;      // xyz center, w radius
+rtBuffer<unsigned int> grid_cell_start;    // num_cells + 1 offsets into items
+rtBuffer<unsigned int> grid_items;         // Sphere indices, x-major cells
+rtDeclareVariable(float3, grid_min, , );
+rtDeclareVariable(float3, grid_max, , );
+rtDeclareVariable(float3, grid_cell_size, , );
+rtDeclareVariable(int3,   grid_dims, , );
+
+rtDeclareVariable(float3, texcoord, attribute texcoord, ); 
+rtDeclareVariable(float3, geometric_normal, attribute geometric_normal, ); 
+rtDeclareVariable(float3, shading_normal, attribute shading_normal, ); 
+rtDeclareVariable(optix::Ray, ray, rtCurrentRay, );
+
+// Nearest hit of the sphere in [tmin, tmax], or tmax if there is none
+static __device__ __inline__ float intersectSphere( const float4& sphere, float tmin, float tmax )
+{
+    const float3 O = ray.origin - make_float3( sphere );
+    const float  b = dot( O, ray.direction );
+    const float  c = dot( O, O ) - sphere.w * sphere.w;
+    const float  disc = b * b - c;
+    if( disc < 0.0f )
+        return tmax;
+
+    const float sdisc = sqrtf( disc );
+    const float t0 = -b - sdisc;
+    if( t0 > tmin && t0 < tmax )
+        return t0;
+    const float t1 = -b + sdisc;
+    if( t1 > tmin && t1 < tmax )
+        return t1;
+    return tmax;
+}
+
+RT_PROGRAM void intersect(int)
+{
+    const float3 inv_dir = make_float3(
+        ray.direction.x != 0.0f ? 1.0f / ray.direction.x : 1e30f,
+        ray.direction.y != 0.0f ? 1.0f / ray.direction.y : 1e30f,
+        ray.direction.z != 0.0f ? 1.0f / ray.direction.z : 1e30f );
+    const float3 t0 = ( grid_min - ray.origin ) * inv_dir;
+    const float3 t1 = ( grid_max - ray.origin ) * inv_dir;
+    const float  t_enter = fmaxf( ray.tmin, fmaxf( fminf( t0, t1 ) ) );
+    const float  t_exit  = fminf( ray.tmax, fminf( fmaxf( t0, t1 ) ) );
+    if( t_enter > t_exit )
+        return;
+
+    const float3 p = ( ray.origin + ray.direction * t_enter - grid_min ) / grid_cell_size;
+    int3 cell = make_int3(
+        min( grid_dims.x - 1, max( 0, int( p.x ) ) ),
+        min( grid_dims.y - 1, max( 0, int( p.y ) ) ),
+        min( grid_dims.z - 1, max( 0, int( p.z ) ) ) );
+
+    const int3 step = make_int3(
+        ray.direction.x > 0.0f ? 1 : ( ray.direction.x < 0.0f ? -1 : 0 ),
+        ray.direction.y > 0.0f ? 1 : ( ray.direction.y < 0.0f ? -1 : 0 ),
+        ray.direction.z > 0.0f ? 1 : ( ray.direction.z < 0.0f ? -1 : 0 ) );
+    const float3 o = ray.origin - grid_min;
+    float3 t_next = make_float3(
+        step.x ? ( ( cell.x + ( step.x > 0 ) ) * grid_cell_size.x - o.x ) * inv_dir.x : 1e30f,
+        step.y ? ( ( cell.y + ( step.y > 0 ) ) * grid_cell_size.y - o.y ) * inv_dir.y : 1e30f,
+        step.z ? ( ( cell.z + ( step.z > 0 ) ) * grid_cell_size.z - o.z ) * inv_dir.z : 1e30f );
+    const float3 t_delta = make_float3(
+        step.x ? fabsf( grid_cell_size.x * inv_dir.x ) : 1e30f,
+        step.y ? fabsf( grid_cell_size.y * inv_dir.y ) : 1e30f,
+        step.z ? fabsf( grid_cell_size.z * inv_dir.z ) : 1e30f );
+
+    for( ;; ) {
+        // Spheres overlap every cell they touch, so a hit inside this cell's
+        // t range is the nearest one along the ray
+        const float t_cell_exit = fminf( fminf( t_next ), t_exit );
+        const int   c = ( cell.z * grid_dims.y + cell.y ) * grid_dims.x + cell.x;
+        const unsigned int end = grid_cell_start[c + 1];
+
+        float t_hit = t_cell_exit;
+        unsigned int hit = 0;
+        for( unsigned int i = grid_cell_start[c]; i < end; ++i ) {
+            const unsigned int s = grid_items[i];
+            const float t = intersectSphere( sphere_buffer[s], ray.tmin, t_hit );
+            if( t < t_hit ) {
+                t_hit = t;
+                hit = s;
+            }
+        }
+
+        if( t_hit < t_cell_exit ) {
+            if( rtPotentialIntersection( t_hit ) ) {
+                const float4 sphere = sphere_buffer[hit];
+                shading_normal = geometric_normal = ( ray.origin + t_hit * ray.direction - make_float3( sphere ) ) / sphere.w;
+                texcoord = make_float3( 0.0f );
+                rtReportIntersection( 0 );
+            }
+            return;
+        }
+
+        if( t_next.x < t_next.y && t_next.x < t_next.z ) {
+            if( t_next.x > t_exit ) return;
+            cell.x += step.x;
+            if( cell.x < 0 || cell.x >= grid_dims.x ) return;
+            t_next.x += t_delta.x;
+        } else if( t_next.y < t_next.z ) {
+            if( t_next.y > t_exit ) return;
+            cell.y += step.y;
+            if( cell.y < 0 || cell.y >= grid_dims.y ) return;
+            t_next.y += t_delta.y;
+        } else {
+            if( t_next.z > t_exit ) return;
+            cell.z += step.z;
+            if( cell.z < 0 || cell.z >= grid_dims.z ) return;
+            t_next.z += t_delta.z;
+        }
+    }
+}
+
+RT_PROGRAM void bounds (int, float result[6])
+{
+    optix::Aabb* aabb = (optix::Aabb*)result;
+
+    if( grid_dims.x > 0 ) {
+        aabb->m_min = grid_min;
+        aabb->m_max = grid_max;
+    } else {
+        aabb->invalidate();
+    }
+}
@@ -28,11 +28,22 @@
 
 #include "HDRLoader.h"
 
+#include "ThreadPool.h"
+
 #include <math.h>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <new>
 #include <string>
 #include <cstdlib>
+#include <vector>
+
+#if defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+#  include <emmintrin.h>
+#  define HDR_LOADER_USE_SSE2
+#endif
 
 //-----------------------------------------------------------------------------
 //  
@@ -40,18 +51,6 @@
 //
 //-----------------------------------------------------------------------------
 
-void HDRLoader::getLine( std::ifstream& file_in, std::string& s )
-{
-  for (;;) {
-    if ( !std::getline( file_in, s ) )
-      return;
-    if(s.empty()) return;
-    std::string::size_type index = s.find_first_not_of( "\n\r\t " );
-    if ( index != std::string::npos && s[index] != '#' )
-      break;
-  }
-}
-
 namespace {
 
   // The error class to throw
@@ -60,76 +59,115 @@ namespace {
     HDRError(const std::string &st = "HDRLoader error") : Er(st) {}
   };
 
-  union RGBe {
-    struct {
-      unsigned char r, g, b, e;
-    };
-    unsigned char v[4];
+  struct RGBe {
+    unsigned char r, g, b, e;
   };
 
-  inline void RGBEtoFloats(const RGBe &RV, float *FV, float inv_img_exposure)
-  {
-    if(RV.e == 0)
-      FV[0] = FV[1] = FV[2] = 0.0f;
-    else {
-      const int HDR_EXPON_BIAS = 128;
-      float s = (float)ldexp(1.0, (int(RV.e)-(HDR_EXPON_BIAS+8)));
-      s *= inv_img_exposure;
-      FV[0] = (RV.r + 0.5f)*s;
-      FV[1] = (RV.g + 0.5f)*s;
-      FV[2] = (RV.b + 0.5f)*s;
-    }
-  }
-
-
-  void ReadScanlineNoRLE(std::ifstream &inf, RGBe *RGBEline, const size_t wid)
+  // Next line of the header without the newline, false at the end of data
+  bool GetLine(const char *&p, const char *end, std::string &line)
   {
-    inf.read(reinterpret_cast<char *>(RGBEline), wid * sizeof(RGBe));
-    if(inf.eof()) throw HDRError("Premature file end in ReadScanlineNoRLE");
+    if(p == end) return false;
+    const char *eol = static_cast<const char *>(memchr(p, '\n', end - p));
+    if(!eol) eol = end;
+    line.assign(p, eol);
+    p = eol == end ? end : eol + 1;
+    return true;
   }
 
-  void ReadScanline(std::ifstream &inf, RGBe *RGBEline, const size_t wid)
+  // Start of the scanline after the one at p.  Validates every run so that
+  // DecodeScanline can trust the data.
+  const char *SkipScanline(const char *p, const char *end, const size_t wid)
   {
     const size_t MinLen = 8, MaxLen = 0x7fff;
-    if(wid<MinLen || wid>MaxLen) return ReadScanlineNoRLE(inf, RGBEline, wid);
-    char c0, c1, c2, c3;
-    inf.get(c0);
-    inf.get(c1);
-    inf.get(c2);
-    inf.get(c3);
-    if(inf.eof()) throw HDRError("Premature file end in ReadScanline 1");
-    if(c0 != 2 || c1 != 2 || (c2&0x80)) {
-      inf.putback(c3);
-      inf.putback(c2);
-      inf.putback(c1);
-      inf.putback(c0);
-      return ReadScanlineNoRLE(inf, RGBEline, wid); // Found an old-format scanline
+    const unsigned char *u = reinterpret_cast<const unsigned char *>(p);
+    const size_t left = end - p;
+    if(wid<MinLen || wid>MaxLen || left < 4 || u[0] != 2 || u[1] != 2 || (u[2]&0x80)) {
+      // Old-format scanline
+      if(left < wid*sizeof(RGBe)) throw HDRError("Premature file end in ReadScanlineNoRLE");
+      return p + wid*sizeof(RGBe);
     }
 
-    if(size_t(size_t((unsigned char) c2)<<8 | size_t((unsigned char) c3)) != wid) throw HDRError("Scanline width inconsistent");
+    if((size_t(u[2])<<8 | size_t(u[3])) != wid) throw HDRError("Scanline width inconsistent");
+    p += 4;
 
     // This scanline is RLE.
     for(unsigned int ch=0; ch<4; ch++) {
-      for(unsigned int x=0; x<wid; ) {
-        unsigned char code;
-        inf.get(reinterpret_cast<char &>(code));
-        if(inf.eof()) throw HDRError("Premature file end in ReadScanline 2");
+      for(size_t x=0; x<wid; ) {
+        if(p == end) throw HDRError("Premature file end in ReadScanline 2");
+        unsigned char code = static_cast<unsigned char>(*p++);
+        size_t count = code > 0x80 ? code & 0x7f : code;
+        if(count == 0 || x + count > wid) throw HDRError("Invalid run in scanline");
+        size_t bytes = code > 0x80 ? 1 : count;
+        if(size_t(end - p) < bytes) throw HDRError("Premature file end in ReadScanline 3");
+        p += bytes;
+        x += count;
+      }
+    }
+    return p;
+  }
+
+  // Scanline at p, already checked by SkipScanline
+  void DecodeScanline(const char *p, RGBe *RGBEline, const size_t wid)
+  {
+    const unsigned char *u = reinterpret_cast<const unsigned char *>(p);
+    if(wid<8 || wid>0x7fff || u[0] != 2 || u[1] != 2 || (u[2]&0x80)) {
+      memcpy(RGBEline, p, wid*sizeof(RGBe));
+      return;
+    }
+
+    u += 4;
+    for(unsigned int ch=0; ch<4; ch++) {
+      unsigned char *dst = reinterpret_cast<unsigned char *>(RGBEline) + ch;
+      for(size_t x=0; x<wid; ) {
+        unsigned char code = *u++;
         if(code > 0x80) { // RLE span
-          char pix;
-          inf.get(pix);
-          if(inf.eof()) throw HDRError("Premature file end in ReadScanline 3");
+          unsigned char pix = *u++;
           code = code & 0x7f;
-          while(code--)
-            RGBEline[x++].v[ch] = pix;
+          while(code--) {
+            dst[x*4] = pix;
+            ++x;
+          }
         } else { // Arbitrary span
           while(code--) {
-            inf.get(reinterpret_cast<char &>(RGBEline[x++].v[ch]));
-            if(inf.eof()) throw HDRError("Premature file end in ReadScanline 4");
+            dst[x*4] = *u++;
+            ++x;
           }
         }
       }
     }
   }
+
+  // RGBe to float RGBA with alpha 1.  scale[e] holds 2^(e-136) over the
+  // image exposure, 0 for e == 0, so there is no branch or ldexp per pixel.
+  void RGBEtoFloats(const RGBe *RGBEline, float *FV, const size_t wid, const float *scale)
+  {
+    size_t x = 0;
+#ifdef HDR_LOADER_USE_SSE2
+    const __m128i zero  = _mm_setzero_si128();
+    const __m128  half  = _mm_set1_ps(0.5f);
+    const __m128  rgb   = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+    const __m128  alpha = _mm_set_ps(1.0f, 0.0f, 0.0f, 0.0f);
+    for(; x + 4 <= wid; x += 4) {
+      const __m128i px  = _mm_loadu_si128(reinterpret_cast<const __m128i *>(RGBEline + x));
+      const __m128i lo  = _mm_unpacklo_epi8(px, zero);
+      const __m128i hi  = _mm_unpackhi_epi8(px, zero);
+      const __m128i p[4] = { _mm_unpacklo_epi16(lo, zero), _mm_unpackhi_epi16(lo, zero),
+                             _mm_unpacklo_epi16(hi, zero), _mm_unpackhi_epi16(hi, zero) };
+      for(int i=0; i<4; i++) {
+        __m128 f = _mm_mul_ps(_mm_add_ps(_mm_cvtepi32_ps(p[i]), half), _mm_set1_ps(scale[RGBEline[x+i].e]));
+        _mm_storeu_ps(FV + (x+i)*4, _mm_or_ps(_mm_and_ps(f, rgb), alpha));
+      }
+    }
+#endif
+    for(; x<wid; x++) {
+      const RGBe &RV = RGBEline[x];
+      const float s = scale[RV.e];
+      FV[x*4+0] = (RV.r + 0.5f)*s;
+      FV[x*4+1] = (RV.g + 0.5f)*s;
+      FV[x*4+2] = (RV.b + 0.5f)*s;
+      FV[x*4+3] = 1.0f;
+    }
+  }
 };
 
 HDRLoader::HDRLoader( const std::string& filename )
@@ -137,24 +175,30 @@ HDRLoader::HDRLoader( const std::string& filename )
 {
   if ( filename.empty() ) return;
 
-  // Open file
   try {
+    // Read the whole file and parse it in place
     std::ifstream inf(filename.c_str(), std::ios::binary);
-
     if(!inf.is_open()) throw HDRError("Couldn't open file " + filename);
+    inf.seekg(0, std::ios::end);
+    const std::streamoff size = inf.tellg();
+    if(size <= 0) throw HDRError("Empty file");
+    inf.seekg(0, std::ios::beg);
+    std::vector<char> data(static_cast<size_t>(size));
+    if(!inf.read(&data[0], size)) throw HDRError("Couldn't read file " + filename);
+
+    const char *p = &data[0], *end = p + data.size();
 
     std::string magic, comment;
     float exposure = 1.0f;
 
-    std::getline(inf, magic);
+    GetLine(p, end, magic);
     if(magic != "#?RADIANCE" && magic != "#?RGBE") throw HDRError("File isn't Radiance.");
     for (;;) {
-      getLine(inf, comment);
+      if(!GetLine(p, end, comment)) throw HDRError("Premature file end in header");
 
-      // VS2010 doesn't let you look at the 0th element of a 0 length string, so this was tripping
-      // debug asserts
-      if (comment.empty()) break;
-      if(comment[0] == '#') continue;
+      // An empty line ends the header, lines of only whitespace are skipped
+      if(comment.empty()) break;
+      if(comment[0] == '#' || comment.find_first_not_of("\r\t ") == std::string::npos) continue;
 
       if(comment.find("FORMAT") != std::string::npos) {
         if(comment != "FORMAT=32-bit_rle_rgbe") throw HDRError("Can only handle RGBe, not XYZe.");
@@ -166,30 +210,53 @@ HDRLoader::HDRLoader( const std::string& filename )
         exposure = (float)atof(comment.c_str()+ofs+9);
       }
     }
-    
-    std::string major, minor;
-    inf >> minor >> m_ny >> major >> m_nx;
-    if(minor != "-Y" || major != "+X") throw "Can only handle -Y +X ordering";
-    if(m_nx <= 0 || m_ny <= 0) throw "Invalid image dimensions";
-    getLine(inf, comment); // Read the last newline of the header
-
-    RGBe *RGBERaster = new RGBe[m_nx * m_ny];
 
+    // Resolution line
+    if(!GetLine(p, end, comment)) throw HDRError("Premature file end in header");
+    char minor[3], major[3];
+    int ny = 0, nx = 0;
+    if(sscanf(comment.c_str(), "%2s %d %2s %d", minor, &ny, major, &nx) != 4) throw HDRError("Invalid resolution line");
+    if(std::string(minor) != "-Y" || std::string(major) != "+X") throw HDRError("Can only handle -Y +X ordering");
+    if(nx <= 0 || ny <= 0) throw HDRError("Invalid image dimensions");
+    m_nx = nx;
+    m_ny = ny;
+
+    // Find the scanlines, checking the data on the way
+    std::vector<const char *> scanlines(m_ny);
     for(unsigned int y=0; y<m_ny; y++) {
-      ReadScanline(inf, RGBERaster + m_nx*y, m_nx);
+      scanlines[y] = p;
+      p = SkipScanline(p, end, m_nx);
     }
 
-    m_raster = new float[m_nx * m_ny * 4];
-
+    float scale[256];
+    scale[0] = 0.0f;
+    const int HDR_EXPON_BIAS = 128;
     float inv_img_exposure = 1.0f / exposure;
-    for(unsigned int i=0; i<m_nx*m_ny; i++) {
-      RGBEtoFloats(RGBERaster[i], m_raster + i*4, inv_img_exposure);
+    for(int e=1; e<256; e++) {
+      scale[e]  = (float)ldexp(1.0, (e-(HDR_EXPON_BIAS+8)));
+      scale[e] *= inv_img_exposure;
     }
-    delete[] RGBERaster;
+
+    m_raster = new float[size_t(m_nx) * m_ny * 4];
+
+    // Decode bands of scanlines in parallel
+    const unsigned int nx_ = m_nx;
+    float *raster = m_raster;
+    sutil::defaultThreadPool().parallelFor(0, m_ny, 16, [&](size_t first, size_t last) {
+      std::vector<RGBe> line(nx_);
+      for(size_t y=first; y<last; y++) {
+        DecodeScanline(scanlines[y], &line[0], nx_);
+        RGBEtoFloats(&line[0], raster + y*nx_*4, nx_, scale);
+      }
+    });
   } catch ( const HDRError& err  ) {
     std::cerr << "HDRLoader( '" << filename << "' ) failed to load file: " << err.Er << '\n';
     delete [] m_raster;
     m_raster = 0;
+  } catch ( const std::bad_alloc& ) {
+    std::cerr << "HDRLoader( '" << filename << "' ) failed to load file: out of memory\n";
+    delete [] m_raster;
+    m_raster = 0;
   }
 }
 
@@ -233,6 +300,14 @@ float* HDRLoader::raster()const
 optix::TextureSampler loadHDRTexture( optix::Context context,
                                       const std::string& filename,
                                       const optix::float3& default_color )
+{
+  HDRLoader hdr( filename );
+  return hdr.loadTexture( context, default_color );
+}
+
+
+optix::TextureSampler HDRLoader::loadTexture( optix::Context context,
+                                              const optix::float3& default_color )
 {
   // Create tex sampler and populate with default values
   optix::TextureSampler sampler = context->createTextureSampler();
@@ -243,9 +318,8 @@ optix::TextureSampler loadHDRTexture( optix::Context context,
   sampler->setReadMode( RT_TEXTURE_READ_NORMALIZED_FLOAT );
   sampler->setMaxAnisotropy( 1.0f );
 
-  // Read in HDR, set texture buffer to empty buffer if fails
-  HDRLoader hdr( filename );
-  if ( hdr.failed() ) {
+  // Set texture buffer to a single texel if the read failed
+  if ( failed() ) {
 
     // Create buffer with single texel set to default_color
     optix::Buffer buffer = context->createBuffer( RT_BUFFER_INPUT, RT_FORMAT_FLOAT4, 1u, 1u );
@@ -265,25 +339,16 @@ optix::TextureSampler loadHDRTexture( optix::Context context,
     return sampler;
   }
 
-  const unsigned int nx = hdr.width();
-  const unsigned int ny = hdr.height();
+  const unsigned int nx = width();
+  const unsigned int ny = height();
 
   // Create buffer and populate with HDR data
   optix::Buffer buffer = context->createBuffer( RT_BUFFER_INPUT, RT_FORMAT_FLOAT4, nx, ny );
   float* buffer_data = static_cast<float*>( buffer->map() );
 
-  for ( unsigned int i = 0; i < nx; ++i ) {
-    for ( unsigned int j = 0; j < ny; ++j ) {
-
-      unsigned int hdr_index = ( (ny-j-1)*nx + i )*4;
-      unsigned int buf_index = ( (j     )*nx + i )*4;
-
-      buffer_data[ buf_index + 0 ] = hdr.raster()[ hdr_index + 0 ];
-      buffer_data[ buf_index + 1 ] = hdr.raster()[ hdr_index + 1 ];
-      buffer_data[ buf_index + 2 ] = hdr.raster()[ hdr_index + 2 ];
-      buffer_data[ buf_index + 3 ] = hdr.raster()[ hdr_index + 3 ];
-    }
-  }
+  // Rows are stored top down, same texel layout
+  for ( unsigned int j = 0; j < ny; ++j )
+    memcpy( buffer_data + size_t( j )*nx*4, raster() + size_t( ny-j-1 )*nx*4, nx*4*sizeof( float ) );
 
   buffer->unmap();
 
@@ -59,6 +59,9 @@ public:
   SUTILAPI HDRLoader( const std::string& filename );
   SUTILAPI ~HDRLoader();
 
+  SUTILAPI optix::TextureSampler loadTexture( optix::Context context,
+                                              const optix::float3& default_color );
+
   SUTILAPI bool           failed()const;
   SUTILAPI unsigned int   width()const;
   SUTILAPI unsigned int   height()const;
@@ -68,7 +71,4 @@ private:
   unsigned int   m_nx;
   unsigned int   m_ny;
   float*         m_raster;
-
-  static void getLine( std::ifstream& file_in, std::string& s );
-
 };
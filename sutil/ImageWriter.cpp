@@ -0,0 +1,469 @@
+/*
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "ImageWriter.h"
+#include "sutil.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdint.h>
+
+
+namespace sutil
+{
+
+namespace
+{
+
+// Gamma encoding to 8 bit, bit exact with the int( pow( x, 1/2.2 ) * 255 )
+// clamped to [0, 255] that displayBufferPPM computed per channel.  Floats in
+// (0, 1) are bucketed by their top 16 bits, which is less than one step of
+// the curve, so the byte at the bucket start and a comparison with the
+// thresholds that follow give the exact result.
+class GammaTable
+{
+public:
+  GammaTable()
+  {
+    for( uint32_t bucket = 0; bucket < NUM_BUCKETS; ++bucket )
+      m_bucket[bucket] = static_cast<unsigned char>( reference( fromBits( bucket << 16 ) ) );
+
+    // Smallest float in (0, 1) encoding to each byte, the curve is monotonic
+    m_threshold[0]   = 0.0f;
+    m_threshold[256] = HUGE_VALF;
+    for( int k = 1; k < 256; ++k )
+    {
+      uint32_t lo = 0, hi = ONE_BITS;
+      while( lo < hi )
+      {
+        const uint32_t mid = lo + ( hi - lo ) / 2;
+        if( reference( fromBits( mid ) ) >= k )
+          hi = mid;
+        else
+          lo = mid + 1;
+      }
+      m_threshold[k] = fromBits( lo );
+    }
+  }
+
+  unsigned char encode( float x ) const
+  {
+    if( !( x > 0.0f ) )          // NaN too
+      return 0;
+    if( x >= 1.0f )
+      return 255;
+
+    uint32_t bits;
+    memcpy( &bits, &x, sizeof( bits ) );
+    unsigned int b = m_bucket[bits >> 16];
+    while( x >= m_threshold[b + 1] )
+      ++b;
+    return static_cast<unsigned char>( b );
+  }
+
+private:
+  static const uint32_t ONE_BITS    = 0x3f800000u;
+  static const uint32_t NUM_BUCKETS = ONE_BITS >> 16;
+
+  static float fromBits( uint32_t bits )
+  {
+    float x;
+    memcpy( &x, &bits, sizeof( x ) );
+    return x;
+  }
+
+  static int reference( float x )
+  {
+    const float gamma_inv = 1.0f / 2.2f;
+    const int P = static_cast<int>( std::pow( x, gamma_inv ) * 255.0f );
+    return P < 0 ? 0 : P > 0xff ? 0xff : P;
+  }
+
+  unsigned char m_bucket[NUM_BUCKETS];
+  float         m_threshold[257];
+};
+
+
+const GammaTable& gammaTable()
+{
+  static GammaTable table;
+  return table;
+}
+
+
+inline unsigned char encodeLinear( float x )
+{
+  if( !( x > 0.0f ) )
+    return 0;
+  if( x >= 1.0f )
+    return 255;
+  return static_cast<unsigned char>( x * 255.0f );
+}
+
+
+unsigned int channelCount( RTformat format )
+{
+  switch( format )
+  {
+    case RT_FORMAT_FLOAT:          return 1;
+    case RT_FORMAT_FLOAT3:         return 3;
+    case RT_FORMAT_FLOAT4:         return 4;
+    case RT_FORMAT_UNSIGNED_BYTE4: return 4;
+    default:                       return 0;
+  }
+}
+
+
+// Row y of the frame, counted from the bottom, as RGB bytes
+void encodeRowPPM( const ImageFrame& frame, unsigned int y, bool srgb, unsigned char* dst )
+{
+  const unsigned int channels = channelCount( frame.format );
+  const size_t       width    = frame.width;
+
+  if( frame.format == RT_FORMAT_UNSIGNED_BYTE4 )
+  {
+    // Data is BGRA, swizzle to RGB
+    const unsigned char* src = &frame.data[0] + 4 * width * y;
+    for( size_t i = 0; i < width; ++i, src += 4 )
+    {
+      *dst++ = src[2];
+      *dst++ = src[1];
+      *dst++ = src[0];
+    }
+    return;
+  }
+
+  const float*      src   = reinterpret_cast<const float*>( &frame.data[0] ) + channels * width * y;
+  const GammaTable& gamma = gammaTable();
+  for( size_t i = 0; i < width; ++i, src += channels )
+  {
+    // A single channel is written to all three
+    for( int c = 0; c < 3; ++c )
+    {
+      const float x = src[channels == 1 ? 0 : c];
+      *dst++ = srgb ? gamma.encode( x ) : encodeLinear( x );
+    }
+  }
+}
+
+
+// Row y of the frame, counted from the bottom, as float channels.  Bytes
+// are scaled to [0, 1] and swizzled to RGB(A).
+void encodeRowFloat( const ImageFrame& frame, unsigned int y, unsigned int out_channels, float* dst )
+{
+  const unsigned int channels = channelCount( frame.format );
+  const size_t       width    = frame.width;
+
+  if( frame.format == RT_FORMAT_UNSIGNED_BYTE4 )
+  {
+    const unsigned char* src = &frame.data[0] + 4 * width * y;
+    for( size_t i = 0; i < width; ++i, src += 4 )
+    {
+      const unsigned char rgba[4] = { src[2], src[1], src[0], src[3] };
+      for( unsigned int c = 0; c < out_channels; ++c )
+        *dst++ = rgba[c] * ( 1.0f / 255.0f );
+    }
+    return;
+  }
+
+  const float* src = reinterpret_cast<const float*>( &frame.data[0] ) + channels * width * y;
+  if( out_channels == channels )
+  {
+    memcpy( dst, src, width * channels * sizeof( float ) );
+    return;
+  }
+  for( size_t i = 0; i < width; ++i, src += channels )
+    for( unsigned int c = 0; c < out_channels; ++c )
+      *dst++ = src[c];
+}
+
+
+bool isLittleEndian()
+{
+  const uint16_t one = 1;
+  unsigned char  first;
+  memcpy( &first, &one, 1 );
+  return first == 1;
+}
+
+} // namespace
+
+
+ImageFileFormat imageFileFormat( const std::string& filename )
+{
+  const size_t dot = filename.find_last_of( '.' );
+  std::string extension = dot == std::string::npos ? std::string() : filename.substr( dot + 1 );
+  for( size_t i = 0; i < extension.size(); ++i )
+    extension[i] = static_cast<char>( tolower( extension[i] ) );
+
+  if( extension == "pfm" )
+    return IMAGE_FILE_PFM;
+  if( extension == "raw" )
+    return IMAGE_FILE_RAW;
+  return IMAGE_FILE_PPM;
+}
+
+
+void snapshotBuffer( RTbuffer buffer, ImageFrame& frame )
+{
+  RTsize   width, height, element_size;
+  RTformat format;
+  RT_CHECK_ERROR( rtBufferGetSize2D( buffer, &width, &height ) );
+  RT_CHECK_ERROR( rtBufferGetFormat( buffer, &format ) );
+  RT_CHECK_ERROR( rtBufferGetElementSize( buffer, &element_size ) );
+  if( channelCount( format ) == 0 )
+    throw optix::Exception( "Unrecognized buffer data type or format." );
+
+  frame.width  = static_cast<unsigned int>( width );
+  frame.height = static_cast<unsigned int>( height );
+  frame.format = format;
+  frame.data.resize( width * height * element_size );
+
+  void* data;
+  RT_CHECK_ERROR( rtBufferMap( buffer, &data ) );
+  if( !frame.data.empty() )
+    memcpy( &frame.data[0], data, frame.data.size() );
+  RT_CHECK_ERROR( rtBufferUnmap( buffer ) );
+}
+
+
+void writeImage( const std::string& filename, const ImageFrame& frame, ImageFileFormat format, bool srgb )
+{
+  const unsigned int channels = channelCount( frame.format );
+  if( frame.width < 1 || frame.height < 1 || channels == 0 ||
+      frame.data.size() < size_t( frame.width ) * frame.height * ( frame.format == RT_FORMAT_UNSIGNED_BYTE4 ? 4 : channels * sizeof( float ) ) )
+    throw optix::Exception( "Image is ill-formed. Not saving" );
+
+  std::ofstream out( filename.c_str(), std::ios::out | std::ios::binary );
+  if( !out.is_open() )
+    throw optix::Exception( "Could not open file '" + filename + "' for writing" );
+
+  if( format == IMAGE_FILE_PPM )
+  {
+    // Top row first
+    out << "P6\n" << frame.width << " " << frame.height << "\n255\n";
+    std::vector<unsigned char> row( size_t( frame.width ) * 3 );
+    for( unsigned int y = frame.height; y-- > 0; )
+    {
+      encodeRowPPM( frame, y, srgb, &row[0] );
+      out.write( reinterpret_cast<const char*>( &row[0] ), row.size() );
+    }
+  }
+  else if( format == IMAGE_FILE_PFM )
+  {
+    // Bottom row first like the buffer, a negative scale for little endian
+    const unsigned int out_channels = channels == 1 ? 1 : 3;
+    out << ( out_channels == 1 ? "Pf\n" : "PF\n" ) << frame.width << " " << frame.height << "\n"
+        << ( isLittleEndian() ? "-1.0" : "1.0" ) << "\n";
+    std::vector<float> row( size_t( frame.width ) * out_channels );
+    for( unsigned int y = 0; y < frame.height; ++y )
+    {
+      encodeRowFloat( frame, y, out_channels, &row[0] );
+      out.write( reinterpret_cast<const char*>( &row[0] ), row.size() * sizeof( float ) );
+    }
+  }
+  else
+  {
+    std::vector<float> row( size_t( frame.width ) * channels );
+    for( unsigned int y = frame.height; y-- > 0; )
+    {
+      encodeRowFloat( frame, y, channels, &row[0] );
+      out.write( reinterpret_cast<const char*>( &row[0] ), row.size() * sizeof( float ) );
+    }
+  }
+
+  out.close();
+  if( !out )
+    throw optix::Exception( "Failed to write '" + filename + "'" );
+}
+
+
+//------------------------------------------------------------------------------
+//
+// ImageWriter
+//
+//------------------------------------------------------------------------------
+
+ImageWriter::ImageWriter( size_t max_queued )
+  : m_max_queued( std::max<size_t>( max_queued, 1 ) ),
+    m_reserved( 0 ),
+    m_busy( false ),
+    m_stop( false ),
+    m_written( 0 ),
+    m_dropped( 0 ),
+    m_failed( 0 )
+{
+  m_thread = std::thread( &ImageWriter::writerLoop, this );
+}
+
+
+ImageWriter::~ImageWriter()
+{
+  {
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_stop = true;
+  }
+  m_job_available.notify_all();
+  m_thread.join();
+}
+
+
+bool ImageWriter::write( const std::string& filename, RTbuffer buffer, bool srgb, bool wait )
+{
+  // The slot is reserved in the same critical section that finds it free,
+  // so concurrent write() calls can not both take the last one while they
+  // copy outside the lock
+  Job job;
+  {
+    std::unique_lock<std::mutex> lock( m_mutex );
+    if( wait )
+    {
+      while( m_queue.size() + m_reserved >= m_max_queued )
+        m_job_done.wait( lock );
+    }
+    else if( m_queue.size() + m_reserved >= m_max_queued )
+    {
+      ++m_dropped;
+      return false;
+    }
+    ++m_reserved;
+
+    if( !m_free.empty() )
+    {
+      job.frame = std::move( m_free.back() );
+      m_free.pop_back();
+    }
+  }
+
+  try
+  {
+    if( !job.frame )
+      job.frame.reset( new ImageFrame );
+    snapshotBuffer( buffer, *job.frame );
+  }
+  catch( ... )
+  {
+    {
+      std::lock_guard<std::mutex> lock( m_mutex );
+      --m_reserved;
+      if( job.frame && m_free.size() < m_max_queued )
+        m_free.push_back( std::move( job.frame ) );
+    }
+    m_job_done.notify_all();
+    throw;
+  }
+  job.filename = filename;
+  job.srgb     = srgb;
+
+  {
+    std::lock_guard<std::mutex> lock( m_mutex );
+    --m_reserved;
+    m_queue.push_back( std::move( job ) );
+  }
+  m_job_available.notify_one();
+  return true;
+}
+
+
+void ImageWriter::flush()
+{
+  std::unique_lock<std::mutex> lock( m_mutex );
+  while( !m_queue.empty() || m_reserved || m_busy )
+    m_job_done.wait( lock );
+}
+
+
+size_t ImageWriter::numWritten() const
+{
+  std::lock_guard<std::mutex> lock( m_mutex );
+  return m_written;
+}
+
+
+size_t ImageWriter::numDropped() const
+{
+  std::lock_guard<std::mutex> lock( m_mutex );
+  return m_dropped;
+}
+
+
+size_t ImageWriter::numFailed() const
+{
+  std::lock_guard<std::mutex> lock( m_mutex );
+  return m_failed;
+}
+
+
+void ImageWriter::writerLoop()
+{
+  for( ;; )
+  {
+    Job job;
+    {
+      std::unique_lock<std::mutex> lock( m_mutex );
+      while( m_queue.empty() && !m_stop )
+        m_job_available.wait( lock );
+      if( m_queue.empty() )
+        return;
+
+      job = std::move( m_queue.front() );
+      m_queue.pop_front();
+      m_busy = true;
+    }
+
+    bool ok = true;
+    try
+    {
+      writeImage( job.filename, *job.frame, imageFileFormat( job.filename ), job.srgb );
+    }
+    catch( const std::exception& e )
+    {
+      std::cerr << "ImageWriter: " << e.what() << "\n";
+      ok = false;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock( m_mutex );
+      if( ok )
+        ++m_written;
+      else
+        ++m_failed;
+      if( m_free.size() < m_max_queued )
+        m_free.push_back( std::move( job.frame ) );
+      m_busy = false;
+    }
+    m_job_done.notify_all();
+  }
+}
+
+} // namespace sutil
@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#pragma once
+
+#include <optixu/optixpp_namespace.h>
+#include <sutilapi.h>
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace sutil
+{
+
+enum ImageFileFormat
+{
+  IMAGE_FILE_PPM = 0,   // 8 bit RGB, gamma encoded or linear
+  IMAGE_FILE_PFM,       // 32 bit float RGB, or gray for one channel buffers
+  IMAGE_FILE_RAW        // The buffer's channels as 32 bit floats, top row first, no header
+};
+
+// .pfm and .raw select those formats, anything else is written as PPM
+SUTILAPI ImageFileFormat imageFileFormat( const std::string& filename );
+
+
+// Copy of an output buffer, bottom row first like the buffer
+struct ImageFrame
+{
+  ImageFrame() : width( 0 ), height( 0 ), format( RT_FORMAT_UNKNOWN ) {}
+
+  unsigned int               width;
+  unsigned int               height;
+  RTformat                   format;    // RT_FORMAT_FLOAT, FLOAT3, FLOAT4 or UNSIGNED_BYTE4 (BGRA)
+  std::vector<unsigned char> data;
+};
+
+// Copy a 2D buffer into frame, reusing the frame's storage
+SUTILAPI void snapshotBuffer( RTbuffer buffer, ImageFrame& frame );
+
+// Write a frame to an image file.  With srgb, float channels written to PPM
+// are gamma encoded with the curve displayBufferPPM always used, through
+// tables instead of a pow() per channel.  Float formats stay linear.
+// Throws optix::Exception on failure.
+SUTILAPI void writeImage( const std::string& filename, const ImageFrame& frame, ImageFileFormat format, bool srgb );
+
+
+//------------------------------------------------------------------------------
+//
+// Writes images on a background thread.  write() copies the buffer into a
+// recycled snapshot and queues it, the encoding and file output happen on
+// the writer thread, so a render loop can save every frame of a run at the
+// cost of a buffer copy.
+//
+// At most max_queued frames wait to be written, counting those still being
+// copied.  A write() that finds the queue full drops its frame and returns
+// false, unless asked to wait.  write() may be called from several threads.
+// Frames still queued are written by flush() and the destructor.
+//
+//------------------------------------------------------------------------------
+class ImageWriter
+{
+public:
+  SUTILAPI explicit ImageWriter( size_t max_queued = 8 );
+  SUTILAPI ~ImageWriter();
+
+  // Queue the buffer for writing to filename in the format its extension
+  // selects.  Called from the thread that owns the buffer's context.
+  SUTILAPI bool write( const std::string& filename, RTbuffer buffer, bool srgb, bool wait = false );
+  SUTILAPI bool write( const std::string& filename, optix::Buffer buffer, bool srgb, bool wait = false )
+  {
+    return write( filename, buffer->get(), srgb, wait );
+  }
+
+  // Block until every frame accepted so far is written
+  SUTILAPI void flush();
+
+  SUTILAPI size_t numWritten() const;
+  SUTILAPI size_t numDropped() const;
+  SUTILAPI size_t numFailed() const;
+
+private:
+  struct Job
+  {
+    std::string                 filename;
+    bool                        srgb;
+    std::unique_ptr<ImageFrame> frame;
+  };
+
+  void writerLoop();
+
+  std::deque<Job>                           m_queue;
+  std::vector< std::unique_ptr<ImageFrame> > m_free;      // Written frames, for reuse
+  size_t                                    m_max_queued;
+  size_t                                    m_reserved;  // Slots taken by write() calls still copying
+  bool                                      m_busy;      // Writer thread is writing a frame
+  bool                                      m_stop;
+  size_t                                    m_written;
+  size_t                                    m_dropped;
+  size_t                                    m_failed;
+  mutable std::mutex                        m_mutex;
+  std::condition_variable                   m_job_available;
+  std::condition_variable                   m_job_done;
+  std::thread                               m_thread;
+
+  ImageWriter( const ImageWriter& );            // forbidden
+  ImageWriter& operator=( const ImageWriter& ); // forbidden
+};
+
+} // namespace sutil
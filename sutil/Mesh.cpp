@@ -31,13 +31,21 @@
 #include <optixu/optixu_math_stream_namespace.h>
 
 #include "Mesh.h" 
+#include "Morton.h"
+#include "sutil.h"
 #include "rply-1.01/rply.h"
 #include "tinyobjloader/tiny_obj_loader.h"
 #include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
 #include <iostream>
 #include <locale>
+#include <queue>
 #include <stdexcept>
 #include <stdint.h>
+#include <sys/stat.h>
 #include <vector>
 
 //------------------------------------------------------------------------------
@@ -282,8 +290,565 @@ void applyLoadXForm( Mesh& mesh, const float* load_xform )
   }
 }
 
+
+// Move vertex v's attribute of the given width to slot remap[v]
+void permuteVertexAttribute( float* data, int width, const std::vector<int32_t>& remap )
+{
+  const std::vector<float> source( data, data + width * remap.size() );
+  for( size_t v = 0; v < remap.size(); ++v )
+    for( int k = 0; k < width; ++k )
+      data[width * remap[v] + k] = source[width * v + k];
+}
+
 } 
 
+//------------------------------------------------------------------------------
+//
+// Simplification helpers
+//
+//------------------------------------------------------------------------------
+
+namespace
+{
+
+// Symmetric 4x4 error quadric, upper triangle row by row
+struct Quadric
+{
+  Quadric() { for( int i = 0; i < 10; ++i ) q[i] = 0.0; }
+
+  void addPlane( double a, double b, double c, double d, double w )
+  {
+    q[0] += w*a*a; q[1] += w*a*b; q[2] += w*a*c; q[3] += w*a*d;
+                   q[4] += w*b*b; q[5] += w*b*c; q[6] += w*b*d;
+                                  q[7] += w*c*c; q[8] += w*c*d;
+                                                 q[9] += w*d*d;
+  }
+
+  Quadric& operator+=( const Quadric& other )
+  {
+    for( int i = 0; i < 10; ++i )
+      q[i] += other.q[i];
+    return *this;
+  }
+
+  double error( const float3& p ) const
+  {
+    const double x = p.x, y = p.y, z = p.z;
+    return   q[0]*x*x + 2.0*q[1]*x*y + 2.0*q[2]*x*z + 2.0*q[3]*x
+           + q[4]*y*y + 2.0*q[5]*y*z + 2.0*q[6]*y
+           + q[7]*z*z + 2.0*q[8]*z
+           + q[9];
+  }
+
+  // Position of minimal error, false if the quadric is close to singular
+  bool minimize( float3& p ) const
+  {
+    const double a00 = q[0], a01 = q[1], a02 = q[2];
+    const double a11 = q[4], a12 = q[5], a22 = q[7];
+    const double det = a00*( a11*a22 - a12*a12 ) - a01*( a01*a22 - a12*a02 ) + a02*( a01*a12 - a11*a02 );
+    const double scale = a00*a11*a22 + 1e-30;
+    if( std::fabs( det ) < 1e-6 * std::fabs( scale ) )
+      return false;
+
+    // Cramer's rule for A p = -b
+    const double inv = 1.0 / det;
+    const double b0 = -q[3], b1 = -q[6], b2 = -q[8];
+    p.x = static_cast<float>( inv*(  b0*( a11*a22 - a12*a12 ) - a01*( b1*a22 - a12*b2 ) + a02*( b1*a12 - a11*b2 ) ) );
+    p.y = static_cast<float>( inv*(  a00*( b1*a22 - a12*b2 ) - b0*( a01*a22 - a12*a02 ) + a02*( a01*b2 - b1*a02 ) ) );
+    p.z = static_cast<float>( inv*(  a00*( a11*b2 - b1*a12 ) - a01*( a01*b2 - b1*a02 ) + b0*( a01*a12 - a11*a02 ) ) );
+    return true;
+  }
+
+  double q[10];
+};
+
+
+struct Collapse
+{
+  double   cost;
+  int32_t  v0, v1;
+  uint32_t stamp0, stamp1;
+  float3   target;
+
+  bool operator<( const Collapse& other ) const { return cost > other.cost; }   // Min heap
+};
+
+
+class Simplifier
+{
+public:
+  Simplifier( const Mesh& mesh );
+
+  void run( int32_t target_triangles );
+  void write( Mesh& simplified ) const;
+
+private:
+  void     weld( const Mesh& mesh );
+  void     computeQuadrics();
+  void     pushCollapse( int32_t v0, int32_t v1 );
+  bool     collapse( const Collapse& c );
+  bool     flips( int32_t v, int32_t other, const float3& target ) const;
+  void     neighbors( int32_t v, std::vector<int32_t>& out ) const;
+
+  std::vector<float3>                 m_positions;
+  std::vector<int32_t>                m_triangles;      // 3 per triangle
+  std::vector<unsigned char>          m_alive;          // Per triangle
+  std::vector< std::vector<int32_t> > m_vertex_tris;
+  std::vector<Quadric>                m_quadrics;
+  std::vector<uint32_t>               m_stamps;         // Bumped when a vertex changes
+  std::vector<unsigned char>          m_removed;        // Per vertex
+  std::priority_queue<Collapse>       m_heap;
+  int32_t                             m_live_triangles;
+  std::vector<int32_t>                m_scratch[2];
+};
+
+
+Simplifier::Simplifier( const Mesh& mesh )
+  : m_live_triangles( 0 )
+{
+  weld( mesh );
+  computeQuadrics();
+
+  std::vector< std::pair<int32_t, int32_t> > edges;
+  edges.reserve( m_triangles.size() );
+  for( size_t i = 0; i < m_triangles.size(); i += 3 )
+    for( int e = 0; e < 3; ++e )
+    {
+      const int32_t a = m_triangles[i + e], b = m_triangles[i + ( e + 1 ) % 3];
+      edges.push_back( std::make_pair( std::min( a, b ), std::max( a, b ) ) );
+    }
+  std::sort( edges.begin(), edges.end() );
+  edges.erase( std::unique( edges.begin(), edges.end() ), edges.end() );
+  for( size_t i = 0; i < edges.size(); ++i )
+    pushCollapse( edges[i].first, edges[i].second );
+}
+
+
+void Simplifier::weld( const Mesh& mesh )
+{
+  // Loaders split vertices along normal and UV seams, which would otherwise
+  // become borders
+  const float3* positions = reinterpret_cast<const float3*>( mesh.positions );
+  std::vector<int32_t> order( mesh.num_vertices );
+  for( int32_t i = 0; i < mesh.num_vertices; ++i )
+    order[i] = i;
+  std::sort( order.begin(), order.end(), [positions]( int32_t a, int32_t b )
+  {
+    const float3& pa = positions[a];
+    const float3& pb = positions[b];
+    if( pa.x != pb.x ) return pa.x < pb.x;
+    if( pa.y != pb.y ) return pa.y < pb.y;
+    return pa.z < pb.z;
+  } );
+
+  std::vector<int32_t> remap( mesh.num_vertices );
+  for( int32_t i = 0; i < mesh.num_vertices; ++i )
+  {
+    const float3& p = positions[order[i]];
+    if( m_positions.empty() || p.x != m_positions.back().x || p.y != m_positions.back().y || p.z != m_positions.back().z )
+      m_positions.push_back( p );
+    remap[order[i]] = static_cast<int32_t>( m_positions.size() - 1 );
+  }
+
+  m_triangles.reserve( 3*mesh.num_triangles );
+  for( int32_t i = 0; i < mesh.num_triangles; ++i )
+  {
+    const int32_t a = remap[mesh.tri_indices[3*i + 0]];
+    const int32_t b = remap[mesh.tri_indices[3*i + 1]];
+    const int32_t c = remap[mesh.tri_indices[3*i + 2]];
+    if( a == b || b == c || c == a )
+      continue;
+    m_triangles.push_back( a );
+    m_triangles.push_back( b );
+    m_triangles.push_back( c );
+  }
+
+  m_live_triangles = static_cast<int32_t>( m_triangles.size() / 3 );
+  m_alive.assign( m_live_triangles, 1 );
+  m_vertex_tris.resize( m_positions.size() );
+  for( int32_t t = 0; t < m_live_triangles; ++t )
+    for( int e = 0; e < 3; ++e )
+      m_vertex_tris[m_triangles[3*t + e]].push_back( t );
+  m_stamps.assign( m_positions.size(), 0 );
+  m_removed.assign( m_positions.size(), 0 );
+}
+
+
+void Simplifier::computeQuadrics()
+{
+  m_quadrics.assign( m_positions.size(), Quadric() );
+
+  std::vector< std::pair< std::pair<int32_t, int32_t>, int32_t > > edges;   // Edge, triangle
+  edges.reserve( m_triangles.size() );
+  for( size_t t = 0; t < m_triangles.size() / 3; ++t )
+  {
+    const float3& p0 = m_positions[m_triangles[3*t + 0]];
+    const float3& p1 = m_positions[m_triangles[3*t + 1]];
+    const float3& p2 = m_positions[m_triangles[3*t + 2]];
+    const float3 n = optix::cross( p1 - p0, p2 - p0 );
+    const float  len = optix::length( n );
+    if( len > 0.0f )
+    {
+      // Area weighted face planes
+      const float3 u = n / len;
+      Quadric plane;
+      plane.addPlane( u.x, u.y, u.z, -optix::dot( u, p0 ), 0.5 * len );
+      for( int e = 0; e < 3; ++e )
+        m_quadrics[m_triangles[3*t + e]] += plane;
+    }
+    for( int e = 0; e < 3; ++e )
+    {
+      const int32_t a = m_triangles[3*t + e], b = m_triangles[3*t + ( e + 1 ) % 3];
+      edges.push_back( std::make_pair( std::make_pair( std::min( a, b ), std::max( a, b ) ), static_cast<int32_t>( t ) ) );
+    }
+  }
+
+  // Edges used by a single triangle get a plane through them, perpendicular
+  // to the triangle and weighted far above the face planes.  This is a
+  // penalty, not a constraint: border vertices can still move, but leaving
+  // the border line costs so much that borders collapse along themselves
+  // and do not shrink
+  std::sort( edges.begin(), edges.end() );
+  for( size_t i = 0; i < edges.size(); ++i )
+  {
+    const bool shared = ( i > 0 && edges[i - 1].first == edges[i].first ) ||
+                        ( i + 1 < edges.size() && edges[i + 1].first == edges[i].first );
+    if( shared )
+      continue;
+
+    const int32_t t = edges[i].second;
+    const float3& p0 = m_positions[m_triangles[3*t + 0]];
+    const float3 n  = optix::cross( m_positions[m_triangles[3*t + 1]] - p0, m_positions[m_triangles[3*t + 2]] - p0 );
+    const float3 pa = m_positions[edges[i].first.first];
+    const float3 pb = m_positions[edges[i].first.second];
+    const float3 b  = optix::cross( pb - pa, n );
+    const float  len = optix::length( b );
+    if( len == 0.0f )
+      continue;
+
+    const float3 u = b / len;
+    Quadric plane;
+    plane.addPlane( u.x, u.y, u.z, -optix::dot( u, pa ), 1000.0 * optix::dot( pb - pa, pb - pa ) );
+    m_quadrics[edges[i].first.first]  += plane;
+    m_quadrics[edges[i].first.second] += plane;
+  }
+}
+
+
+void Simplifier::pushCollapse( int32_t v0, int32_t v1 )
+{
+  Quadric q = m_quadrics[v0];
+  q += m_quadrics[v1];
+
+  const float3 p0 = m_positions[v0];
+  const float3 p1 = m_positions[v1];
+  const float3 mid = ( p0 + p1 ) * 0.5f;
+
+  // Fall back to the end points and the midpoint where the quadric is flat,
+  // or its minimum lies far away from the edge
+  Collapse c;
+  float3 target;
+  const float edge_length = optix::length( p1 - p0 );
+  if( q.minimize( target ) && optix::length( target - mid ) <= 2.0f * edge_length )
+  {
+    c.target = target;
+    c.cost   = q.error( target );
+  }
+  else
+  {
+    const float3 candidates[3] = { p0, p1, mid };
+    c.target = mid;
+    c.cost   = q.error( mid );
+    for( int i = 0; i < 2; ++i )
+    {
+      const double cost = q.error( candidates[i] );
+      if( cost < c.cost )
+      {
+        c.cost   = cost;
+        c.target = candidates[i];
+      }
+    }
+  }
+
+  c.cost   = std::max( c.cost, 0.0 );
+  c.v0     = v0;
+  c.v1     = v1;
+  c.stamp0 = m_stamps[v0];
+  c.stamp1 = m_stamps[v1];
+  m_heap.push( c );
+}
+
+
+void Simplifier::neighbors( int32_t v, std::vector<int32_t>& out ) const
+{
+  out.clear();
+  const std::vector<int32_t>& tris = m_vertex_tris[v];
+  for( size_t i = 0; i < tris.size(); ++i )
+    for( int e = 0; e < 3; ++e )
+      if( m_triangles[3*tris[i] + e] != v )
+        out.push_back( m_triangles[3*tris[i] + e] );
+  std::sort( out.begin(), out.end() );
+  out.erase( std::unique( out.begin(), out.end() ), out.end() );
+}
+
+
+bool Simplifier::flips( int32_t v, int32_t other, const float3& target ) const
+{
+  // Triangles around v that survive the collapse must keep their facing
+  const std::vector<int32_t>& tris = m_vertex_tris[v];
+  for( size_t i = 0; i < tris.size(); ++i )
+  {
+    const int32_t* tri = &m_triangles[3*tris[i]];
+    if( tri[0] == other || tri[1] == other || tri[2] == other )
+      continue;
+
+    float3 p[3], q[3];
+    for( int e = 0; e < 3; ++e )
+    {
+      p[e] = m_positions[tri[e]];
+      q[e] = tri[e] == v ? target : p[e];
+    }
+    const float3 before = optix::cross( p[1] - p[0], p[2] - p[0] );
+    const float3 after  = optix::cross( q[1] - q[0], q[2] - q[0] );
+    if( optix::dot( before, after ) <= 0.0f )
+      return true;
+  }
+  return false;
+}
+
+
+bool Simplifier::collapse( const Collapse& c )
+{
+  const int32_t v0 = c.v0;
+  const int32_t v1 = c.v1;
+
+  // Link condition: the edge's triangles must be the only ones the two
+  // vertices' rings share, or the collapse pinches the surface
+  neighbors( v0, m_scratch[0] );
+  neighbors( v1, m_scratch[1] );
+  std::vector<int32_t> shared;
+  std::set_intersection( m_scratch[0].begin(), m_scratch[0].end(), m_scratch[1].begin(), m_scratch[1].end(),
+                         std::back_inserter( shared ) );
+  size_t edge_tris = 0;
+  const std::vector<int32_t>& tris1 = m_vertex_tris[v1];
+  for( size_t i = 0; i < tris1.size(); ++i )
+  {
+    const int32_t* tri = &m_triangles[3*tris1[i]];
+    if( tri[0] == v0 || tri[1] == v0 || tri[2] == v0 )
+      ++edge_tris;
+  }
+  if( shared.size() != edge_tris )
+    return false;
+
+  if( flips( v0, v1, c.target ) || flips( v1, v0, c.target ) )
+    return false;
+
+  m_positions[v0] = c.target;
+  m_quadrics[v0] += m_quadrics[v1];
+  m_removed[v1] = 1;
+  ++m_stamps[v0];
+
+  std::vector<int32_t>& tris0 = m_vertex_tris[v0];
+  for( size_t i = 0; i < tris1.size(); ++i )
+  {
+    const int32_t t = tris1[i];
+    int32_t* tri = &m_triangles[3*t];
+    if( tri[0] == v0 || tri[1] == v0 || tri[2] == v0 )
+    {
+      m_alive[t] = 0;
+      --m_live_triangles;
+      continue;
+    }
+    for( int e = 0; e < 3; ++e )
+      if( tri[e] == v1 )
+        tri[e] = v0;
+    tris0.push_back( t );
+  }
+  m_vertex_tris[v1].clear();
+
+  // Drop the triangles that died from the rings of the edge's other vertices
+  tris0.erase( std::remove_if( tris0.begin(), tris0.end(), [this]( int32_t t ) { return !m_alive[t]; } ), tris0.end() );
+  for( size_t i = 0; i < shared.size(); ++i )
+  {
+    std::vector<int32_t>& tris = m_vertex_tris[shared[i]];
+    tris.erase( std::remove_if( tris.begin(), tris.end(), [this]( int32_t t ) { return !m_alive[t]; } ), tris.end() );
+  }
+
+  neighbors( v0, m_scratch[0] );
+  for( size_t i = 0; i < m_scratch[0].size(); ++i )
+    pushCollapse( v0, m_scratch[0][i] );
+  return true;
+}
+
+
+void Simplifier::run( int32_t target_triangles )
+{
+  while( m_live_triangles > target_triangles && !m_heap.empty() )
+  {
+    const Collapse c = m_heap.top();
+    m_heap.pop();
+    if( m_removed[c.v0] || m_removed[c.v1] || c.stamp0 != m_stamps[c.v0] || c.stamp1 != m_stamps[c.v1] )
+      continue;   // Stale entry
+    collapse( c );
+  }
+}
+
+
+void Simplifier::write( Mesh& simplified ) const
+{
+  std::vector<int32_t> remap( m_positions.size(), -1 );
+  int32_t num_vertices = 0;
+  for( size_t t = 0; t < m_alive.size(); ++t )
+    if( m_alive[t] )
+      for( int e = 0; e < 3; ++e )
+        if( remap[m_triangles[3*t + e]] < 0 )
+          remap[m_triangles[3*t + e]] = num_vertices++;
+
+  clearMesh( simplified );
+  simplified.num_vertices  = num_vertices;
+  simplified.num_triangles = m_live_triangles;
+  allocMesh( simplified );
+  if( !simplified.num_triangles )
+    return;
+
+  simplified.bbox_min[0] = simplified.bbox_min[1] = simplified.bbox_min[2] =  1e16f;
+  simplified.bbox_max[0] = simplified.bbox_max[1] = simplified.bbox_max[2] = -1e16f;
+  for( size_t v = 0; v < m_positions.size(); ++v )
+  {
+    if( remap[v] < 0 )
+      continue;
+    const float3& p = m_positions[v];
+    float* out = simplified.positions + 3*remap[v];
+    out[0] = p.x; out[1] = p.y; out[2] = p.z;
+    for( int i = 0; i < 3; ++i )
+    {
+      simplified.bbox_min[i] = std::min( simplified.bbox_min[i], out[i] );
+      simplified.bbox_max[i] = std::max( simplified.bbox_max[i], out[i] );
+    }
+  }
+
+  int32_t t_out = 0;
+  for( size_t t = 0; t < m_alive.size(); ++t )
+  {
+    if( !m_alive[t] )
+      continue;
+    for( int e = 0; e < 3; ++e )
+      simplified.tri_indices[3*t_out + e] = remap[m_triangles[3*t + e]];
+    simplified.mat_indices[t_out] = 0;
+    ++t_out;
+  }
+}
+
+
+//
+// Simplified mesh cache file: header, positions, indices
+//
+
+struct SimplifiedCacheHeader
+{
+  char     magic[8];
+  uint64_t source_size;
+  int64_t  source_mtime;
+  float    ratio;
+  int32_t  num_vertices;
+  int32_t  num_triangles;
+};
+
+const char SIMPLIFIED_CACHE_MAGIC[8] = { 'S', 'U', 'T', 'Q', 'E', 'M', '0', '1' };
+
+
+// In the user cache directory shared with the PTX cache, named after the
+// mesh and a hash of its path since meshes in different directories can
+// share a name.  Empty if there is no cache directory.
+std::string simplifiedCachePath( const std::string& filename, float ratio )
+{
+  static const std::string dir = sutil::userCacheDir( "proxies" );
+  if( dir.empty() )
+    return std::string();
+
+  // 64 bit FNV-1a
+  uint64_t hash = 14695981039346656037ull;
+  for( size_t i = 0; i < filename.size(); ++i )
+    hash = ( hash ^ static_cast<unsigned char>( filename[i] ) ) * 1099511628211ull;
+
+  const size_t slash = filename.find_last_of( "/\\" );
+  const std::string name = slash == std::string::npos ? filename : filename.substr( slash + 1 );
+  char suffix[64];
+  sprintf( suffix, ".%016llx.qem%04d.bin", static_cast<unsigned long long>( hash ),
+           static_cast<int>( ratio * 1000.0f + 0.5f ) );
+  return dir + "/" + name + suffix;
+}
+
+
+bool readSimplifiedCache( const std::string& path, const SimplifiedCacheHeader& key, Mesh& simplified )
+{
+  std::ifstream in( path.c_str(), std::ios::binary );
+  if( !in )
+    return false;
+
+  SimplifiedCacheHeader header;
+  if( !in.read( reinterpret_cast<char*>( &header ), sizeof( header ) ) ||
+      memcmp( header.magic, key.magic, sizeof( header.magic ) ) != 0 ||
+      header.source_size  != key.source_size  ||
+      header.source_mtime != key.source_mtime ||
+      header.ratio        != key.ratio        ||
+      header.num_vertices < 0 || header.num_triangles < 0 )
+    return false;
+
+  clearMesh( simplified );
+  simplified.num_vertices  = header.num_vertices;
+  simplified.num_triangles = header.num_triangles;
+  allocMesh( simplified );
+  if( !simplified.num_triangles )
+    return true;
+
+  in.read( reinterpret_cast<char*>( simplified.positions ), sizeof( float ) * 3 * simplified.num_vertices );
+  in.read( reinterpret_cast<char*>( simplified.tri_indices ), sizeof( int32_t ) * 3 * simplified.num_triangles );
+  if( !in )
+  {
+    freeMesh( simplified );
+    return false;
+  }
+
+  for( int32_t i = 0; i < 3 * simplified.num_triangles; ++i )
+  {
+    if( simplified.tri_indices[i] < 0 || simplified.tri_indices[i] >= simplified.num_vertices )
+    {
+      freeMesh( simplified );
+      return false;
+    }
+  }
+
+  simplified.bbox_min[0] = simplified.bbox_min[1] = simplified.bbox_min[2] =  1e16f;
+  simplified.bbox_max[0] = simplified.bbox_max[1] = simplified.bbox_max[2] = -1e16f;
+  for( int32_t v = 0; v < simplified.num_vertices; ++v )
+    for( int i = 0; i < 3; ++i )
+    {
+      simplified.bbox_min[i] = std::min( simplified.bbox_min[i], simplified.positions[3*v + i] );
+      simplified.bbox_max[i] = std::max( simplified.bbox_max[i], simplified.positions[3*v + i] );
+    }
+  std::fill( simplified.mat_indices, simplified.mat_indices + simplified.num_triangles, 0 );
+  return true;
+}
+
+
+void writeSimplifiedCache( const std::string& path, const SimplifiedCacheHeader& key, const Mesh& simplified )
+{
+  // Atomic, as scenes place the same mesh more than once and the placements
+  // load concurrently
+  SimplifiedCacheHeader header = key;
+  header.num_vertices  = simplified.num_vertices;
+  header.num_triangles = simplified.num_triangles;
+  const void* const chunks[] = { &header, simplified.positions, simplified.tri_indices };
+  const size_t sizes[] = { sizeof( header ),
+                           simplified.num_triangles ? sizeof( float ) * 3 * simplified.num_vertices : 0,
+                           simplified.num_triangles ? sizeof( int32_t ) * 3 * simplified.num_triangles : 0 };
+  sutil::writeFileAtomic( path, chunks, sizes, 3 );
+}
+
+} // namespace
+
+
 //------------------------------------------------------------------------------
 //
 // MeshLoader implementation class
@@ -303,6 +868,8 @@ public:
 
   void loadMeshOBJ( Mesh& mesh );
   void loadMeshPLY( Mesh& mesh );
+
+  void setReorder( bool reorder ) { m_reorder = reorder; }
 private:
   enum FileType
   {
@@ -312,6 +879,7 @@ private:
   };
   std::string                         m_filename;
   FileType                            m_filetype;
+  bool                                m_reorder;
   
   std::vector<tinyobj::shape_t>       m_shapes;
   std::vector<tinyobj::material_t>    m_materials;
@@ -319,7 +887,8 @@ private:
 
 
 MeshLoader::Impl::Impl( const std::string& filename )
-  : m_filename( filename )
+  : m_filename( filename ),
+    m_reorder( false )
 {
    if( fileIsOBJ( m_filename ) )
      m_filetype = OBJ;
@@ -363,6 +932,9 @@ void MeshLoader::Impl::loadMesh( Mesh& mesh, const float* load_xform )
   else
     throw std::runtime_error( "MeshLoader: Unsupported file type for '" + m_filename + "'" );
 
+  if( m_reorder )
+    reorderMesh( mesh );
+
   applyLoadXForm( mesh, load_xform );
 }
 
@@ -707,6 +1279,12 @@ void MeshLoader::loadMesh( Mesh& mesh, const float* load_xform )
   p_impl->loadMesh( mesh, load_xform );
 }
 
+
+void MeshLoader::setReorder( bool reorder )
+{
+  p_impl->setReorder( reorder );
+}
+
 //------------------------------------------------------------------------------
 //
 // Mesh Loader convenience  functions
@@ -714,10 +1292,118 @@ void MeshLoader::loadMesh( Mesh& mesh, const float* load_xform )
 //------------------------------------------------------------------------------
 
 
-void loadMesh( const std::string& filename, Mesh& mesh, const float* xform )
+void loadMesh( const std::string& filename, Mesh& mesh, const float* xform, bool reorder )
 {
     MeshLoader loader( filename );
+    loader.setReorder( reorder );
     loader.scanMesh( mesh );
     allocMesh( mesh );
     loader.loadMesh( mesh, xform );
 }
+
+
+//------------------------------------------------------------------------------
+//
+// Mesh reordering
+//
+//------------------------------------------------------------------------------
+
+void reorderMesh( Mesh& mesh )
+{
+  const int32_t num_triangles = mesh.num_triangles;
+  const int32_t num_vertices  = mesh.num_vertices;
+  if( num_triangles < 2 )
+    return;
+
+  const optix::float3* positions = reinterpret_cast<const optix::float3*>( mesh.positions );
+  std::vector<optix::float3> centroids( num_triangles );
+  for( int32_t i = 0; i < num_triangles; ++i )
+  {
+    const int32_t* tri = mesh.tri_indices + 3 * i;
+    centroids[i] = ( positions[tri[0]] + positions[tri[1]] + positions[tri[2]] ) * ( 1.0f / 3.0f );
+  }
+  std::vector<uint32_t> order;
+  sutil::mortonOrder( centroids.data(), num_triangles, order );
+
+  // New vertex numbers by first use in the new triangle order
+  std::vector<int32_t> remap( num_vertices, -1 );
+  int32_t next = 0;
+  for( int32_t i = 0; i < num_triangles; ++i )
+  {
+    const int32_t* tri = mesh.tri_indices + 3 * order[i];
+    for( int k = 0; k < 3; ++k )
+      if( remap[tri[k]] < 0 )
+        remap[tri[k]] = next++;
+  }
+  for( int32_t v = 0; v < num_vertices; ++v )
+    if( remap[v] < 0 )
+      remap[v] = next++;
+
+  const std::vector<int32_t> tri_indices( mesh.tri_indices, mesh.tri_indices + 3 * num_triangles );
+  const std::vector<int32_t> mat_indices( mesh.mat_indices, mesh.mat_indices + num_triangles );
+  for( int32_t i = 0; i < num_triangles; ++i )
+  {
+    const uint32_t source = order[i];
+    for( int k = 0; k < 3; ++k )
+      mesh.tri_indices[3 * i + k] = remap[tri_indices[3 * source + k]];
+    mesh.mat_indices[i] = mat_indices[source];
+  }
+
+  permuteVertexAttribute( mesh.positions, 3, remap );
+  if( mesh.has_normals )
+    permuteVertexAttribute( mesh.normals, 3, remap );
+  if( mesh.has_texcoords )
+    permuteVertexAttribute( mesh.texcoords, 2, remap );
+}
+
+
+//------------------------------------------------------------------------------
+//
+// Mesh simplification
+//
+//------------------------------------------------------------------------------
+
+void simplifyMesh( const Mesh& mesh, float ratio, Mesh& simplified )
+{
+  Simplifier simplifier( mesh );
+  const float clamped = std::min( std::max( ratio, 0.0f ), 1.0f );
+  simplifier.run( static_cast<int32_t>( clamped * mesh.num_triangles ) );
+  simplifier.write( simplified );
+}
+
+
+void loadSimplifiedMesh( const std::string& filename, float ratio, Mesh& simplified, const float* load_xform )
+{
+  struct stat info;
+  if( stat( filename.c_str(), &info ) != 0 )
+    throw std::runtime_error( "MeshLoader: cannot open " + filename );
+
+  SimplifiedCacheHeader key;
+  memcpy( key.magic, SIMPLIFIED_CACHE_MAGIC, sizeof( key.magic ) );
+  key.source_size   = static_cast<uint64_t>( info.st_size );
+  key.source_mtime  = static_cast<int64_t>( info.st_mtime );
+  key.ratio         = ratio;
+  key.num_vertices  = 0;
+  key.num_triangles = 0;
+
+  const std::string cache_path = simplifiedCachePath( filename, ratio );
+  if( cache_path.empty() || !readSimplifiedCache( cache_path, key, simplified ) )
+  {
+    Mesh mesh = Mesh();
+    loadMesh( filename, mesh );
+    try
+    {
+      simplifyMesh( mesh, ratio, simplified );
+    }
+    catch( ... )
+    {
+      freeMesh( mesh );
+      throw;
+    }
+    freeMesh( mesh );
+    if( !cache_path.empty() )
+      writeSimplifiedCache( cache_path, key, simplified );
+  }
+
+  applyLoadXForm( simplified, load_xform );
+}
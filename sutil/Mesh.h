@@ -114,6 +114,9 @@ public:
   SUTILAPI void scanMesh( Mesh& mesh );
   SUTILAPI void loadMesh( Mesh& mesh, const float* load_xform=0 );
 
+  // Run reorderMesh() on the loaded mesh.  Off by default.
+  SUTILAPI void setReorder( bool reorder );
+
 private:
   class Impl;
   Impl* p_impl;
@@ -127,8 +130,49 @@ private:
 //------------------------------------------------------------------------------
 
 
-// Load mesh using std lib new for allocations
-SUTILAPI void loadMesh( const std::string& filename, Mesh& mesh, const float* load_xform=0 );
+// Load mesh using std lib new for allocations, optionally reordered
+SUTILAPI void loadMesh( const std::string& filename, Mesh& mesh, const float* load_xform=0,
+                        bool reorder=false );
+
+
+
+//------------------------------------------------------------------------------
+//
+// Mesh reordering
+//
+//------------------------------------------------------------------------------
+
+// Sort the triangles along a Morton curve through their centroids and
+// renumber the vertices in order of first use, so triangles that are close
+// in space, and the vertices they reference, are close in memory too.
+// Material indices follow their triangles.  Vertices no triangle uses are
+// kept, after the others.
+SUTILAPI void reorderMesh( Mesh& mesh );
+
+
+
+//------------------------------------------------------------------------------
+//
+// Mesh simplification
+//
+//------------------------------------------------------------------------------
+
+// Quadric error metric edge collapse (Garland and Heckbert 1997) down to
+// about ratio * num_triangles triangles.  Vertices are welded by position
+// first.  Open borders are not pinned; a heavily weighted plane through each
+// border edge makes moving off the border costly, so borders keep their shape
+// while still collapsing along themselves.  The result only has positions
+// and triangle indices, eg for shadow proxies.  Release with freeMesh().
+SUTILAPI void simplifyMesh( const Mesh& mesh, float ratio, Mesh& simplified );
+
+// loadMesh() followed by simplifyMesh(), with the result cached in a file
+// under sutil::userCacheDir( "proxies" ).  The cache is keyed by the path
+// and ratio and the size and modification time of the mesh file and is
+// rewritten when stale.  load_xform is applied after simplification, so all
+// placements of a mesh share one cache file.  Failing to write the cache is
+// not an error, and without a user cache directory nothing is cached.
+SUTILAPI void loadSimplifiedMesh( const std::string& filename, float ratio, Mesh& simplified,
+                                  const float* load_xform=0 );
 
 
 
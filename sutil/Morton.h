@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#pragma once
+
+#include <optixu/optixu_math_namespace.h>
+
+#include <algorithm>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace sutil
+{
+
+//------------------------------------------------------------------------------
+//
+// Morton codes, shared by the mesh reordering and the host tracing
+// structures.  A code interleaves the bits of quantized x, y and z, x
+// highest, so sorting by it orders points along a Z curve.
+//
+//------------------------------------------------------------------------------
+
+// Spread the low 10 bits of v so there are two zero bits between each
+inline uint32_t expandBits10( uint32_t v )
+{
+  v = ( v * 0x00010001u ) & 0xFF0000FFu;
+  v = ( v * 0x00000101u ) & 0x0F00F00Fu;
+  v = ( v * 0x00000011u ) & 0xC30C30C3u;
+  v = ( v * 0x00000005u ) & 0x49249249u;
+  return v;
+}
+
+
+// Spread the low 21 bits of v so there are two zero bits between each
+inline uint64_t expandBits21( uint64_t v )
+{
+  v &= 0x1fffffull;
+  v = ( v | v << 32 ) & 0x1f00000000ffffull;
+  v = ( v | v << 16 ) & 0x1f0000ff0000ffull;
+  v = ( v | v << 8  ) & 0x100f00f00f00f00full;
+  v = ( v | v << 4  ) & 0x10c30c30c30c30c3ull;
+  v = ( v | v << 2  ) & 0x1249249249249249ull;
+  return v;
+}
+
+
+// 30 bit code of a cell of a 1024^3 grid
+inline uint32_t mortonCode30( uint32_t x, uint32_t y, uint32_t z )
+{
+  return ( expandBits10( x ) << 2 ) | ( expandBits10( y ) << 1 ) | expandBits10( z );
+}
+
+
+// 63 bit code of a cell of a 2^21^3 grid
+inline uint64_t mortonCode63( uint32_t x, uint32_t y, uint32_t z )
+{
+  return ( expandBits21( x ) << 2 ) | ( expandBits21( y ) << 1 ) | expandBits21( z );
+}
+
+
+// Indices of count points, ordered along the 30 bit Morton curve through
+// their bounds.  Points in the same grid cell keep their index order.
+inline void mortonOrder( const optix::float3* points, size_t count, std::vector<uint32_t>& order )
+{
+  optix::float3 lo = optix::make_float3(  1e16f );
+  optix::float3 hi = optix::make_float3( -1e16f );
+  for( size_t i = 0; i < count; ++i )
+  {
+    lo = optix::fminf( lo, points[i] );
+    hi = optix::fmaxf( hi, points[i] );
+  }
+
+  const optix::float3 extent = hi - lo;
+  const optix::float3 scale = optix::make_float3(
+      extent.x > 0.0f ? 1023.0f / extent.x : 0.0f,
+      extent.y > 0.0f ? 1023.0f / extent.y : 0.0f,
+      extent.z > 0.0f ? 1023.0f / extent.z : 0.0f );
+
+  // Code in the high half, index in the low half keeps the sort stable
+  std::vector<uint64_t> keys( count );
+  for( size_t i = 0; i < count; ++i )
+  {
+    const optix::float3 p = ( points[i] - lo ) * scale;
+    const uint32_t code = mortonCode30( static_cast<uint32_t>( p.x ), static_cast<uint32_t>( p.y ),
+                                        static_cast<uint32_t>( p.z ) );
+    keys[i] = static_cast<uint64_t>( code ) << 32 | i;
+  }
+  std::sort( keys.begin(), keys.end() );
+
+  order.resize( count );
+  for( size_t i = 0; i < count; ++i )
+    order[i] = static_cast<uint32_t>( keys[i] & 0xFFFFFFFFu );
+}
+
+} // namespace sutil
@@ -31,6 +31,7 @@
 #include "Mesh.h"
 #include "OptiXMesh.h"
 #include "sutil.h"
+#include "TextureCache.h"
 #include <algorithm>
 #include <cstring>
 #include <stdexcept>
@@ -129,17 +130,19 @@ optix::Material createOptiXMaterial(
     optix::Program         closest_hit,
     optix::Program         any_hit,
     const MaterialParams&  mat_params,
-    bool                   use_textures
+    bool                   use_textures,
+    std::vector<optix::TextureSampler>& textures
     )
 {
   optix::Material mat = context->createMaterial();
   mat->setClosestHitProgram( 0u, closest_hit );             
   mat->setAnyHitProgram( 1u, any_hit ) ;    
 
-  if( use_textures )
-    mat[ "Kd_map"]->setTextureSampler( sutil::loadTexture( context, mat_params.Kd_map, optix::make_float3(mat_params.Kd) ) );
-  else
-    mat[ "Kd_map"]->setTextureSampler( sutil::loadTexture( context, "", optix::make_float3(mat_params.Kd) ) );
+  // Materials sharing a map, or a default color, share the texture
+  sutil::TextureCache& cache = sutil::defaultTextureCache();
+  textures.push_back( cache.acquire( context, use_textures ? mat_params.Kd_map : std::string(),
+                                     optix::make_float3(mat_params.Kd) ) );
+  mat[ "Kd_map"]->setTextureSampler( textures.back() );
 
   mat[ "Kd_mapped" ]->setInt( use_textures  );
   mat[ "Kd"        ]->set3fv( mat_params.Kd );
@@ -202,7 +205,8 @@ void translateMeshToOptiX(
                                                closest_hit,
                                                any_hit,
                                                default_params,
-                                               have_textures );
+                                               have_textures,
+                                               optix_mesh.textures );
 
     optix_materials.push_back( mtl );
 
@@ -233,7 +237,8 @@ void translateMeshToOptiX(
             closest_hit,
             any_hit,
             mesh.mat_params[i],
-            have_textures ) );
+            have_textures,
+            optix_mesh.textures ) );
   }
 
   if( optix_mesh.use_tri_api )
@@ -315,3 +320,35 @@ void loadMesh(
 
   unmap( buffers, mesh );
 }
+
+
+void uploadMesh(
+    const Mesh&                 host_mesh,
+    OptiXMesh&                  optix_mesh
+    )
+{
+  if( !optix_mesh.context )
+  {
+    throw std::runtime_error( "OptiXMesh: uploadMesh() requires valid OptiX context" );
+  }
+
+  optix::Context context = optix_mesh.context;
+
+  Mesh mesh = host_mesh;
+
+  MeshBuffers buffers;
+  setupMeshLoaderInputs( context, buffers, mesh );
+
+  memcpy( mesh.positions,   host_mesh.positions,   3*sizeof(float)*mesh.num_vertices );
+  memcpy( mesh.tri_indices, host_mesh.tri_indices, 3*sizeof(int32_t)*mesh.num_triangles );
+  memcpy( mesh.mat_indices, host_mesh.mat_indices, 1*sizeof(int32_t)*mesh.num_triangles );
+  if( mesh.has_normals )
+    memcpy( mesh.normals,   host_mesh.normals,     3*sizeof(float)*mesh.num_vertices );
+  if( mesh.has_texcoords )
+    memcpy( mesh.texcoords, host_mesh.texcoords,   2*sizeof(float)*mesh.num_vertices );
+  std::copy( host_mesh.mat_params, host_mesh.mat_params + mesh.num_materials, mesh.mat_params );
+
+  translateMeshToOptiX( mesh, buffers, optix_mesh );
+
+  unmap( buffers, mesh );
+}
@@ -34,6 +34,8 @@
 #include <optixu/optixpp_namespace.h>
 #include <optixu/optixu_matrix_namespace.h>
 
+#include <vector>
+
 
 //------------------------------------------------------------------------------
 //
@@ -76,6 +78,10 @@ struct OptiXMesh
   optix::float3                bbox_max;
 
   int                          num_triangles;
+
+  // Textures of the materials created, held in sutil::defaultTextureCache().
+  // Give each back with release() once the materials are destroyed.
+  std::vector<optix::TextureSampler> textures;
 };
 
 
@@ -84,3 +90,13 @@ SUTILAPI void loadMesh(
     OptiXMesh&                mesh, 
     const optix::Matrix4x4&   load_xform = optix::Matrix4x4::identity()
     );
+
+
+// Create the OptiX mesh from a mesh that has already been loaded into host
+// memory, eg by loadMesh( filename, Mesh&, xform ) on a worker thread.  The
+// host mesh is copied and remains owned by the caller.
+SUTILAPI void uploadMesh(
+    const Mesh&               host_mesh,
+    OptiXMesh&                mesh
+    );
+
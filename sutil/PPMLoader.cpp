@@ -28,9 +28,10 @@
 
 #include <PPMLoader.h>
 #include <optixu/optixu_math_namespace.h>
+#include <algorithm>
+#include <cstring>
 #include <fstream>
 #include <iostream>
-#include <sstream>
 
 using namespace optix;
 
@@ -59,72 +60,88 @@ PPMLoader::PPMLoader( const std::string& filename, const bool vflip )
     return;
   }
 
-  // Open file
-  try {
-    std::ifstream file_in( filename.c_str(), std::ifstream::in | std::ifstream::binary );
-    if ( !file_in ) {
-      std::cerr << "PPMLoader( '" << filename << "' ) failed to open file."
-                << std::endl;
-      return;
-    }
+  std::ifstream file_in( filename.c_str(), std::ifstream::in | std::ifstream::binary );
+  if ( !file_in ) {
+    std::cerr << "PPMLoader( '" << filename << "' ) failed to open file."
+              << std::endl;
+    return;
+  }
 
-    // Check magic number to make sure we have an ascii or binary PPM
-    std::string line, magic_number;
-    getLine( file_in, line );
-    std::istringstream iss1( line );
-    iss1 >> magic_number;
-    if ( magic_number != "P6" && magic_number != "P3") {
-      std::cerr << "PPMLoader( '" << filename << "' ) unknown magic number: "
-                << magic_number << ".  Only P3 and P6 supported." << std::endl;
-      return;
-    }
-    if ( magic_number == "P3" ) {
-      m_is_ascii = true;
-    }
+  // Parse the header from the first block of the file, which usually holds
+  // it completely.  ASCII data is then parsed in memory and binary data is
+  // read straight into the raster.
+  std::vector<char> data;
+  bool at_end = readBlock( file_in, data, 4096 );
+  const char* p   = data.empty() ? 0 : &data[0];
+  const char* end = p + data.size();
+  bool header_ok  = parseHeader( p, end );
+  if ( !at_end && ( !header_ok || end - p < 2 || m_is_ascii ) ) {
+    at_end    = readBlock( file_in, data, 0 );
+    p         = &data[0];
+    end       = p + data.size();
+    header_ok = parseHeader( p, end );
+  }
 
-    // width, height
-    getLine( file_in, line );
-    std::istringstream iss2( line );
-    iss2 >> m_nx >> m_ny;
-
-    // max channel value
-    getLine( file_in, line );
-    std::istringstream iss3( line );
-    iss3 >> m_max_val;
-
-    m_raster = new(std::nothrow)  unsigned char[ m_nx*m_ny*3 ];
-    if(m_is_ascii) {
-      unsigned int num_elements = m_nx*m_ny*3;
-      unsigned int count = 0;
-
-      while(count < num_elements) {
-        getLine( file_in, line );
-        std::istringstream iss(line);
-
-        while(iss.good()) {
-          unsigned int c;
-          iss >> c;
-          m_raster[count++] = static_cast<unsigned char>(c);
-        }
-      }
+  if ( !header_ok ) {
+    std::cerr << "PPMLoader( '" << filename << "' ) invalid header.  Only P3 and P6 supported." << std::endl;
+    m_nx = m_ny = 0;
+    return;
+  }
+  if ( !m_is_ascii && m_max_val > 255 ) {
+    std::cerr << "PPMLoader( '" << filename << "' ) only 8 bit binary PPM supported" << std::endl;
+    return;
+  }
 
-    } else {
-      file_in.read( reinterpret_cast<char*>( m_raster ), m_nx*m_ny*3 );
-    }
+  const size_t num_elements = size_t( m_nx )*m_ny*3;
+  m_raster = new(std::nothrow) unsigned char[ num_elements ];
+  if ( !m_raster ) {
+    std::cerr << "PPMLoader( '" << filename << "' ) out of memory" << std::endl;
+    return;
+  }
 
-    if(vflip) {
-      unsigned char *m_raster2 = new(std::nothrow)  unsigned char[ m_nx*m_ny*3 ];
-      for(unsigned int y2=m_ny-1, y=0; y<m_ny; y2--, y++) {
-        for(unsigned int x=0; x<m_nx*3; x++)
-          m_raster2[y2*m_nx*3+x] = m_raster[y*m_nx*3+x];
+  bool data_ok = true;
+  if ( m_is_ascii ) {
+    for ( size_t i = 0; i < num_elements; ++i ) {
+      unsigned int c;
+      if ( !parseUInt( p, end, c ) ) {
+        data_ok = false;
+        break;
       }
-
-      delete [] m_raster;
-      m_raster = m_raster2;
+      m_raster[i] = static_cast<unsigned char>( c );
+    }
+  } else {
+    // A single whitespace character separates the header from the data,
+    // accept a CRLF from files written on Windows too
+    if ( end - p >= 2 && p[0] == '\r' && p[1] == '\n' )
+      ++p;
+    p = std::min( p + 1, end );
+
+    const size_t in_block = std::min<size_t>( end - p, num_elements );
+    memcpy( m_raster, p, in_block );
+    if ( in_block < num_elements ) {
+      file_in.read( reinterpret_cast<char*>( m_raster + in_block ), num_elements - in_block );
+      data_ok = !at_end && static_cast<size_t>( file_in.gcount() ) == num_elements - in_block;
     }
-  } catch ( ... ) {
-    std::cerr << "PPMLoader( '" << filename << "' ) failed to load" << std::endl;
+  }
+
+  if ( !data_ok ) {
+    std::cerr << "PPMLoader( '" << filename << "' ) premature end of data" << std::endl;
+    delete [] m_raster;
     m_raster = 0;
+    return;
+  }
+
+  if ( vflip ) {
+    // Swap rows through a row sized buffer
+    const size_t row = size_t( m_nx )*3;
+    std::vector<unsigned char> tmp( row );
+    for ( unsigned int y = 0; y < m_ny/2; ++y ) {
+      unsigned char* a = m_raster + y*row;
+      unsigned char* b = m_raster + (m_ny-y-1)*row;
+      memcpy( &tmp[0], a, row );
+      memcpy( a, b, row );
+      memcpy( b, &tmp[0], row );
+    }
   }
 }
 
@@ -159,15 +176,71 @@ unsigned char* PPMLoader::raster() const
 }
 
 
-void PPMLoader::getLine( std::ifstream& file_in, std::string& s )
+bool PPMLoader::readBlock( std::ifstream& file_in, std::vector<char>& data, size_t max_bytes )
 {
-  for (;;) {
-    if ( !std::getline( file_in, s ) )
-      return;
-    std::string::size_type index = s.find_first_not_of( "\n\r\t " );
-    if ( index != std::string::npos && s[index] != '#' )
+  // Without a limit read the rest of the file in one go
+  if ( max_bytes == 0 ) {
+    const std::streamoff pos = file_in.tellg();
+    file_in.seekg( 0, std::ios::end );
+    const std::streamoff size = file_in.tellg();
+    file_in.seekg( pos, std::ios::beg );
+    if ( pos < 0 || size < pos )
+      return true;
+    max_bytes = static_cast<size_t>( size - pos );
+  }
+
+  const size_t offset = data.size();
+  if ( max_bytes > 0 ) {
+    data.resize( offset + max_bytes );
+    file_in.read( &data[offset], max_bytes );
+    data.resize( offset + static_cast<size_t>( file_in.gcount() ) );
+  }
+  return !file_in || file_in.peek() == std::ifstream::traits_type::eof();
+}
+
+
+bool PPMLoader::parseHeader( const char*& p, const char* end )
+{
+  // Magic number for ascii or binary PPM, then width, height and max
+  // channel value
+  p = skipSpace( p, end );
+  if ( end - p < 2 || p[0] != 'P' || ( p[1] != '6' && p[1] != '3' ) )
+    return false;
+  m_is_ascii = p[1] == '3';
+  p += 2;
+
+  return parseUInt( p, end, m_nx ) && parseUInt( p, end, m_ny ) && parseUInt( p, end, m_max_val ) &&
+         m_nx > 0 && m_ny > 0;
+}
+
+
+const char* PPMLoader::skipSpace( const char* p, const char* end )
+{
+  while ( p < end ) {
+    if ( *p == '#' ) {
+      while ( p < end && *p != '\n' )
+        ++p;
+    } else if ( *p == ' ' || *p == '\t' || *p == '\n' || *p == '\r' || *p == '\v' || *p == '\f' ) {
+      ++p;
+    } else {
       break;
+    }
   }
+  return p;
+}
+
+
+bool PPMLoader::parseUInt( const char*& p, const char* end, unsigned int& value )
+{
+  p = skipSpace( p, end );
+  if ( p == end || *p < '0' || *p > '9' )
+    return false;
+
+  unsigned int v = 0;
+  while ( p < end && *p >= '0' && *p <= '9' )
+    v = v*10 + static_cast<unsigned int>( *p++ - '0' );
+  value = v;
+  return true;
 }
 
   
@@ -220,21 +293,25 @@ optix::TextureSampler PPMLoader::loadTexture( optix::Context context,
   optix::Buffer buffer = context->createBuffer( RT_BUFFER_INPUT, RT_FORMAT_UNSIGNED_BYTE4, nx, ny );
   unsigned char* buffer_data = static_cast<unsigned char*>( buffer->map() );
 
-  for ( unsigned int i = 0; i < nx; ++i ) {
-    for ( unsigned int j = 0; j < ny; ++j ) {
-
-      unsigned int ppm_index = ( (ny-j-1)*nx + i )*3;
-      unsigned int buf_index = ( (j     )*nx + i )*4;
-
-      buffer_data[ buf_index + 0 ] = raster()[ ppm_index + 0 ];
-      buffer_data[ buf_index + 1 ] = raster()[ ppm_index + 1 ];
-      buffer_data[ buf_index + 2 ] = raster()[ ppm_index + 2 ];
-      if (linearize_gamma) {
-        buffer_data[ buf_index + 0 ] = s_srgb2linear[buffer_data[ buf_index + 0 ]];
-        buffer_data[ buf_index + 1 ] = s_srgb2linear[buffer_data[ buf_index + 1 ]];
-        buffer_data[ buf_index + 2 ] = s_srgb2linear[buffer_data[ buf_index + 2 ]];
+  // Rows are stored bottom up, walk both in memory order
+  for ( unsigned int j = 0; j < ny; ++j ) {
+    const unsigned char* src = raster() + size_t( ny-j-1 )*nx*3;
+    unsigned char*       dst = buffer_data + size_t( j )*nx*4;
+
+    if (linearize_gamma) {
+      for ( unsigned int i = 0; i < nx; ++i, src += 3, dst += 4 ) {
+        dst[0] = s_srgb2linear[ src[0] ];
+        dst[1] = s_srgb2linear[ src[1] ];
+        dst[2] = s_srgb2linear[ src[2] ];
+        dst[3] = 255;
+      }
+    } else {
+      for ( unsigned int i = 0; i < nx; ++i, src += 3, dst += 4 ) {
+        dst[0] = src[0];
+        dst[1] = src[1];
+        dst[2] = src[2];
+        dst[3] = 255;
       }
-      buffer_data[ buf_index + 3 ] = 255;
     }
   }
 
@@ -279,29 +356,17 @@ optix::Buffer PPMLoader::loadFloat4Buffer( optix::Context context, bool lineariz
     optix::Buffer  buffer      = context->createBuffer( RT_BUFFER_INPUT, RT_FORMAT_FLOAT4, nx, ny );
     optix::float4* buffer_data = static_cast<optix::float4*>( buffer->map() );
 
-    for( unsigned int i = 0; i < nx; ++i )
+    // Byte to float, with the gamma linearization folded in
+    float to_float[256];
+    for( int i = 0; i < 256; ++i )
+        to_float[i] = ( linearize_gamma ? s_srgb2linear[i] : i ) * ( 1.f / 255.f );
+
+    for( unsigned int j = 0; j < ny; ++j )
     {
-        for( unsigned int j = 0; j < ny; ++j )
-        {
-            unsigned int ppm_index = ( ( ny - j - 1 ) * nx + i ) * 3;
-            unsigned int buf_index = ( j * nx + i );
-
-            if( linearize_gamma )
-            {
-                buffer_data[buf_index].x = s_srgb2linear[raster()[ppm_index + 0]];
-                buffer_data[buf_index].y = s_srgb2linear[raster()[ppm_index + 1]];
-                buffer_data[buf_index].z = s_srgb2linear[raster()[ppm_index + 2]];
-            }
-            else
-            {
-                buffer_data[buf_index].x = raster()[ppm_index + 0];
-                buffer_data[buf_index].y = raster()[ppm_index + 1];
-                buffer_data[buf_index].z = raster()[ppm_index + 2];
-            }
-            buffer_data[buf_index].w = 255.f;
-
-            buffer_data[buf_index] *= (1.f / 255.f);
-        }
+        const unsigned char* src = raster() + size_t( ny - j - 1 ) * nx * 3;
+        optix::float4*       dst = buffer_data + size_t( j ) * nx;
+        for( unsigned int i = 0; i < nx; ++i, src += 3 )
+            dst[i] = optix::make_float4( to_float[src[0]], to_float[src[1]], to_float[src[2]], 1.f );
     }
 
     buffer->unmap();
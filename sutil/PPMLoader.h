@@ -32,6 +32,7 @@
 #include <sutil.h>
 #include <string>
 #include <iosfwd>
+#include <vector>
 
 //-----------------------------------------------------------------------------
 //
@@ -84,6 +85,12 @@ private:
   static unsigned char s_srgb2linear[256];
   static bool s_srgb2linear_initialized;
 
-  static void getLine( std::ifstream& file_in, std::string& s );
+  bool parseHeader( const char*& p, const char* end );
+
+  // Appends up to max_bytes, or the rest of the file for 0, and returns
+  // whether the end of the file was reached
+  static bool        readBlock( std::ifstream& file_in, std::vector<char>& data, size_t max_bytes );
+  static const char* skipSpace( const char* p, const char* end );   // Whitespace and comments
+  static bool        parseUInt( const char*& p, const char* end, unsigned int& value );
   static void init_srgb2linear();
 };
@@ -0,0 +1,288 @@
+/*
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "TextureCache.h"
+#include "HDRLoader.h"
+#include "PPMLoader.h"
+
+#include <optixu/optixu_math_namespace.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+
+#if !defined(_WIN32)
+#include <climits>
+#endif
+
+
+namespace sutil
+{
+
+namespace
+{
+
+bool isHDRFile( const std::string& filename )
+{
+  const size_t len = filename.length();
+  return len >= 3 &&
+         ( filename[len-3] == 'H' || filename[len-3] == 'h' ) &&
+         ( filename[len-2] == 'D' || filename[len-2] == 'd' ) &&
+         ( filename[len-1] == 'R' || filename[len-1] == 'r' );
+}
+
+
+// Absolute path with links and dot segments resolved, so every spelling of
+// a file maps to the same entry.  Returns filename as is if it does not
+// exist.
+std::string canonicalPath( const std::string& filename )
+{
+#if defined(_WIN32)
+  char buffer[_MAX_PATH];
+  if( _fullpath( buffer, filename.c_str(), _MAX_PATH ) )
+    return buffer;
+#else
+  char buffer[PATH_MAX];
+  if( realpath( filename.c_str(), buffer ) )
+    return buffer;
+#endif
+  return filename;
+}
+
+} // namespace
+
+
+TextureCache::TextureCache()
+  : m_hits( 0 ), m_misses( 0 )
+{
+}
+
+
+TextureCache::~TextureCache()
+{
+  // Contexts may be gone by now, the textures go with them
+}
+
+
+optix::TextureSampler TextureCache::acquire( optix::Context context, const std::string& filename,
+                                             const optix::float3& default_color, bool linearize_gamma )
+{
+  const bool hdr = isHDRFile( filename );
+  if( filename.empty() )
+  {
+    std::lock_guard<std::mutex> lock( m_mutex );
+    return fallback( context, hdr, default_color ).sampler;
+  }
+
+  const Key key( context->get(), std::string( hdr ? "hdr:" : linearize_gamma ? "ppm linear:" : "ppm:" ) +
+                                 canonicalPath( filename ) );
+  {
+    std::lock_guard<std::mutex> lock( m_mutex );
+    if( Entry* entry = lookup( context, key, hdr, default_color ) )
+      return entry->sampler;
+  }
+
+  // Files are decoded without the lock, so threads loading different files
+  // overlap.  Only the upload is serialized, an OptiX context is not thread
+  // safe.
+  std::unique_ptr<HDRLoader> hdr_loader;
+  std::unique_ptr<PPMLoader> ppm_loader;
+  if( hdr )
+    hdr_loader.reset( new HDRLoader( filename ) );
+  else
+    ppm_loader.reset( new PPMLoader( filename ) );
+
+  std::lock_guard<std::mutex> lock( m_mutex );
+
+  // Another thread may have loaded the file in the meantime
+  if( Entry* entry = lookup( context, key, hdr, default_color ) )
+    return entry->sampler;
+
+  optix::TextureSampler sampler;
+  if( hdr_loader && !hdr_loader->failed() )
+    sampler = hdr_loader->loadTexture( context, default_color );
+  else if( ppm_loader && !ppm_loader->failed() )
+    sampler = ppm_loader->loadTexture( context, default_color, linearize_gamma );
+
+  // Every acquire() counts once, a failed file as the fallback it gets
+  if( !sampler )
+  {
+    m_failed.insert( key );
+    return fallback( context, hdr, default_color ).sampler;
+  }
+
+  ++m_misses;
+  Entry& entry = insert( key, sampler );
+  ++entry.count;
+  return entry.sampler;
+}
+
+
+TextureCache::Entry* TextureCache::lookup( optix::Context context, const Key& key, bool hdr,
+                                          const optix::float3& default_color )
+{
+  if( m_failed.count( key ) )
+    return &fallback( context, hdr, default_color );
+
+  std::map<Key, Entry>::iterator it = m_entries.find( key );
+  if( it == m_entries.end() )
+    return 0;
+  ++m_hits;
+  ++it->second.count;
+  return &it->second;
+}
+
+
+TextureCache::Entry& TextureCache::fallback( optix::Context context, bool hdr, const optix::float3& default_color )
+{
+  // Keyed by the texel the loaders would store
+  char texel[128];
+  if( hdr )
+    snprintf( texel, sizeof( texel ), "default hdr:%a %a %a",
+              default_color.x, default_color.y, default_color.z );
+  else
+    snprintf( texel, sizeof( texel ), "default ppm:%d %d %d",
+              optix::clamp( static_cast<int>( default_color.x * 255.0f ), 0, 255 ),
+              optix::clamp( static_cast<int>( default_color.y * 255.0f ), 0, 255 ),
+              optix::clamp( static_cast<int>( default_color.z * 255.0f ), 0, 255 ) );
+
+  const Key key( context->get(), texel );
+  std::map<Key, Entry>::iterator it = m_entries.find( key );
+  if( it != m_entries.end() )
+  {
+    ++m_hits;
+    ++it->second.count;
+    return it->second;
+  }
+
+  ++m_misses;
+  optix::TextureSampler sampler;
+  if( hdr )
+    sampler = HDRLoader( "" ).loadTexture( context, default_color );
+  else
+    sampler = PPMLoader( "" ).loadTexture( context, default_color );
+
+  Entry& entry = insert( key, sampler );
+  ++entry.count;
+  return entry;
+}
+
+
+TextureCache::Entry& TextureCache::insert( const Key& key, optix::TextureSampler sampler )
+{
+  Entry& entry  = m_entries[key];
+  entry.sampler = sampler;
+  m_keys[sampler->get()] = key;
+  return entry;
+}
+
+
+void TextureCache::destroy( Entry& entry )
+{
+  // Each sampler owns its buffer
+  optix::Buffer buffer = entry.sampler->getBuffer();
+  m_keys.erase( entry.sampler->get() );
+  entry.sampler->destroy();
+  if( buffer )
+    buffer->destroy();
+  entry.sampler = 0;
+}
+
+
+void TextureCache::release( optix::TextureSampler sampler )
+{
+  if( !sampler )
+    return;
+
+  std::lock_guard<std::mutex> lock( m_mutex );
+  std::map<RTtexturesampler, Key>::iterator it = m_keys.find( sampler->get() );
+  if( it == m_keys.end() )
+    return;
+
+  Entry& entry = m_entries[it->second];
+  if( entry.count > 0 )
+    --entry.count;
+}
+
+
+void TextureCache::purge()
+{
+  std::lock_guard<std::mutex> lock( m_mutex );
+  for( std::map<Key, Entry>::iterator it = m_entries.begin(); it != m_entries.end(); )
+  {
+    if( it->second.count == 0 )
+    {
+      destroy( it->second );
+      m_entries.erase( it++ );
+    }
+    else
+      ++it;
+  }
+  m_failed.clear();
+}
+
+
+void TextureCache::releaseContext( optix::Context context )
+{
+  std::lock_guard<std::mutex> lock( m_mutex );
+  const RTcontext ctx = context->get();
+  for( std::map<Key, Entry>::iterator it = m_entries.begin(); it != m_entries.end(); )
+  {
+    if( it->first.first == ctx )
+    {
+      m_keys.erase( it->second.sampler->get() );
+      m_entries.erase( it++ );
+    }
+    else
+      ++it;
+  }
+  for( std::set<Key>::iterator it = m_failed.begin(); it != m_failed.end(); )
+  {
+    if( it->first == ctx )
+      m_failed.erase( it++ );
+    else
+      ++it;
+  }
+}
+
+
+size_t TextureCache::numEntries() const
+{
+  std::lock_guard<std::mutex> lock( m_mutex );
+  return m_entries.size();
+}
+
+
+TextureCache& defaultTextureCache()
+{
+  static TextureCache cache;
+  return cache;
+}
+
+} // namespace sutil
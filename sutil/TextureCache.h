@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#pragma once
+
+#include <optixu/optixpp_namespace.h>
+#include <sutilapi.h>
+
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+
+namespace sutil
+{
+
+//------------------------------------------------------------------------------
+//
+// Textures shared between materials.  acquire() has the contract of
+// sutil::loadTexture but returns the sampler created by an earlier call with
+// the same file and decode options, so an image referenced by many materials
+// is read and uploaded once per context.  Files are keyed by their canonical
+// path.  A file that failed to load is remembered as such, and the 1x1
+// fallback textures are shared between all users of the same color.
+//
+// Entries count their acquire() calls.  release() gives one back and purge()
+// destroys the textures nobody holds any more.  Entries with a count of zero
+// stay cached until purged, so a scene that is reloaded finds its textures.
+// OptiXMesh lists the textures its materials hold in OptiXMesh::textures.
+//
+// Safe to call from any thread.  Files are decoded outside the lock and
+// only the upload into the context is serialized.  releaseContext() must be
+// called before a context is destroyed.
+//
+//------------------------------------------------------------------------------
+class TextureCache
+{
+public:
+  SUTILAPI TextureCache();
+  SUTILAPI ~TextureCache();
+
+  SUTILAPI optix::TextureSampler acquire( optix::Context context, const std::string& filename,
+                                          const optix::float3& default_color, bool linearize_gamma = false );
+  SUTILAPI void release( optix::TextureSampler sampler );
+
+  // Destroy the textures of all entries that are not held.  Files that
+  // failed to load are tried again by the next acquire().
+  SUTILAPI void purge();
+
+  // Forget all entries of the context, held or not, without destroying them
+  SUTILAPI void releaseContext( optix::Context context );
+
+  SUTILAPI size_t numEntries() const;
+  SUTILAPI size_t numHits() const   { return m_hits; }
+  SUTILAPI size_t numMisses() const { return m_misses; }
+
+private:
+  struct Entry
+  {
+    Entry() : count( 0 ) {}
+    optix::TextureSampler sampler;
+    size_t                count;
+  };
+
+  // Context and decode options, then the path or fallback color
+  typedef std::pair<RTcontext, std::string> Key;
+
+  // Acquire the entry of a file loaded before, or the fallback of one that
+  // failed, null if it is new
+  Entry* lookup( optix::Context context, const Key& key, bool hdr, const optix::float3& default_color );
+  Entry& fallback( optix::Context context, bool hdr, const optix::float3& default_color );
+  Entry& insert( const Key& key, optix::TextureSampler sampler );
+  void   destroy( Entry& entry );
+
+  std::map<Key, Entry>            m_entries;
+  std::map<RTtexturesampler, Key> m_keys;     // Sampler of every entry to its key
+  std::set<Key>                   m_failed;   // Files that did not load
+  mutable std::mutex              m_mutex;
+  size_t                          m_hits;
+  size_t                          m_misses;
+
+  TextureCache( const TextureCache& );            // forbidden
+  TextureCache& operator=( const TextureCache& ); // forbidden
+};
+
+
+// Process wide cache used by the sutil mesh loaders
+SUTILAPI TextureCache& defaultTextureCache();
+
+} // namespace sutil
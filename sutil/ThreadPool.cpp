@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+
+namespace sutil
+{
+
+ThreadPool::ThreadPool( unsigned int num_threads )
+  : m_stop( false )
+{
+  if( num_threads == 0 )
+    num_threads = std::max( 1u, std::thread::hardware_concurrency() );
+
+  m_threads.reserve( num_threads );
+  for( unsigned int i = 0; i < num_threads; ++i )
+    m_threads.push_back( std::thread( &ThreadPool::workerLoop, this ) );
+}
+
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_stop = true;
+  }
+  m_task_available.notify_all();
+
+  for( size_t i = 0; i < m_threads.size(); ++i )
+    m_threads[i].join();
+}
+
+
+void ThreadPool::push( const std::function<void()>& task )
+{
+  {
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_tasks.push_back( task );
+  }
+  m_task_available.notify_one();
+}
+
+
+void ThreadPool::workerLoop()
+{
+  for( ;; )
+  {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock( m_mutex );
+      while( !m_stop && m_tasks.empty() )
+        m_task_available.wait( lock );
+
+      // Drain the queue before shutting down so no future is left broken
+      if( m_tasks.empty() )
+        return;
+
+      task = m_tasks.front();
+      m_tasks.pop_front();
+    }
+    task();
+  }
+}
+
+
+ThreadPool& defaultThreadPool()
+{
+  static ThreadPool pool;
+  return pool;
+}
+
+} // namespace sutil
@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2018, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <sutilapi.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace sutil
+{
+
+//------------------------------------------------------------------------------
+//
+// Fixed size pool of worker threads.  Tasks are executed in FIFO order.
+//
+// parallelFor() lets the calling thread help with the work and only waits for
+// chunks that have actually been started, so it is safe to call from inside
+// a task running on the same pool.
+//
+//------------------------------------------------------------------------------
+class ThreadPool
+{
+public:
+  // num_threads == 0 uses one worker per hardware thread
+  SUTILAPI explicit ThreadPool( unsigned int num_threads = 0 );
+  SUTILAPI ~ThreadPool();
+
+  SUTILAPI unsigned int numThreads() const { return static_cast<unsigned int>( m_threads.size() ); }
+
+  // Queue f for execution.  The returned future holds f's result or the
+  // exception it threw.
+  template<typename F>
+  auto enqueue( F f ) -> std::future<decltype( f() )>
+  {
+    typedef decltype( f() ) Result;
+    std::shared_ptr< std::packaged_task<Result()> > task( new std::packaged_task<Result()>( f ) );
+    std::future<Result> result = task->get_future();
+    push( [task]() { (*task)(); } );
+    return result;
+  }
+
+  // Run body( chunk_begin, chunk_end ) over [begin, end) in chunks of at most
+  // grain items.  Blocks until all chunks are done and rethrows the first
+  // exception thrown by body.
+  template<typename F>
+  void parallelFor( size_t begin, size_t end, size_t grain, F body )
+  {
+    if( end <= begin )
+      return;
+    if( grain == 0 )
+      grain = 1;
+
+    const size_t num_chunks = ( end - begin + grain - 1 ) / grain;
+    if( num_chunks == 1 || m_threads.empty() )
+    {
+      for( size_t b = begin; b < end; b += grain )
+        body( b, std::min( b + grain, end ) );
+      return;
+    }
+
+    struct Shared
+    {
+      std::atomic<size_t>     next_chunk;
+      std::atomic<size_t>     done_chunks;
+      std::mutex              mutex;
+      std::condition_variable done;
+      std::exception_ptr      error;
+    };
+    std::shared_ptr<Shared> shared( new Shared );
+    shared->next_chunk  = 0;
+    shared->done_chunks = 0;
+
+    // Helpers capture the body by value so late starters never touch the
+    // caller's stack after parallelFor has returned.
+    std::function<void()> work = [shared, body, begin, end, grain, num_chunks]()
+    {
+      for( ;; )
+      {
+        const size_t chunk = shared->next_chunk++;
+        if( chunk >= num_chunks )
+          return;
+
+        const size_t b = begin + chunk * grain;
+        try
+        {
+          body( b, std::min( b + grain, end ) );
+        }
+        catch( ... )
+        {
+          std::lock_guard<std::mutex> lock( shared->mutex );
+          if( !shared->error )
+            shared->error = std::current_exception();
+        }
+
+        if( ++shared->done_chunks == num_chunks )
+        {
+          std::lock_guard<std::mutex> lock( shared->mutex );
+          shared->done.notify_all();
+        }
+      }
+    };
+
+    const size_t num_helpers = std::min<size_t>( m_threads.size(), num_chunks - 1 );
+    for( size_t i = 0; i < num_helpers; ++i )
+      push( work );
+    work();
+
+    {
+      std::unique_lock<std::mutex> lock( shared->mutex );
+      while( shared->done_chunks < num_chunks )
+        shared->done.wait( lock );
+    }
+
+    if( shared->error )
+      std::rethrow_exception( shared->error );
+  }
+
+private:
+  SUTILAPI void push( const std::function<void()>& task );
+  void workerLoop();
+
+  std::vector<std::thread>            m_threads;
+  std::deque< std::function<void()> > m_tasks;
+  std::mutex                          m_mutex;
+  std::condition_variable             m_task_available;
+  bool                                m_stop;
+
+  ThreadPool( const ThreadPool& );            // forbidden
+  ThreadPool& operator=( const ThreadPool& ); // forbidden
+};
+
+
+// Process wide pool shared by the sample and sutil loaders.  Created on first
+// use with one worker per hardware thread.
+SUTILAPI ThreadPool& defaultThreadPool();
+
+} // namespace sutil
@@ -40,21 +40,31 @@
 
 #include <sutil/sutil.h>
 #include <sutil/HDRLoader.h>
+#include <sutil/ImageWriter.h>
 #include <sutil/PPMLoader.h>
+#include <sutil/ThreadPool.h>
 #include <sampleConfig.h>
 
 #include <optixu/optixu_math_namespace.h>
 
 #include <nvrtc.h>
 
+#include <algorithm>
 #include <cmath>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <iostream>
 #include <fstream>
+#include <future>
 #include <stdint.h>
 #include <sstream>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
 
 #if defined(_WIN32)
 #    ifndef WIN32_LEAN_AND_MEAN
@@ -62,8 +72,11 @@
 #    endif
 #    include<windows.h>
 #    include<mmsystem.h>
+#    include <sys/utime.h>
 #else // Apple and Linux both use this
 #    include<sys/time.h>
+#    include <sys/stat.h>
+#    include <sys/types.h>
 #    include <unistd.h>
 #    include <dirent.h>
 #endif
@@ -267,29 +280,6 @@ void displayBufferSwap()
 }
 
 
-void SavePPM(const unsigned char *Pix, const char *fname, int wid, int hgt, int chan)
-{
-    if( Pix==NULL || wid < 1 || hgt < 1 )
-        throw Exception( "Image is ill-formed. Not saving" );
-
-    if( chan != 1 && chan != 3 && chan != 4 )
-        throw Exception( "Attempting to save image with channel count != 1, 3, or 4.");
-
-    std::ofstream OutFile(fname, std::ios::out | std::ios::binary);
-    if(!OutFile.is_open())
-        throw Exception( "Could not open file for SavePPM" );
-
-    bool is_float = false;
-    OutFile << 'P';
-    OutFile << ((chan==1 ? (is_float?'Z':'5') : (chan==3 ? (is_float?'7':'6') : '8'))) << std::endl;
-    OutFile << wid << " " << hgt << std::endl << 255 << std::endl;
-
-    OutFile.write(reinterpret_cast<char*>(const_cast<unsigned char*>( Pix )), wid * hgt * chan * (is_float ? 4 : 1));
-
-    OutFile.close();
-}
-
-
 bool dirExists( const char* path )
 {
 #if defined(_WIN32)
@@ -522,110 +512,9 @@ void sutil::displayBufferPPM( const char* filename, Buffer buffer, bool disable_
 
 void sutil::displayBufferPPM( const char* filename, RTbuffer buffer, bool disable_srgb_conversion)
 {
-    GLsizei width, height;
-    RTsize buffer_width, buffer_height;
-
-    GLvoid* imageData;
-    RT_CHECK_ERROR( rtBufferMap( buffer, &imageData) );
-
-    RT_CHECK_ERROR( rtBufferGetSize2D(buffer, &buffer_width, &buffer_height) );
-    width  = static_cast<GLsizei>(buffer_width);
-    height = static_cast<GLsizei>(buffer_height);
-
-    std::vector<unsigned char> pix(width * height * 3);
-
-    RTformat buffer_format;
-    RT_CHECK_ERROR( rtBufferGetFormat(buffer, &buffer_format) );
-
-    const float gamma_inv = 1.0f / 2.2f;
-
-    switch(buffer_format) {
-        case RT_FORMAT_UNSIGNED_BYTE4:
-            // Data is BGRA and upside down, so we need to swizzle to RGB
-            for(int j = height-1; j >= 0; --j) {
-                unsigned char *dst = &pix[0] + (3*width*(height-1-j));
-                unsigned char *src = ((unsigned char*)imageData) + (4*width*j);
-                for(int i = 0; i < width; i++) {
-                    *dst++ = *(src + 2);
-                    *dst++ = *(src + 1);
-                    *dst++ = *(src + 0);
-                    src += 4;
-                }
-            }
-            break;
-
-        case RT_FORMAT_FLOAT:
-            // This buffer is upside down
-            for(int j = height-1; j >= 0; --j) {
-                unsigned char *dst = &pix[0] + width*(height-1-j);
-                float* src = ((float*)imageData) + (3*width*j);
-                for(int i = 0; i < width; i++) {
-                    int P;
-                    if (disable_srgb_conversion)
-                        P = static_cast<int>((*src++) * 255.0f);
-                    else
-                        P = static_cast<int>(std::pow(*src++, gamma_inv) * 255.0f);
-                    unsigned int Clamped = P < 0 ? 0 : P > 0xff ? 0xff : P;
-
-                    // write the pixel to all 3 channels
-                    *dst++ = static_cast<unsigned char>(Clamped);
-                    *dst++ = static_cast<unsigned char>(Clamped);
-                    *dst++ = static_cast<unsigned char>(Clamped);
-                }
-            }
-            break;
-
-        case RT_FORMAT_FLOAT3:
-            // This buffer is upside down
-            for(int j = height-1; j >= 0; --j) {
-                unsigned char *dst = &pix[0] + (3*width*(height-1-j));
-                float* src = ((float*)imageData) + (3*width*j);
-                for(int i = 0; i < width; i++) {
-                    for(int elem = 0; elem < 3; ++elem) {
-                        int P;
-                        if (disable_srgb_conversion)
-                            P = static_cast<int>((*src++) * 255.0f);
-                        else
-                            P = static_cast<int>(std::pow(*src++, gamma_inv) * 255.0f);
-                        unsigned int Clamped = P < 0 ? 0 : P > 0xff ? 0xff : P;
-                        *dst++ = static_cast<unsigned char>(Clamped);
-                    }
-                }
-            }
-            break;
-
-        case RT_FORMAT_FLOAT4:
-            // This buffer is upside down
-            for(int j = height-1; j >= 0; --j) {
-                unsigned char *dst = &pix[0] + (3*width*(height-1-j));
-                float* src = ((float*)imageData) + (4*width*j);
-                for(int i = 0; i < width; i++) {
-                    for(int elem = 0; elem < 3; ++elem) {
-                        int P;
-                        if(disable_srgb_conversion)
-                            P = static_cast<int>((*src++) * 255.0f);
-                        else
-                            P = static_cast<int>(std::pow(*src++, gamma_inv) * 255.0f);
-                        unsigned int Clamped = P < 0 ? 0 : P > 0xff ? 0xff : P;
-                        *dst++ = static_cast<unsigned char>(Clamped);
-                    }
-
-                    // skip alpha
-                    src++;
-                }
-            }
-            break;
-
-        default:
-            fprintf(stderr, "Unrecognized buffer data type or format.\n");
-            exit(2);
-            break;
-    }
-
-    SavePPM(&pix[0], filename, width, height, 3);
-
-    // Now unmap the buffer
-    RT_CHECK_ERROR( rtBufferUnmap(buffer) );
+    ImageFrame frame;
+    snapshotBuffer( buffer, frame );
+    writeImage( filename, frame, IMAGE_FILE_PPM, !disable_srgb_conversion );
 }
 
 
@@ -838,6 +727,46 @@ void sutil::sleep( int seconds )
 }
 
 
+bool sutil::writeFileAtomic( const std::string& path, const void* const* chunks, const size_t* sizes, size_t count )
+{
+    // The temporary name is unique to the writer, as the same file may be
+    // written by several threads of this process and by other processes
+#if defined(_WIN32)
+    const unsigned long long process_id = GetCurrentProcessId();
+#else
+    const unsigned long long process_id = getpid();
+#endif
+    const unsigned long long thread_hash = std::hash<std::thread::id>()( std::this_thread::get_id() );
+    const std::string tmp_path = path + "." + std::to_string( process_id ) + "." + std::to_string( thread_hash ) + ".tmp";
+    {
+        std::ofstream file( tmp_path.c_str(), std::ios::binary | std::ios::trunc );
+        if( !file )
+            return false;
+        for( size_t i = 0; i < count; ++i )
+            if( sizes[i] )
+                file.write( static_cast<const char*>( chunks[i] ), sizes[i] );
+        if( !file )
+        {
+            file.close();
+            std::remove( tmp_path.c_str() );
+            return false;
+        }
+    }
+
+    // rename() does not replace an existing file everywhere
+    if( std::rename( tmp_path.c_str(), path.c_str() ) != 0 )
+    {
+        std::remove( path.c_str() );
+        if( std::rename( tmp_path.c_str(), path.c_str() ) != 0 )
+        {
+            std::remove( tmp_path.c_str() );
+            return false;
+        }
+    }
+    return true;
+}
+
+
 #define STRINGIFY(x) STRINGIFY2(x)
 #define STRINGIFY2(x) #x
 #define LINE_STR STRINGIFY(__LINE__)
@@ -900,62 +829,57 @@ static void getCuStringFromFile( std::string &cu, std::string& location, const c
     throw Exception( "Couldn't open source file " + std::string( filename ) );
 }
 
-static std::string g_nvrtcLog;
-
-static void getPtxFromCuString( std::string &ptx, const char* sample_name, const char* cu_source, const char* name, const char** log_string )
+// Include paths and compiler options for NVRTC, in the order they are passed
+static void getNvrtcOptions( std::vector<std::string>& options, const char* sample_name )
 {
-    // Create program
-    nvrtcProgram prog = 0;
-    NVRTC_CHECK_ERROR( nvrtcCreateProgram( &prog, cu_source, name, 0, NULL, NULL ) );
-
-    // Gather NVRTC options
-    std::vector<const char *> options;
-
     std::string base_dir = std::string( sutil::samplesDir() );
 
     // Set sample dir as the primary include path
-    std::string sample_dir;
     if( sample_name )
-    {
-        sample_dir = std::string( "-I" ) + base_dir + "/" + sample_name;
-        options.push_back( sample_dir.c_str() );
-    }
+        options.push_back( std::string( "-I" ) + base_dir + "/" + sample_name );
 
     // Collect include dirs
-    std::vector<std::string> include_dirs;
     const char *abs_dirs[] = { SAMPLES_ABSOLUTE_INCLUDE_DIRS };
     const char *rel_dirs[] = { SAMPLES_RELATIVE_INCLUDE_DIRS };
 
     const size_t n_abs_dirs = sizeof( abs_dirs ) / sizeof( abs_dirs[0] );
     for( size_t i = 0; i < n_abs_dirs; i++ )
-        include_dirs.push_back(std::string( "-I" ) + abs_dirs[i]);
+        options.push_back(std::string( "-I" ) + abs_dirs[i]);
     const size_t n_rel_dirs = sizeof( rel_dirs ) / sizeof( rel_dirs[0] );
     for( size_t i = 0; i < n_rel_dirs; i++ )
-        include_dirs.push_back(std::string( "-I" ) + base_dir + rel_dirs[i]);
-    for( std::vector<std::string>::const_iterator it = include_dirs.begin(); it != include_dirs.end(); ++it )
-        options.push_back( it->c_str() );
+        options.push_back(std::string( "-I" ) + base_dir + rel_dirs[i]);
 
     // Collect NVRTC options
     const char *compiler_options[] = { CUDA_NVRTC_OPTIONS };
     const size_t n_compiler_options = sizeof( compiler_options ) / sizeof( compiler_options[0] );
     for( size_t i = 0; i < n_compiler_options - 1; i++ )
         options.push_back( compiler_options[i] );
+}
+
+static void getPtxFromCuString( std::string &ptx, std::string& log, const std::vector<std::string>& option_strings, const char* cu_source, const char* name )
+{
+    // Create program
+    nvrtcProgram prog = 0;
+    NVRTC_CHECK_ERROR( nvrtcCreateProgram( &prog, cu_source, name, 0, NULL, NULL ) );
+
+    std::vector<const char *> options;
+    for( std::vector<std::string>::const_iterator it = option_strings.begin(); it != option_strings.end(); ++it )
+        options.push_back( it->c_str() );
 
     // JIT compile CU to PTX
     const nvrtcResult compileRes = nvrtcCompileProgram( prog, (int) options.size(), options.data() );
 
-    // Retrieve log output
+    // Retrieve log output, left empty if there is none
     size_t log_size = 0;
     NVRTC_CHECK_ERROR( nvrtcGetProgramLogSize( prog, &log_size ) );
-    g_nvrtcLog.resize( log_size );
+    log.clear();
     if( log_size > 1 )
     {
-        NVRTC_CHECK_ERROR( nvrtcGetProgramLog( prog, &g_nvrtcLog[0] ) );
-        if( log_string )
-            *log_string = g_nvrtcLog.c_str();
+        log.resize( log_size );
+        NVRTC_CHECK_ERROR( nvrtcGetProgramLog( prog, &log[0] ) );
     }
     if( compileRes != NVRTC_SUCCESS )
-        throw Exception( "NVRTC Compilation failed.\n" + g_nvrtcLog );
+        throw Exception( "NVRTC Compilation failed.\n" + log );
 
     // Retrieve PTX code
     size_t ptx_size = 0;
@@ -967,6 +891,274 @@ static void getPtxFromCuString( std::string &ptx, const char* sample_name, const
     NVRTC_CHECK_ERROR( nvrtcDestroyProgram( &prog ) );
 }
 
+
+//
+// Persistent PTX cache.  Compiled PTX is kept in a user cache directory,
+// keyed by a hash of the source, every header it includes that is found on
+// the include path, the NVRTC options and the NVRTC version, so unchanged
+// programs skip NVRTC from the second start on.  SUTIL_PTX_CACHE_DIR
+// overrides the directory, an empty value disables the cache.  Past
+// PTX_CACHE_MAX_BYTES the least recently used files are evicted.
+//
+
+static const uint64_t PTX_CACHE_MAX_BYTES = 64ull << 20;
+static const char     PTX_CACHE_MAGIC[]   = "SUTILPTX 1";
+
+static uint64_t hashBytes( uint64_t hash, const void* data, size_t size )
+{
+    // 64 bit FNV-1a
+    const unsigned char* bytes = static_cast<const unsigned char*>( data );
+    for( size_t i = 0; i < size; ++i )
+        hash = ( hash ^ bytes[i] ) * 0x100000001b3ull;
+    return hash;
+}
+
+static uint64_t hashString( uint64_t hash, const std::string& str )
+{
+    // The terminator keeps "ab" + "c" apart from "a" + "bc"
+    return hashBytes( hash, str.c_str(), str.size() + 1 );
+}
+
+static std::string parentDir( const std::string& path )
+{
+    const size_t slash = path.find_last_of( "/\\" );
+    return slash == std::string::npos ? std::string( "." ) : path.substr( 0, slash );
+}
+
+// Hash the contents of the headers source includes, recursively.  Headers
+// that are not on the include path, like the CUDA ones NVRTC brings along,
+// are covered by the compiler version and only hashed by name.
+static uint64_t hashIncludes( uint64_t hash, const std::string& source, const std::string& source_dir,
+                              const std::vector<std::string>& include_dirs, std::set<std::string>& visited )
+{
+    std::istringstream lines( source );
+    std::string line;
+    while( std::getline( lines, line ) )
+    {
+        size_t pos = line.find_first_not_of( " \t" );
+        if( pos == std::string::npos || line[pos] != '#' )
+            continue;
+        pos = line.find_first_not_of( " \t", pos + 1 );
+        if( pos == std::string::npos || line.compare( pos, 7, "include" ) != 0 )
+            continue;
+        pos = line.find_first_not_of( " \t", pos + 7 );
+        if( pos == std::string::npos || ( line[pos] != '"' && line[pos] != '<' ) )
+            continue;
+        const size_t end = line.find( line[pos] == '"' ? '"' : '>', pos + 1 );
+        if( end == std::string::npos )
+            continue;
+        const std::string name = line.substr( pos + 1, end - pos - 1 );
+        hash = hashString( hash, name );
+
+        // Quoted includes look next to the including file first
+        std::vector<std::string> candidates;
+        if( line[pos] == '"' )
+            candidates.push_back( source_dir + "/" + name );
+        for( std::vector<std::string>::const_iterator it = include_dirs.begin(); it != include_dirs.end(); ++it )
+            candidates.push_back( *it + "/" + name );
+
+        for( std::vector<std::string>::const_iterator it = candidates.begin(); it != candidates.end(); ++it )
+        {
+            std::string header;
+            if( !readSourceFile( header, *it ) )
+                continue;
+            if( visited.insert( *it ).second )
+            {
+                hash = hashString( hash, header );
+                hash = hashIncludes( hash, header, parentDir( *it ), include_dirs, visited );
+            }
+            break;
+        }
+    }
+    return hash;
+}
+
+static uint64_t ptxCacheKey( const std::string& cu, const std::string& location, const std::vector<std::string>& options )
+{
+    int major = 0, minor = 0;
+    NVRTC_CHECK_ERROR( nvrtcVersion( &major, &minor ) );
+
+    uint64_t hash = 0xcbf29ce484222325ull;
+    hash = hashString( hash, PTX_CACHE_MAGIC );
+    hash = hashBytes( hash, &major, sizeof( major ) );
+    hash = hashBytes( hash, &minor, sizeof( minor ) );
+    hash = hashString( hash, location );
+    hash = hashString( hash, cu );
+
+    std::vector<std::string> include_dirs;
+    for( std::vector<std::string>::const_iterator it = options.begin(); it != options.end(); ++it )
+    {
+        hash = hashString( hash, *it );
+        if( it->compare( 0, 2, "-I" ) == 0 )
+            include_dirs.push_back( it->substr( 2 ) );
+    }
+
+    std::set<std::string> visited;
+    return hashIncludes( hash, cu, parentDir( location ), include_dirs, visited );
+}
+
+static bool makeDirs( const std::string& path )
+{
+    if( path.empty() || dirExists( path.c_str() ) )
+        return true;
+    const size_t slash = path.find_last_of( "/\\" );
+    if( slash != std::string::npos && slash > 0 && !makeDirs( path.substr( 0, slash ) ) )
+        return false;
+#if defined(_WIN32)
+    return CreateDirectoryA( path.c_str(), NULL ) || GetLastError() == ERROR_ALREADY_EXISTS;
+#else
+    return mkdir( path.c_str(), 0755 ) == 0 || dirExists( path.c_str() );
+#endif
+}
+
+std::string sutil::userCacheDir( const char* name )
+{
+    std::string dir;
+#if defined(_WIN32)
+    if( const char* local_app_data = getenv( "LOCALAPPDATA" ) )
+        dir = std::string( local_app_data ) + "\\OptiX-Samples\\" + name;
+#else
+    if( const char* xdg_cache_home = getenv( "XDG_CACHE_HOME" ) )
+        dir = std::string( xdg_cache_home ) + "/optix-samples/" + name;
+    else if( const char* home = getenv( "HOME" ) )
+        dir = std::string( home ) + "/.cache/optix-samples/" + name;
+#endif
+
+    if( !makeDirs( dir ) )
+        dir.clear();
+    return dir;
+}
+
+static std::string findPtxCacheDir()
+{
+    const char* override_dir = getenv( "SUTIL_PTX_CACHE_DIR" );
+    if( !override_dir )
+        return sutil::userCacheDir( "ptx" );
+
+    std::string dir = override_dir;
+    if( !makeDirs( dir ) )
+        dir.clear();
+    return dir;
+}
+
+// Empty if the cache is disabled or its directory cannot be created
+static const std::string& ptxCacheDir()
+{
+    static const std::string dir = findPtxCacheDir();
+    return dir;
+}
+
+static std::string ptxCachePath( const std::string& dir, uint64_t key )
+{
+    char name[32];
+    sprintf( name, "%016llx.ptx", static_cast<unsigned long long>( key ) );
+    return dir + "/" + name;
+}
+
+// Files start with a line holding the magic, key and PTX size
+static std::string ptxCacheHeader( uint64_t key, size_t size )
+{
+    char header[64];
+    sprintf( header, "%s %016llx %llu\n", PTX_CACHE_MAGIC, static_cast<unsigned long long>( key ),
+             static_cast<unsigned long long>( size ) );
+    return header;
+}
+
+static bool readPtxCache( const std::string& path, uint64_t key, std::string& ptx )
+{
+    std::ifstream file( path.c_str(), std::ios::binary );
+    std::string header;
+    if( !file || !std::getline( file, header ) )
+        return false;
+
+    const unsigned long long size = strtoull( header.c_str() + std::min( header.size(), sizeof( PTX_CACHE_MAGIC ) + 17 ), NULL, 10 );
+    if( header + "\n" != ptxCacheHeader( key, static_cast<size_t>( size ) ) )
+        return false;
+
+    ptx.resize( static_cast<size_t>( size ) );
+    if( size && !file.read( &ptx[0], size ) )
+        return false;
+    if( file.peek() != std::ifstream::traits_type::eof() )
+        return false;
+
+    // Mark it recently used for eviction
+    file.close();
+#if defined(_WIN32)
+    _utime( path.c_str(), NULL );
+#else
+    utimes( path.c_str(), NULL );
+#endif
+    return true;
+}
+
+struct PtxCacheFile
+{
+    std::string path;
+    uint64_t    size;
+    int64_t     mtime;
+
+    bool operator<( const PtxCacheFile& other ) const { return mtime < other.mtime; }
+};
+
+static void evictPtxCache( const std::string& dir )
+{
+    std::vector<PtxCacheFile> files;
+#if defined(_WIN32)
+    WIN32_FIND_DATAA data;
+    HANDLE find = FindFirstFileA( ( dir + "\\*.ptx" ).c_str(), &data );
+    if( find == INVALID_HANDLE_VALUE )
+        return;
+    do
+    {
+        PtxCacheFile file;
+        file.path  = dir + "\\" + data.cFileName;
+        file.size  = ( static_cast<uint64_t>( data.nFileSizeHigh ) << 32 ) | data.nFileSizeLow;
+        file.mtime = ( static_cast<int64_t>( data.ftLastWriteTime.dwHighDateTime ) << 32 ) | data.ftLastWriteTime.dwLowDateTime;
+        files.push_back( file );
+    } while( FindNextFileA( find, &data ) );
+    FindClose( find );
+#else
+    DIR* handle = opendir( dir.c_str() );
+    if( !handle )
+        return;
+    while( dirent* entry = readdir( handle ) )
+    {
+        const std::string name = entry->d_name;
+        struct stat info;
+        PtxCacheFile file;
+        file.path = dir + "/" + name;
+        if( name.size() < 4 || name.compare( name.size() - 4, 4, ".ptx" ) != 0 || stat( file.path.c_str(), &info ) != 0 )
+            continue;
+        file.size  = static_cast<uint64_t>( info.st_size );
+        file.mtime = static_cast<int64_t>( info.st_mtime );
+        files.push_back( file );
+    }
+    closedir( handle );
+#endif
+
+    uint64_t total = 0;
+    for( size_t i = 0; i < files.size(); ++i )
+        total += files[i].size;
+    if( total <= PTX_CACHE_MAX_BYTES )
+        return;
+
+    std::sort( files.begin(), files.end() );
+    for( size_t i = 0; i < files.size() && total > PTX_CACHE_MAX_BYTES; ++i )
+    {
+        if( std::remove( files[i].path.c_str() ) == 0 )
+            total -= files[i].size;
+    }
+}
+
+static void writePtxCache( const std::string& dir, uint64_t key, const std::string& ptx )
+{
+    const std::string header = ptxCacheHeader( key, ptx.size() );
+    const void* const chunks[] = { header.c_str(), ptx.c_str() };
+    const size_t sizes[] = { header.size(), ptx.size() };
+    if( sutil::writeFileAtomic( ptxCachePath( dir, key ), chunks, sizes, 2 ) )
+        evictPtxCache( dir );
+}
+
 #else // CUDA_NVRTC_ENABLED
 
 static void getPtxStringFromFile( std::string &ptx, const char* sample_name, const char* filename )
@@ -984,14 +1176,42 @@ static void getPtxStringFromFile( std::string &ptx, const char* sample_name, con
 
 #endif // CUDA_NVRTC_ENABLED
 
-struct PtxSourceCache
+// Source or PTX file to PTX, log is filled by NVRTC if it ran
+static void loadPtxString( std::string& ptx, std::string& log, const char* sample, const char* filename )
 {
-    std::map<std::string, std::string *> map;
-    ~PtxSourceCache()
+#if CUDA_NVRTC_ENABLED
+    std::string cu, location;
+    getCuStringFromFile( cu, location, sample, filename );
+
+    std::vector<std::string> options;
+    getNvrtcOptions( options, sample );
+    const std::string& cache_dir = ptxCacheDir();
+    const uint64_t cache_key = cache_dir.empty() ? 0 : ptxCacheKey( cu, location, options );
+    if( cache_dir.empty() || !readPtxCache( ptxCachePath( cache_dir, cache_key ), cache_key, ptx ) )
     {
-        for( std::map<std::string, std::string *>::const_iterator it = map.begin(); it != map.end(); ++it )
-            delete it->second;
+        getPtxFromCuString( ptx, log, options, cu.c_str(), location.c_str() );
+        if( !cache_dir.empty() )
+            writePtxCache( cache_dir, cache_key, ptx );
     }
+#else
+    getPtxStringFromFile( ptx, sample, filename );
+#endif
+}
+
+// An entry is added by the first thread to ask for a program, which loads
+// it while later callers wait on ready.  Entries of failed loads are removed
+// again, so the next call retries.
+struct PtxSourceEntry
+{
+    std::string              ptx;
+    std::string              log;
+    std::shared_future<void> ready;
+};
+
+struct PtxSourceCache
+{
+    std::mutex mutex;
+    std::map<std::string, std::shared_ptr<PtxSourceEntry> > map;
 };
 static PtxSourceCache g_ptxSourceCache;
 
@@ -1003,28 +1223,72 @@ const char* sutil::getPtxString(
     if (log)
         *log = NULL;
 
-    std::string *ptx, cu;
-    std::string key = std::string( filename ) + ";" + ( sample ? sample : "" );
-    std::map<std::string, std::string *>::iterator elem = g_ptxSourceCache.map.find( key );
+    const std::string key = std::string( filename ) + ";" + ( sample ? sample : "" );
+    std::shared_ptr<PtxSourceEntry> entry;
+    std::promise<void> loaded;
+    bool load = false;
+    {
+        std::lock_guard<std::mutex> lock( g_ptxSourceCache.mutex );
+        std::shared_ptr<PtxSourceEntry>& slot = g_ptxSourceCache.map[key];
+        if( !slot )
+        {
+            slot.reset( new PtxSourceEntry );
+            slot->ready = loaded.get_future().share();
+            load = true;
+        }
+        entry = slot;
+    }
 
-    if( elem == g_ptxSourceCache.map.end() )
+    if( !load )
     {
-        ptx = new std::string();
-#if CUDA_NVRTC_ENABLED
-        std::string location;
-        getCuStringFromFile( cu, location, sample, filename );
-        getPtxFromCuString( *ptx, sample, cu.c_str(), location.c_str(), log );
-#else
-        getPtxStringFromFile( *ptx, sample, filename );
-#endif
-        g_ptxSourceCache.map[key] = ptx;
+        // Rethrows the failure of the thread that loaded it
+        entry->ready.get();
+        return entry->ptx.c_str();
     }
-    else
+
+    try
+    {
+        loadPtxString( entry->ptx, entry->log, sample, filename );
+    }
+    catch( ... )
     {
-        ptx = elem->second;
+        {
+            std::lock_guard<std::mutex> lock( g_ptxSourceCache.mutex );
+            g_ptxSourceCache.map.erase( key );
+        }
+        loaded.set_exception( std::current_exception() );
+        throw;
     }
+    loaded.set_value();
 
-    return ptx->c_str();
+    if( log && !entry->log.empty() )
+        *log = entry->log.c_str();
+    return entry->ptx.c_str();
+}
+
+void sutil::compilePtxStringsAsync(
+    const char* sample,
+    const char* const* filenames,
+    size_t count )
+{
+    const bool has_sample = sample != NULL;
+    const std::string sample_name = has_sample ? sample : "";
+    for( size_t i = 0; i < count; ++i )
+    {
+        const std::string filename = filenames[i];
+        sutil::defaultThreadPool().enqueue( [has_sample, sample_name, filename]()
+        {
+            // Failures are thrown again by the getPtxString() call that
+            // asks for the program
+            try
+            {
+                getPtxString( has_sample ? sample_name.c_str() : NULL, filename.c_str() );
+            }
+            catch( ... )
+            {
+            }
+        } );
+    }
 }
 
 void sutil::ensureMinimumSize(int& w, int& h)
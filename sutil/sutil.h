@@ -204,11 +204,37 @@ void SUTILAPI parseDimensions(
 // Get current time in seconds for benchmarking/timing purposes.
 double SUTILAPI currentTime();
 
-// Get PTX, either pre-compiled with NVCC or JIT compiled by NVRTC.
+// Write the chunks back to back to a temporary file next to path and rename
+// it over path, so concurrent readers in any thread or process never see a
+// partial file.  Returns false, leaving no temporary file, if it failed.
+bool SUTILAPI writeFileAtomic(
+        const std::string& path,            // File to create or replace
+        const void* const* chunks,          // Data of each chunk
+        const size_t* sizes,                // Size of each chunk in bytes
+        size_t count );                     // Number of chunks
+
+// Directory name under the user's cache directory, created if missing, eg
+// ~/.cache/optix-samples/<name>.  Empty if there is no user cache directory
+// or it cannot be created.
+std::string SUTILAPI userCacheDir( const char* name );
+
+// Get PTX, either pre-compiled with NVCC or JIT compiled by NVRTC.  NVRTC
+// output is cached on disk across runs, under $SUTIL_PTX_CACHE_DIR if set
+// (empty disables the cache) or else the user's cache directory.  A program
+// loaded from the cache has no compiler log.  Safe to call from any thread,
+// concurrent calls for the same program wait for a single compile.
 SUTILAPI const char* getPtxString(
         const char* sample,                 // Name of the sample, used to locate the input file. NULL = only search the common /cuda dir
         const char* filename,               // Cuda C input file name
-        const char** log = NULL );          // (Optional) pointer to compiler log string. If *log == NULL there is no output. Only valid until the next getPtxString call
+        const char** log = NULL );          // (Optional) pointer to compiler log string. If *log == NULL there is no output. Only given to the call that compiled the program
+
+// Start getPtxString() for each file on the default thread pool and return.
+// Later getPtxString() calls for them only wait for what is still compiling,
+// and rethrow any compile error.
+SUTILAPI void compilePtxStringsAsync(
+        const char* sample,                 // As for getPtxString
+        const char* const* filenames,       // Cuda C input file names
+        size_t count );
 
 // Ensures that width and height have the minimum size to prevent launch errors.
 void SUTILAPI ensureMinimumSize(